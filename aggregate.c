@@ -0,0 +1,67 @@
+#include "aggregate.h"
+
+static VOID IntervalOpen(PINTERVAL_AGGREGATOR Aggregator, ULONG64 Index)
+{
+    ULONG cpu = Aggregator->Open.Cpu;
+    ULONG flags = Aggregator->Open.Flags;
+    WINMSR_INTERVAL_SUMMARY empty = { 0 };
+
+    Aggregator->Open = empty;
+    Aggregator->Open.Cpu = cpu;
+    Aggregator->Open.Flags = flags;
+    Aggregator->Open.IntervalIndex = Index;
+    Aggregator->Open.MinTemperature = MAXLONG;
+    Aggregator->Open.MaxTemperature = MINLONG;
+}
+
+VOID IntervalInit(_Out_ PINTERVAL_AGGREGATOR Aggregator, ULONG Cpu, ULONG64 Length)
+{
+    Aggregator->Length = Length ? Length : 1;
+    Aggregator->Open.Cpu = Cpu;
+    IntervalOpen(Aggregator, 0);
+}
+
+// Folds one sample into the open interval. Intervals are aligned on
+// multiples of Length so every CPU's interval N covers the same time span.
+// When the sample belongs to a later interval, the open one is copied to
+// Closed, a new one is started and TRUE is returned. Empty intervals are
+// never reported. Temperature < 0 marks an invalid reading: it counts as a
+// sample and its status bits are counted, but min/max/sum skip it.
+BOOLEAN IntervalAdd(_Inout_ PINTERVAL_AGGREGATOR Aggregator, ULONG64 Time, LONG Temperature,
+                    ULONG64 ThermStatus, _Out_ PWINMSR_INTERVAL_SUMMARY Closed)
+{
+    PWINMSR_INTERVAL_SUMMARY open = &Aggregator->Open;
+    ULONG64 index = Time / Aggregator->Length;
+    BOOLEAN closed = FALSE;
+
+    if (index != open->IntervalIndex) {
+        if (open->Samples != 0) {
+            *Closed = *open;
+            closed = TRUE;
+        }
+        IntervalOpen(Aggregator, index);
+    }
+
+    if (open->Samples == 0) {
+        open->FirstSampleTime = Time;
+    }
+    open->LastSampleTime = Time;
+    open->Samples++;
+
+    if (Temperature >= 0) {
+        open->ValidSamples++;
+        open->SumTemperature += Temperature;
+        if (Temperature < open->MinTemperature) {
+            open->MinTemperature = Temperature;
+        }
+        if (Temperature > open->MaxTemperature) {
+            open->MaxTemperature = Temperature;
+        }
+    }
+
+    for (ULONG bit = 0; bit < WINMSR_THERM_STATUS_BITS; bit++) {
+        open->StatusBitCounts[bit] += (ULONG)((ThermStatus >> bit) & 1);
+    }
+
+    return closed;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "public.h"
+
+//
+// Incremental per-interval aggregation of temperature samples. Portable:
+// no kernel calls, no allocation, one writer per aggregator.
+//
+
+typedef struct _INTERVAL_AGGREGATOR {
+    ULONG64 Length;             // interval length, same unit as sample times
+    WINMSR_INTERVAL_SUMMARY Open;
+} INTERVAL_AGGREGATOR, *PINTERVAL_AGGREGATOR;
+
+VOID IntervalInit(_Out_ PINTERVAL_AGGREGATOR Aggregator, ULONG Cpu, ULONG64 Length);
+BOOLEAN IntervalAdd(_Inout_ PINTERVAL_AGGREGATOR Aggregator, ULONG64 Time, LONG Temperature,
+                    ULONG64 ThermStatus, _Out_ PWINMSR_INTERVAL_SUMMARY Closed);
@@ -0,0 +1,43 @@
+#include "batch.h"
+
+VOID BatchInit(_Out_ PBATCHER Batcher, ULONG Size, ULONG64 Deadline)
+{
+    Batcher->Size = Size ? Size : 1;
+    Batcher->Deadline = Deadline;
+    Batcher->Pending = 0;
+    Batcher->FirstTime = 0;
+}
+
+// Counts one item. Exactly one producer sees the count reach Size, so a full
+// batch is flushed once however many producers race; an urgent item always
+// flushes. The producer that starts a batch is told to arm the deadline.
+BATCH_ACTION BatchAdd(_Inout_ PBATCHER Batcher, ULONG64 Now, BOOLEAN Urgent)
+{
+    LONG pending = InterlockedIncrement(&Batcher->Pending);
+
+    if (pending == 1) {
+        WriteRelease64(&Batcher->FirstTime, (LONG64)Now);
+    }
+    if (Urgent || (ULONG)pending == Batcher->Size) {
+        return BatchFlush;
+    }
+    return (pending == 1) ? BatchArm : BatchNone;
+}
+
+// For consumers that poll instead of arming a timer
+BOOLEAN BatchDue(_In_ const BATCHER* Batcher, ULONG64 Now)
+{
+    LONG pending = ReadAcquire(&Batcher->Pending);
+
+    if (pending == 0) {
+        return FALSE;
+    }
+    return (ULONG)pending >= Batcher->Size ||
+           Now - (ULONG64)ReadAcquire64(&Batcher->FirstTime) >= Batcher->Deadline;
+}
+
+// Starts a new batch and returns how many items the finished one had
+ULONG BatchTake(_Inout_ PBATCHER Batcher)
+{
+    return (ULONG)InterlockedExchange(&Batcher->Pending, 0);
+}
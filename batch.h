@@ -0,0 +1,33 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include "compat.h"
+#endif
+
+//
+// Batch/deadline delivery policy for parked readers. Any number of producers
+// call BatchAdd; one consumer calls BatchTake when it delivers. Portable: no
+// kernel calls, no allocation, no locks.
+//
+
+typedef enum _BATCH_ACTION {
+    BatchNone = 0,              // keep accumulating
+    BatchArm,                   // first item of a new batch: start the deadline timer
+    BatchFlush                  // deliver now
+} BATCH_ACTION;
+
+typedef struct DECLSPEC_CACHEALIGN _BATCHER {
+    ULONG Size;                 // deliver once this many items are pending
+    ULONG64 Deadline;           // ... or this long after the first one, same unit as Now
+    volatile LONG Pending;
+    volatile LONG64 FirstTime;  // time of the first pending item
+} BATCHER, *PBATCHER;
+
+VOID BatchInit(_Out_ PBATCHER Batcher, ULONG Size, ULONG64 Deadline);
+BATCH_ACTION BatchAdd(_Inout_ PBATCHER Batcher, ULONG64 Now, BOOLEAN Urgent);
+BOOLEAN BatchDue(_In_ const BATCHER* Batcher, ULONG64 Now);
+ULONG BatchTake(_Inout_ PBATCHER Batcher);
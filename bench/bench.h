@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef _WIN32
+#define _GNU_SOURCE                 // pthread_setaffinity_np
+#endif
+#include "test.h"
+#include <string.h>
+#ifndef _WIN32
+#include <time.h>
+#include <unistd.h>
+#endif
+
+//
+// Minimal support for the user-mode benchmarks: a monotonic clock, a sink
+// that keeps results alive and pinning threads to CPUs. Random sources and threads come from the
+// tests' test.h. Numbers quoted in README.md come from these programs.
+//
+
+static volatile ULONG64 BenchSink;
+
+// Monotonic time in nanoseconds
+static inline ULONG64 BenchNow(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (ULONG64)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONG64)ts.tv_sec * 1000000000ULL + (ULONG64)ts.tv_nsec;
+#endif
+}
+
+static inline void BenchReport(const char* Name, ULONG64 Nanoseconds, ULONG64 Operations)
+{
+    printf("  %-40s %10.1f ns/op\n", Name, (double)Nanoseconds / (double)Operations);
+}
+
+// Logical processors the process may run on
+static inline ULONG BenchCpuCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (ULONG)count : 1;
+#endif
+}
+
+// Pins the calling thread to one CPU (in the first processor group on
+// Windows); FALSE if that failed
+static inline BOOLEAN BenchPinThread(ULONG Cpu)
+{
+#ifdef _WIN32
+    return Cpu < 8 * sizeof(DWORD_PTR) && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << Cpu) != 0;
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(Cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
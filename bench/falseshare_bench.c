@@ -0,0 +1,106 @@
+#include "bench.h"
+#include "stats.h"
+
+//
+// Per-CPU counters bumped with the driver's own StatAdd: one writer per
+// counter, plain loads and stores. Cache-aligned, each thread bumps its own
+// CORE_STATS exactly as the driver lays them out; packed, the same two
+// counters of neighbouring threads share cache lines. Every thread is pinned
+// to its own CPU, so runs go up to as many threads as there are CPUs: with
+// fewer CPUs the threads would take turns and never contend.
+//
+
+#define MAX_THREADS     16
+#define BUMPS           50000000
+
+// The CORE_STATS counters SampleCore bumps on every sample, without the padding
+typedef struct _PACKED_COUNTERS {
+    volatile LONG64 SamplesTaken;
+    volatile LONG64 SampleCycles;
+} PACKED_COUNTERS;
+
+C_ASSERT(sizeof(PACKED_COUNTERS) == 2 * sizeof(LONG64) && sizeof(PACKED_COUNTERS) < sizeof(CORE_STATS));
+
+typedef struct _WORKER {
+    void* Counters;
+    ULONG Cpu;
+    BOOLEAN Pinned;
+} WORKER;
+
+static PACKED_COUNTERS Packed[MAX_THREADS];
+static CORE_STATS Aligned[MAX_THREADS];
+static WORKER Workers[MAX_THREADS];
+
+static void BumpPacked(void* Context)
+{
+    WORKER* worker = (WORKER*)Context;
+    PACKED_COUNTERS* counters = (PACKED_COUNTERS*)worker->Counters;
+
+    worker->Pinned = BenchPinThread(worker->Cpu);
+    for (ULONG i = 0; i < BUMPS; i++) {
+        StatAdd(&counters->SamplesTaken, 1);
+        StatAdd(&counters->SampleCycles, i);
+    }
+}
+
+static void BumpAligned(void* Context)
+{
+    WORKER* worker = (WORKER*)Context;
+    PCORE_STATS stats = (PCORE_STATS)worker->Counters;
+
+    worker->Pinned = BenchPinThread(worker->Cpu);
+    for (ULONG i = 0; i < BUMPS; i++) {
+        StatAdd(&stats->SamplesTaken, 1);
+        StatAdd(&stats->SampleCycles, i);
+    }
+}
+
+// Thread t on CPU t; FALSE if a thread could not be pinned
+static BOOLEAN Run(ULONG Threads, TEST_THREAD_ROUTINE Routine, BOOLEAN IsAligned, ULONG64* Nanoseconds)
+{
+    TEST_THREAD threads[MAX_THREADS];
+    BOOLEAN pinned = TRUE;
+    ULONG64 start = BenchNow();
+
+    for (ULONG t = 0; t < Threads; t++) {
+        Workers[t].Counters = IsAligned ? (void*)&Aligned[t] : (void*)&Packed[t];
+        Workers[t].Cpu = t;
+        TestThreadStart(&threads[t], Routine, &Workers[t]);
+    }
+    for (ULONG t = 0; t < Threads; t++) {
+        TestThreadJoin(threads[t]);
+        pinned = pinned && Workers[t].Pinned;
+    }
+    *Nanoseconds = BenchNow() - start;
+    return pinned;
+}
+
+int main(int argc, char** argv)
+{
+    ULONG cpus = BenchCpuCount();
+    ULONG maxThreads = (argc > 1) ? (ULONG)atoi(argv[1]) : 4;
+
+    maxThreads = min(max(maxThreads, 1), min(MAX_THREADS, cpus));
+    printf("falseshare_bench: %u bumps per thread, time per bump, %u CPUs, up to %u threads\n",
+           BUMPS, cpus, maxThreads);
+    for (ULONG threads = 1; threads <= maxThreads; threads *= 2) {
+        char name[64];
+        ULONG64 ops = (ULONG64)threads * BUMPS;
+        ULONG64 elapsed;
+
+        snprintf(name, sizeof(name), "%u threads, packed", threads);
+        if (!Run(threads, BumpPacked, FALSE, &elapsed)) {
+            printf("  %s: could not pin every thread\n", name);
+        }
+        BenchReport(name, elapsed, ops);
+        snprintf(name, sizeof(name), "%u threads, CORE_STATS", threads);
+        if (!Run(threads, BumpAligned, TRUE, &elapsed)) {
+            printf("  %s: could not pin every thread\n", name);
+        }
+        BenchReport(name, elapsed, ops);
+    }
+    if (maxThreads == 1) {
+        printf("  one CPU only: nothing to contend, the layouts cannot differ here\n");
+    }
+    return 0;
+}
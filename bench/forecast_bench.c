@@ -0,0 +1,70 @@
+#include "bench.h"
+#include "snapshot.h"
+
+//
+// Forecast costs on 256 CPUs: ForecastUpdate as each sampler calls it once
+// per sample, ForecastAhead over the level and slope arrays of every CPU,
+// and SnapshotForecast entry by entry for comparison.
+//
+
+#define CPUS            256
+#define UPDATES         20000
+#define CALLS           200000
+
+static FORECAST Forecasts[CPUS];
+static LONG Level[CPUS];
+static LONG Slope[CPUS];
+static LONG Out[CPUS];
+static WINMSR_CPU_SNAPSHOT Copies[CPUS];
+
+int main(void)
+{
+    ULONG64 seed = 41;
+    ULONG64 start;
+    static LONG readings[1024];
+
+    for (ULONG i = 0; i < 1024; i++) {
+        readings[i] = (LONG)TestRange(&seed, 40, 95) * 1000;
+    }
+    for (ULONG i = 0; i < CPUS; i++) {
+        ForecastInit(&Forecasts[i], 1000, 4000);
+    }
+
+    printf("forecast_bench: %u CPUs\n", CPUS);
+
+    // Readings 1 ms apart, CPU by CPU as the samplers would interleave
+    start = BenchNow();
+    for (ULONG u = 0; u < UPDATES; u++) {
+        ULONG64 time = 10000ULL * (u + 1);
+        for (ULONG i = 0; i < CPUS; i++) {
+            ForecastUpdate(&Forecasts[i], readings[(u + i) & 1023], (u & 63) == 0, time + i);
+        }
+    }
+    BenchReport("ForecastUpdate, per sample", BenchNow() - start, (ULONG64)UPDATES * CPUS);
+
+    for (ULONG i = 0; i < CPUS; i++) {
+        Level[i] = Forecasts[i].Level;
+        Slope[i] = Forecasts[i].Slope;
+        Copies[i].Level = Level[i];
+        Copies[i].Slope = Slope[i];
+        BenchSink += (ULONG64)Forecasts[i].Level;
+    }
+
+    start = BenchNow();
+    for (ULONG c = 0; c < CALLS; c++) {
+        ForecastAhead(Level, Slope, CPUS, 1000 + (LONG)(c & 4095), Out);
+        BenchSink += (ULONG64)Out[c % CPUS];
+    }
+    BenchReport("ForecastAhead, all 256 CPUs", BenchNow() - start, CALLS);
+
+    start = BenchNow();
+    for (ULONG c = 0; c < CALLS; c++) {
+        LONG horizon = 1000 + (LONG)(c & 4095);
+        for (ULONG i = 0; i < CPUS; i++) {
+            Out[i] = SnapshotForecast(&Copies[i], horizon);
+        }
+        BenchSink += (ULONG64)Out[c % CPUS];
+    }
+    BenchReport("SnapshotForecast, all 256 CPUs", BenchNow() - start, CALLS);
+    return 0;
+}
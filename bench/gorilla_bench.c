@@ -0,0 +1,109 @@
+#include "bench.h"
+#include "gorilla.h"
+
+//
+// Compression of one CPU's (stamp, raw IA32_THERM_STATUS) series sampled at
+// 1 kHz: stamps with uniform timer jitter around the period (in one series
+// with idle stretches sampled at a tenth of the rate), the DTS wandering by a
+// degree every few samples and a log bit now and then.
+// Ratio and bits per sample count every chunk in full (4 KiB each), against
+// 16 raw bytes per sample; every sample is checked after decoding.
+//
+
+#define SAMPLES         (1 << 20)
+#define MAX_CHUNKS      4096
+#define ROUNDS          10
+
+static ULONG64 Stamps[SAMPLES];
+static ULONG64 Values[SAMPLES];
+static ULONG64 Chunks[MAX_CHUNKS][GORILLA_CHUNK_BYTES / sizeof(ULONG64)];
+
+static ULONG EncodeAll(ULONG64 Period)
+{
+    GORILLA_ENCODER encoder;
+    ULONG chunks = 1;
+
+    GorillaEncodeBegin(&encoder, Chunks[0], Period);
+    for (ULONG i = 0; i < SAMPLES; i++) {
+        if (!GorillaEncode(&encoder, Stamps[i], Values[i])) {
+            GorillaEncodeNext(&encoder, Chunks[chunks++]);
+            GorillaEncode(&encoder, Stamps[i], Values[i]);
+        }
+    }
+    return chunks;
+}
+
+static ULONG DecodeAll(ULONG ChunkCount, BOOLEAN Compare)
+{
+    ULONG n = 0;
+    ULONG mismatches = 0;
+
+    for (ULONG c = 0; c < ChunkCount; c++) {
+        GORILLA_DECODER decoder;
+        ULONG64 stamp;
+        ULONG64 value;
+
+        if (!GorillaDecodeBegin(&decoder, Chunks[c], GORILLA_CHUNK_BYTES)) {
+            return MAXULONG;
+        }
+        while (GorillaDecode(&decoder, &stamp, &value)) {
+            if (Compare) {
+                mismatches += n >= SAMPLES || stamp != Stamps[n] || value != Values[n];
+            }
+            BenchSink += stamp ^ value;
+            n++;
+        }
+    }
+    return mismatches + (n != SAMPLES);
+}
+
+static void Run(const char* Name, ULONG64 Period, ULONG64 Jitter, BOOLEAN Idle, ULONG64* Seed)
+{
+    LONG dts = 40;
+    ULONG chunks = 0;
+    ULONG64 start;
+    ULONG64 grid = 1000000000ULL;
+    BOOLEAN deferred = FALSE;
+
+    for (ULONG i = 0; i < SAMPLES; i++) {
+        if (TestRange(Seed, 0, 7) == 0) {
+            dts = min(max(dts + (LONG)TestRange(Seed, -1, 1), 0), 100);
+        }
+        // Idle stretches of about 300 fires, IdleDeferPeriods = 10 apart
+        if (Idle && TestRange(Seed, 0, 299) == 0) {
+            deferred = !deferred;
+        }
+        grid += deferred ? 10 * Period : Period;
+        Stamps[i] = grid + (ULONG64)TestRange(Seed, 0, 2 * (LONG64)Jitter);
+        Values[i] = 0x80000000ULL | (1ULL << 27) | ((ULONG64)dts << 16) | ((TestRange(Seed, 0, 999) == 0) ? 0x2 : 0);
+    }
+
+    start = BenchNow();
+    for (ULONG r = 0; r < ROUNDS; r++) {
+        chunks = EncodeAll(Period);
+    }
+    ULONG64 encode = BenchNow() - start;
+
+    start = BenchNow();
+    for (ULONG r = 0; r < ROUNDS; r++) {
+        DecodeAll(chunks, FALSE);
+    }
+    ULONG64 decode = BenchNow() - start;
+
+    double bits = (double)chunks * GORILLA_CHUNK_BYTES * 8 / SAMPLES;
+    printf("  %-40s %5.1fx %5.1f bits/sample, encode %3.0f M/s, decode %3.0f M/s, %u mismatches\n",
+           Name, 128 / bits, bits, (double)SAMPLES * ROUNDS * 1e3 / (double)encode,
+           (double)SAMPLES * ROUNDS * 1e3 / (double)decode, DecodeAll(chunks, TRUE));
+}
+
+int main(void)
+{
+    ULONG64 seed = 48;
+
+    printf("gorilla_bench: %u samples at 1 kHz\n", SAMPLES);
+    Run("interrupt time, +-5 us jitter", 10000, 50, FALSE, &seed);
+    Run("interrupt time, +-50 us jitter", 10000, 500, FALSE, &seed);
+    Run("interrupt time, +-5 us, idle stretches", 10000, 50, TRUE, &seed);
+    Run("TSC (3 GHz), +-5 us jitter", 3000000, 15000, FALSE, &seed);
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "bench.h"
+
+//
+// Idle-respecting sampling, simulated tick by tick for 256 CPUs that go
+// through busy and idle phases of random length while their temperature
+// follows a first-order model. Each policy mirrors ThreadEntry's decision on
+// every fire; the outcome is how often an idle CPU is woken, how many plan
+// reads are made, and how far the published temperature is from the true
+// one at every tick.
+//
+//   always  IdleSampling = 0: every CPU fires and is read on every tick
+//   skip    the former idle path: every CPU still fires on every tick, idle
+//           ones only read MPERF
+//   defer   the current path: an idle CPU's timer is widened to every
+//           IdleDeferPeriods-th tick and read on each of those fires
+//
+
+#define CPUS            256
+#define TICKS           20000
+#define DEFER_PERIODS   10
+#define BUSY_PERMILLE   20
+#define IDLE_MILLIC     45000
+#define BUSY_MILLIC     85000
+#define TAU_TICKS       200
+
+typedef enum _POLICY {
+    PolicyAlways = 0,
+    PolicySkip,
+    PolicyDefer,
+    PolicyCount
+} POLICY;
+
+static const char* PolicyName[PolicyCount] = { "always", "skip", "defer" };
+
+typedef struct _SIM_CPU {
+    ULONG64 Seed;
+    ULONG PhaseLeft;            // ticks left in the current phase
+    BOOLEAN Busy;
+    LONG MilliC;                // true temperature
+    LONG Published;             // snapshot temperature
+    ULONG64 LastFire;
+    ULONG64 BusySinceFire;
+    ULONG64 LastRead;
+    ULONG64 NextFire;
+    BOOLEAN Deferred;
+    BOOLEAN Checked;            // has an MPERF baseline
+    ULONG64 BusySince;          // tick the busy phase began, MAXULONG64 once it was read
+} SIM_CPU;
+
+typedef struct _SIM_RESULT {
+    ULONG64 Fires;
+    ULONG64 IdleWakes;          // fires that found the CPU in an idle phase
+    ULONG64 Reads;
+    ULONG64 ErrorSum;           // |published - true|, m°C, summed over CPUs and ticks
+    ULONG64 ErrorMax;
+    ULONG64 OnsetDelaySum;      // ticks from a busy phase's start to its first read
+    ULONG64 OnsetDelayMax;
+    ULONG64 Onsets;             // busy phases read while still busy
+    ULONG64 Missed;             // busy phases over before any read
+} SIM_RESULT;
+
+static SIM_CPU Cpus[CPUS];
+
+static ULONG PhaseLength(ULONG64* Seed, ULONG Mean)
+{
+    return (ULONG)TestRange(Seed, 1, 2 * (LONG64)Mean - 1);
+}
+
+static void Simulate(POLICY Policy, ULONG IdleMean, ULONG BusyMean, SIM_RESULT* Result)
+{
+    RtlZeroMemory(Result, sizeof(*Result));
+    for (ULONG i = 0; i < CPUS; i++) {
+        SIM_CPU* cpu = &Cpus[i];
+        RtlZeroMemory(cpu, sizeof(*cpu));
+        cpu->Seed = 0x9E3779B97F4A7C15ULL * (i + 1);     // same workload for every policy
+        cpu->Busy = TestRange(&cpu->Seed, 0, IdleMean + BusyMean - 1) < BusyMean;
+        cpu->PhaseLeft = PhaseLength(&cpu->Seed, cpu->Busy ? BusyMean : IdleMean);
+        cpu->MilliC = cpu->Busy ? BUSY_MILLIC : IDLE_MILLIC;
+        cpu->Published = cpu->MilliC;
+        cpu->BusySince = MAXULONG64;
+    }
+
+    for (ULONG64 t = 1; t <= TICKS; t++) {
+        for (ULONG i = 0; i < CPUS; i++) {
+            SIM_CPU* cpu = &Cpus[i];
+
+            if (--cpu->PhaseLeft == 0) {
+                cpu->Busy = !cpu->Busy;
+                cpu->PhaseLeft = PhaseLength(&cpu->Seed, cpu->Busy ? BusyMean : IdleMean);
+                if (cpu->Busy) {
+                    cpu->BusySince = t;
+                }
+                else if (cpu->BusySince != MAXULONG64) {
+                    Result->Missed++;
+                    cpu->BusySince = MAXULONG64;
+                }
+            }
+            cpu->MilliC += ((cpu->Busy ? BUSY_MILLIC : IDLE_MILLIC) - cpu->MilliC) / TAU_TICKS;
+            cpu->BusySinceFire += cpu->Busy;
+
+            if (t >= cpu->NextFire) {
+                ULONG64 elapsed = t - cpu->LastFire;
+                BOOLEAN idle = FALSE;
+                BOOLEAN read;
+
+                Result->Fires++;
+                Result->IdleWakes += !cpu->Busy;
+                if (Policy != PolicyAlways) {
+                    idle = cpu->Checked && cpu->BusySinceFire * 1000 < elapsed * BUSY_PERMILLE;
+                    cpu->Checked = TRUE;
+                }
+                read = !(idle && !cpu->Deferred && t - cpu->LastRead < DEFER_PERIODS);
+                if (read) {
+                    Result->Reads++;
+                    cpu->Published = cpu->MilliC;
+                    cpu->LastRead = t;
+                    if (cpu->Busy && cpu->BusySince != MAXULONG64) {
+                        ULONG64 delay = t - cpu->BusySince;
+                        Result->OnsetDelaySum += delay;
+                        Result->OnsetDelayMax = max(Result->OnsetDelayMax, delay);
+                        Result->Onsets++;
+                        cpu->BusySince = MAXULONG64;
+                    }
+                }
+                cpu->LastFire = t;
+                cpu->BusySinceFire = 0;
+
+                // Deferred timers fire on every DEFER_PERIODS-th tick of the grid
+                cpu->Deferred = Policy == PolicyDefer && idle;
+                cpu->NextFire = cpu->Deferred ? (t / DEFER_PERIODS + 1) * DEFER_PERIODS : t + 1;
+            }
+
+            ULONG64 error = (ULONG64)((cpu->Published > cpu->MilliC) ? cpu->Published - cpu->MilliC
+                                                                      : cpu->MilliC - cpu->Published);
+            Result->ErrorSum += error;
+            Result->ErrorMax = max(Result->ErrorMax, error);
+        }
+    }
+}
+
+static void Case(const char* Name, ULONG IdleMean, ULONG BusyMean)
+{
+    SIM_RESULT results[PolicyCount];
+
+    printf("\n  %s (idle phases %u ticks, busy phases %u ticks on average)\n", Name, IdleMean, BusyMean);
+    printf("  %-8s %10s %10s %10s %8s %9s %9s %13s %7s\n", "policy", "fires", "idle wakes", "reads",
+           "avoided", "mean err", "max err", "onset mean/max", "missed");
+    for (ULONG p = 0; p < PolicyCount; p++) {
+        Simulate((POLICY)p, IdleMean, BusyMean, &results[p]);
+    }
+    for (ULONG p = 0; p < PolicyCount; p++) {
+        SIM_RESULT* r = &results[p];
+        printf("  %-8s %10llu %10llu %10llu %7.1f%% %6.0f mC %6llu mC %7.2f / %3llu %7llu\n", PolicyName[p],
+               (unsigned long long)r->Fires, (unsigned long long)r->IdleWakes, (unsigned long long)r->Reads,
+               100.0 * (double)(results[PolicyAlways].IdleWakes - r->IdleWakes) / (double)results[PolicyAlways].IdleWakes,
+               (double)r->ErrorSum / ((double)CPUS * TICKS), (unsigned long long)r->ErrorMax,
+               r->Onsets ? (double)r->OnsetDelaySum / (double)r->Onsets : 0.0, (unsigned long long)r->OnsetDelayMax,
+               (unsigned long long)r->Missed);
+    }
+}
+
+int main(void)
+{
+    printf("idle_bench: %u CPUs, %u ticks, IdleDeferPeriods %u, IdleBusyPermille %u, tau %u ticks\n",
+           CPUS, TICKS, DEFER_PERIODS, BUSY_PERMILLE, TAU_TICKS);
+    Case("mostly idle", 2000, 100);
+    Case("mixed", 300, 300);
+    Case("short bursts", 100, 5);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "bench.h"
+
+//
+// Driver load latency with and without waiting for the initial sweeps,
+// simulated in user mode: one thread per CPU stands in for ThreadEntry and
+// sleeps for its configuration time (sleeping rather than spinning, as the
+// real CPUs configure in parallel), then counts WarmingUp down like
+// WarmupDone. "Waiting" returns once every thread is done, as DriverEntry
+// did before; "not waiting" returns once every thread is created.
+//
+
+#define CPUS            256
+#define RUNS            5
+
+typedef struct _SIM_CPU {
+    ULONG DelayUs;              // before the CPU's thread gets to run
+    ULONG ConfigureUs;          // probing or loading a cached plan
+} SIM_CPU;
+
+static SIM_CPU Cpus[CPUS];
+static volatile LONG WarmingUp;
+static volatile LONG64 WarmTime;
+
+static void SleepUs(ULONG Microseconds)
+{
+#ifdef _WIN32
+    Sleep((Microseconds + 999) / 1000);
+#else
+    struct timespec ts = { Microseconds / 1000000, (long)(Microseconds % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static void CpuThread(void* Context)
+{
+    SIM_CPU* cpu = (SIM_CPU*)Context;
+
+    if (cpu->DelayUs != 0) {
+        SleepUs(cpu->DelayUs);
+    }
+    SleepUs(cpu->ConfigureUs);
+    if (InterlockedDecrement(&WarmingUp) == 0) {
+        WriteRelease64(&WarmTime, (LONG64)BenchNow());
+    }
+}
+
+// Returns the load time; *Warm gets the time until every CPU is warm
+static ULONG64 Load(BOOLEAN Wait, ULONG64* Warm)
+{
+    static TEST_THREAD threads[CPUS];
+    ULONG64 start = BenchNow();
+    ULONG64 loaded;
+
+    WarmingUp = CPUS;
+    for (ULONG i = 0; i < CPUS; i++) {
+        TestThreadStart(&threads[i], CpuThread, &Cpus[i]);
+    }
+    if (Wait) {
+        for (ULONG i = 0; i < CPUS; i++) {
+            TestThreadJoin(threads[i]);
+        }
+        loaded = BenchNow() - start;
+    }
+    else {
+        loaded = BenchNow() - start;
+        for (ULONG i = 0; i < CPUS; i++) {
+            TestThreadJoin(threads[i]);
+        }
+    }
+    *Warm = (ULONG64)ReadAcquire64(&WarmTime) - start;
+    return loaded;
+}
+
+static void Case(const char* Name, ULONG ConfigureUs, ULONG HeldOffUs)
+{
+    ULONG64 best[2] = { MAXULONG64, MAXULONG64 };
+    ULONG64 warm[2] = { MAXULONG64, MAXULONG64 };
+
+    for (ULONG i = 0; i < CPUS; i++) {
+        Cpus[i].DelayUs = (i == CPUS / 2) ? HeldOffUs : 0;
+        Cpus[i].ConfigureUs = ConfigureUs;
+    }
+    // Best of RUNS, to leave out scheduling noise of the host
+    for (ULONG run = 0; run < RUNS; run++) {
+        for (ULONG wait = 0; wait < 2; wait++) {
+            ULONG64 w;
+            ULONG64 t = Load(wait == 0, &w);
+            best[wait] = min(best[wait], t);
+            warm[wait] = min(warm[wait], w);
+        }
+    }
+    printf("  %-30s waiting %7.1f ms, not waiting %5.1f ms (all warm after %.1f ms)\n", Name,
+           (double)best[0] / 1e6, (double)best[1] / 1e6, (double)warm[1] / 1e6);
+}
+
+int main(void)
+{
+    printf("load_bench: %u simulated CPUs, best of %u\n", CPUS, RUNS);
+    Case("cached plan, 50 us per CPU", 50, 0);
+    Case("probing, 2 ms per CPU", 2000, 0);
+    Case("one CPU held off 250 ms", 50, 250000);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "bench.h"
+#include "rank.h"
+
+//
+// RankCpus over a 256-CPU snapshot page: a call that finds the page as the
+// last one left it, a call after one sampler wrote its entry (full
+// recompute), and the plain seqlock copy of every entry for comparison.
+//
+
+#define CPUS            256
+#define CALLS           200000
+
+static union {
+    WINMSR_SNAPSHOT_PAGE Page;
+    UCHAR Bytes[sizeof(WINMSR_SNAPSHOT_PAGE) + CPUS * sizeof(WINMSR_CPU_SNAPSHOT)];
+} Memory;
+static RANK_CONTEXT Context;
+static RANKED_CPU Ranked[CPUS];
+
+static PWINMSR_CPU_SNAPSHOT Entry(ULONG Cpu)
+{
+    return (PWINMSR_CPU_SNAPSHOT)SnapshotCpu(&Memory.Page, Cpu);
+}
+
+static void Write(ULONG Cpu, ULONG64* Seed)
+{
+    FORECAST forecast = { 0 };
+    LONG temperature = (LONG)TestRange(Seed, 40, 95);
+
+    forecast.Level = temperature * 1000;
+    forecast.Slope = (LONG)TestRange(Seed, -2000, 2000);
+    SnapshotWrite(Entry(Cpu), temperature, 0, 0, 0, 1, &forecast);
+}
+
+int main(void)
+{
+    ULONG64 seed = 42;
+    ULONG64 start;
+
+    Memory.Page.CpuCount = CPUS;
+    Memory.Page.CpuStride = sizeof(WINMSR_CPU_SNAPSHOT);
+    for (ULONG i = 0; i < CPUS; i++) {
+        Entry(i)->Core = (USHORT)(i & ~1u);
+        Entry(i)->Package = (USHORT)(i / 64 * 64);
+        Entry(i)->TjMax = 100;
+        Write(i, &seed);
+    }
+    RankInit(&Context);
+
+    printf("rank_bench: %u CPUs\n", CPUS);
+
+    start = BenchNow();
+    for (ULONG c = 0; c < CALLS; c++) {
+        BenchSink += RankCpus(&Memory.Page, 5000, &Context, Ranked, CPUS);
+    }
+    BenchReport("RankCpus, page unchanged", BenchNow() - start, CALLS);
+
+    start = BenchNow();
+    for (ULONG c = 0; c < CALLS; c++) {
+        Write(c % CPUS, &seed);
+        BenchSink += RankCpus(&Memory.Page, 5000, &Context, Ranked, CPUS);
+    }
+    BenchReport("RankCpus, one entry written before", BenchNow() - start, CALLS);
+
+    start = BenchNow();
+    for (ULONG c = 0; c < CALLS; c++) {
+        for (ULONG i = 0; i < CPUS; i++) {
+            WINMSR_CPU_SNAPSHOT copy;
+            SnapshotRead(Entry(i), &copy);
+            BenchSink += (ULONG64)copy.Level;
+        }
+    }
+    BenchReport("SnapshotRead of every entry", BenchNow() - start, CALLS);
+    return 0;
+}
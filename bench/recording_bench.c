@@ -0,0 +1,206 @@
+#include "bench.h"
+#include "recording.h"
+#ifdef _WIN32
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//
+// Range queries over a multi-GB recording: 64 CPUs sampled once a second
+// for Days days (35 by default, about 2.3 GB), temperatures wandering
+// between 40 and 80 C with rare short spikes above 95 C. The file is written
+// to Path (removed at the end), mapped read-only and queried through the
+// index, then scanned brute force for the same answer. The page cache is
+// warm for both.
+//
+// recording_bench [path [days]]
+//
+
+#define CPUS            64
+#define PERIOD          10000000ULL     // 1 s, 100 ns units
+#define THRESHOLD_C     95
+#define QUERY_ROUNDS    100
+
+static UCHAR HeaderBuffer[RECORDING_BLOCK_SIZE];
+static UCHAR IndexBuffer[RECORDING_BLOCK_SIZE];
+static UCHAR BlockBuffers[CPUS][RECORDING_BLOCK_SIZE];
+
+static void Put(FILE* File, ULONG64 Offset, const void* Data)
+{
+#ifdef _WIN32
+    _fseeki64(File, (LONG64)Offset, SEEK_SET);
+#else
+    fseeko(File, (off_t)Offset, SEEK_SET);
+#endif
+    fwrite(Data, RECORDING_BLOCK_SIZE, 1, File);
+}
+
+// Index blocks are written once full and at the end, the header at the end
+static void WriteBlock(FILE* File, PRECORDING_WRITER Writer, const RECORDING_BLOCK_HEADER* Block)
+{
+    Put(File, RecordingBlockOffset(Block->Index), Block);
+    if (Writer->Index->Samples == RECORDING_INDEX_SPAN) {
+        Put(File, RecordingBlockOffset(Writer->Index->Index), Writer->Index);
+    }
+}
+
+static ULONG64 Generate(const char* Path, ULONG Days)
+{
+    RECORDING_WRITER writer;
+    FILE* file = fopen(Path, "wb");
+    LONG temperature[CPUS];
+    ULONG spike[CPUS] = { 0 };
+    ULONG64 seed = 46;
+    ULONG64 seconds = (ULONG64)Days * 86400;
+
+    if (file == NULL) {
+        return 0;
+    }
+    RecordingWriterInit(&writer, (PRECORDING_FILE_HEADER)HeaderBuffer, IndexBuffer, BlockBuffers, CPUS, 0);
+    for (ULONG cpu = 0; cpu < CPUS; cpu++) {
+        temperature[cpu] = 60;
+    }
+
+    for (ULONG64 s = 0; s < seconds; s++) {
+        for (ULONG cpu = 0; cpu < CPUS; cpu++) {
+            RECORDING_SAMPLE sample = { 0 };
+            ULONG64 r = TestRandom(&seed);
+
+            if ((r & 7) == 0) {
+                temperature[cpu] = min(max(temperature[cpu] + (LONG)((r >> 3) % 3) - 1, 40), 80);
+            }
+            if (spike[cpu] == 0 && (r >> 8) % 4000000 == 0) {
+                spike[cpu] = 1 + (ULONG)((r >> 40) % 4);
+            }
+            LONG t = temperature[cpu];
+            if (spike[cpu] != 0) {
+                spike[cpu]--;
+                t = 96 + (LONG)((r >> 44) % 4);
+            }
+
+            sample.Time = 1000000000ULL + s * PERIOD + cpu;
+            sample.TjMax = 100;
+            sample.ThermStatus = 0x80000000UL | ((ULONG)(100 - t) << 16);
+            const RECORDING_BLOCK_HEADER* block = RecordingAppend(&writer, cpu, &sample);
+            if (block != NULL) {
+                WriteBlock(file, &writer, block);
+            }
+        }
+    }
+    for (ULONG cpu = 0; cpu < CPUS; cpu++) {
+        const RECORDING_BLOCK_HEADER* block = RecordingSeal(&writer, cpu);
+        if (block != NULL) {
+            WriteBlock(file, &writer, block);
+        }
+    }
+    Put(file, RecordingBlockOffset(writer.Index->Index), writer.Index);
+    Put(file, 0, writer.Header);
+    fclose(file);
+    return (writer.Header->BlockCount + 1) * RECORDING_BLOCK_SIZE;
+}
+
+static const void* Map(const char* Path, ULONG64 Size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)Size);
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return view;
+#else
+    int fd = open(Path, O_RDONLY);
+    void* view = mmap(NULL, (size_t)Size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return (view == MAP_FAILED) ? NULL : view;
+#endif
+}
+
+static ULONG64 IndexQuery(const RECORDING_READER* Reader, PRECORDING_QUERY Query)
+{
+    const RECORDING_BLOCK_HEADER* block;
+    ULONG64 matches = 0;
+
+    while ((block = RecordingQueryNext(Reader, Query)) != NULL) {
+        for (ULONG i = RecordingQuerySample(Reader, Query, block, 0); i != MAXULONG;
+             i = RecordingQuerySample(Reader, Query, block, i + 1)) {
+            matches++;
+        }
+    }
+    return matches;
+}
+
+// Every sample block, DTS and TjMax columns only
+static ULONG64 BruteQuery(const RECORDING_READER* Reader)
+{
+    ULONG64 matches = 0;
+
+    for (ULONG64 index = 1; index <= Reader->Blocks; index++) {
+        const RECORDING_BLOCK_HEADER* block = (const RECORDING_BLOCK_HEADER*)(Reader->Base + RecordingBlockOffset(index));
+        if (block->Cpu == RECORDING_INDEX_CPU) {
+            continue;
+        }
+        const UCHAR* dts = (const UCHAR*)RecordingColumn(Reader, block, RecordingColumnDts);
+        const UCHAR* tjMax = (const UCHAR*)RecordingColumn(Reader, block, RecordingColumnTjMax);
+        for (ULONG i = 0; i < block->Samples; i++) {
+            matches += RecordingTemperature(dts[i], tjMax[i]) > THRESHOLD_C;
+        }
+    }
+    return matches;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = (argc > 1) ? argv[1] : "recording_bench.wsm";
+    ULONG days = (argc > 2) ? (ULONG)atoi(argv[2]) : 35;
+    RECORDING_READER reader;
+    RECORDING_QUERY query;
+    ULONG64 start;
+    ULONG64 matches = 0;
+
+    start = BenchNow();
+    ULONG64 size = Generate(path, days);
+    printf("recording_bench: %u CPUs, %u days, %.2f GB written in %.1f s\n", CPUS, days, (double)size / 1e9,
+           (double)(BenchNow() - start) / 1e9);
+
+    const void* view = (size != 0) ? Map(path, size) : NULL;
+    if (view == NULL || !RecordingOpen(&reader, view, size)) {
+        printf("  cannot write or map %s\n", path);
+        return 1;
+    }
+    BenchSink += BruteQuery(&reader);     // warm the page cache
+
+    // Above THRESHOLD_C on any CPU, whole file
+    start = BenchNow();
+    for (ULONG r = 0; r < QUERY_ROUNDS; r++) {
+        RecordingQueryInit(&query, 0, MAXULONG64, RECORDING_ANY_CPU, THRESHOLD_C, 0);
+        matches = IndexQuery(&reader, &query);
+    }
+    ULONG64 indexed = (BenchNow() - start) / QUERY_ROUNDS;
+
+    start = BenchNow();
+    ULONG64 brute = BruteQuery(&reader);
+    ULONG64 scanned = BenchNow() - start;
+
+    printf("  above %d C, any CPU: %llu samples; index opened %llu of %llu sample blocks in %.3f ms,\n"
+           "  brute-force scan of every block found %llu in %.1f ms\n",
+           THRESHOLD_C, (unsigned long long)matches, (unsigned long long)query.BlocksOpened,
+           (unsigned long long)(query.BlocksOpened + query.BlocksSkipped), (double)indexed / 1e6,
+           (unsigned long long)brute, (double)scanned / 1e6);
+
+    // One CPU over one day in the middle, no condition
+    ULONG64 day = 1000000000ULL + (ULONG64)(days / 2) * 86400 * PERIOD;
+    start = BenchNow();
+    for (ULONG r = 0; r < QUERY_ROUNDS; r++) {
+        RecordingQueryInit(&query, day, day + 86400 * PERIOD - 1, 7, RECORDING_NO_THRESHOLD, 0);
+        matches = IndexQuery(&reader, &query);
+    }
+    printf("  CPU 7, one day: %llu samples from %llu blocks in %.3f ms\n", (unsigned long long)matches,
+           (unsigned long long)query.BlocksOpened, (double)(BenchNow() - start) / QUERY_ROUNDS / 1e6);
+
+    remove(path);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "bench.h"
+#include "wire.h"
+
+//
+// Wire encoding of a synthetic stream: 64 CPUs sampled at 1 kHz with
+// +-50 us timer jitter, a valid reading on almost every sample and a status
+// bit now and then. Records are encoded in frames of FRAME_RECORDS as one
+// IOCTL_WINMSR_READ_PACKED would return them, then decoded and compared.
+//
+
+#define CPUS            64
+#define RECORDS         (1 << 20)
+#define FRAME_RECORDS   4096
+#define FRAME_BYTES     (sizeof(WIRE_FRAME_HEADER) + CPUS * sizeof(WIRE_CPU_INFO) + FRAME_RECORDS * WIRE_MAX_RECORD_BYTES)
+#define ROUNDS          20
+
+static WINMSR_SAMPLE_RECORD Records[RECORDS];
+static UCHAR Frames[RECORDS / FRAME_RECORDS][FRAME_BYTES];
+static ULONG FrameSize[RECORDS / FRAME_RECORDS];
+
+static ULONG64 EncodeAll(void)
+{
+    ULONG64 bytes = 0;
+
+    for (ULONG f = 0; f < RECORDS / FRAME_RECORDS; f++) {
+        const WINMSR_SAMPLE_RECORD* records = &Records[f * FRAME_RECORDS];
+        WIRE_ENCODER encoder;
+
+        WireEncodeBegin(&encoder, Frames[f], FRAME_BYTES, records[0].Time, CPUS);
+        PWIRE_CPU_INFO table = WireEncodeTable(&encoder);
+        for (ULONG i = 0; i < CPUS; i++) {
+            table[i].TjMax = 100;
+            table[i].DtsResolution = 1;
+        }
+        for (ULONG i = 0; i < FRAME_RECORDS; i++) {
+            WireEncodeRecord(&encoder, &records[i]);
+        }
+        FrameSize[f] = WireEncodeEnd(&encoder);
+        bytes += FrameSize[f];
+    }
+    return bytes;
+}
+
+static ULONG64 DecodeAll(BOOLEAN Compare)
+{
+    ULONG64 mismatches = 0;
+
+    for (ULONG f = 0; f < RECORDS / FRAME_RECORDS; f++) {
+        WIRE_DECODER decoder = { 0 };
+        WINMSR_SAMPLE_RECORD record;
+        ULONG n = f * FRAME_RECORDS;
+
+        if (WireDecodeBegin(&decoder, Frames[f], FrameSize[f]) != FrameSize[f]) {
+            mismatches++;
+            continue;
+        }
+        while (WireDecodeRecord(&decoder, &record)) {
+            if (Compare) {
+                const WINMSR_SAMPLE_RECORD* original = &Records[n];
+                mismatches += record.Time != original->Time || record.Cpu != original->Cpu ||
+                              record.Temperature != original->Temperature;
+            }
+            BenchSink += record.Time;
+            n++;
+        }
+        mismatches += n != (f + 1) * FRAME_RECORDS;
+    }
+    return mismatches;
+}
+
+int main(void)
+{
+    ULONG64 seed = 44;
+    ULONG64 start;
+    ULONG64 bytes = 0;
+
+    for (ULONG i = 0; i < RECORDS; i++) {
+        PWINMSR_SAMPLE_RECORD record = &Records[i];
+        ULONG dts = (ULONG)TestRange(&seed, 20, 60);
+
+        record->Cpu = i % CPUS;
+        record->Time = 1000000000ULL + (ULONG64)(i / CPUS) * 10000 + (ULONG64)TestRange(&seed, 0, 1000);
+        record->ThermStatus = WIRE_READING_VALID | (1UL << WIRE_RESOLUTION_SHIFT) | (dts << WIRE_DTS_SHIFT);
+        if (TestRange(&seed, 0, 99) == 0) {
+            record->ThermStatus |= 0x2;     // a log bit
+        }
+        record->Temperature = 100 - (LONG)dts;
+        record->FireDelay = 0;
+    }
+
+    start = BenchNow();
+    for (ULONG r = 0; r < ROUNDS; r++) {
+        bytes = EncodeAll();
+    }
+    ULONG64 encode = BenchNow() - start;
+
+    start = BenchNow();
+    for (ULONG r = 0; r < ROUNDS; r++) {
+        DecodeAll(FALSE);
+    }
+    ULONG64 decode = BenchNow() - start;
+
+    printf("wire_bench: %u records, %u CPUs, frames of %u\n", RECORDS, CPUS, FRAME_RECORDS);
+    printf("  %.2f bytes per record (%u as WINMSR_SAMPLE_RECORD), %llu mismatches\n",
+           (double)bytes / RECORDS, (ULONG)sizeof(WINMSR_SAMPLE_RECORD), (unsigned long long)DecodeAll(TRUE));
+    printf("  encode %.0f M records/s, decode %.0f M records/s\n",
+           (double)RECORDS * ROUNDS * 1e3 / (double)encode, (double)RECORDS * ROUNDS * 1e3 / (double)decode);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+//
+// The Windows types, SAL annotations and interlocked intrinsics the portable
+// modules use, for building them outside Windows (the tests and benchmarks,
+// see CMakeLists.txt). The portable headers include this instead of
+// <windows.h> when neither _KERNEL_MODE nor _WIN32 is defined. GCC and Clang.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef void VOID, *PVOID;
+typedef char CHAR;
+typedef const char* PCSTR;
+typedef unsigned char UCHAR, *PUCHAR;
+typedef short SHORT;
+typedef unsigned short USHORT, *PUSHORT;
+typedef uint16_t WCHAR;
+typedef int32_t LONG, *PLONG;
+typedef uint32_t ULONG, *PULONG;
+typedef int64_t LONG64, *PLONG64, LONGLONG;
+typedef uint64_t ULONG64, *PULONG64, ULONGLONG;
+typedef uintptr_t ULONG_PTR;
+typedef size_t SIZE_T;
+typedef UCHAR BOOLEAN;
+
+#define TRUE    1
+#define FALSE   0
+
+#define MINSHORT    ((SHORT)0x8000)
+#define MAXSHORT    ((SHORT)0x7FFF)
+#define MAXUSHORT   0xFFFF
+#define MINLONG     ((LONG)0x80000000)
+#define MAXLONG     ((LONG)0x7FFFFFFF)
+#define MAXULONG    0xFFFFFFFFU
+#define MAXULONG64  0xFFFFFFFFFFFFFFFFULL
+
+#ifndef min
+#define min(a, b)   (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)   (((a) > (b)) ? (a) : (b))
+#endif
+
+#define FORCEINLINE                 static inline __attribute__((always_inline))
+#define DECLSPEC_CACHEALIGN         __attribute__((aligned(64)))
+#define C_ASSERT(e)                 _Static_assert(e, #e)
+#define TYPE_ALIGNMENT(t)           _Alignof(t)
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_reads_(n)
+#define _In_reads_bytes_(n)
+#define _Out_writes_(n)
+#define _Out_writes_bytes_(n)
+
+#define RtlZeroMemory(d, n)         memset((d), 0, (n))
+#define RtlCopyMemory(d, s, n)      memcpy((d), (s), (n))
+
+// public.h
+#define CTL_CODE(t, f, m, a)        (((t) << 16) | ((a) << 14) | ((f) << 2) | (m))
+#define FILE_DEVICE_UNKNOWN         0x22
+#define METHOD_BUFFERED             0
+#define FILE_READ_ACCESS            0x1
+#define FILE_WRITE_ACCESS           0x2
+
+// Interlocked operations are full barriers, as on Windows
+#define InterlockedIncrement(p)                 __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p)                 __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(p)               __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v)               __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(p, v)             __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(p, v, c)     __sync_val_compare_and_swap((p), (c), (v))
+#define InterlockedCompareExchange64(p, v, c)   __sync_val_compare_and_swap((p), (c), (v))
+
+#define ReadAcquire(p)              __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ReadAcquire64(p)            __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ReadNoFence(p)              __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ReadNoFence64(p)            __atomic_load_n((p), __ATOMIC_RELAXED)
+#define WriteRelease(p, v)          __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define WriteRelease64(p, v)        __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define WriteNoFence(p, v)          __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define WriteNoFence64(p, v)        __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define MemoryBarrier()             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YieldProcessor()            __builtin_ia32_pause()
+#else
+#define YieldProcessor()            ((void)0)
+#endif
+
+static inline BOOLEAN _BitScanReverse64(ULONG* Index, ULONG64 Mask)
+{
+    if (Mask == 0) {
+        return FALSE;
+    }
+    *Index = 63 - (ULONG)__builtin_clzll(Mask);
+    return TRUE;
+}
+
+static inline BOOLEAN _BitScanForward64(ULONG* Index, ULONG64 Mask)
+{
+    if (Mask == 0) {
+        return FALSE;
+    }
+    *Index = (ULONG)__builtin_ctzll(Mask);
+    return TRUE;
+}
@@ -0,0 +1,350 @@
+#include <ntddk.h>
+#include <intrin.h>
+#include "cpumodel.h"
+
+const MSR_INFO MsrInfo[MsrIndexCount] = {
+    { MSR_TEMPERATURE_TARGET,     MsrScopePackage, MsrClassThermal,   "TEMPERATURE_TARGET" },
+    { IA32_THERM_STATUS,          MsrScopeCore,    MsrClassThermal,   "THERM_STATUS" },
+    { MSR_CUSTOM_808,             MsrScopeThread,  MsrClassOther,     "MSR808" },
+    { IA32_PACKAGE_THERM_STATUS,  MsrScopePackage, MsrClassThermal,   "PACKAGE_THERM_STATUS" },
+    { MSR_RAPL_POWER_UNIT,        MsrScopePackage, MsrClassPower,     "RAPL_POWER_UNIT" },
+    { MSR_PKG_ENERGY_STATUS,      MsrScopePackage, MsrClassPower,     "PKG_ENERGY_STATUS" },
+    { MSR_DRAM_ENERGY_STATUS,     MsrScopePackage, MsrClassPower,     "DRAM_ENERGY_STATUS" },
+    { MSR_PP0_ENERGY_STATUS,      MsrScopePackage, MsrClassPower,     "PP0_ENERGY_STATUS" },
+    { MSR_AMD_RAPL_POWER_UNIT,    MsrScopePackage, MsrClassPower,     "AMD_RAPL_POWER_UNIT" },
+    { MSR_AMD_CORE_ENERGY_STATUS, MsrScopeCore,    MsrClassPower,     "AMD_CORE_ENERGY_STATUS" },
+    { MSR_AMD_PKG_ENERGY_STATUS,  MsrScopePackage, MsrClassPower,     "AMD_PKG_ENERGY_STATUS" },
+    { IA32_MPERF,                 MsrScopeThread,  MsrClassResidency, "MPERF" },
+    { IA32_APERF,                 MsrScopeThread,  MsrClassResidency, "APERF" },
+    { MSR_PKG_C2_RESIDENCY,       MsrScopePackage, MsrClassResidency, "PKG_C2_RESIDENCY" },
+    { MSR_PKG_C3_RESIDENCY,       MsrScopePackage, MsrClassResidency, "PKG_C3_RESIDENCY" },
+    { MSR_PKG_C6_RESIDENCY,       MsrScopePackage, MsrClassResidency, "PKG_C6_RESIDENCY" },
+    { MSR_PKG_C7_RESIDENCY,       MsrScopePackage, MsrClassResidency, "PKG_C7_RESIDENCY" },
+    { MSR_CORE_C3_RESIDENCY,      MsrScopeCore,    MsrClassResidency, "CORE_C3_RESIDENCY" },
+    { MSR_CORE_C6_RESIDENCY,      MsrScopeCore,    MsrClassResidency, "CORE_C6_RESIDENCY" },
+    { MSR_CORE_C7_RESIDENCY,      MsrScopeCore,    MsrClassResidency, "CORE_C7_RESIDENCY" },
+    { MSR_MODULE_C6_RESIDENCY,    MsrScopeModule,  MsrClassResidency, "MODULE_C6_RESIDENCY" },
+};
+
+// Leaf 0x7 EDX: hybrid part
+#define CPUID7_EDX_HYBRID       (1UL << 15)
+// Leaf 0x1A EAX[31:24]: core type
+#define CPUID1A_CORE_TYPE_ATOM  0x20
+#define CPUID1A_CORE_TYPE_CORE  0x40
+
+// Leaf 0x6 EAX / ECX feature bits
+#define CPUID6_EAX_DTS          (1UL << 0)
+#define CPUID6_EAX_PLN          (1UL << 4)
+#define CPUID6_EAX_PTM          (1UL << 6)
+#define CPUID6_ECX_HCF          (1UL << 0)
+// Leaf 0x80000007 EDX: AMD running average power limit
+#define CPUID80000007_EDX_RAPL  (1UL << 14)
+
+#define CAPS_THERMAL        (MSR_BIT(MsrIndexTemperatureTarget) | MSR_BIT(MsrIndexThermStatus) | \
+                             MSR_BIT(MsrIndexPackageThermStatus))
+#define CAPS_THERMAL_LEGACY (MSR_BIT(MsrIndexThermStatus))
+#define CAPS_RAPL_CLIENT    (MSR_BIT(MsrIndexRaplPowerUnit) | MSR_BIT(MsrIndexPkgEnergyStatus) | \
+                             MSR_BIT(MsrIndexPp0EnergyStatus))
+#define CAPS_RAPL_SERVER    (MSR_BIT(MsrIndexRaplPowerUnit) | MSR_BIT(MsrIndexPkgEnergyStatus) | \
+                             MSR_BIT(MsrIndexDramEnergyStatus))
+#define CAPS_RAPL_AMD       (MSR_BIT(MsrIndexAmdRaplPowerUnit) | MSR_BIT(MsrIndexAmdCoreEnergyStatus) | \
+                             MSR_BIT(MsrIndexAmdPkgEnergyStatus))
+#define CAPS_CSTATE_NHM     (MSR_BIT(MsrIndexCoreC3Residency) | MSR_BIT(MsrIndexCoreC6Residency) | \
+                             MSR_BIT(MsrIndexPkgC3Residency) | MSR_BIT(MsrIndexPkgC6Residency) | \
+                             MSR_BIT(MsrIndexPkgC7Residency))
+#define CAPS_CSTATE_SNB     (CAPS_CSTATE_NHM | MSR_BIT(MsrIndexCoreC7Residency) | MSR_BIT(MsrIndexPkgC2Residency))
+#define CAPS_CSTATE_SRV     (MSR_BIT(MsrIndexCoreC6Residency) | MSR_BIT(MsrIndexPkgC2Residency) | \
+                             MSR_BIT(MsrIndexPkgC6Residency))
+#define CAPS_CSTATE_HYBRID  (CAPS_CSTATE_SNB | MSR_BIT(MsrIndexModuleC6Residency))
+#define CAPS_CSTATE_ATOM    (MSR_BIT(MsrIndexCoreC6Residency) | MSR_BIT(MsrIndexPkgC2Residency) | \
+                             MSR_BIT(MsrIndexPkgC3Residency) | MSR_BIT(MsrIndexPkgC6Residency))
+
+#define INTEL_CLIENT(Model, Name, CState) \
+    { CpuVendorIntel, 6, Model, 0, 0xFF, 0, 1, CAPS_THERMAL | CAPS_RAPL_CLIENT | CState, Name }
+#define INTEL_SERVER(Model, Name) \
+    { CpuVendorIntel, 6, Model, 0, 0xFF, 0, 1, CAPS_THERMAL | CAPS_RAPL_SERVER | CAPS_CSTATE_SRV, Name }
+
+static const CPU_MODEL_CAPS CpuModelTable[] = {
+    // Pre-Nehalem parts have no MSR_TEMPERATURE_TARGET
+    { CpuVendorIntel, 6, 0x0F, 0, 0xFF, 100, 1, CAPS_THERMAL_LEGACY, "Core 2 (Merom)" },
+    { CpuVendorIntel, 6, 0x17, 0, 0xFF, 100, 1, CAPS_THERMAL_LEGACY, "Core 2 (Penryn)" },
+    { CpuVendorIntel, 6, 0x1C, 0, 0xFF,  90, 1, CAPS_THERMAL_LEGACY, "Atom (Bonnell)" },
+    { CpuVendorIntel, 6, 0x1A, 0, 0xFF,   0, 1, CAPS_THERMAL | CAPS_CSTATE_NHM, "Nehalem" },
+    { CpuVendorIntel, 6, 0x1E, 0, 0xFF,   0, 1, CAPS_THERMAL | CAPS_CSTATE_NHM, "Nehalem" },
+    { CpuVendorIntel, 6, 0x2C, 0, 0xFF,   0, 1, CAPS_THERMAL | CAPS_CSTATE_NHM, "Westmere" },
+    INTEL_CLIENT(0x2A, "Sandy Bridge", CAPS_CSTATE_SNB),
+    INTEL_SERVER(0x2D, "Sandy Bridge-EP"),
+    INTEL_CLIENT(0x3A, "Ivy Bridge", CAPS_CSTATE_SNB),
+    INTEL_SERVER(0x3E, "Ivy Bridge-EP"),
+    INTEL_CLIENT(0x3C, "Haswell", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0x45, "Haswell-ULT", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0x46, "Haswell-GT3e", CAPS_CSTATE_SNB),
+    INTEL_SERVER(0x3F, "Haswell-EP"),
+    INTEL_CLIENT(0x3D, "Broadwell", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0x47, "Broadwell-GT3e", CAPS_CSTATE_SNB),
+    INTEL_SERVER(0x4F, "Broadwell-EP"),
+    INTEL_SERVER(0x56, "Broadwell-DE"),
+    INTEL_CLIENT(0x4E, "Skylake-U", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0x5E, "Skylake", CAPS_CSTATE_SNB),
+    INTEL_SERVER(0x55, "Skylake-SP"),
+    INTEL_CLIENT(0x8E, "Kaby/Coffee Lake-U", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0x9E, "Kaby/Coffee Lake", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0xA5, "Comet Lake", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0xA6, "Comet Lake-U", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0x7D, "Ice Lake", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0x7E, "Ice Lake-U", CAPS_CSTATE_SNB),
+    INTEL_SERVER(0x6A, "Ice Lake-SP"),
+    INTEL_SERVER(0x6C, "Ice Lake-D"),
+    INTEL_CLIENT(0x8C, "Tiger Lake-U", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0x8D, "Tiger Lake", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0xA7, "Rocket Lake", CAPS_CSTATE_SNB),
+    INTEL_CLIENT(0x97, "Alder Lake", CAPS_CSTATE_HYBRID),
+    INTEL_CLIENT(0x9A, "Alder Lake-P", CAPS_CSTATE_HYBRID),
+    INTEL_CLIENT(0xB7, "Raptor Lake", CAPS_CSTATE_HYBRID),
+    INTEL_CLIENT(0xBA, "Raptor Lake-P", CAPS_CSTATE_HYBRID),
+    INTEL_CLIENT(0xBF, "Raptor Lake-S", CAPS_CSTATE_HYBRID),
+    INTEL_CLIENT(0xAA, "Meteor Lake", CAPS_CSTATE_HYBRID),
+    INTEL_CLIENT(0xAC, "Meteor Lake-S", CAPS_CSTATE_HYBRID),
+    INTEL_SERVER(0x8F, "Sapphire Rapids"),
+    INTEL_SERVER(0xCF, "Emerald Rapids"),
+    INTEL_CLIENT(0x37, "Atom (Silvermont)", CAPS_CSTATE_ATOM),
+    INTEL_CLIENT(0x4C, "Atom (Airmont)", CAPS_CSTATE_ATOM),
+    INTEL_CLIENT(0x5C, "Atom (Goldmont)", CAPS_CSTATE_ATOM),
+    INTEL_CLIENT(0x7A, "Atom (Goldmont Plus)", CAPS_CSTATE_ATOM),
+    INTEL_CLIENT(0x86, "Atom (Tremont-D)", CAPS_CSTATE_ATOM),
+    INTEL_CLIENT(0x96, "Atom (Elkhart Lake)", CAPS_CSTATE_ATOM),
+    INTEL_CLIENT(0x9C, "Atom (Jasper Lake)", CAPS_CSTATE_ATOM),
+};
+
+// Used when the model is not in the table. Only architectural registers;
+// leaf 0x6 and 0x80000007 decide the rest.
+static const CPU_MODEL_CAPS CpuModelDefaultIntel = {
+    CpuVendorIntel, 0, 0, 0, 0xFF, 0, 1, CAPS_THERMAL | MSR_BIT(MsrIndexCustom808), "Intel (generic)"
+};
+static const CPU_MODEL_CAPS CpuModelDefaultAmd = {
+    CpuVendorAmd, 0, 0, 0, 0xFF, 0, 1, CAPS_RAPL_AMD, "AMD (generic)"
+};
+static const CPU_MODEL_CAPS CpuModelDefaultUnknown = {
+    CpuVendorUnknown, 0, 0, 0, 0xFF, 0, 1, 0, "Unknown"
+};
+
+VOID CpuIdRead(_Out_ PCPU_ID Id)
+{
+    int regs[4];
+    ULONG maxLeaf;
+    ULONG maxExtLeaf;
+
+    RtlZeroMemory(Id, sizeof(*Id));
+
+    __cpuid(regs, 0);
+    maxLeaf = (ULONG)regs[0];
+    RtlCopyMemory(Id->VendorString + 0, &regs[1], 4);
+    RtlCopyMemory(Id->VendorString + 4, &regs[3], 4);
+    RtlCopyMemory(Id->VendorString + 8, &regs[2], 4);
+
+    if (RtlCompareMemory(Id->VendorString, "GenuineIntel", 12) == 12) {
+        Id->Vendor = CpuVendorIntel;
+    }
+    else if (RtlCompareMemory(Id->VendorString, "AuthenticAMD", 12) == 12) {
+        Id->Vendor = CpuVendorAmd;
+    }
+
+    __cpuid(regs, 1);
+    Id->Signature = (ULONG)regs[0];
+    Id->Hypervisor = (regs[2] & (1 << 31)) != 0;
+    Id->Stepping = (UCHAR)(Id->Signature & 0xF);
+    Id->Family = (UCHAR)((Id->Signature >> 8) & 0xF);
+    Id->Model = (UCHAR)((Id->Signature >> 4) & 0xF);
+    if (Id->Family == 0xF) {
+        Id->Family += (UCHAR)((Id->Signature >> 20) & 0xFF);
+    }
+    if (Id->Family == 0x6 || Id->Family >= 0xF) {
+        Id->Model |= (UCHAR)(((Id->Signature >> 16) & 0xF) << 4);
+    }
+
+    if (maxLeaf >= 0x6) {
+        __cpuid(regs, 0x6);
+        Id->ThermalEax = (ULONG)regs[0];
+        Id->ThermalEcx = (ULONG)regs[2];
+    }
+    if (maxLeaf >= 0x7) {
+        __cpuidex(regs, 0x7, 0);
+        Id->Hybrid = (regs[3] & CPUID7_EDX_HYBRID) != 0;
+    }
+    if (Id->Hybrid && maxLeaf >= 0x1A) {
+        __cpuidex(regs, 0x1A, 0);
+        Id->HybridEax = (ULONG)regs[0];
+        switch (Id->HybridEax >> 24) {
+        case CPUID1A_CORE_TYPE_CORE:
+            Id->CoreType = CpuCoreTypePerformance;
+            break;
+        case CPUID1A_CORE_TYPE_ATOM:
+            Id->CoreType = CpuCoreTypeEfficient;
+            break;
+        default:
+            Id->CoreType = CpuCoreTypeUniform;
+            break;
+        }
+    }
+
+    __cpuid(regs, 0x80000000);
+    maxExtLeaf = (ULONG)regs[0];
+    if (maxExtLeaf >= 0x80000007) {
+        __cpuid(regs, 0x80000007);
+        Id->ExtPowerEdx = (ULONG)regs[3];
+    }
+}
+
+PCSTR CpuCoreTypeName(CPU_CORE_TYPE Type)
+{
+    switch (Type) {
+    case CpuCoreTypePerformance:
+        return "P-core";
+    case CpuCoreTypeEfficient:
+        return "E-core";
+    default:
+        return "core";
+    }
+}
+
+const CPU_MODEL_CAPS* CpuModelLookup(_In_ const CPU_ID* Id)
+{
+    for (ULONG i = 0; i < ARRAYSIZE(CpuModelTable); i++) {
+        const CPU_MODEL_CAPS* caps = &CpuModelTable[i];
+        if (caps->Vendor == Id->Vendor &&
+            caps->Family == Id->Family &&
+            caps->Model == Id->Model &&
+            Id->Stepping >= caps->SteppingMin &&
+            Id->Stepping <= caps->SteppingMax) {
+            return caps;
+        }
+    }
+
+    switch (Id->Vendor) {
+    case CpuVendorIntel:
+        return &CpuModelDefaultIntel;
+    case CpuVendorAmd:
+        return &CpuModelDefaultAmd;
+    default:
+        return &CpuModelDefaultUnknown;
+    }
+}
+
+// Registers worth probing on this CPU: the table row narrowed (or widened,
+// for architectural registers) by what CPUID enumerates.
+ULONG CpuModelMsrMask(_In_ const CPU_ID* Id, _In_ const CPU_MODEL_CAPS* Caps)
+{
+    ULONG mask = Caps->MsrMask;
+
+    if (Id->Vendor == CpuVendorIntel) {
+        if (!(Id->ThermalEax & CPUID6_EAX_DTS)) {
+            mask &= ~(MSR_BIT(MsrIndexThermStatus) | MSR_BIT(MsrIndexTemperatureTarget));
+        }
+        if (!(Id->ThermalEax & CPUID6_EAX_PTM)) {
+            mask &= ~MSR_BIT(MsrIndexPackageThermStatus);
+        }
+        // 0x808 is the x2APIC TPR; keep probing it on every Intel part
+        mask |= MSR_BIT(MsrIndexCustom808);
+    }
+
+    if (Id->Vendor == CpuVendorAmd && !(Id->ExtPowerEdx & CPUID80000007_EDX_RAPL)) {
+        mask &= ~CAPS_RAPL_AMD;
+    }
+
+    if (Id->ThermalEcx & CPUID6_ECX_HCF) {
+        mask |= MSR_BIT(MsrIndexMperf) | MSR_BIT(MsrIndexAperf);
+    }
+
+    return mask;
+}
+
+// Log bits of IA32_THERM_STATUS this CPU implements, i.e. the ones that
+// may be written. PowerLimitLog is reserved unless CPUID reports PLN.
+ULONG64 CpuModelThermLogMask(_In_ const CPU_ID* Id)
+{
+    ULONG64 mask = 0;
+
+    if (Id->Vendor == CpuVendorIntel && (Id->ThermalEax & CPUID6_EAX_DTS)) {
+        mask = THERM_STATUS_LOG_MASK;
+        if (Id->ThermalEax & CPUID6_EAX_PLN) {
+            mask |= THERM_STATUS_POWER_LIMIT_LOG;
+        }
+    }
+    return mask;
+}
+
+// TjMax is static, so it is resolved once: the table fallback for parts
+// without a usable MSR_TEMPERATURE_TARGET, else the MSR, else the default.
+UCHAR CpuModelTjMax(_In_ const CPU_MODEL_CAPS* Caps, ULONG Support, ULONG64 TemperatureTarget)
+{
+    MSR_TEMPERATURE_TARGET_UNION target;
+
+    if (Caps->FallbackTjMax != 0) {
+        return Caps->FallbackTjMax;
+    }
+
+    target.Value = TemperatureTarget;
+    if ((Support & MSR_BIT(MsrIndexTemperatureTarget)) && target.Fields.Target != 0) {
+        return (UCHAR)target.Fields.Target;
+    }
+
+    return CPU_DEFAULT_TJMAX;
+}
+
+// Specializes the per-sample read list for one CPU. Static registers are
+// left out, and shared registers are read only by the leader of their
+// scope. IA32_THERM_STATUS is read on every CPU so each one reports its
+// own temperature.
+VOID SamplePlanBuild(_Out_ PSAMPLE_PLAN Plan, ULONG Support, _In_ const SCOPE_LEADER* Leader,
+                     UCHAR TjMax, UCHAR DtsResolution)
+{
+    RtlZeroMemory(Plan, sizeof(*Plan));
+    Plan->TjMax = TjMax;
+    Plan->DtsResolution = DtsResolution;
+
+    for (ULONG m = 0; m < MsrIndexCount; m++) {
+        BOOLEAN read;
+
+        if (!(Support & MSR_BIT(m))) {
+            continue;
+        }
+
+        switch (MsrInfo[m].Scope) {
+        case MsrScopeCore:
+            read = Leader->Core || m == MsrIndexThermStatus;
+            break;
+        case MsrScopeModule:
+            read = Leader->Module;
+            break;
+        case MsrScopePackage:
+            read = Leader->Package;
+            break;
+        default:
+            read = TRUE;
+            break;
+        }
+
+        // Constant for the lifetime of the driver
+        if (m == MsrIndexTemperatureTarget || m == MsrIndexRaplPowerUnit || m == MsrIndexAmdRaplPowerUnit) {
+            read = FALSE;
+        }
+
+        if (read) {
+            Plan->ReadMask |= MSR_BIT(m);
+            Plan->Index[Plan->Count++] = (UCHAR)m;
+        }
+    }
+}
+
+// Reads registers that cost at least ExpensiveCycles only every 2^RateShift
+// samples. IA32_THERM_STATUS drives the temperature and is always read.
+VOID SamplePlanThrottle(_Inout_ PSAMPLE_PLAN Plan, _In_reads_(MsrIndexCount) const MSR_COST* Cost,
+                        ULONG ExpensiveCycles, UCHAR RateShift)
+{
+    for (ULONG k = 0; k < Plan->Count; k++) {
+        UCHAR m = Plan->Index[k];
+        if (m != MsrIndexThermStatus && Cost[m].MinCycles >= ExpensiveCycles) {
+            Plan->RateShift[k] = RateShift;
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "msr.h"
+
+// TjMax assumed when neither the model table nor MSR_TEMPERATURE_TARGET gives one
+#define CPU_DEFAULT_TJMAX       100
+
+// Core type from CPUID leaf 0x1A on hybrid parts
+typedef enum _CPU_CORE_TYPE {
+    CpuCoreTypeUniform = 0,     // not a hybrid part
+    CpuCoreTypePerformance,     // P-core
+    CpuCoreTypeEfficient,       // E-core
+    CpuCoreTypeCount
+} CPU_CORE_TYPE;
+
+typedef enum _CPU_VENDOR {
+    CpuVendorUnknown = 0,
+    CpuVendorIntel,
+    CpuVendorAmd
+} CPU_VENDOR;
+
+// CPUID identity of the current logical processor
+typedef struct _CPU_ID {
+    CPU_VENDOR Vendor;
+    CHAR VendorString[13];
+    ULONG Signature;            // leaf 0x1 EAX
+    UCHAR Family;               // display family (base + extended)
+    UCHAR Model;                // display model (base + extended)
+    UCHAR Stepping;
+    BOOLEAN Hypervisor;         // leaf 0x1 ECX[31]
+    ULONG ThermalEax;           // leaf 0x6 EAX: DTS, PTM, ...
+    ULONG ThermalEcx;           // leaf 0x6 ECX: MPERF/APERF
+    BOOLEAN Hybrid;             // leaf 0x7 EDX[15]
+    ULONG HybridEax;            // leaf 0x1A EAX, 0 on non-hybrid parts
+    CPU_CORE_TYPE CoreType;
+    ULONG ExtPowerEdx;          // leaf 0x80000007 EDX: AMD RAPL
+} CPU_ID, *PCPU_ID;
+
+// One row of the capability table. Steppings are inclusive.
+typedef struct _CPU_MODEL_CAPS {
+    CPU_VENDOR Vendor;
+    UCHAR Family;
+    UCHAR Model;
+    UCHAR SteppingMin;
+    UCHAR SteppingMax;
+    UCHAR FallbackTjMax;        // nonzero: MSR_TEMPERATURE_TARGET is absent or unreliable, use this
+    UCHAR DtsResolution;        // °C per DTS step
+    ULONG MsrMask;              // MSR_BIT() of each register the model implements
+    PCSTR Name;
+} CPU_MODEL_CAPS, *PCPU_MODEL_CAPS;
+
+// Registers one CPU reads on every sample, resolved once at configuration time
+typedef struct _SAMPLE_PLAN {
+    ULONG ReadMask;             // MSR_BIT() of the registers in Index[]
+    UCHAR Count;
+    UCHAR Index[MsrIndexCount];
+    UCHAR RateShift[MsrIndexCount]; // per Index[] entry: read on every 2^RateShift-th sample
+    UCHAR TjMax;
+    UCHAR DtsResolution;
+} SAMPLE_PLAN, *PSAMPLE_PLAN;
+
+// Which scopes the current CPU is the designated reader for
+typedef struct _SCOPE_LEADER {
+    BOOLEAN Core;
+    BOOLEAN Module;
+    BOOLEAN Package;
+} SCOPE_LEADER, *PSCOPE_LEADER;
+
+VOID CpuIdRead(_Out_ PCPU_ID Id);
+PCSTR CpuCoreTypeName(CPU_CORE_TYPE Type);
+const CPU_MODEL_CAPS* CpuModelLookup(_In_ const CPU_ID* Id);
+ULONG CpuModelMsrMask(_In_ const CPU_ID* Id, _In_ const CPU_MODEL_CAPS* Caps);
+ULONG64 CpuModelThermLogMask(_In_ const CPU_ID* Id);
+UCHAR CpuModelTjMax(_In_ const CPU_MODEL_CAPS* Caps, ULONG Support, ULONG64 TemperatureTarget);
+VOID SamplePlanBuild(_Out_ PSAMPLE_PLAN Plan, ULONG Support, _In_ const SCOPE_LEADER* Leader,
+                     UCHAR TjMax, UCHAR DtsResolution);
+VOID SamplePlanThrottle(_Inout_ PSAMPLE_PLAN Plan, _In_reads_(MsrIndexCount) const MSR_COST* Cost,
+                        ULONG ExpensiveCycles, UCHAR RateShift);
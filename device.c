@@ -0,0 +1,517 @@
+#include "driver.h"
+#include <wdmsec.h>
+
+static WDFDEVICE ControlDevice = NULL;
+
+// One per open handle: the handle's read position in every CPU's ring
+typedef struct _READER_CONTEXT {
+    WDFWAITLOCK Lock;           // serializes reads on the same handle
+    ULONG NextCpu;              // CPU the next read starts at, for fairness
+    PULONG64 Cursors;           // [CoreCount]
+    PVOID SnapshotView;         // read-only view of SnapshotPage in SnapshotProcess
+    SIZE_T SnapshotSize;
+    PEPROCESS SnapshotProcess;
+} READER_CONTEXT, *PREADER_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(READER_CONTEXT, GetReaderContext)
+
+EVT_WDF_DEVICE_FILE_CREATE EvtDeviceFileCreate;
+EVT_WDF_FILE_CLEANUP EvtFileCleanup;
+EVT_WDF_FILE_CLOSE EvtFileClose;
+EVT_WDF_IO_IN_CALLER_CONTEXT EvtIoInCallerContext;
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL EvtIoDeviceControl;
+
+VOID EvtDeviceFileCreate(_In_ WDFDEVICE Device, _In_ WDFREQUEST Request, _In_ WDFFILEOBJECT FileObject)
+{
+    PREADER_CONTEXT reader = GetReaderContext(FileObject);
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(Device);
+
+    // Zeroed cursors start every ring at its oldest retained record
+    reader->Cursors = (PULONG64)ExAllocatePool2(POOL_FLAG_NON_PAGED, CoreCount * sizeof(ULONG64), 'ruCR');
+    if (reader->Cursors == NULL) {
+        WdfRequestComplete(Request, STATUS_INSUFFICIENT_RESOURCES);
+        return;
+    }
+
+    WDF_OBJECT_ATTRIBUTES lockAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+    lockAttributes.ParentObject = FileObject;
+
+    status = WdfWaitLockCreate(&lockAttributes, &reader->Lock);
+    if (!NT_SUCCESS(status)) {
+        ExFreePoolWithTag(reader->Cursors, 'ruCR');
+        reader->Cursors = NULL;
+    }
+
+    WdfRequestComplete(Request, status);
+}
+
+// Runs in the context of the process closing its last handle
+VOID EvtFileCleanup(_In_ WDFFILEOBJECT FileObject)
+{
+    PREADER_CONTEXT reader = GetReaderContext(FileObject);
+
+    // A handle inherited by or duplicated into another process must not
+    // unmap an address there; the owner's view goes when the owner exits
+    if (reader->SnapshotView != NULL && reader->SnapshotProcess == PsGetCurrentProcess()) {
+        UnmapSnapshot(reader->SnapshotView);
+    }
+    reader->SnapshotView = NULL;
+}
+
+VOID EvtFileClose(_In_ WDFFILEOBJECT FileObject)
+{
+    PREADER_CONTEXT reader = GetReaderContext(FileObject);
+
+    // The lock is a child of the file object and goes with it
+    if (reader->Cursors != NULL) {
+        ExFreePoolWithTag(reader->Cursors, 'ruCR');
+    }
+}
+
+static NTSTATUS GetIntervals(WDFREQUEST Request, size_t OutputBufferLength, size_t* Information)
+{
+    PWINMSR_INTERVAL_SUMMARY out;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(WINMSR_INTERVAL_SUMMARY), (PVOID*)&out, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    ULONG count = (ULONG)min(CoreCount, OutputBufferLength / sizeof(WINMSR_INTERVAL_SUMMARY));
+    for (ULONG i = 0; i < count; i++) {
+        ReadPublishedInterval(CoreArray[i].Hot, &out[i]);
+        out[i].Cpu = i;
+    }
+
+    *Information = count * sizeof(WINMSR_INTERVAL_SUMMARY);
+    return STATUS_SUCCESS;
+}
+
+// Drains each CPU's ring from this handle's cursor into the output buffer,
+// starting one CPU further on each call so a small buffer cannot starve the
+// high-numbered CPUs. Records lost to the producer are reported in the
+// header and added to the CPU's RingOverruns.
+NTSTATUS ReadSamples(_In_ WDFREQUEST Request, size_t OutputBufferLength, _Out_ size_t* Information)
+{
+    PREADER_CONTEXT reader = GetReaderContext(WdfRequestGetFileObject(Request));
+    PWINMSR_READ_HEADER header;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(WINMSR_READ_HEADER), (PVOID*)&header, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    PWINMSR_SAMPLE_RECORD records = (PWINMSR_SAMPLE_RECORD)(header + 1);
+    ULONG capacity = (ULONG)min((OutputBufferLength - sizeof(*header)) / sizeof(WINMSR_SAMPLE_RECORD), MAXULONG);
+    ULONG count = 0;
+    ULONG64 lost = 0;
+    ULONG64 pending = 0;
+
+    WdfWaitLockAcquire(reader->Lock, NULL);
+    for (ULONG n = 0; n < CoreCount; n++) {
+        ULONG cpu = (reader->NextCpu + n) % CoreCount;
+        PCORE_HOT pHot = CoreArray[cpu].Hot;
+        ULONG64 cpuLost;
+
+        count += RingRead(&pHot->Ring, &reader->Cursors[cpu], records + count, capacity - count, &cpuLost);
+        if (cpuLost != 0) {
+            InterlockedAdd64(&pHot->Stats.RingOverruns, (LONG64)cpuLost);
+            lost += cpuLost;
+        }
+        pending += RingHead(&pHot->Ring) - reader->Cursors[cpu];
+    }
+    reader->NextCpu = (reader->NextCpu + 1) % CoreCount;
+    WdfWaitLockRelease(reader->Lock);
+
+    header->Records = count;
+    header->Reserved = 0;
+    header->Lost = lost;
+    header->Pending = pending;
+
+    *Information = sizeof(*header) + count * sizeof(WINMSR_SAMPLE_RECORD);
+    return STATUS_SUCCESS;
+}
+
+// As ReadSamples, but encodes the records as one wire.h frame. Records are
+// taken from the rings in chunks no larger than the space left can encode
+// in the worst case, so nothing is consumed that does not fit.
+static NTSTATUS ReadPackedSamples(WDFREQUEST Request, size_t OutputBufferLength, size_t* Information)
+{
+    PREADER_CONTEXT reader = GetReaderContext(WdfRequestGetFileObject(Request));
+    WINMSR_SAMPLE_RECORD chunk[16];
+    WIRE_ENCODER encoder;
+    PWINMSR_READ_HEADER header;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(WINMSR_READ_HEADER) + sizeof(WIRE_FRAME_HEADER),
+                                            (PVOID*)&header, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    ULONG frameSize = (ULONG)min(OutputBufferLength - sizeof(*header), MAXULONG);
+    if (!WireEncodeBegin(&encoder, header + 1, frameSize, KeQueryInterruptTime(), CoreCount)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    PWIRE_CPU_INFO table = WireEncodeTable(&encoder);
+    for (ULONG cpu = 0; cpu < CoreCount; cpu++) {
+        table[cpu].TjMax = CoreArray[cpu].Hot->Plan.TjMax;
+        table[cpu].DtsResolution = CoreArray[cpu].Hot->Plan.DtsResolution;
+    }
+
+    ULONG64 lost = 0;
+    ULONG64 pending = 0;
+
+    WdfWaitLockAcquire(reader->Lock, NULL);
+    for (ULONG n = 0; n < CoreCount; n++) {
+        ULONG cpu = (reader->NextCpu + n) % CoreCount;
+        PCORE_HOT pHot = CoreArray[cpu].Hot;
+
+        for (;;) {
+            ULONG room = (ULONG)(encoder.End - encoder.Next) / WIRE_MAX_RECORD_BYTES;
+            ULONG64 cpuLost;
+            ULONG got;
+
+            if (room == 0) {
+                break;
+            }
+            got = RingRead(&pHot->Ring, &reader->Cursors[cpu], chunk, min(room, ARRAYSIZE(chunk)), &cpuLost);
+            if (cpuLost != 0) {
+                InterlockedAdd64(&pHot->Stats.RingOverruns, (LONG64)cpuLost);
+                lost += cpuLost;
+            }
+            for (ULONG i = 0; i < got; i++) {
+                WireEncodeRecord(&encoder, &chunk[i]);
+            }
+            if (got < min(room, ARRAYSIZE(chunk))) {
+                break;
+            }
+        }
+        pending += RingHead(&pHot->Ring) - reader->Cursors[cpu];
+    }
+    reader->NextCpu = (reader->NextCpu + 1) % CoreCount;
+    WdfWaitLockRelease(reader->Lock);
+
+    header->Records = encoder.Records;
+    header->Reserved = 0;
+    header->Lost = lost;
+    header->Pending = pending;
+
+    *Information = sizeof(*header) + WireEncodeEnd(&encoder);
+    return STATUS_SUCCESS;
+}
+
+// Maps the snapshot page into the calling process once per handle
+static NTSTATUS MapSnapshotForRequest(WDFREQUEST Request, size_t* Information)
+{
+    PREADER_CONTEXT reader = GetReaderContext(WdfRequestGetFileObject(Request));
+    PWINMSR_SNAPSHOT_MAPPING mapping;
+    NTSTATUS status;
+
+    if (WdfRequestGetRequestorMode(Request) != UserMode) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(WINMSR_SNAPSHOT_MAPPING), (PVOID*)&mapping, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    WdfWaitLockAcquire(reader->Lock, NULL);
+    if (reader->SnapshotView == NULL) {
+        status = MapSnapshot(&reader->SnapshotView, &reader->SnapshotSize);
+        if (NT_SUCCESS(status)) {
+            reader->SnapshotProcess = PsGetCurrentProcess();
+        }
+        else {
+            reader->SnapshotView = NULL;
+        }
+    }
+    else if (reader->SnapshotProcess != PsGetCurrentProcess()) {
+        status = STATUS_ACCESS_DENIED;
+    }
+    WdfWaitLockRelease(reader->Lock);
+
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    mapping->Address = (ULONG64)(ULONG_PTR)reader->SnapshotView;
+    mapping->Size = reader->SnapshotSize;
+    *Information = sizeof(*mapping);
+    return STATUS_SUCCESS;
+}
+
+// Mapping a view needs the caller's address space, so that one IOCTL is
+// handled here before queuing; everything else goes to the default queue.
+VOID EvtIoInCallerContext(_In_ WDFDEVICE Device, _In_ WDFREQUEST Request)
+{
+    WDF_REQUEST_PARAMETERS params;
+    NTSTATUS status;
+
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+
+    if (params.Type == WdfRequestTypeDeviceControl &&
+        params.Parameters.DeviceIoControl.IoControlCode == IOCTL_WINMSR_MAP_SNAPSHOT) {
+        size_t information = 0;
+        status = MapSnapshotForRequest(Request, &information);
+        WdfRequestCompleteWithInformation(Request, status, information);
+        return;
+    }
+
+    status = WdfDeviceEnqueueRequest(Device, Request);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+    }
+}
+
+static NTSTATUS GetJitter(WDFREQUEST Request, size_t OutputBufferLength, size_t* Information)
+{
+    PWINMSR_JITTER_HEADER header;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(WINMSR_JITTER_HEADER), (PVOID*)&header, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    ULONG count = (ULONG)min(CoreCount, (OutputBufferLength - sizeof(*header)) / sizeof(WINMSR_CPU_JITTER));
+    ReadJitter(header, (PWINMSR_CPU_JITTER)(header + 1), count);
+    *Information = sizeof(*header) + count * sizeof(WINMSR_CPU_JITTER);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS GetMsrCosts(WDFREQUEST Request, size_t OutputBufferLength, size_t* Information)
+{
+    PWINMSR_MSR_COST costs;
+    NTSTATUS status;
+
+    // Costs are only final once every CPU has configured itself
+    if (ReadAcquire(&SnapshotPage->WarmingUp) != 0) {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(WINMSR_MSR_COST), (PVOID*)&costs, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    ULONG count = ReadMsrCosts(costs, (ULONG)(OutputBufferLength / sizeof(WINMSR_MSR_COST)));
+    *Information = count * sizeof(WINMSR_MSR_COST);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS GetCoreTypes(WDFREQUEST Request, size_t* Information)
+{
+    PWINMSR_CORE_TYPE_AGGREGATE aggregates;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(WINMSR_CORE_TYPE_AGGREGATE) * WINMSR_CORE_TYPES,
+                                            (PVOID*)&aggregates, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    AggregateByCoreType(aggregates);
+    *Information = sizeof(WINMSR_CORE_TYPE_AGGREGATE) * WINMSR_CORE_TYPES;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ReadHistory(WDFREQUEST Request, size_t OutputBufferLength, size_t* Information)
+{
+    PWINMSR_HISTORY_REQUEST request;
+    PWINMSR_HISTORY_HEADER header;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(WINMSR_HISTORY_REQUEST), (PVOID*)&request, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    // Buffered I/O: input and output share the system buffer
+    ULONG cpu = request->Cpu;
+    ULONG64 cursor = request->FirstChunk;
+    if (cpu >= CoreCount || CoreArray[cpu].Hot->History.Chunks == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(WINMSR_HISTORY_HEADER), (PVOID*)&header, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    const HISTORY_RING* history = &CoreArray[cpu].Hot->History;
+    ULONG maxChunks = (ULONG)min((OutputBufferLength - sizeof(*header)) / WINMSR_HISTORY_CHUNK_BYTES, MAXULONG);
+    header->Chunks = HistoryRead(history, &cursor, header + 1, maxChunks, &header->Lost);
+    header->Reserved = 0;
+    header->NextChunk = cursor;
+    header->Sealed = (ULONG64)ReadAcquire64(&history->Sealed);
+    *Information = sizeof(*header) + (size_t)header->Chunks * WINMSR_HISTORY_CHUNK_BYTES;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS SetSession(WDFREQUEST Request)
+{
+    PWINMSR_SESSION session;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(WINMSR_SESSION), (PVOID*)&session, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    return SetSamplingSession(session);
+}
+
+static NTSTATUS GetSession(WDFREQUEST Request, size_t* Information)
+{
+    PWINMSR_SESSION_STATUS sessionStatus;
+    NTSTATUS status;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(WINMSR_SESSION_STATUS), (PVOID*)&sessionStatus, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    GetSamplingSession(sessionStatus);
+    *Information = sizeof(*sessionStatus);
+    return STATUS_SUCCESS;
+}
+
+VOID EvtIoDeviceControl(
+    _In_ WDFQUEUE Queue,
+    _In_ WDFREQUEST Request,
+    _In_ size_t OutputBufferLength,
+    _In_ size_t InputBufferLength,
+    _In_ ULONG IoControlCode)
+{
+    NTSTATUS status;
+    size_t information = 0;
+
+    UNREFERENCED_PARAMETER(Queue);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    switch (IoControlCode) {
+    case IOCTL_WINMSR_GET_INTERVALS:
+        status = GetIntervals(Request, OutputBufferLength, &information);
+        break;
+    case IOCTL_WINMSR_READ_SAMPLES:
+        status = ReadSamples(Request, OutputBufferLength, &information);
+        break;
+    case IOCTL_WINMSR_WAIT_SAMPLES:
+        status = ParkWaitRequest(Request, OutputBufferLength);
+        if (NT_SUCCESS(status)) {
+            return;
+        }
+        break;
+    case IOCTL_WINMSR_SET_SESSION:
+        status = SetSession(Request);
+        break;
+    case IOCTL_WINMSR_GET_SESSION:
+        status = GetSession(Request, &information);
+        break;
+    case IOCTL_WINMSR_GET_JITTER:
+        status = GetJitter(Request, OutputBufferLength, &information);
+        break;
+    case IOCTL_WINMSR_GET_MSR_COSTS:
+        status = GetMsrCosts(Request, OutputBufferLength, &information);
+        break;
+    case IOCTL_WINMSR_READ_PACKED:
+        status = ReadPackedSamples(Request, OutputBufferLength, &information);
+        break;
+    case IOCTL_WINMSR_GET_CORE_TYPES:
+        status = GetCoreTypes(Request, &information);
+        break;
+    case IOCTL_WINMSR_READ_HISTORY:
+        status = ReadHistory(Request, OutputBufferLength, &information);
+        break;
+    default:
+        status = STATUS_INVALID_DEVICE_REQUEST;
+        break;
+    }
+
+    WdfRequestCompleteWithInformation(Request, status, information);
+}
+
+// Creates \Device\WinMSR (\\.\WinMSR from user mode). Readable by everyone,
+// full access for SYSTEM and administrators.
+NTSTATUS CreateControlDevice(_In_ WDFDRIVER Driver)
+{
+    DECLARE_CONST_UNICODE_STRING(deviceName, WINMSR_DEVICE_NAME);
+    DECLARE_CONST_UNICODE_STRING(symbolicName, WINMSR_SYMBOLIC_NAME);
+    PWDFDEVICE_INIT init;
+    WDF_FILEOBJECT_CONFIG fileConfig;
+    WDF_OBJECT_ATTRIBUTES fileAttributes;
+    WDF_IO_QUEUE_CONFIG queueConfig;
+    WDFDEVICE device;
+    NTSTATUS status;
+
+    init = WdfControlDeviceInitAllocate(Driver, &SDDL_DEVOBJ_SYS_ALL_ADM_RWX_WORLD_R_RES_R);
+    if (init == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    status = WdfDeviceInitAssignName(init, &deviceName);
+    if (!NT_SUCCESS(status)) {
+        WdfDeviceInitFree(init);
+        return status;
+    }
+
+    WDF_FILEOBJECT_CONFIG_INIT(&fileConfig, EvtDeviceFileCreate, EvtFileClose, EvtFileCleanup);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileAttributes, READER_CONTEXT);
+    WdfDeviceInitSetFileObjectConfig(init, &fileConfig, &fileAttributes);
+    WdfDeviceInitSetIoInCallerContextCallback(init, EvtIoInCallerContext);
+
+    status = WdfDeviceCreate(&init, WDF_NO_OBJECT_ATTRIBUTES, &device);
+    if (!NT_SUCCESS(status)) {
+        WdfDeviceInitFree(init);
+        return status;
+    }
+
+    status = WdfDeviceCreateSymbolicLink(device, &symbolicName);
+    if (!NT_SUCCESS(status)) {
+        WdfObjectDelete(device);
+        return status;
+    }
+
+    WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&queueConfig, WdfIoQueueDispatchParallel);
+    queueConfig.EvtIoDeviceControl = EvtIoDeviceControl;
+
+    status = WdfIoQueueCreate(device, &queueConfig, WDF_NO_OBJECT_ATTRIBUTES, WDF_NO_HANDLE);
+    if (!NT_SUCCESS(status)) {
+        WdfObjectDelete(device);
+        return status;
+    }
+
+    status = CreateNotifyQueue(device);
+    if (!NT_SUCCESS(status)) {
+        StopNotifyQueue();
+        WdfObjectDelete(device);
+        return status;
+    }
+
+    status = CreateFlightRecorder(device);
+    if (!NT_SUCCESS(status)) {
+        StopFlightRecorder();
+        StopNotifyQueue();
+        WdfObjectDelete(device);
+        return status;
+    }
+
+    WdfControlFinishInitializing(device);
+    ControlDevice = device;
+    return STATUS_SUCCESS;
+}
+
+VOID DeleteControlDevice(VOID)
+{
+    if (ControlDevice != NULL) {
+        StopFlightRecorder();
+        StopNotifyQueue();
+        WdfObjectDelete(ControlDevice);
+        ControlDevice = NULL;
+    }
+}
@@ -1,144 +1,1139 @@
-#include <ntddk.h>
-#include <wdf.h>
-#include <intrin.h>
+#include "driver.h"
 #include <ntstrsafe.h>
 
-#define IA32_THERM_STATUS       0x19C
-#define MSR_TEMPERATURE_TARGET  0x1A2
-#define MSR_CUSTOM_808          0x808
-
-typedef union {
-    ULONG64 Value;
-    struct {
-        ULONG Reserved1 : 16;
-        ULONG Target : 8;
-        ULONG Reserved2 : 8;
-        ULONG Reserved3 : 32;
-    } Fields;
-} MSR_TEMPERATURE_TARGET_UNION;
-
-typedef union {
-    ULONG64 Value;
-    struct {
-        ULONG StatusBit : 1;
-        ULONG StatusLog : 1;
-        ULONG PROCHOT : 1;
-        ULONG PROCHOTLog : 1;
-        ULONG CriticalTemp : 1;
-        ULONG CriticalTempLog : 1;
-        ULONG Threshold1 : 1;
-        ULONG Threshold1Log : 1;
-        ULONG Threshold2 : 1;
-        ULONG Threshold2Log : 1;
-        ULONG PowerLimit : 1;
-        ULONG PowerLimitLog : 1;
-        ULONG Reserved1 : 4;
-        ULONG DTS : 8;
-        ULONG Reserved2 : 4;
-        ULONG Resolution : 5;
-        ULONG ReadingValid : 1;
-        ULONG Reserved3 : 32;
-    } Fields;
-} MSR_THERM_STATUS_UNION;
-
-typedef struct _CORE {
-    int CpuIndex;
-    HANDLE ThreadHandle;
-    KEVENT ThreadDoneEvent;
-    int Temperature;
-    MSR_TEMPERATURE_TARGET_UNION TjMax;
-    MSR_THERM_STATUS_UNION ThermStatus;
-    ULONG64 Msr808;
-} CORE, *PCORE;
-
 PCORE CoreArray = NULL;
 ULONG CoreCount = 0;
+KEVENT StopEvent;
+DRIVER_CONFIG Config = { SAMPLE_PERIOD_MS, WINMSR_TIMER_COALESCABLE, 0, INTERVAL_MS, 0, NOTIFY_BATCH_SIZE, NOTIFY_LATENCY_US,
+                         0, EXPENSIVE_MSR_CYCLES, EXPENSIVE_MSR_SHIFT, 1, STRIPE_HOT_MARGIN_C, 0,
+                         0, IDLE_BUSY_PERMILLE, IDLE_DEFER_PERIODS, FORECAST_LEVEL_TAU_MS, FORECAST_SLOPE_TAU_MS,
+                         FLIGHT_RECORDER_MS, FLIGHT_POST_TRIGGER_MS, 0 };
+
+// Current sampling session. Core threads re-arm their timers when the
+// generation changes; SessionLock guards Session and SessionEpoch. Every
+// CPU schedules its ticks at SessionEpoch + k * tick length, so tick k is one
+// sweep across all CPUs (across one stripe when striped).
+static WINMSR_SESSION Session;
+static ULONG64 SessionEpoch;
+static volatile LONG SessionGeneration = 0;
+static KSPIN_LOCK SessionLock;
+static SWEEP_TRACKER Sweeps;
+static volatile LONG SamplerCount;  // core threads running, i.e. CPUs per complete sweep
+static volatile LONG PromotedCount; // CPUs sampling on every tick of a striped session
+
+// Support bitmaps loaded from the probe cache, per core type; when valid,
+// threads of that type skip probing
+ULONG CachedMsrSupport[CpuCoreTypeCount] = { 0 };
+BOOLEAN MsrSupportCached[CpuCoreTypeCount] = { 0 };
 
 // Forward declarations
 VOID ThreadEntry(IN PVOID Context);
+static VOID WarmupDone(VOID);
 VOID MyDriverUnload(_In_ WDFDRIVER Driver);
 
-VOID ThreadEntry(IN PVOID Context)
+// Tries one MSR under an exception frame. Only used while probing.
+static BOOLEAN ProbeMsr(PCORE_HOT pHot, MSR_INDEX Index)
 {
-    PCORE pCore = (PCORE)Context;
-    NTSTATUS status = STATUS_SUCCESS;
-
-    // Set affinity for this thread to specific core
-    KAFFINITY oldAffinity = KeSetSystemAffinityThreadEx(((KAFFINITY)1) << pCore->CpuIndex);
+    __try {
+        __readmsr(MsrInfo[Index].Address);
+        return TRUE;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        StatAdd(&pHot->Stats.MsrFaults[Index], 1);
+        return FALSE;
+    }
+}
 
+// Writes 1 to every log bit, which changes nothing, to check that the
+// register accepts writes here (hypervisors often refuse them).
+static BOOLEAN ProbeThermLogClear(PCORE_HOT pHot, ULONG64 Mask)
+{
     __try {
-        // Read MSRs
-        pCore->TjMax.Value = __readmsr(MSR_TEMPERATURE_TARGET);
-        pCore->ThermStatus.Value = __readmsr(IA32_THERM_STATUS);
-        pCore->Msr808 = __readmsr(MSR_CUSTOM_808);
+        __writemsr(IA32_THERM_STATUS, Mask);
+        return TRUE;
     }
     __except (EXCEPTION_EXECUTE_HANDLER) {
-        DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL, "Core(%d): Exception reading MSRs.\n", pCore->CpuIndex);
-        pCore->Temperature = -1;
-        KeRevertToUserAffinityThread();
-        KeSetEvent(&pCore->ThreadDoneEvent, IO_NO_INCREMENT, FALSE);
-        PsTerminateSystemThread(STATUS_UNSUCCESSFUL);
+        StatAdd(&pHot->Stats.MsrFaults[MsrIndexThermStatus], 1);
+        return FALSE;
+    }
+}
+
+// Builds the support bitmap of the current core, once at load. Only the
+// registers the capability table expects on this model are tried.
+static ULONG ProbeCore(PCORE_HOT pHot, ULONG Candidates)
+{
+    ULONG support = 0;
+    for (ULONG m = 0; m < MsrIndexCount; m++) {
+        if ((Candidates & MSR_BIT(m)) && ProbeMsr(pHot, (MSR_INDEX)m)) {
+            support |= MSR_BIT(m);
+        }
+    }
+    return support;
+}
+
+#define MSR_CALIBRATION_ROUNDS  32
+
+// TSC cycles around one __readmsr of Index, or around nothing when Index is
+// MsrIndexCount. The fences keep the read from moving across either timestamp.
+static ULONG64 TimeMsrRead(ULONG Index)
+{
+    unsigned int aux;
+    _mm_lfence();
+    ULONG64 start = __rdtsc();
+    _mm_lfence();
+    if (Index < MsrIndexCount) {
+        __readmsr(MsrInfo[Index].Address);
+    }
+    ULONG64 end = __rdtscp(&aux);
+    _mm_lfence();
+    return end - start;
+}
+
+// Times every register in the plan. Runs at DISPATCH_LEVEL one register at a
+// time so the rounds are not split by a context switch; the cheapest empty
+// measurement is subtracted as timing overhead.
+static VOID CalibrateCore(PCORE_HOT pHot)
+{
+    const SAMPLE_PLAN* plan = &pHot->Plan;
+    ULONG64 overhead = MAXULONG64;
+    KIRQL irql;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    for (ULONG r = 0; r < MSR_CALIBRATION_ROUNDS; r++) {
+        overhead = min(overhead, TimeMsrRead(MsrIndexCount));
+    }
+    KeLowerIrql(irql);
+
+    for (ULONG k = 0; k < plan->Count; k++) {
+        ULONG m = plan->Index[k];
+        ULONG64 least = MAXULONG64;
+        ULONG64 sum = 0;
+
+        KeRaiseIrql(DISPATCH_LEVEL, &irql);
+        for (ULONG r = 0; r < MSR_CALIBRATION_ROUNDS; r++) {
+            ULONG64 cycles = TimeMsrRead(m);
+            least = min(least, cycles);
+            sum += cycles;
+        }
+        KeLowerIrql(irql);
+
+        ULONG64 mean = sum / MSR_CALIBRATION_ROUNDS;
+        pHot->MsrCost[m].MinCycles = (ULONG)min(least > overhead ? least - overhead : 0, MAXULONG);
+        pHot->MsrCost[m].MeanCycles = (ULONG)min(mean > overhead ? mean - overhead : 0, MAXULONG);
     }
+}
 
-    KeRevertToUserAffinityThread();
+// Resolves what the current CPU supports and specializes its sample plan.
+// Must run pinned to pCore.
+static VOID ConfigureCore(PCORE pCore)
+{
+    PCORE_HOT pHot = pCore->Hot;
+    SCOPE_LEADER leader = { 0 };
+    ULONG candidates;
+
+    CpuIdRead(&pCore->CpuId);
+    pCore->Caps = CpuModelLookup(&pCore->CpuId);
+    candidates = CpuModelMsrMask(&pCore->CpuId, pCore->Caps);
 
-    if (pCore->ThermStatus.Fields.ReadingValid) {
-        pCore->Temperature = pCore->TjMax.Fields.Target - pCore->ThermStatus.Fields.DTS;
+    CPU_CORE_TYPE type = pCore->CpuId.CoreType;
+    if (MsrSupportCached[type]) {
+        pHot->Sample.MsrSupport = (CachedMsrSupport[type] & candidates & ~MSR_SUPPORT_MODAL) |
+                                  ProbeCore(pHot, candidates & MSR_SUPPORT_MODAL);
     }
     else {
-        pCore->Temperature = -1;
+        pHot->Sample.MsrSupport = ProbeCore(pHot, candidates);
+    }
+    if (pHot->Sample.MsrSupport != candidates) {
+        DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL, "Core(%d): MSR support bitmap 0x%lX of 0x%lX expected, skipping unsupported registers.\n",
+            pCore->CpuIndex, pHot->Sample.MsrSupport, candidates);
     }
 
+    // Static registers are read once here and never again
+    if (pHot->Sample.MsrSupport & MSR_BIT(MsrIndexTemperatureTarget)) {
+        pHot->Sample.Msr[MsrIndexTemperatureTarget] = __readmsr(MSR_TEMPERATURE_TARGET);
+    }
+    if (pHot->Sample.MsrSupport & MSR_BIT(MsrIndexRaplPowerUnit)) {
+        pHot->Sample.Msr[MsrIndexRaplPowerUnit] = __readmsr(MSR_RAPL_POWER_UNIT);
+    }
+    if (pHot->Sample.MsrSupport & MSR_BIT(MsrIndexAmdRaplPowerUnit)) {
+        pHot->Sample.Msr[MsrIndexAmdRaplPowerUnit] = __readmsr(MSR_AMD_RAPL_POWER_UNIT);
+    }
+
+    leader.Core = pCore->CoreLeaderIndex == (ULONG)pCore->CpuIndex;
+    leader.Package = pCore->PackageLeaderIndex == (ULONG)pCore->CpuIndex;
+    leader.Module = pCore->ModuleLeaderIndex == (ULONG)pCore->CpuIndex;
+
+    SamplePlanBuild(&pHot->Plan, pHot->Sample.MsrSupport, &leader,
+        CpuModelTjMax(pCore->Caps, pHot->Sample.MsrSupport, pHot->Sample.Msr[MsrIndexTemperatureTarget]),
+        pCore->Caps->DtsResolution);
+
+    // IA32_THERM_STATUS is per core: only the core leader clears, otherwise
+    // HT siblings would steal each other's events
+    if (Config.ClearThermLogs && leader.Core && (pHot->Plan.ReadMask & MSR_BIT(MsrIndexThermStatus))) {
+        ULONG64 mask = CpuModelThermLogMask(&pCore->CpuId);
+        if (mask != 0 && ProbeThermLogClear(pHot, mask)) {
+            pHot->ThermLogClearMask = mask;
+            pHot->Interval.Open.Flags |= WINMSR_INTERVAL_LOGS_CLEARED;
+        }
+    }
+
+    if (Config.CalibrateMsrCosts) {
+        CalibrateCore(pHot);
+        SamplePlanThrottle(&pHot->Plan, pHot->MsrCost, Config.ExpensiveMsrCycles, (UCHAR)Config.ExpensiveMsrShift);
+    }
+}
+
+// Publishes a closed interval. Only the owning core thread writes, so the
+// sequence is bumped to odd, the summary copied, then bumped back to even.
+static VOID PublishInterval(PCORE_HOT pHot, const WINMSR_INTERVAL_SUMMARY* Closed)
+{
+    PCORE_PUBLISHED_INTERVAL pub = &pHot->Published;
+
+    InterlockedIncrement(&pub->Sequence);
+    pub->Summary = *Closed;
+    InterlockedIncrement(&pub->Sequence);
+}
+
+// Copies the last closed interval of a CPU without blocking its sampler.
+// Retries while the owner is mid-write. Samples == 0 means no interval has
+// closed yet.
+VOID ReadPublishedInterval(_In_ PCORE_HOT pHot, _Out_ PWINMSR_INTERVAL_SUMMARY Summary)
+{
+    PCORE_PUBLISHED_INTERVAL pub = &pHot->Published;
+    LONG sequence;
+
+    for (;;) {
+        sequence = ReadAcquire(&pub->Sequence);
+        if (sequence & 1) {
+            YieldProcessor();
+            continue;
+        }
+        *Summary = pub->Summary;
+        KeMemoryBarrier();
+        if (ReadAcquire(&pub->Sequence) == sequence) {
+            return;
+        }
+    }
+}
+
+// Reads the registers in the core's sample plan. Must run pinned to the core
+// owning pHot. Registers outside the probed bitmap are never in the plan, so
+// no exception frame is needed here.
+static BOOLEAN SampleCore(PCORE_HOT pHot, ULONG64 Now, ULONG64 FireDelay)
+{
+    const SAMPLE_PLAN* plan = &pHot->Plan;
+    PCORE_SAMPLE pSample = &pHot->Sample;
+    ULONG64 start = __rdtsc();
+    ULONG64 previousStatus = pSample->ThermStatus.Value;
+    ULONG64 sequence = (ULONG64)ReadNoFence64(&pHot->Stats.SamplesTaken);
+
+    for (ULONG k = 0; k < plan->Count; k++) {
+        if (sequence & ((1ULL << plan->RateShift[k]) - 1)) {
+            continue;
+        }
+        pSample->Msr[plan->Index[k]] = __readmsr(MsrInfo[plan->Index[k]].Address);
+    }
+
+    pSample->ThermStatus.Value = pSample->Msr[MsrIndexThermStatus];
+    if (pSample->ThermStatus.Value & pHot->ThermLogClearMask) {
+        __writemsr(IA32_THERM_STATUS, ThermLogClearValue(pSample->ThermStatus.Value, pHot->ThermLogClearMask));
+    }
+    BOOLEAN ok = (plan->ReadMask & MSR_BIT(MsrIndexThermStatus)) && pSample->ThermStatus.Fields.ReadingValid;
+    if (ok) {
+        pSample->Temperature = plan->TjMax - (int)(pSample->ThermStatus.Fields.DTS * plan->DtsResolution);
+        // The log bit only means "since the last sample" when logs are cleared
+        BOOLEAN prochot = pSample->ThermStatus.Fields.PROCHOT ||
+                          (pHot->ThermLogClearMask != 0 && pSample->ThermStatus.Fields.PROCHOTLog);
+        ForecastUpdate(&pHot->Forecast, pSample->Temperature * 1000, prochot, Now);
+    }
+    else {
+        pSample->Temperature = -1;
+    }
+
+    WINMSR_SAMPLE_RECORD record;
+    record.Time = Now;
+    record.Cpu = pHot->Interval.Open.Cpu;
+    record.Temperature = pSample->Temperature;
+    record.ThermStatus = (ULONG)pSample->ThermStatus.Value;
+    record.FireDelay = (ULONG)min(FireDelay, MAXULONG);
+    RingPublish(&pHot->Ring, &record);
+    SnapshotWrite(pHot->Snapshot, pSample->Temperature, pSample->ThermStatus.Fields.DTS,
+                  record.ThermStatus, start, Now, &pHot->Forecast);
+    FlightSample(pHot, &record);
+    if (pHot->History.Chunks != NULL) {
+        HistoryAppend(&pHot->History, Now, pSample->ThermStatus.Value);
+    }
+    NotifySample(Now, ((previousStatus ^ pSample->ThermStatus.Value) & THERM_STATUS_STATE_MASK) != 0);
+
+    WINMSR_INTERVAL_SUMMARY closed;
+    if (IntervalAdd(&pHot->Interval, Now, pSample->Temperature, pSample->ThermStatus.Value, &closed)) {
+        PublishInterval(pHot, &closed);
+    }
+
+    StatAdd(&pHot->Stats.SamplesTaken, 1);
+    ULONG64 cycles = __rdtsc() - start;
+    StatAdd(&pHot->Stats.SampleCycles, (LONG64)cycles);
+    StatAdd(&pHot->Session.SampleCycles, (LONG64)cycles);
+    return ok;
+}
+
+static VOID LogCore(PCORE pCore)
+{
+    PCORE_SAMPLE pSample = &pCore->Hot->Sample;
     char buffer[256] = { 0 };
-    if (pCore->Temperature >= 0) {
+    if (pSample->Temperature >= 0) {
         RtlStringCbPrintfA(buffer, sizeof(buffer),
-            "Core(%02d): Temp=%d°C, MSR808=0x%016llX\n"
+            "Core(%02d): Temp=%d°C, TjMax=%d, MSR808=0x%016llX\n"
             "  ThermStatus: StatusBit=%d, PROCHOT=%d, CriticalTemp=%d, Threshold1=%d, Threshold2=%d, PowerLimit=%d\n"
             "  DTS=%d, Resolution=%d, ReadingValid=%d\n",
             pCore->CpuIndex,
-            pCore->Temperature,
-            pCore->Msr808,
-            pCore->ThermStatus.Fields.StatusBit,
-            pCore->ThermStatus.Fields.PROCHOT,
-            pCore->ThermStatus.Fields.CriticalTemp,
-            pCore->ThermStatus.Fields.Threshold1,
-            pCore->ThermStatus.Fields.Threshold2,
-            pCore->ThermStatus.Fields.PowerLimit,
-            pCore->ThermStatus.Fields.DTS,
-            pCore->ThermStatus.Fields.Resolution,
-            pCore->ThermStatus.Fields.ReadingValid);
+            pSample->Temperature,
+            pCore->Hot->Plan.TjMax,
+            pSample->Msr[MsrIndexCustom808],
+            pSample->ThermStatus.Fields.StatusBit,
+            pSample->ThermStatus.Fields.PROCHOT,
+            pSample->ThermStatus.Fields.CriticalTemp,
+            pSample->ThermStatus.Fields.Threshold1,
+            pSample->ThermStatus.Fields.Threshold2,
+            pSample->ThermStatus.Fields.PowerLimit,
+            pSample->ThermStatus.Fields.DTS,
+            pSample->ThermStatus.Fields.Resolution,
+            pSample->ThermStatus.Fields.ReadingValid);
     }
     else {
         RtlStringCbPrintfA(buffer, sizeof(buffer),
             "Core(%02d): Temperature reading invalid, MSR808=0x%016llX\n",
             pCore->CpuIndex,
-            pCore->Msr808);
+            pSample->Msr[MsrIndexCustom808]);
     }
 
     DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "%s", buffer);
+}
+
+EXT_CALLBACK CoreTimerCallback;
+
+VOID CoreTimerCallback(_In_ PEX_TIMER Timer, _In_opt_ PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Timer);
+    KeSetEvent(&((PCORE)Context)->TimerEvent, IO_NO_INCREMENT, FALSE);
+}
+
+// Takes the current session and starts the core's statistics over for it.
+// The timer is freed since high resolution is chosen at allocation; the next
+// ArmCoreTimer allocates one of the right kind. Returns the session's generation.
+static LONG TakeSession(PCORE pCore, PWINMSR_SESSION Current, PULONG64 Epoch)
+{
+    KIRQL irql;
+    LONG generation;
+
+    KeAcquireSpinLock(&SessionLock, &irql);
+    *Current = Session;
+    *Epoch = SessionEpoch;
+    generation = SessionGeneration;
+    KeReleaseSpinLock(&SessionLock, irql);
 
-    KeSetEvent(&pCore->ThreadDoneEvent, IO_NO_INCREMENT, FALSE);
+    RtlZeroMemory((PVOID)&pCore->Hot->Session, sizeof(pCore->Hot->Session));
+    if (pCore->Timer != NULL) {
+        ExDeleteTimer(pCore->Timer, TRUE, TRUE, NULL);
+        pCore->Timer = NULL;
+    }
+    return generation;
+}
+
+// (Re)arms the core's timer to fire on every Stride-th tick of the session
+// grid, starting with the next tick of its stripe. Returns the timer period;
+// *NextDue and *Tick describe the first tick.
+static ULONG64 ArmCoreTimer(PCORE pCore, const WINMSR_SESSION* Current, ULONG64 Epoch, ULONG Stride,
+                            PULONG64 NextDue, PULONG64 Tick)
+{
+    ULONG stripes = max(Current->Stripes, 1);
+    ULONG64 tickLength = 10ULL * Current->PeriodUs / stripes;
+    ULONG64 period = tickLength * Stride;
+    ULONG64 now = KeQueryInterruptTime();
+
+    *Tick = (now > Epoch) ? (now - Epoch) / tickLength + 1 : 1;
+    *Tick = StripeNextTick(*Tick, Stride, StripeOf((ULONG)pCore->CpuIndex, stripes));
+    *NextDue = Epoch + *Tick * tickLength;
+
+    if (pCore->Timer == NULL) {
+        ULONG attributes = (Current->TimerMode == WINMSR_TIMER_HIGH_RESOLUTION) ? EX_TIMER_HIGH_RESOLUTION : 0;
+        pCore->Timer = ExAllocateTimer(CoreTimerCallback, pCore, attributes);
+        if (pCore->Timer == NULL) {
+            DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL, "Core(%d): failed to allocate sampling timer.\n", pCore->CpuIndex);
+            return period;
+        }
+    }
+
+    EXT_SET_PARAMETERS parameters;
+    ExInitializeSetTimerParameters(&parameters);
+    if (Current->TimerMode == WINMSR_TIMER_COALESCABLE) {
+        parameters.NoWakeTolerance = 10LL * Current->ToleranceUs;
+    }
+    ExSetTimer(pCore->Timer, -(LONGLONG)(*NextDue - now), (LONGLONG)period, &parameters);
+    return period;
+}
+
+// Whether the CPU spent less than IdleBusyPermille of the time since the
+// previous check in C0. MPERF only counts in C0, at the TSC's rate; CPUs
+// without it never count as idle.
+static BOOLEAN CoreWasIdle(PCORE_HOT pHot)
+{
+    if (!(pHot->Plan.ReadMask & MSR_BIT(MsrIndexMperf))) {
+        return FALSE;
+    }
+
+    ULONG64 mperf = __readmsr(IA32_MPERF);
+    ULONG64 tsc = __rdtsc();
+    BOOLEAN first = pHot->IdleTsc == 0;
+    ULONG64 busy = mperf - pHot->IdleMperf;
+    ULONG64 elapsed = tsc - pHot->IdleTsc;
+
+    pHot->IdleMperf = mperf;
+    pHot->IdleTsc = tsc;
+    return !first && busy * 1000 < elapsed * Config.IdleBusyPermille;
+}
+
+VOID ThreadEntry(IN PVOID Context)
+{
+    PCORE pCore = (PCORE)Context;
+    PCORE_HOT pHot = pCore->Hot;
+    PVOID waitObjects[2] = { &StopEvent, &pCore->TimerEvent };
+    GROUP_AFFINITY affinity = { 0 };
+    GROUP_AFFINITY oldAffinity;
+    WINMSR_SESSION current;
+    LONG generation;
+    ULONG64 epoch;
+    ULONG64 period;
+    ULONG64 nextDue;
+    ULONG64 tick;
+    ULONG stride;
+    ULONG timerStride;
+    BOOLEAN promoted = FALSE;
+    BOOLEAN deferred = FALSE;
+    ULONG64 lastRead;
+
+    // Set affinity for this thread to specific core (any processor group)
+    affinity.Group = pCore->ProcNumber.Group;
+    affinity.Mask = ((KAFFINITY)1) << pCore->ProcNumber.Number;
+    KeSetSystemGroupAffinityThread(&affinity, &oldAffinity);
+
+    // Initial sweep: configure (probing unless cached), read and log once
+    ConfigureCore(pCore);
+    pHot->Snapshot->TjMax = pHot->Plan.TjMax;
+    lastRead = KeQueryInterruptTime();
+    SampleCore(pHot, lastRead, 0);
+    LogCore(pCore);
+    pCore->Warm = TRUE;
+    WarmupDone();
+
+    // Keep sampling until unload, following the current session. A promoted
+    // CPU keeps its budget slot across sessions while it stays hot.
+    generation = TakeSession(pCore, &current, &epoch);
+    stride = promoted ? 1 : max(current.Stripes, 1);
+    timerStride = stride;
+    period = ArmCoreTimer(pCore, &current, epoch, timerStride, &nextDue, &tick);
+
+    while (KeWaitForMultipleObjects(2, waitObjects, WaitAny, Executive, KernelMode,
+                                    FALSE, NULL, NULL) == STATUS_WAIT_1) {
+        ULONG64 now = KeQueryInterruptTime();
+
+        if (ReadAcquire(&SessionGeneration) != generation) {
+            generation = TakeSession(pCore, &current, &epoch);
+            if (promoted && current.Stripes <= 1) {
+                StripeDemote(&PromotedCount);
+                promoted = FALSE;
+            }
+            stride = promoted ? 1 : max(current.Stripes, 1);
+            deferred = FALSE;
+            timerStride = stride;
+            period = ArmCoreTimer(pCore, &current, epoch, timerStride, &nextDue, &tick);
+            continue;
+        }
+
+        // Intended vs actual fire time
+        ULONG64 delay = (now > nextDue) ? now - nextDue : 0;
+        StatAdd(&pHot->Session.Fires, 1);
+        StatAdd(&pHot->Session.FireDelaySum, (LONG64)delay);
+        if ((LONG64)delay > ReadNoFence64(&pHot->Session.FireDelayMax)) {
+            WriteNoFence64(&pHot->Session.FireDelayMax, (LONG64)delay);
+        }
+        StatAdd(&pHot->Session.DelayHistogram[JitterBucket(delay)], 1);
+        if (delay > period / 2) {
+            StatAdd(&pHot->Stats.LateTimerFires, 1);
+        }
+        // A tick of a striped session, or of one where idle CPUs skip
+        // ticks, is fired by a varying set of CPUs, so sweep spread is only
+        // tracked unstriped and without idle deferral
+        if (current.Stripes <= 1 && !Config.IdleSampling) {
+            SweepRecord(&Sweeps, generation, tick, delay, (ULONG)ReadNoFence(&SamplerCount));
+        }
+
+        // Skip the periods we slept through rather than counting them all late
+        nextDue += period;
+        tick += timerStride;
+        while (nextDue <= now) {
+            nextDue += period;
+            tick += timerStride;
+            StatAdd(&pHot->Session.MissedPeriods, 1);
+        }
+
+        // Idle-respecting: a CPU found idle keeps its last reading and its
+        // timer is widened to every IdleDeferPeriods-th tick, so it is not
+        // woken in between. A deferred fire always reads, so no reading is
+        // older than IdleDeferPeriods periods; one still idle stays deferred.
+        BOOLEAN idle = Config.IdleSampling && !promoted && CoreWasIdle(pHot);
+        if (idle && !deferred && now - lastRead < period * Config.IdleDeferPeriods) {
+            SnapshotMarkIdle(pHot->Snapshot, now);
+            StatAdd(&pHot->Stats.IdleSkips, 1);
+        }
+        else {
+            SampleCore(pHot, now, delay);
+            lastRead = now;
+            if (idle) {
+                SnapshotMarkIdle(pHot->Snapshot, now);
+            }
+        }
+
+        // Striped: hot or alarming CPUs move onto every tick while the
+        // promotion budget lasts, and back onto their stripe once cool
+        ULONG newStride = stride;
+        if (current.Stripes > 1) {
+            BOOLEAN hot = StripeWantsPromotion(pHot->Sample.Temperature, pHot->Plan.TjMax,
+                (pHot->Sample.ThermStatus.Value & THERM_STATUS_STATE_MASK) != 0, Config.StripeHotMarginC, promoted);
+            if (hot && !promoted && StripePromote(&PromotedCount, (LONG)Config.StripeMaxPromoted)) {
+                promoted = TRUE;
+            }
+            else if (!hot && promoted) {
+                StripeDemote(&PromotedCount);
+                promoted = FALSE;
+            }
+            newStride = promoted ? 1 : current.Stripes;
+        }
+
+        BOOLEAN newDeferred = idle && !promoted;
+        if (newStride != stride || newDeferred != deferred) {
+            stride = newStride;
+            deferred = newDeferred;
+            timerStride = deferred ? stride * Config.IdleDeferPeriods : stride;
+            period = ArmCoreTimer(pCore, &current, epoch, timerStride, &nextDue, &tick);
+        }
+    }
+
+    if (promoted) {
+        StripeDemote(&PromotedCount);
+    }
+    if (pCore->Timer != NULL) {
+        ExDeleteTimer(pCore->Timer, TRUE, TRUE, NULL);
+        pCore->Timer = NULL;
+    }
+    KeRevertToUserGroupAffinityThread(&oldAffinity);
     PsTerminateSystemThread(STATUS_SUCCESS);
 }
 
-VOID MyDriverUnload(_In_ WDFDRIVER Driver)
+// Validates and publishes a new session; every core thread re-arms its timer
+// on its next wakeup, which is forced here.
+NTSTATUS SetSamplingSession(_In_ const WINMSR_SESSION* NewSession)
 {
-    UNREFERENCED_PARAMETER(Driver);
+    KIRQL irql;
 
-    if (CoreArray != NULL)
+    if (NewSession->TimerMode != WINMSR_TIMER_COALESCABLE && NewSession->TimerMode != WINMSR_TIMER_HIGH_RESOLUTION) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (NewSession->PeriodUs < WINMSR_MIN_PERIOD_US || NewSession->PeriodUs > WINMSR_MAX_PERIOD_US) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    // Promoted CPUs sample on every tick, which must still be a valid period
+    if (NewSession->Stripes > WINMSR_MAX_STRIPES ||
+        NewSession->PeriodUs / max(NewSession->Stripes, 1) < WINMSR_MIN_PERIOD_US) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    KeAcquireSpinLock(&SessionLock, &irql);
+    Session = *NewSession;
+    Session.Stripes = max(NewSession->Stripes, 1);
+    SessionEpoch = KeQueryInterruptTime();
+    SweepReset(&Sweeps, InterlockedIncrement(&SessionGeneration));
+    KeReleaseSpinLock(&SessionLock, irql);
+
+    for (ULONG i = 0; i < CoreCount; i++) {
+        KeSetEvent(&CoreArray[i].TimerEvent, IO_NO_INCREMENT, FALSE);
+    }
+
+    DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "WinMSRDriver session: TimerMode=%lu, PeriodUs=%lu, ToleranceUs=%lu, Stripes=%lu\n",
+        NewSession->TimerMode, NewSession->PeriodUs, NewSession->ToleranceUs, max(NewSession->Stripes, 1));
+    return STATUS_SUCCESS;
+}
+
+VOID ReadJitter(_Out_ PWINMSR_JITTER_HEADER Header, _Out_writes_(Count) PWINMSR_CPU_JITTER Cpus, ULONG Count)
+{
+    RtlZeroMemory(Header, sizeof(*Header));
+    Header->CpuCount = Count;
+    Header->Sweeps = SweepCount(ReadNoFence64(&Sweeps.Sweeps));
+    Header->IncompleteSweeps = SweepCount(ReadNoFence64(&Sweeps.Incomplete));
+    Header->SpreadMax = SweepCount(ReadNoFence64(&Sweeps.SpreadMax));
+    for (ULONG b = 0; b < WINMSR_JITTER_BUCKETS; b++) {
+        Header->SpreadHistogram[b] = SweepCount(ReadNoFence64(&Sweeps.SpreadHistogram[b]));
+    }
+
+    for (ULONG i = 0; i < Count; i++) {
+        PSESSION_STATS s = &CoreArray[i].Hot->Session;
+        Cpus[i].Cpu = i;
+        Cpus[i].Reserved = 0;
+        Cpus[i].Fires = (ULONG64)ReadNoFence64(&s->Fires);
+        Cpus[i].DelayMax = (ULONG64)ReadNoFence64(&s->FireDelayMax);
+        for (ULONG b = 0; b < WINMSR_JITTER_BUCKETS; b++) {
+            Cpus[i].DelayHistogram[b] = (ULONG64)ReadNoFence64(&s->DelayHistogram[b]);
+        }
+    }
+}
+
+VOID GetSamplingSession(_Out_ PWINMSR_SESSION_STATUS Status)
+{
+    KIRQL irql;
+
+    RtlZeroMemory(Status, sizeof(*Status));
+    KeAcquireSpinLock(&SessionLock, &irql);
+    Status->Session = Session;
+    Status->Generation = (ULONG)SessionGeneration;
+    Status->Promoted = (ULONG)ReadNoFence(&PromotedCount);
+    KeReleaseSpinLock(&SessionLock, irql);
+    Status->WarmingUp = (ULONG)ReadNoFence(&SnapshotPage->WarmingUp);
+
+    // CPUs that have not picked up the session yet still report the previous one
+    for (ULONG i = 0; i < CoreCount; i++) {
+        PSESSION_STATS s = &CoreArray[i].Hot->Session;
+        Status->Fires += ReadNoFence64(&s->Fires);
+        Status->MissedPeriods += ReadNoFence64(&s->MissedPeriods);
+        Status->FireDelaySum += ReadNoFence64(&s->FireDelaySum);
+        Status->FireDelayMax = max(Status->FireDelayMax, (ULONG64)ReadNoFence64(&s->FireDelayMax));
+        Status->SampleCycles += ReadNoFence64(&s->SampleCycles);
+    }
+}
+
+// Copies the calibrated cost of every register each CPU samples. Costs are
+// written once at configuration, before the CPU's warm-up ends, so once
+// SnapshotPage->WarmingUp is 0 no locking is needed.
+ULONG ReadMsrCosts(_Out_writes_(Count) PWINMSR_MSR_COST Costs, ULONG Count)
+{
+    ULONG n = 0;
+
+    for (ULONG i = 0; i < CoreCount; i++) {
+        PCORE_HOT pHot = CoreArray[i].Hot;
+        for (ULONG k = 0; k < pHot->Plan.Count && n < Count; k++) {
+            ULONG m = pHot->Plan.Index[k];
+            if (pHot->MsrCost[m].MinCycles == 0 && pHot->MsrCost[m].MeanCycles == 0) {
+                continue;
+            }
+            Costs[n].Cpu = i;
+            Costs[n].Address = MsrInfo[m].Address;
+            Costs[n].MinCycles = pHot->MsrCost[m].MinCycles;
+            Costs[n].MeanCycles = pHot->MsrCost[m].MeanCycles;
+            Costs[n].ReadEvery = 1UL << pHot->Plan.RateShift[k];
+            Costs[n].Reserved = 0;
+            n++;
+        }
+    }
+    return n;
+}
+
+// Cheapest and dearest calibrated cost of each register across all CPUs
+static VOID LogMsrCosts(VOID)
+{
+    for (ULONG m = 0; m < MsrIndexCount; m++) {
+        ULONG least = MAXULONG;
+        ULONG most = 0;
+        for (ULONG i = 0; i < CoreCount; i++) {
+            PMSR_COST cost = &CoreArray[i].Hot->MsrCost[m];
+            if (cost->MeanCycles != 0) {
+                least = min(least, cost->MinCycles);
+                most = max(most, cost->MeanCycles);
+            }
+        }
+        if (most != 0) {
+            DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "  Cost(%s): min=%lu, mean up to %lu cycles%s\n",
+                MsrInfo[m].Name, least, most, least >= Config.ExpensiveMsrCycles ? ", throttled" : "");
+        }
+    }
+}
+
+// Sums the per-CPU counters. Entries are read without locking; each counter
+// is a naturally aligned 64-bit value so individual reads never tear.
+VOID SumCoreStats(_Out_ PCORE_STATS Total)
+{
+    RtlZeroMemory((PVOID)Total, sizeof(*Total));
+    if (CoreArray == NULL) {
+        return;
+    }
+
+    for (ULONG i = 0; i < CoreCount; i++) {
+        if (CoreArray[i].Hot == NULL) {
+            continue;
+        }
+        PCORE_STATS s = &CoreArray[i].Hot->Stats;
+        Total->SamplesTaken += ReadNoFence64(&s->SamplesTaken);
+        for (ULONG m = 0; m < MsrIndexCount; m++) {
+            Total->MsrFaults[m] += ReadNoFence64(&s->MsrFaults[m]);
+        }
+        Total->RingOverruns += ReadNoFence64(&s->RingOverruns);
+        Total->LateTimerFires += ReadNoFence64(&s->LateTimerFires);
+        Total->SampleCycles += ReadNoFence64(&s->SampleCycles);
+        Total->ThreadCreateFailures += ReadNoFence64(&s->ThreadCreateFailures);
+        Total->IdleSkips += ReadNoFence64(&s->IdleSkips);
+    }
+}
+
+static VOID LogCoreStats(VOID)
+{
+    CORE_STATS total;
+    SumCoreStats(&total);
+
+    DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL,
+        "WinMSRDriver stats: Samples=%lld, RingOverruns=%lld, LateTimerFires=%lld, "
+        "ThreadCreateFailures=%lld, IdleSkips=%lld, CyclesPerSample=%lld\n",
+        total.SamplesTaken,
+        total.RingOverruns,
+        total.LateTimerFires,
+        total.ThreadCreateFailures,
+        total.IdleSkips,
+        total.SamplesTaken ? total.SampleCycles / total.SamplesTaken : 0);
+
+    for (ULONG m = 0; m < MsrIndexCount; m++) {
+        if (total.MsrFaults[m] != 0) {
+            DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "  Faults(%s)=%lld\n", MsrInfo[m].Name, total.MsrFaults[m]);
+        }
+    }
+}
+
+// Aggregates the latest sample of every CPU separately per core type, so
+// P-core and E-core temperatures are never averaged together. Lock-free
+// like SumCoreStats; a reading may be one sample newer than its neighbour's.
+// Logged at load and unload, returned by IOCTL_WINMSR_GET_CORE_TYPES.
+VOID AggregateByCoreType(_Out_writes_(CpuCoreTypeCount) PWINMSR_CORE_TYPE_AGGREGATE Aggregates)
+{
+    RtlZeroMemory(Aggregates, sizeof(WINMSR_CORE_TYPE_AGGREGATE) * CpuCoreTypeCount);
+    for (ULONG t = 0; t < CpuCoreTypeCount; t++) {
+        Aggregates[t].CoreType = t;
+        Aggregates[t].MinTemperature = MAXLONG;
+        Aggregates[t].MaxTemperature = MINLONG;
+    }
+    if (CoreArray == NULL) {
+        return;
+    }
+
+    for (ULONG i = 0; i < CoreCount; i++) {
+        PCORE_HOT pHot = CoreArray[i].Hot;
+        PWINMSR_CORE_TYPE_AGGREGATE agg = &Aggregates[CoreArray[i].CpuId.CoreType];
+        if (pHot == NULL) {
+            continue;
+        }
+
+        agg->Cpus++;
+        agg->SamplesTaken += ReadNoFence64(&pHot->Stats.SamplesTaken);
+        agg->SampleCycles += ReadNoFence64(&pHot->Stats.SampleCycles);
+
+        LONG temperature = ReadNoFence((volatile LONG*)&pHot->Sample.Temperature);
+        if (temperature < 0) {
+            continue;
+        }
+        agg->ValidReadings++;
+        agg->SumTemperature += temperature;
+        agg->MinTemperature = min(agg->MinTemperature, temperature);
+        agg->MaxTemperature = max(agg->MaxTemperature, temperature);
+        if (pHot->Sample.ThermStatus.Fields.PROCHOT) {
+            agg->Prochot++;
+        }
+    }
+}
+
+static VOID LogCoreTypeAggregates(VOID)
+{
+    WINMSR_CORE_TYPE_AGGREGATE aggregates[CpuCoreTypeCount];
+    AggregateByCoreType(aggregates);
+
+    for (ULONG t = 0; t < CpuCoreTypeCount; t++) {
+        PWINMSR_CORE_TYPE_AGGREGATE agg = &aggregates[t];
+        if (agg->ValidReadings == 0) {
+            continue;
+        }
+        DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL,
+            "%s x%lu: Temp min/avg/max=%ld/%lld/%ld°C, PROCHOT=%lu, CyclesPerSample=%lld\n",
+            CpuCoreTypeName((CPU_CORE_TYPE)t), agg->Cpus,
+            agg->MinTemperature, agg->SumTemperature / agg->ValidReadings, agg->MaxTemperature,
+            agg->Prochot,
+            agg->SamplesTaken ? agg->SampleCycles / agg->SamplesTaken : 0);
+    }
+}
+
+// Returns the NUMA node of a processor, or 0 if it cannot be determined
+static USHORT QueryProcessorNode(PPROCESSOR_NUMBER ProcNumber)
+{
+    UCHAR buffer[256] = { 0 };
+    PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer;
+    ULONG length = sizeof(buffer);
+
+    if (NT_SUCCESS(KeQueryLogicalProcessorRelationship(ProcNumber, RelationNumaNode, info, &length))) {
+        return (USHORT)info->NumaNode.NodeNumber;
+    }
+    return 0;
+}
+
+// Finds the lowest CPU index sharing the given relationship (core, module
+// or package) with a processor. Fails if the OS does not report it.
+static BOOLEAN QueryProcessorLeader(PPROCESSOR_NUMBER ProcNumber, LOGICAL_PROCESSOR_RELATIONSHIP Relation, PULONG LeaderIndex)
+{
+    UCHAR buffer[512] = { 0 };
+    PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer;
+    ULONG length = sizeof(buffer);
+    PROCESSOR_NUMBER leader = { 0 };
+    ULONG bit;
+
+    if (!NT_SUCCESS(KeQueryLogicalProcessorRelationship(ProcNumber, Relation, info, &length)) ||
+        info->Processor.GroupCount == 0 ||
+        !BitScanForward64(&bit, info->Processor.GroupMask[0].Mask)) {
+        return FALSE;
+    }
+
+    leader.Group = info->Processor.GroupMask[0].Group;
+    leader.Number = (UCHAR)bit;
+    *LeaderIndex = KeGetProcessorIndexFromNumber(&leader);
+    return TRUE;
+}
+
+static VOID QueryProcessorTopology(PCORE pCore)
+{
+    ULONG self = (ULONG)pCore->CpuIndex;
+
+    if (!QueryProcessorLeader(&pCore->ProcNumber, RelationProcessorCore, &pCore->CoreLeaderIndex)) {
+        pCore->CoreLeaderIndex = self;
+    }
+    // Modules are only reported on recent OS builds; a P-core is its own module
+    if (!QueryProcessorLeader(&pCore->ProcNumber, RelationProcessorModule, &pCore->ModuleLeaderIndex)) {
+        pCore->ModuleLeaderIndex = pCore->CoreLeaderIndex;
+    }
+    if (!QueryProcessorLeader(&pCore->ProcNumber, RelationProcessorPackage, &pCore->PackageLeaderIndex)) {
+        pCore->PackageLeaderIndex = self;
+    }
+    // Dies likewise; a monolithic package is one die
+    if (!QueryProcessorLeader(&pCore->ProcNumber, RelationProcessorDie, &pCore->DieLeaderIndex)) {
+        pCore->DieLeaderIndex = pCore->PackageLeaderIndex;
+    }
+}
+
+// Allocates the hot part of one CPU, cache-aligned, on that CPU's NUMA node
+static PCORE_HOT AllocateCoreHot(USHORT Node)
+{
+    POOL_EXTENDED_PARAMETER param = { 0 };
+    param.Type = PoolExtendedParameterNumaNode;
+    param.PreferredNode = Node;
+
+    // ExAllocatePool3 returns zeroed memory
+    return (PCORE_HOT)ExAllocatePool3(POOL_FLAG_NON_PAGED | POOL_FLAG_CACHE_ALIGNED,
+                                      sizeof(CORE_HOT), 'toHC', &param, 1);
+}
+
+// Allocates one CPU's flight recorder ring on that CPU's NUMA node
+static PWINMSR_SAMPLE_RECORD AllocateFlightRing(USHORT Node, ULONG Capacity)
+{
+    POOL_EXTENDED_PARAMETER param = { 0 };
+    param.Type = PoolExtendedParameterNumaNode;
+    param.PreferredNode = Node;
+
+    return (PWINMSR_SAMPLE_RECORD)ExAllocatePool3(POOL_FLAG_NON_PAGED,
+                                                  (SIZE_T)Capacity * sizeof(WINMSR_SAMPLE_RECORD), 'tlFW', &param, 1);
+}
+
+// Allocates one CPU's compressed history on that CPU's NUMA node
+static PVOID AllocateHistory(USHORT Node, ULONG Chunks)
+{
+    POOL_EXTENDED_PARAMETER param = { 0 };
+    param.Type = PoolExtendedParameterNumaNode;
+    param.PreferredNode = Node;
+
+    return ExAllocatePool3(POOL_FLAG_NON_PAGED, HISTORY_BYTES(Chunks), 'tsHW', &param, 1);
+}
+
+// Builds the probe cache value name from the CPUID vendor and signature
+// (leaf 1 EAX), e.g. MsrSupport_GenuineIntel_000906A3. Running under a
+// hypervisor changes which MSRs trap, so it is part of the key too. P-cores
+// and E-cores of a hybrid part implement different registers and are
+// cached separately (_P / _E suffix).
+// x2APIC is enabled on all CPUs or none, so any CPU can answer
+static BOOLEAN X2ApicEnabled(VOID)
+{
+    __try {
+        return (__readmsr(IA32_APIC_BASE) & APIC_BASE_X2APIC_ENABLE) != 0;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return FALSE;
+    }
+}
+
+static NTSTATUS BuildMsrSupportCacheName(PUNICODE_STRING Name, CPU_CORE_TYPE Type)
+{
+    static const PCWSTR typeSuffix[CpuCoreTypeCount] = { L"", L"_P", L"_E" };
+    CPU_ID id;
+
+    CpuIdRead(&id);
+    return RtlUnicodeStringPrintf(Name, L"MsrSupport_%hs_%08X%s%s%s",
+        id.VendorString, id.Signature, id.Hypervisor ? L"_HV" : L"",
+        X2ApicEnabled() ? L"_X2" : L"", typeSuffix[Type]);
+}
+
+static VOID LoadMsrSupportCache(WDFDRIVER Driver)
+{
+    WCHAR nameBuffer[64];
+    UNICODE_STRING name;
+    WDFKEY key;
+
+    if (!NT_SUCCESS(WdfDriverOpenParametersRegistryKey(Driver, KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &key))) {
+        return;
+    }
+
+    for (ULONG t = 0; t < CpuCoreTypeCount; t++) {
+        RtlInitEmptyUnicodeString(&name, nameBuffer, sizeof(nameBuffer));
+        if (NT_SUCCESS(BuildMsrSupportCacheName(&name, (CPU_CORE_TYPE)t)) &&
+            NT_SUCCESS(WdfRegistryQueryULong(key, &name, &CachedMsrSupport[t])) &&
+            (CachedMsrSupport[t] & ~MSR_SUPPORT_ALL) == 0) {
+            MsrSupportCached[t] = TRUE;
+            DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "Using cached MSR support bitmap 0x%lX for %s.\n",
+                CachedMsrSupport[t], CpuCoreTypeName((CPU_CORE_TYPE)t));
+        }
+    }
+
+    WdfRegistryClose(key);
+}
+
+// Caches what every core of each type supports so later loads skip probing.
+// Only cores whose thread got through its initial sweep have probed; the
+// others are left out.
+static VOID StoreMsrSupportCache(WDFDRIVER Driver)
+{
+    WCHAR nameBuffer[64];
+    UNICODE_STRING name;
+    WDFKEY key;
+    ULONG common[CpuCoreTypeCount];
+    ULONG probed[CpuCoreTypeCount] = { 0 };
+
+    for (ULONG t = 0; t < CpuCoreTypeCount; t++) {
+        common[t] = MSR_SUPPORT_ALL;
+    }
+    for (ULONG i = 0; i < CoreCount; i++) {
+        CPU_CORE_TYPE type = CoreArray[i].CpuId.CoreType;
+        if (CoreArray[i].Warm && !MsrSupportCached[type]) {
+            common[type] &= CoreArray[i].Hot->Sample.MsrSupport;
+            probed[type]++;
+        }
+    }
+
+    if (!NT_SUCCESS(WdfDriverOpenParametersRegistryKey(Driver, KEY_WRITE, WDF_NO_OBJECT_ATTRIBUTES, &key))) {
+        return;
+    }
+
+    for (ULONG t = 0; t < CpuCoreTypeCount; t++) {
+        RtlInitEmptyUnicodeString(&name, nameBuffer, sizeof(nameBuffer));
+        if (probed[t] != 0 && NT_SUCCESS(BuildMsrSupportCacheName(&name, (CPU_CORE_TYPE)t))) {
+            WdfRegistryAssignULong(key, &name, common[t]);
+        }
+    }
+
+    WdfRegistryClose(key);
+}
+
+// Reads DRIVER_CONFIG from the Parameters key; missing or zero values keep their defaults
+static VOID LoadDriverConfig(WDFDRIVER Driver)
+{
+    DECLARE_CONST_UNICODE_STRING(samplePeriodName, L"SamplePeriodMs");
+    DECLARE_CONST_UNICODE_STRING(timerModeName, L"TimerMode");
+    DECLARE_CONST_UNICODE_STRING(timerToleranceName, L"TimerToleranceUs");
+    DECLARE_CONST_UNICODE_STRING(intervalName, L"IntervalMs");
+    DECLARE_CONST_UNICODE_STRING(clearThermLogsName, L"ClearThermLogs");
+    DECLARE_CONST_UNICODE_STRING(notifyBatchSizeName, L"NotifyBatchSize");
+    DECLARE_CONST_UNICODE_STRING(notifyLatencyName, L"NotifyLatencyUs");
+    DECLARE_CONST_UNICODE_STRING(calibrateName, L"CalibrateMsrCosts");
+    DECLARE_CONST_UNICODE_STRING(expensiveCyclesName, L"ExpensiveMsrCycles");
+    DECLARE_CONST_UNICODE_STRING(expensiveShiftName, L"ExpensiveMsrShift");
+    DECLARE_CONST_UNICODE_STRING(stripeCountName, L"StripeCount");
+    DECLARE_CONST_UNICODE_STRING(stripeMarginName, L"StripeHotMarginC");
+    DECLARE_CONST_UNICODE_STRING(stripePromotedName, L"StripeMaxPromoted");
+    DECLARE_CONST_UNICODE_STRING(idleSamplingName, L"IdleSampling");
+    DECLARE_CONST_UNICODE_STRING(idleBusyName, L"IdleBusyPermille");
+    DECLARE_CONST_UNICODE_STRING(idleDeferName, L"IdleDeferPeriods");
+    DECLARE_CONST_UNICODE_STRING(levelTauName, L"ForecastLevelTauMs");
+    DECLARE_CONST_UNICODE_STRING(slopeTauName, L"ForecastSlopeTauMs");
+    DECLARE_CONST_UNICODE_STRING(flightName, L"FlightRecorderMs");
+    DECLARE_CONST_UNICODE_STRING(flightPostName, L"FlightPostTriggerMs");
+    DECLARE_CONST_UNICODE_STRING(flightTriggerName, L"FlightTriggerC");
+    DECLARE_CONST_UNICODE_STRING(historyName, L"HistoryKb");
+    WDFKEY key;
+    ULONG value;
+
+    if (!NT_SUCCESS(WdfDriverOpenParametersRegistryKey(Driver, KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &key))) {
+        return;
+    }
+
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &samplePeriodName, &value)) && value != 0) {
+        Config.SamplePeriodMs = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &timerModeName, &value))) {
+        Config.TimerMode = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &timerToleranceName, &value))) {
+        Config.TimerToleranceUs = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &intervalName, &value)) && value != 0) {
+        Config.IntervalMs = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &clearThermLogsName, &value))) {
+        Config.ClearThermLogs = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &notifyBatchSizeName, &value)) && value != 0) {
+        Config.NotifyBatchSize = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &notifyLatencyName, &value)) && value != 0) {
+        Config.NotifyLatencyUs = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &calibrateName, &value))) {
+        Config.CalibrateMsrCosts = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &expensiveCyclesName, &value)) && value != 0) {
+        Config.ExpensiveMsrCycles = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &expensiveShiftName, &value)) && value < 16) {
+        Config.ExpensiveMsrShift = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &stripeCountName, &value)) && value != 0) {
+        Config.StripeCount = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &stripeMarginName, &value))) {
+        Config.StripeHotMarginC = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &stripePromotedName, &value))) {
+        Config.StripeMaxPromoted = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &idleSamplingName, &value))) {
+        Config.IdleSampling = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &idleBusyName, &value)) && value != 0 && value <= 1000) {
+        Config.IdleBusyPermille = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &idleDeferName, &value)) && value != 0 && value <= 1000) {
+        Config.IdleDeferPeriods = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &levelTauName, &value)) && value != 0) {
+        Config.ForecastLevelTauMs = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &slopeTauName, &value)) && value != 0) {
+        Config.ForecastSlopeTauMs = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &flightName, &value))) {
+        Config.FlightRecorderMs = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &flightPostName, &value))) {
+        Config.FlightPostTriggerMs = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &flightTriggerName, &value))) {
+        Config.FlightTriggerC = value;
+    }
+    if (NT_SUCCESS(WdfRegistryQueryULong(key, &historyName, &value)) && value <= HISTORY_MAX_KB) {
+        Config.HistoryKb = value;
+    }
+    // The dump must still hold the lead-up to the trigger
+    Config.FlightPostTriggerMs = min(Config.FlightPostTriggerMs, Config.FlightRecorderMs / 2);
+
+    WdfRegistryClose(key);
+
+    DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "WinMSRDriver config: SamplePeriodMs=%lu, TimerMode=%lu, TimerToleranceUs=%lu, IntervalMs=%lu, "
+        "ClearThermLogs=%lu, NotifyBatchSize=%lu, NotifyLatencyUs=%lu, CalibrateMsrCosts=%lu, ExpensiveMsrCycles=%lu, "
+        "ExpensiveMsrShift=%lu, StripeCount=%lu, StripeHotMarginC=%lu, StripeMaxPromoted=%lu, "
+        "IdleSampling=%lu, IdleBusyPermille=%lu, IdleDeferPeriods=%lu, ForecastLevelTauMs=%lu, ForecastSlopeTauMs=%lu, "
+        "FlightRecorderMs=%lu, FlightPostTriggerMs=%lu, FlightTriggerC=%lu, HistoryKb=%lu\n",
+        Config.SamplePeriodMs, Config.TimerMode, Config.TimerToleranceUs, Config.IntervalMs, Config.ClearThermLogs,
+        Config.NotifyBatchSize, Config.NotifyLatencyUs, Config.CalibrateMsrCosts, Config.ExpensiveMsrCycles,
+        Config.ExpensiveMsrShift, Config.StripeCount, Config.StripeHotMarginC, Config.StripeMaxPromoted,
+        Config.IdleSampling, Config.IdleBusyPermille, Config.IdleDeferPeriods,
+        Config.ForecastLevelTauMs, Config.ForecastSlopeTauMs,
+        Config.FlightRecorderMs, Config.FlightPostTriggerMs, Config.FlightTriggerC, Config.HistoryKb);
+}
+
+// Called once per CPU when its initial sweep is done or its thread could not
+// be created. DriverEntry does not wait for the sweeps: the last CPU stores
+// the probe cache and logs the load summary instead.
+static VOID WarmupDone(VOID)
+{
+    if (InterlockedDecrement(&SnapshotPage->WarmingUp) != 0) {
+        return;
+    }
+
+    StoreMsrSupportCache(WdfGetDriver());
+
+    if (CoreArray[0].Caps != NULL) {
+        DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "CPU model: %s (family 0x%X, model 0x%X, stepping %u), TjMax=%u\n",
+            CoreArray[0].Caps->Name, CoreArray[0].CpuId.Family, CoreArray[0].CpuId.Model,
+            CoreArray[0].CpuId.Stepping, CoreArray[0].Hot->Plan.TjMax);
+    }
+    DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "WinMSRDriver: All core temperature readings completed.\n");
+    LogCoreTypeAggregates();
+    LogCoreStats();
+    if (Config.CalibrateMsrCosts) {
+        LogMsrCosts();
+    }
+}
+
+static VOID StopCoreThreads(VOID)
+{
+    KeSetEvent(&StopEvent, IO_NO_INCREMENT, FALSE);
+
+    for (ULONG i = 0; i < CoreCount; i++)
     {
-        // Wait for any running threads to finish
-        for (ULONG i = 0; i < CoreCount; i++)
+        if (CoreArray[i].ThreadHandle)
         {
-            if (CoreArray[i].ThreadHandle)
-            {
-                KeWaitForSingleObject(&CoreArray[i].ThreadDoneEvent, Executive, KernelMode, FALSE, NULL);
-                ZwClose(CoreArray[i].ThreadHandle);
-                CoreArray[i].ThreadHandle = NULL;
+            ZwWaitForSingleObject(CoreArray[i].ThreadHandle, FALSE, NULL);
+            ZwClose(CoreArray[i].ThreadHandle);
+            CoreArray[i].ThreadHandle = NULL;
+        }
+    }
+}
+
+static VOID FreeCoreArray(VOID)
+{
+    for (ULONG i = 0; i < CoreCount; i++)
+    {
+        if (CoreArray[i].Hot != NULL)
+        {
+            if (CoreArray[i].Hot->Flight.Records != NULL) {
+                ExFreePoolWithTag(CoreArray[i].Hot->Flight.Records, 'tlFW');
             }
+            if (CoreArray[i].Hot->History.Chunks != NULL) {
+                ExFreePoolWithTag(CoreArray[i].Hot->History.Chunks, 'tsHW');
+            }
+            ExFreePoolWithTag(CoreArray[i].Hot, 'toHC');
+            CoreArray[i].Hot = NULL;
         }
-        ExFreePoolWithTag(CoreArray, 'corE');
-        CoreArray = NULL;
+    }
+    ExFreePoolWithTag(CoreArray, 'corE');
+    CoreArray = NULL;
+    DeleteSnapshot();
+}
+
+VOID MyDriverUnload(_In_ WDFDRIVER Driver)
+{
+    UNREFERENCED_PARAMETER(Driver);
+
+    if (CoreArray != NULL)
+    {
+        // Stop the sampling threads and wait for them to exit, so none of
+        // them notifies a device that is going away
+        StopCoreThreads();
+    }
+
+    // No more requests may reach CoreArray once it is freed
+    DeleteControlDevice();
+
+    if (CoreArray != NULL)
+    {
+        LogCoreTypeAggregates();
+        LogCoreStats();
+        FreeCoreArray();
     }
 
     DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "WinMSRDriver (KMDF) unloaded.\n");
@@ -155,6 +1150,7 @@ NTSTATUS DriverEntry(
 
     WDF_DRIVER_CONFIG_INIT(&config, WDF_NO_EVENT_CALLBACK);
     config.EvtDriverUnload = MyDriverUnload;
+    config.DriverInitFlags |= WdfDriverInitNonPnpDriver;
 
     status = WdfDriverCreate(DriverObject, RegistryPath, WDF_NO_OBJECT_ATTRIBUTES, &config, &hDriver);
     if (!NT_SUCCESS(status)) {
@@ -173,6 +1169,8 @@ NTSTATUS DriverEntry(
 
     DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "CPU Brand: %s\n", brandString);
 
+    LoadDriverConfig(hDriver);
+
     // Query active processor count (total logical cores)
     CoreCount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
     if (CoreCount == 0) {
@@ -188,11 +1186,83 @@ NTSTATUS DriverEntry(
     }
     RtlZeroMemory(CoreArray, sizeof(CORE) * CoreCount);
 
-    // Create a system thread per CPU core to read MSRs
+    // Latest-snapshot page, mapped read-only into readers on request
+    status = CreateSnapshot(CoreCount);
+    if (!NT_SUCCESS(status)) {
+        DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL, "Failed to create snapshot section: 0x%X\n", status);
+        FreeCoreArray();
+        return status;
+    }
+
+    // Resolve each CPU's group/number and NUMA node, then give it node-local hot state
     for (ULONG i = 0; i < CoreCount; i++)
     {
         CoreArray[i].CpuIndex = (int)i;
-        KeInitializeEvent(&CoreArray[i].ThreadDoneEvent, NotificationEvent, FALSE);
+        KeGetProcessorNumberFromIndex(i, &CoreArray[i].ProcNumber);
+        CoreArray[i].Node = QueryProcessorNode(&CoreArray[i].ProcNumber);
+        QueryProcessorTopology(&CoreArray[i]);
+
+        CoreArray[i].Hot = AllocateCoreHot(CoreArray[i].Node);
+        if (CoreArray[i].Hot == NULL) {
+            DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL,
+                "Failed to allocate sample state for core %lu on node %u.\n", i, CoreArray[i].Node);
+            FreeCoreArray();
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        IntervalInit(&CoreArray[i].Hot->Interval, i, 10000ULL * Config.IntervalMs);
+        RingInit(&CoreArray[i].Hot->Ring);
+        CoreArray[i].Hot->Snapshot = &SnapshotPage->Cpu[i];
+        CoreArray[i].Hot->Snapshot->Core = (USHORT)CoreArray[i].CoreLeaderIndex;
+        CoreArray[i].Hot->Snapshot->Package = (USHORT)CoreArray[i].PackageLeaderIndex;
+        CoreArray[i].Hot->Snapshot->Die = (USHORT)CoreArray[i].DieLeaderIndex;
+        ForecastInit(&CoreArray[i].Hot->Forecast, Config.ForecastLevelTauMs, Config.ForecastSlopeTauMs);
+    }
+
+    KeInitializeEvent(&StopEvent, NotificationEvent, FALSE);
+
+    // Initial session from the registry; an invalid mode falls back to coalescable
+    KeInitializeSpinLock(&SessionLock);
+    Session.TimerMode = (Config.TimerMode == WINMSR_TIMER_HIGH_RESOLUTION) ? WINMSR_TIMER_HIGH_RESOLUTION : WINMSR_TIMER_COALESCABLE;
+    Session.PeriodUs = max(1000UL * min(Config.SamplePeriodMs, WINMSR_MAX_PERIOD_US / 1000), WINMSR_MIN_PERIOD_US);
+    Session.ToleranceUs = Config.TimerToleranceUs;
+    Session.Stripes = min(max(Config.StripeCount, 1), min(WINMSR_MAX_STRIPES, Session.PeriodUs / WINMSR_MIN_PERIOD_US));
+    if (Config.StripeMaxPromoted == 0) {
+        Config.StripeMaxPromoted = max(CoreCount / Session.Stripes, 1);
+    }
+    SessionEpoch = KeQueryInterruptTime();
+    SweepInit(&Sweeps);
+    SamplerCount = (LONG)CoreCount;
+
+    // Flight recorder rings, sized for the initial period; a CPU whose ring
+    // cannot be allocated just records nothing
+    if (Config.FlightRecorderMs != 0) {
+        ULONG tickUs = max(Session.PeriodUs / Session.Stripes, 1);
+        ULONG capacity = (ULONG)min(1000ULL * Config.FlightRecorderMs / tickUs + 1, FLIGHT_MAX_RECORDS);
+        for (ULONG i = 0; i < CoreCount; i++) {
+            CoreArray[i].Hot->Flight.Records = AllocateFlightRing(CoreArray[i].Node, capacity);
+            CoreArray[i].Hot->Flight.Capacity = capacity;
+        }
+    }
+
+    // Compressed history, the same way; the initial period seeds the
+    // expected stamp spacing, later sessions are picked up as they come
+    if (Config.HistoryKb != 0) {
+        ULONG chunks = max(Config.HistoryKb / (GORILLA_CHUNK_BYTES / 1024), HISTORY_MIN_CHUNKS);
+        for (ULONG i = 0; i < CoreCount; i++) {
+            PVOID buffer = AllocateHistory(CoreArray[i].Node, chunks);
+            if (buffer != NULL) {
+                HistoryInit(&CoreArray[i].Hot->History, buffer, chunks, 10ULL * Session.PeriodUs);
+            }
+        }
+    }
+
+    // Reuse the probe results of an earlier load on the same CPU model
+    LoadMsrSupportCache(hDriver);
+
+    // Create a system thread per CPU core to read MSRs
+    for (ULONG i = 0; i < CoreCount; i++)
+    {
+        KeInitializeEvent(&CoreArray[i].TimerEvent, SynchronizationEvent, FALSE);
 
         status = PsCreateSystemThread(
             &CoreArray[i].ThreadHandle,
@@ -206,21 +1276,24 @@ NTSTATUS DriverEntry(
         if (!NT_SUCCESS(status)) {
             DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL,
                 "Failed to create thread for core %lu: 0x%X\n", i, status);
+            StatAdd(&CoreArray[i].Hot->Stats.ThreadCreateFailures, 1);
+            InterlockedDecrement(&SamplerCount);
             CoreArray[i].ThreadHandle = NULL;
-            KeSetEvent(&CoreArray[i].ThreadDoneEvent, IO_NO_INCREMENT, FALSE);
+            WarmupDone();
         }
     }
 
-    // Wait for all threads to finish
-    for (ULONG i = 0; i < CoreCount; i++) {
-        if (CoreArray[i].ThreadHandle != NULL) {
-            KeWaitForSingleObject(&CoreArray[i].ThreadDoneEvent, Executive, KernelMode, FALSE, NULL);
-            ZwClose(CoreArray[i].ThreadHandle);
-            CoreArray[i].ThreadHandle = NULL;
-        }
-    }
+    // The threads run their initial sweep while the driver finishes loading;
+    // readers see SnapshotPage->WarmingUp count down to 0
+    DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "WinMSRDriver: warming up %lu CPUs.\n", CoreCount);
 
-    DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL, "WinMSRDriver: All core temperature readings completed.\n");
+    status = CreateControlDevice(hDriver);
+    if (!NT_SUCCESS(status)) {
+        DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL, "Failed to create control device: 0x%X\n", status);
+        StopCoreThreads();
+        FreeCoreArray();
+        return status;
+    }
 
     return STATUS_SUCCESS;
 }
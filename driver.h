@@ -0,0 +1,169 @@
+#pragma once
+
+#include <ntddk.h>
+#include <wdf.h>
+#include <intrin.h>
+#include "msr.h"
+#include "cpumodel.h"
+#include "aggregate.h"
+#include "ring.h"
+#include "forecast.h"
+#include "snapshot.h"
+#include "batch.h"
+#include "jitter.h"
+#include "stripe.h"
+#include "wire.h"
+#include "flight.h"
+#include "history.h"
+#include "stats.h"
+#include "public.h"
+
+// Defaults of the Parameters registry values, see DRIVER_CONFIG
+#define SAMPLE_PERIOD_MS        100
+#define INTERVAL_MS             60000
+#define NOTIFY_BATCH_SIZE       64
+#define NOTIFY_LATENCY_US       100000
+#define EXPENSIVE_MSR_CYCLES    2000
+#define EXPENSIVE_MSR_SHIFT     3
+#define STRIPE_HOT_MARGIN_C     10
+#define IDLE_BUSY_PERMILLE      20
+#define IDLE_DEFER_PERIODS      10
+#define FORECAST_LEVEL_TAU_MS   1000
+#define FORECAST_SLOPE_TAU_MS   4000
+#define FLIGHT_RECORDER_MS      10000
+#define FLIGHT_POST_TRIGGER_MS  2000
+#define FLIGHT_MAX_RECORDS      65536
+#define HISTORY_MAX_KB          (1024 * 1024)   // 1 GiB per CPU
+
+// Settings read from the driver's Parameters key at load
+typedef struct _DRIVER_CONFIG {
+    ULONG SamplePeriodMs;       // SamplePeriodMs: sampling period of the initial session
+    ULONG TimerMode;            // TimerMode: WINMSR_TIMER_* of the initial session
+    ULONG TimerToleranceUs;     // TimerToleranceUs: coalescing tolerance of the initial session
+    ULONG IntervalMs;           // IntervalMs: length of an aggregation interval
+    ULONG ClearThermLogs;       // ClearThermLogs: nonzero clears IA32_THERM_STATUS log bits after each sample
+    ULONG NotifyBatchSize;      // NotifyBatchSize: samples that complete parked wait requests
+    ULONG NotifyLatencyUs;      // NotifyLatencyUs: longest a sample waits for its batch
+    ULONG CalibrateMsrCosts;    // CalibrateMsrCosts: nonzero times every sampled register at load
+    ULONG ExpensiveMsrCycles;   // ExpensiveMsrCycles: read cost from which a register is read less often
+    ULONG ExpensiveMsrShift;    // ExpensiveMsrShift: expensive registers are read every 2^shift samples
+    ULONG StripeCount;          // StripeCount: stripes of the initial session, 1 = no striping
+    ULONG StripeHotMarginC;     // StripeHotMarginC: CPUs this close to TjMax sample on every tick
+    ULONG StripeMaxPromoted;    // StripeMaxPromoted: CPUs that may be promoted at once, 0 = CPUs / stripes
+    ULONG IdleSampling;         // IdleSampling: nonzero skips and defers CPUs that were idle since their last fire
+    ULONG IdleBusyPermille;     // IdleBusyPermille: C0 share (MPERF / TSC) below which a CPU counts as idle
+    ULONG IdleDeferPeriods;     // IdleDeferPeriods: idle CPUs fire and are read only every this many periods
+    ULONG ForecastLevelTauMs;   // ForecastLevelTauMs: smoothing time constant of the forecast level
+    ULONG ForecastSlopeTauMs;   // ForecastSlopeTauMs: smoothing time constant of the forecast slope
+    ULONG FlightRecorderMs;     // FlightRecorderMs: full-rate history kept per CPU for trigger dumps, 0 = off
+    ULONG FlightPostTriggerMs;  // FlightPostTriggerMs: recorded after a trigger before the dump
+    ULONG FlightTriggerC;       // FlightTriggerC: temperature that triggers a dump, 0 = PROCHOT / critical only
+    ULONG HistoryKb;            // HistoryKb: compressed full-rate history kept per CPU, 0 = off
+} DRIVER_CONFIG, *PDRIVER_CONFIG;
+
+// Timer accuracy of one CPU in the current session. Owner only; the core
+// thread zeroes it when it picks up a new session.
+typedef struct DECLSPEC_CACHEALIGN _SESSION_STATS {
+    volatile LONG64 Fires;
+    volatile LONG64 MissedPeriods;
+    volatile LONG64 FireDelaySum;
+    volatile LONG64 FireDelayMax;
+    volatile LONG64 SampleCycles;
+    volatile LONG64 DelayHistogram[WINMSR_JITTER_BUCKETS];
+} SESSION_STATS, *PSESSION_STATS;
+
+// Latest readings of one CPU, written on every sample. Msr[] holds the raw
+// value of every register in the plan as of its last read; static registers
+// are filled once.
+typedef struct DECLSPEC_CACHEALIGN _CORE_SAMPLE {
+    ULONG MsrSupport;           // MSR_BIT() of each register that read without faulting
+    int Temperature;
+    MSR_THERM_STATUS_UNION ThermStatus;
+    ULONG64 Msr[MsrIndexCount];
+} CORE_SAMPLE, *PCORE_SAMPLE;
+
+// Last closed interval of one CPU, published to readers on other CPUs.
+// Sequence is odd while the owner is writing; see ReadPublishedInterval.
+typedef struct DECLSPEC_CACHEALIGN _CORE_PUBLISHED_INTERVAL {
+    volatile LONG Sequence;
+    WINMSR_INTERVAL_SUMMARY Summary;
+} CORE_PUBLISHED_INTERVAL, *PCORE_PUBLISHED_INTERVAL;
+
+// Hot per-CPU state. Allocated separately for each CPU on that CPU's NUMA
+// node so samples are written locally and never share a line with a neighbour.
+typedef struct DECLSPEC_CACHEALIGN _CORE_HOT {
+    SAMPLE_PLAN Plan;           // read-only after configuration
+    ULONG64 ThermLogClearMask;  // log bits cleared after each sample, 0 if not clearing
+    MSR_COST MsrCost[MsrIndexCount];    // read-only after configuration, zero unless calibrated
+    CORE_SAMPLE Sample;
+    CORE_STATS Stats;
+    SESSION_STATS Session;
+    DECLSPEC_CACHEALIGN INTERVAL_AGGREGATOR Interval;   // owner only
+    CORE_PUBLISHED_INTERVAL Published;
+    SAMPLE_RING Ring;           // every sample, shared by all readers
+    PWINMSR_CPU_SNAPSHOT Snapshot;  // this CPU's entry in SnapshotPage
+    FORECAST Forecast;          // owner only, published through Snapshot
+    ULONG64 IdleMperf;          // owner only: IA32_MPERF and TSC at the previous idle check
+    ULONG64 IdleTsc;
+    FLIGHT_RING Flight;         // owner writes; the dumper reads it while frozen
+    HISTORY_RING History;       // owner appends, IOCTL_WINMSR_READ_HISTORY copies sealed chunks
+} CORE_HOT, *PCORE_HOT;
+
+// Cold per-CPU state: identity, thread bookkeeping and a pointer to the hot part
+typedef struct _CORE {
+    int CpuIndex;
+    PROCESSOR_NUMBER ProcNumber;
+    USHORT Node;
+    ULONG CoreLeaderIndex;      // lowest CPU index sharing this CPU's core
+    ULONG ModuleLeaderIndex;    // lowest CPU index sharing this CPU's module (E-core cluster)
+    ULONG PackageLeaderIndex;   // lowest CPU index sharing this CPU's package
+    ULONG DieLeaderIndex;       // lowest CPU index sharing this CPU's die
+    CPU_ID CpuId;
+    const CPU_MODEL_CAPS* Caps;
+    HANDLE ThreadHandle;
+    BOOLEAN Warm;               // initial sweep done, set by the core thread
+    KEVENT TimerEvent;          // set by the sampling timer and by session changes
+    PEX_TIMER Timer;            // owned by the core thread
+    PCORE_HOT Hot;
+} CORE, *PCORE;
+
+C_ASSERT(CpuCoreTypeUniform == WINMSR_CORE_TYPE_UNIFORM);
+C_ASSERT(CpuCoreTypePerformance == WINMSR_CORE_TYPE_PERFORMANCE);
+C_ASSERT(CpuCoreTypeEfficient == WINMSR_CORE_TYPE_EFFICIENT);
+C_ASSERT(CpuCoreTypeCount == WINMSR_CORE_TYPES);
+
+extern PCORE CoreArray;
+extern ULONG CoreCount;
+extern DRIVER_CONFIG Config;
+extern PWINMSR_SNAPSHOT_PAGE SnapshotPage;
+
+// driver.c
+VOID SumCoreStats(_Out_ PCORE_STATS Total);
+VOID AggregateByCoreType(_Out_writes_(CpuCoreTypeCount) PWINMSR_CORE_TYPE_AGGREGATE Aggregates);
+NTSTATUS SetSamplingSession(_In_ const WINMSR_SESSION* NewSession);
+VOID GetSamplingSession(_Out_ PWINMSR_SESSION_STATUS Status);
+VOID ReadJitter(_Out_ PWINMSR_JITTER_HEADER Header, _Out_writes_(Count) PWINMSR_CPU_JITTER Cpus, ULONG Count);
+ULONG ReadMsrCosts(_Out_writes_(Count) PWINMSR_MSR_COST Costs, ULONG Count);
+VOID ReadPublishedInterval(_In_ PCORE_HOT pHot, _Out_ PWINMSR_INTERVAL_SUMMARY Summary);
+
+// snapshot.c
+NTSTATUS CreateSnapshot(ULONG CpuCount);
+VOID DeleteSnapshot(VOID);
+NTSTATUS MapSnapshot(_Out_ PVOID* UserAddress, _Out_ PSIZE_T Size);
+VOID UnmapSnapshot(_In_ PVOID UserAddress);
+
+// device.c
+NTSTATUS CreateControlDevice(_In_ WDFDRIVER Driver);
+VOID DeleteControlDevice(VOID);
+NTSTATUS ReadSamples(_In_ WDFREQUEST Request, size_t OutputBufferLength, _Out_ size_t* Information);
+
+// notify.c
+NTSTATUS CreateNotifyQueue(_In_ WDFDEVICE Device);
+VOID StopNotifyQueue(VOID);
+NTSTATUS ParkWaitRequest(_In_ WDFREQUEST Request, size_t OutputBufferLength);
+VOID NotifySample(ULONG64 Now, BOOLEAN Urgent);
+
+// recorder.c
+NTSTATUS CreateFlightRecorder(_In_ WDFDEVICE Device);
+VOID StopFlightRecorder(VOID);
+VOID FlightSample(_Inout_ PCORE_HOT pHot, _In_ const WINMSR_SAMPLE_RECORD* Record);
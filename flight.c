@@ -0,0 +1,96 @@
+#include "flight.h"
+#include "thermstatus.h"
+
+VOID FlightInit(_Out_ PFLIGHT_TRIGGER Trigger, ULONG64 PostWindow, LONG ThresholdC)
+{
+    Trigger->State = FlightArmed;
+    Trigger->Reason = 0;
+    Trigger->Cpu = 0;
+    Trigger->ThresholdC = ThresholdC;
+    Trigger->PostWindow = PostWindow;
+    Trigger->TriggerTime = 0;
+    Trigger->FreezeTime = 0;
+}
+
+// Why a sample should trigger a dump, 0 if it should not. Log bits only say
+// "since the previous sample" when the driver clears them after each one.
+ULONG FlightReason(_In_ const FLIGHT_TRIGGER* Trigger, _In_ const WINMSR_SAMPLE_RECORD* Record, BOOLEAN LogsCleared)
+{
+    ULONG64 status = ThermStatusActive(Record->ThermStatus, LogsCleared);
+    ULONG reason = 0;
+
+    if (status & THERM_STATUS_PROCHOT) {
+        reason |= WINMSR_FLIGHT_PROCHOT;
+    }
+    if (status & THERM_STATUS_CRITICAL_TEMP) {
+        reason |= WINMSR_FLIGHT_CRITICAL;
+    }
+    if (Trigger->ThresholdC != 0 && Record->Temperature >= Trigger->ThresholdC) {
+        reason |= WINMSR_FLIGHT_THRESHOLD;
+    }
+    return reason;
+}
+
+// Called by the owner of Ring for every sample. Records it unless the rings
+// are frozen; a Reason bit the CPU's previous sample did not have arms the
+// freeze if nothing else has. An onset while a dump is pending is not kept
+// for later, so a condition that persists through the dump does not fire
+// again after it. The first sampler past the freeze time is told to queue
+// the dump.
+FLIGHT_ACTION FlightRecord(_Inout_ PFLIGHT_TRIGGER Trigger, _Inout_ PFLIGHT_RING Ring,
+                           _In_ const WINMSR_SAMPLE_RECORD* Record, ULONG Reason)
+{
+    LONG state = ReadAcquire(&Trigger->State);
+    ULONG onset = Reason & ~Ring->Active;
+
+    Ring->Active = Reason;
+
+    if (state == FlightDumping) {
+        return FlightNone;
+    }
+    if (state == FlightTriggered && Record->Time > Trigger->FreezeTime) {
+        if (InterlockedCompareExchange(&Trigger->State, FlightDumping, FlightTriggered) == FlightTriggered) {
+            return FlightDump;
+        }
+        return FlightNone;
+    }
+
+    LONG64 head = Ring->Head;
+    Ring->Records[head % Ring->Capacity] = *Record;
+    WriteRelease64(&Ring->Head, head + 1);
+
+    if (state == FlightArmed && onset != 0 &&
+        InterlockedCompareExchange(&Trigger->State, FlightTriggering, FlightArmed) == FlightArmed) {
+        Trigger->Reason = onset;
+        Trigger->Cpu = Record->Cpu;
+        Trigger->TriggerTime = Record->Time;
+        Trigger->FreezeTime = Record->Time + Trigger->PostWindow;
+        WriteRelease(&Trigger->State, FlightTriggered);
+    }
+    return FlightNone;
+}
+
+// Copies the frozen ring's records up to Until, oldest first. The oldest
+// slot is left out: a sampler that saw the state just before the freeze may
+// still be rewriting it.
+ULONG FlightCopy(_In_ const FLIGHT_RING* Ring, ULONG64 Until,
+                 _Out_writes_(MaxRecords) PWINMSR_SAMPLE_RECORD Records, ULONG MaxRecords)
+{
+    LONG64 head = ReadAcquire64(&Ring->Head);
+    LONG64 first = max(head - (LONG64)Ring->Capacity + 1, 0);
+    ULONG count = 0;
+
+    for (LONG64 p = first; p < head && count < MaxRecords; p++) {
+        const WINMSR_SAMPLE_RECORD* record = &Ring->Records[p % Ring->Capacity];
+        if (record->Time <= Until) {
+            Records[count++] = *record;
+        }
+    }
+    return count;
+}
+
+// After the dump: recording resumes and the next trigger is watched for
+VOID FlightRearm(_Inout_ PFLIGHT_TRIGGER Trigger)
+{
+    WriteRelease(&Trigger->State, FlightArmed);
+}
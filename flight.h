@@ -0,0 +1,58 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "public.h"
+
+//
+// Flight recorder: every CPU keeps its last Capacity samples in its own
+// ring, and a shared trigger freezes all rings for a dump once PostWindow
+// has passed after a PROCHOT, critical-temperature or threshold sample. Only
+// the onset of a condition triggers: a CPU that stays throttled does not fire
+// again until the condition has cleared on it. The samplers never wait: triggering, freezing and handing over the dump are
+// each one interlocked operation. Portable: no kernel calls, no allocation.
+//
+
+typedef enum _FLIGHT_STATE {
+    FlightArmed = 0,            // recording, watching for a trigger
+    FlightTriggering,           // the winning sampler is filling in the trigger
+    FlightTriggered,            // recording up to FreezeTime
+    FlightDumping               // frozen; the dumper owns the rings
+} FLIGHT_STATE;
+
+typedef enum _FLIGHT_ACTION {
+    FlightNone = 0,
+    FlightDump                  // the rings are frozen: queue the dump
+} FLIGHT_ACTION;
+
+// Owner-written ring of one CPU. Head is published after the slot is written.
+typedef struct _FLIGHT_RING {
+    PWINMSR_SAMPLE_RECORD Records;  // [Capacity], NULL if the recorder is off
+    ULONG Capacity;
+    volatile LONG64 Head;           // samples written so far
+    ULONG Active;                   // owner-only: WINMSR_FLIGHT_* of the previous sample
+} FLIGHT_RING, *PFLIGHT_RING;
+
+typedef struct DECLSPEC_CACHEALIGN _FLIGHT_TRIGGER {
+    volatile LONG State;        // FLIGHT_STATE
+    ULONG Reason;               // WINMSR_FLIGHT_* of the trigger
+    ULONG Cpu;
+    LONG ThresholdC;            // 0: no temperature threshold
+    ULONG64 PostWindow;         // recorded after the trigger, same unit as sample times
+    ULONG64 TriggerTime;
+    ULONG64 FreezeTime;
+} FLIGHT_TRIGGER, *PFLIGHT_TRIGGER;
+
+VOID FlightInit(_Out_ PFLIGHT_TRIGGER Trigger, ULONG64 PostWindow, LONG ThresholdC);
+ULONG FlightReason(_In_ const FLIGHT_TRIGGER* Trigger, _In_ const WINMSR_SAMPLE_RECORD* Record, BOOLEAN LogsCleared);
+FLIGHT_ACTION FlightRecord(_Inout_ PFLIGHT_TRIGGER Trigger, _Inout_ PFLIGHT_RING Ring,
+                           _In_ const WINMSR_SAMPLE_RECORD* Record, ULONG Reason);
+ULONG FlightCopy(_In_ const FLIGHT_RING* Ring, ULONG64 Until,
+                 _Out_writes_(MaxRecords) PWINMSR_SAMPLE_RECORD Records, ULONG MaxRecords);
+VOID FlightRearm(_Inout_ PFLIGHT_TRIGGER Trigger);
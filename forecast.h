@@ -0,0 +1,132 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+
+//
+// Short-horizon temperature forecast: Holt's linear smoothing (level plus
+// slope) in fixed point, for irregularly spaced samples. The sampler updates
+// one FORECAST per CPU; readers extrapolate Level + Slope * horizon. Portable
+// and header-only so user-mode consumers of the snapshot page can use the
+// same helpers.
+//
+
+#define FORECAST_ONE                65536       // Q16 weights and state
+#define FORECAST_MAX_SLOPE          100000      // milli-degrees per second, clamp
+#define FORECAST_MAX_HORIZON_MS     10000
+#define FORECAST_MAX_GAP            (60 * FORECAST_TICKS_PER_SECOND)    // longer gaps start over
+#define FORECAST_TICKS_PER_SECOND   10000000LL  // 100 ns units
+
+typedef struct _FORECAST {
+    LONG Level;                 // smoothed temperature, milli-degrees C
+    LONG Slope;                 // milli-degrees C per second
+    LONG Prochot;               // share of readings with PROCHOT, permille, smoothed like Level
+    ULONG64 Time;               // of the last update, 0 before the first
+    ULONG64 LevelTau;           // smoothing time constants, 100 ns units
+    ULONG64 SlopeTau;
+    LONG64 LevelQ;              // the filter state in Q16; Level .. Prochot are it rounded.
+    LONG64 SlopeQ;              // Whole units would stall: at 10 ms spacing a step moves
+    LONG64 ProchotQ;            // Slope by under 1 m°C/s until it is 400 m°C/s off.
+} FORECAST, *PFORECAST;
+
+FORCEINLINE VOID ForecastInit(_Out_ PFORECAST Forecast, ULONG LevelTauMs, ULONG SlopeTauMs)
+{
+    Forecast->Level = 0;
+    Forecast->Slope = 0;
+    Forecast->Prochot = 0;
+    Forecast->Time = 0;
+    Forecast->LevelTau = 10000ULL * LevelTauMs;
+    Forecast->SlopeTau = 10000ULL * SlopeTauMs;
+    Forecast->LevelQ = 0;
+    Forecast->SlopeQ = 0;
+    Forecast->ProchotQ = 0;
+}
+
+// Q16 to the nearest whole unit
+FORCEINLINE LONG ForecastRound(LONG64 Q)
+{
+    return (LONG)((Q >= 0) ? (Q + FORECAST_ONE / 2) / FORECAST_ONE : (Q - FORECAST_ONE / 2) / FORECAST_ONE);
+}
+
+// dt / (dt + Tau) in Q16, rounded
+FORCEINLINE LONG64 ForecastWeight(LONG64 Dt, ULONG64 Tau)
+{
+    LONG64 span = Dt + (LONG64)Tau;
+    return (Dt * FORECAST_ONE + span / 2) / span;
+}
+
+// Folds in one reading taken at Time. The weights dt / (dt + tau) follow the
+// actual spacing, so skipped or striped samples weigh more. The first reading,
+// and one after more than FORECAST_MAX_GAP, start the filter over.
+FORCEINLINE VOID ForecastUpdate(_Inout_ PFORECAST Forecast, LONG MilliC, BOOLEAN Prochot, ULONG64 Time)
+{
+    LONG64 prochot = Prochot ? 1000LL * FORECAST_ONE : 0;
+
+    if (Forecast->Time != 0 && Time <= Forecast->Time) {
+        return;
+    }
+    if (Forecast->Time == 0 || Time - Forecast->Time > (ULONG64)FORECAST_MAX_GAP) {
+        Forecast->LevelQ = (LONG64)MilliC * FORECAST_ONE;
+        Forecast->SlopeQ = 0;
+        Forecast->ProchotQ = prochot;
+    }
+    else {
+        LONG64 dt = (LONG64)(Time - Forecast->Time);
+        LONG64 alpha = ForecastWeight(dt, Forecast->LevelTau);
+        LONG64 beta = ForecastWeight(dt, Forecast->SlopeTau);
+
+        // |SlopeQ| <= 2^33 and dt <= 2^30 keep the products in 64 bits
+        LONG64 predicted = Forecast->LevelQ + Forecast->SlopeQ * dt / FORECAST_TICKS_PER_SECOND;
+        LONG64 level = predicted + ((LONG64)MilliC * FORECAST_ONE - predicted) * alpha / FORECAST_ONE;
+        LONG64 observedSlope = (level - Forecast->LevelQ) * FORECAST_TICKS_PER_SECOND / dt;
+        LONG64 slope = Forecast->SlopeQ + (observedSlope - Forecast->SlopeQ) * beta / FORECAST_ONE;
+        LONG64 maxSlope = (LONG64)FORECAST_MAX_SLOPE * FORECAST_ONE;
+
+        Forecast->LevelQ = level;
+        Forecast->SlopeQ = (slope > maxSlope) ? maxSlope : (slope < -maxSlope) ? -maxSlope : slope;
+        Forecast->ProchotQ += (prochot - Forecast->ProchotQ) * alpha / FORECAST_ONE;
+    }
+    Forecast->Level = ForecastRound(Forecast->LevelQ);
+    Forecast->Slope = ForecastRound(Forecast->SlopeQ);
+    Forecast->Prochot = ForecastRound(Forecast->ProchotQ);
+    Forecast->Time = Time;
+}
+
+// Horizon limited to 0 .. FORECAST_MAX_HORIZON_MS: with |Slope| at most
+// FORECAST_MAX_SLOPE, Slope * HorizonMs then fits in 32 bits
+FORCEINLINE LONG ForecastClampHorizon(LONG HorizonMs)
+{
+    return (HorizonMs < 0) ? 0 : (HorizonMs > FORECAST_MAX_HORIZON_MS) ? FORECAST_MAX_HORIZON_MS : HorizonMs;
+}
+
+// Forecasts of Count CPUs HorizonMs (clamped to FORECAST_MAX_HORIZON_MS)
+// ahead, from level and slope arrays. Branch-free 32-bit arithmetic, so
+// compilers vectorize the loop.
+FORCEINLINE VOID ForecastAhead(_In_reads_(Count) const LONG* Level, _In_reads_(Count) const LONG* Slope,
+                               ULONG Count, LONG HorizonMs, _Out_writes_(Count) LONG* Out)
+{
+    HorizonMs = ForecastClampHorizon(HorizonMs);
+    for (ULONG i = 0; i < Count; i++) {
+        Out[i] = Level[i] + Slope[i] * HorizonMs / 1000;
+    }
+}
+
+// Milliseconds until the forecast reaches LimitMilliC: 0 if already there,
+// MAXULONG if it is not rising
+FORCEINLINE ULONG ForecastMsToLimit(LONG Level, LONG Slope, LONG LimitMilliC)
+{
+    if (Level >= LimitMilliC) {
+        return 0;
+    }
+    if (Slope <= 0) {
+        return MAXULONG;
+    }
+    LONG64 ms = ((LONG64)LimitMilliC - Level) * 1000 / Slope;
+    return (ms < MAXULONG) ? (ULONG)ms : MAXULONG - 1;
+}
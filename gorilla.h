@@ -0,0 +1,389 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+
+//
+// Gorilla-style compression of one CPU's (stamp, raw MSR word) pairs into
+// fixed-size chunks, for full-rate history kept in memory (history.h) or
+// archived from recordings. Values are stored as the XOR with the previous
+// value, stamps as their distance from a tracked sampling grid:
+//
+//   stamp            residual from Grid + Step, zigzagged and Rice-coded:
+//                    q ones, a zero and k low bits, k following the mean
+//                    residual; GORILLA_RICE_LIMIT ones and the 64-bit
+//                    distance from the previous stamp when it does not fit
+//   XOR              0 -> '0'; '10' + the bits inside the previous window of
+//                    leading/trailing zeros; '11' + 6-bit leading zeros +
+//                    6-bit length - 1 + the bits
+//
+// The grid and the spacing follow the stamps like an alpha-beta filter, so a
+// residual is the jitter of one timer fire, not the difference of two as with
+// plain delta-of-delta. A spacing change (idle deferral, a new session)
+// costs one escape.
+//
+// Bits are packed LSB first into 64-bit words. Chunks are independent: each
+// starts with its first stamp, the tracked spacing and the mean residual in
+// the header and its first value in full, so old chunks can be dropped one at
+// a time. Portable and header-only.
+//
+
+#define GORILLA_CHUNK_BYTES         4096
+#define GORILLA_RICE_LIMIT          16
+#define GORILLA_MAX_RICE_BITS       47
+#define GORILLA_MAX_SAMPLE_BITS     ((GORILLA_RICE_LIMIT + 64) + (2 + 12 + 64))
+
+// Grid and spacing gains: 1/GORILLA_GRID_GAIN and 1/GORILLA_STEP_GAIN of each residual
+#define GORILLA_GRID_GAIN           8
+#define GORILLA_STEP_GAIN           256
+#define GORILLA_MAX_STEP            (1LL << 54)
+
+typedef struct _GORILLA_CHUNK_HEADER {
+    ULONG Count;                // samples in the chunk
+    ULONG Bits;                 // bits used after the header
+    ULONG64 FirstStamp;
+    ULONG64 LastStamp;
+    LONG64 Step;                // tracked spacing at the first stamp, 1/256 units
+    ULONG64 Mean;               // mean zigzagged residual at the first stamp, 1/16 units
+} GORILLA_CHUNK_HEADER, *PGORILLA_CHUNK_HEADER;
+
+#define GORILLA_CHUNK_WORDS     ((GORILLA_CHUNK_BYTES - sizeof(GORILLA_CHUNK_HEADER)) / sizeof(ULONG64))
+
+// Stamp model, advanced the same way by the encoder and the decoder
+typedef struct _GORILLA_TRACK {
+    ULONG64 Stamp;              // previous stamp
+    ULONG64 Grid;               // where the previous stamp was expected, corrected by it
+    LONG64 Step;                // spacing, 1/256 units
+    ULONG64 Mean;               // mean zigzagged residual, 1/16 units
+} GORILLA_TRACK, *PGORILLA_TRACK;
+
+// Appending state; lives beside the chunk while it is being filled
+typedef struct _GORILLA_ENCODER {
+    PGORILLA_CHUNK_HEADER Chunk;
+    PULONG64 Words;
+    GORILLA_TRACK Track;
+    ULONG64 Value;
+    ULONG Leading;              // window of the previous XOR, 64 before the first
+    ULONG Trailing;
+} GORILLA_ENCODER, *PGORILLA_ENCODER;
+
+typedef struct _GORILLA_DECODER {
+    const ULONG64* Words;
+    ULONG Bits;                 // bits in the chunk
+    ULONG Position;
+    ULONG Remaining;            // samples not decoded yet
+    BOOLEAN First;
+    GORILLA_TRACK Track;
+    ULONG64 Value;
+    ULONG Leading;
+    ULONG Trailing;
+} GORILLA_DECODER, *PGORILLA_DECODER;
+
+FORCEINLINE ULONG64 GorillaPredict(_In_ const GORILLA_TRACK* Track)
+{
+    return Track->Grid + (ULONG64)(Track->Step / 256);
+}
+
+// Rice parameter: the bit length of 2/3 of the mean residual, close to
+// log2(ln 2 * mean) which is best for geometric residuals and one bit short of
+// the range of uniform ones
+FORCEINLINE ULONG GorillaRiceBits(_In_ const GORILLA_TRACK* Track)
+{
+    ULONG64 mean = Track->Mean / 24;
+    ULONG bit;
+
+    if (mean == 0) {
+        return 0;
+    }
+    _BitScanReverse64(&bit, mean);
+    return min(bit + 1, GORILLA_MAX_RICE_BITS);
+}
+
+FORCEINLINE ULONG64 GorillaZigzag(LONG64 Value)
+{
+    return ((ULONG64)Value << 1) ^ (ULONG64)(Value >> 63);
+}
+
+FORCEINLINE LONG64 GorillaUnzigzag(ULONG64 Value)
+{
+    return (LONG64)(Value >> 1) ^ -(LONG64)(Value & 1);
+}
+
+// Moves the model on to Stamp, which was Residual from the prediction.
+// After an escape the grid restarts at Stamp, and so does the spacing if the
+// residual was a sizable part of it.
+FORCEINLINE VOID GorillaTrack(_Inout_ PGORILLA_TRACK Track, ULONG64 Stamp, LONG64 Residual, BOOLEAN Escaped)
+{
+    ULONG64 zigzag = GorillaZigzag(Residual);
+
+    if (!Escaped) {
+        Track->Grid = GorillaPredict(Track) + (ULONG64)(Residual / GORILLA_GRID_GAIN);
+        Track->Step += Residual * (256 / GORILLA_STEP_GAIN);
+    }
+    else {
+        ULONG64 magnitude = (Residual < 0) ? (ULONG64)0 - (ULONG64)Residual : (ULONG64)Residual;
+        ULONG64 step = (Track->Step < 0) ? (ULONG64)0 - (ULONG64)Track->Step : (ULONG64)Track->Step;
+        if (magnitude >= step / 1024) {
+            LONG64 delta = (LONG64)(Stamp - Track->Stamp);
+            Track->Step = max(min(delta, GORILLA_MAX_STEP), -GORILLA_MAX_STEP) * 256;
+        }
+        Track->Grid = Stamp;
+    }
+    Track->Mean += min(zigzag, 1ULL << 50) - Track->Mean / 16;
+    Track->Stamp = Stamp;
+}
+
+FORCEINLINE VOID GorillaPut(_Inout_ PGORILLA_ENCODER Encoder, ULONG64 Value, ULONG Count)
+{
+    ULONG position = Encoder->Chunk->Bits;
+    ULONG word = position >> 6;
+    ULONG shift = position & 63;
+
+    if (Count < 64) {
+        Value &= (1ULL << Count) - 1;
+    }
+    Encoder->Words[word] |= Value << shift;
+    if (shift != 0 && shift + Count > 64) {
+        Encoder->Words[word + 1] = Value >> (64 - shift);
+    }
+    else if (shift + Count == 64) {
+        Encoder->Words[word + 1] = 0;
+    }
+    Encoder->Chunk->Bits = position + Count;
+}
+
+// Reads Count bits; FALSE past the end of the chunk
+FORCEINLINE BOOLEAN GorillaGet(_Inout_ PGORILLA_DECODER Decoder, ULONG Count, _Out_ PULONG64 Value)
+{
+    ULONG position = Decoder->Position;
+    ULONG word = position >> 6;
+    ULONG shift = position & 63;
+
+    if (position > Decoder->Bits || Count > Decoder->Bits - position) {
+        return FALSE;
+    }
+    if (Count == 0) {
+        *Value = 0;
+        return TRUE;
+    }
+    ULONG64 value = Decoder->Words[word] >> shift;
+    if (shift != 0 && shift + Count > 64) {
+        value |= Decoder->Words[word + 1] << (64 - shift);
+    }
+    if (Count < 64) {
+        value &= (1ULL << Count) - 1;
+    }
+    *Value = value;
+    Decoder->Position = position + Count;
+    return TRUE;
+}
+
+// Starts an empty chunk in Buffer (GORILLA_CHUNK_BYTES bytes). Period is the
+// expected spacing of the stamps, 0 if not known.
+FORCEINLINE VOID GorillaEncodeBegin(_Out_ PGORILLA_ENCODER Encoder, _Out_writes_bytes_(GORILLA_CHUNK_BYTES) PVOID Buffer,
+                                    ULONG64 Period)
+{
+    Encoder->Chunk = (PGORILLA_CHUNK_HEADER)Buffer;
+    Encoder->Words = (PULONG64)(Encoder->Chunk + 1);
+    Encoder->Chunk->Count = 0;
+    Encoder->Chunk->Bits = 0;
+    Encoder->Chunk->FirstStamp = 0;
+    Encoder->Chunk->LastStamp = 0;
+    Encoder->Chunk->Step = 0;
+    Encoder->Chunk->Mean = 0;
+    Encoder->Words[0] = 0;
+    Encoder->Track.Stamp = 0;
+    Encoder->Track.Grid = 0;
+    Encoder->Track.Step = (LONG64)min(Period, (ULONG64)GORILLA_MAX_STEP) * 256;
+    Encoder->Track.Mean = 0;
+    Encoder->Value = 0;
+    Encoder->Leading = 64;
+    Encoder->Trailing = 64;
+}
+
+// Starts the next chunk of the same series in Buffer, carrying on with the
+// spacing and residual size the full chunk had learned
+FORCEINLINE VOID GorillaEncodeNext(_Inout_ PGORILLA_ENCODER Encoder, _Out_writes_bytes_(GORILLA_CHUNK_BYTES) PVOID Buffer)
+{
+    GORILLA_TRACK track = Encoder->Track;
+
+    GorillaEncodeBegin(Encoder, Buffer, 0);
+    Encoder->Track.Step = track.Step;
+    Encoder->Track.Mean = track.Mean;
+}
+
+// Appends one sample. FALSE once the chunk is full: start the next one.
+FORCEINLINE BOOLEAN GorillaEncode(_Inout_ PGORILLA_ENCODER Encoder, ULONG64 Stamp, ULONG64 Value)
+{
+    PGORILLA_CHUNK_HEADER chunk = Encoder->Chunk;
+    PGORILLA_TRACK track = &Encoder->Track;
+
+    if (chunk->Bits + GORILLA_MAX_SAMPLE_BITS > (GORILLA_CHUNK_WORDS - 1) * 64) {
+        return FALSE;
+    }
+
+    if (chunk->Count == 0) {
+        chunk->FirstStamp = Stamp;
+        chunk->Step = track->Step;
+        chunk->Mean = track->Mean;
+        track->Stamp = Stamp;
+        track->Grid = Stamp;
+        GorillaPut(Encoder, Value, 64);
+    }
+    else {
+        LONG64 residual = (LONG64)(Stamp - GorillaPredict(track));
+        ULONG64 zigzag = GorillaZigzag(residual);
+        ULONG k = GorillaRiceBits(track);
+        ULONG64 q = zigzag >> k;
+
+        if (q < GORILLA_RICE_LIMIT) {
+            GorillaPut(Encoder, (1ULL << q) - 1, (ULONG)q + 1);
+            GorillaPut(Encoder, zigzag, k);
+        }
+        else {
+            GorillaPut(Encoder, (1ULL << GORILLA_RICE_LIMIT) - 1, GORILLA_RICE_LIMIT);
+            GorillaPut(Encoder, Stamp - track->Stamp, 64);
+        }
+        GorillaTrack(track, Stamp, residual, q >= GORILLA_RICE_LIMIT);
+
+        ULONG64 xor = Value ^ Encoder->Value;
+        if (xor == 0) {
+            GorillaPut(Encoder, 0, 1);
+        }
+        else {
+            ULONG leading;
+            ULONG trailing;
+            _BitScanReverse64(&leading, xor);
+            _BitScanForward64(&trailing, xor);
+            leading = 63 - leading;
+
+            if (leading >= Encoder->Leading && trailing >= Encoder->Trailing) {
+                GorillaPut(Encoder, 0x1, 2);
+                GorillaPut(Encoder, xor >> Encoder->Trailing, 64 - Encoder->Leading - Encoder->Trailing);
+            }
+            else {
+                ULONG length = 64 - leading - trailing;
+                GorillaPut(Encoder, 0x3, 2);
+                GorillaPut(Encoder, leading, 6);
+                GorillaPut(Encoder, length - 1, 6);
+                GorillaPut(Encoder, xor >> trailing, length);
+                Encoder->Leading = leading;
+                Encoder->Trailing = trailing;
+            }
+        }
+    }
+
+    Encoder->Value = Value;
+    chunk->LastStamp = Stamp;
+    chunk->Count++;
+    return TRUE;
+}
+
+// Checks the header of a chunk of Size bytes; FALSE if it does not fit
+FORCEINLINE BOOLEAN GorillaDecodeBegin(_Out_ PGORILLA_DECODER Decoder, _In_reads_bytes_(Size) const VOID* Buffer, ULONG Size)
+{
+    const GORILLA_CHUNK_HEADER* chunk = (const GORILLA_CHUNK_HEADER*)Buffer;
+
+    if (Size < GORILLA_CHUNK_BYTES || chunk->Bits > GORILLA_CHUNK_WORDS * 64) {
+        return FALSE;
+    }
+    Decoder->Words = (const ULONG64*)(chunk + 1);
+    Decoder->Bits = chunk->Bits;
+    Decoder->Position = 0;
+    Decoder->Remaining = chunk->Count;
+    Decoder->First = TRUE;
+    Decoder->Track.Stamp = chunk->FirstStamp;
+    Decoder->Track.Grid = chunk->FirstStamp;
+    Decoder->Track.Step = chunk->Step;
+    Decoder->Track.Mean = chunk->Mean;
+    Decoder->Value = 0;
+    Decoder->Leading = 64;
+    Decoder->Trailing = 64;
+    return TRUE;
+}
+
+// Next sample of the chunk; FALSE at the end or on a damaged chunk
+FORCEINLINE BOOLEAN GorillaDecode(_Inout_ PGORILLA_DECODER Decoder, _Out_ PULONG64 Stamp, _Out_ PULONG64 Value)
+{
+    PGORILLA_TRACK track = &Decoder->Track;
+    ULONG64 bits;
+
+    if (Decoder->Remaining == 0) {
+        return FALSE;
+    }
+
+    if (Decoder->First) {
+        if (!GorillaGet(Decoder, 64, &Decoder->Value)) {
+            return FALSE;
+        }
+        Decoder->First = FALSE;
+    }
+    else {
+        // Stamp: the unary quotient, at most GORILLA_RICE_LIMIT ones
+        ULONG64 predicted = GorillaPredict(track);
+        ULONG q = 0;
+        while (q < GORILLA_RICE_LIMIT) {
+            if (!GorillaGet(Decoder, 1, &bits)) {
+                return FALSE;
+            }
+            if (bits == 0) {
+                break;
+            }
+            q++;
+        }
+
+        if (q < GORILLA_RICE_LIMIT) {
+            ULONG k = GorillaRiceBits(track);
+            if (!GorillaGet(Decoder, k, &bits)) {
+                return FALSE;
+            }
+            LONG64 residual = GorillaUnzigzag(((ULONG64)q << k) | bits);
+            GorillaTrack(track, predicted + (ULONG64)residual, residual, FALSE);
+        }
+        else {
+            if (!GorillaGet(Decoder, 64, &bits)) {
+                return FALSE;
+            }
+            ULONG64 stamp = track->Stamp + bits;
+            GorillaTrack(track, stamp, (LONG64)(stamp - predicted), TRUE);
+        }
+
+        // Value
+        if (!GorillaGet(Decoder, 1, &bits)) {
+            return FALSE;
+        }
+        if (bits != 0) {
+            if (!GorillaGet(Decoder, 1, &bits)) {
+                return FALSE;
+            }
+            if (bits != 0) {
+                ULONG64 leading;
+                ULONG64 length;
+                if (!GorillaGet(Decoder, 6, &leading) || !GorillaGet(Decoder, 6, &length) ||
+                    leading + length + 1 > 64) {
+                    return FALSE;
+                }
+                Decoder->Leading = (ULONG)leading;
+                Decoder->Trailing = (ULONG)(64 - leading - length - 1);
+            }
+            else if (Decoder->Leading == 64) {
+                return FALSE;
+            }
+            if (!GorillaGet(Decoder, 64 - Decoder->Leading - Decoder->Trailing, &bits)) {
+                return FALSE;
+            }
+            Decoder->Value ^= bits << Decoder->Trailing;
+        }
+    }
+
+    *Stamp = track->Stamp;
+    *Value = Decoder->Value;
+    Decoder->Remaining--;
+    return TRUE;
+}
@@ -0,0 +1,353 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "public.h"
+#include "snapshot.h"
+
+//
+// Per-die heat map built from the mapped snapshot page: one cell per
+// physical core, grouped by die, with the temperature gradient of each core
+// against its neighbours. Header-only like rank.h. The layout is resolved
+// once from the static topology in the page; after that HeatMapUpdate only
+// copies entries whose sequence moved and recomputes the dies they belong
+// to. No allocation: the caller owns the HEATMAP.
+//
+// Neighbours are the adjacent cores in enumeration order within a die. The
+// OS does not report the floorplan, and on current parts enumeration order
+// follows the ring or mesh position closely enough to show a hot or cold
+// region.
+//
+
+#define HEATMAP_MAX_CPUS            2048
+#define HEATMAP_INVALID             MINLONG
+
+// Cell flags
+#define HEATMAP_CELL_HOT            0x1     // warmer than its neighbours by GradientC or more
+#define HEATMAP_CELL_COLD           0x2     // cooler than its neighbours by GradientC or more
+#define HEATMAP_CELL_IDLE           0x4     // last known value of an idle CPU
+
+// Die flags
+#define HEATMAP_DIE_UNEVEN          0x1     // hottest minus coolest core is SpreadC or more
+
+typedef struct _HEATMAP_CELL {
+    USHORT Core;                // core leader CPU index
+    USHORT Die;                 // index into HEATMAP.Die
+    LONG Temperature;           // hottest CPU of the core, degrees C, HEATMAP_INVALID if none
+    LONG Gradient;              // Temperature minus the mean of its neighbours, degrees C
+    ULONG Flags;                // HEATMAP_CELL_*
+} HEATMAP_CELL, *PHEATMAP_CELL;
+
+typedef struct _HEATMAP_DIE {
+    USHORT Leader;              // die leader CPU index
+    USHORT Package;             // package leader CPU index
+    USHORT FirstCell;
+    USHORT Cells;
+    LONG Min;                   // degrees C over valid cells, HEATMAP_INVALID if none
+    LONG Max;
+    LONG Mean;
+    ULONG Flags;                // HEATMAP_DIE_*
+} HEATMAP_DIE, *PHEATMAP_DIE;
+
+typedef struct _HEATMAP {
+    LONG GradientC;             // thresholds, set by HeatMapInit
+    LONG SpreadC;
+    ULONG CpuCount;             // 0 until the layout is built
+    ULONG CellCount;
+    ULONG DieCount;
+    ULONG64 Time;               // newest sample time seen
+    LONG Seen[HEATMAP_MAX_CPUS];            // last sequence copied per CPU
+    LONG CpuTemperature[HEATMAP_MAX_CPUS];  // last reading per CPU, HEATMAP_INVALID if none
+    ULONG CpuFlags[HEATMAP_MAX_CPUS];       // WINMSR_SNAPSHOT_* per CPU
+    USHORT CellOf[HEATMAP_MAX_CPUS];        // cell of each CPU
+    UCHAR DieDirty[HEATMAP_MAX_CPUS];
+    HEATMAP_CELL Cell[HEATMAP_MAX_CPUS];
+    HEATMAP_DIE Die[HEATMAP_MAX_CPUS];
+} HEATMAP, *PHEATMAP;
+
+FORCEINLINE VOID HeatMapInit(_Out_ PHEATMAP Map, LONG GradientC, LONG SpreadC)
+{
+    Map->GradientC = GradientC;
+    Map->SpreadC = SpreadC;
+    Map->CpuCount = 0;
+    Map->CellCount = 0;
+    Map->DieCount = 0;
+    Map->Time = 0;
+}
+
+// Cells ordered by die, then by core. Dies are numbered in order of their
+// leader; leaders are the lowest CPU index of their group, so one pass in
+// CPU order sees every die before any of its later cores.
+FORCEINLINE VOID HeatMapBuildLayout(_Inout_ PHEATMAP Map, _In_ const WINMSR_SNAPSHOT_PAGE* Page)
+{
+    ULONG count = (Page->CpuCount < HEATMAP_MAX_CPUS) ? Page->CpuCount : HEATMAP_MAX_CPUS;
+    USHORT* dieOf = (USHORT*)Map->CellOf;       // CPU -> die slot, while building
+
+    Map->DieCount = 0;
+    Map->CellCount = 0;
+
+    // Dies and their core counts
+    for (ULONG i = 0; i < count; i++) {
+        const WINMSR_CPU_SNAPSHOT* entry = SnapshotCpu(Page, i);
+        ULONG die = (entry->Die < count) ? entry->Die : i;
+        if (die == i) {
+            PHEATMAP_DIE d = &Map->Die[Map->DieCount];
+            d->Leader = (USHORT)i;
+            d->Package = entry->Package;
+            d->Cells = 0;
+            dieOf[i] = (USHORT)Map->DieCount++;
+        }
+        else {
+            dieOf[i] = dieOf[die];
+        }
+        if (entry->Core >= count || entry->Core == i) {
+            Map->Die[dieOf[i]].Cells++;
+        }
+    }
+
+    USHORT next[HEATMAP_MAX_CPUS];
+    ULONG first = 0;
+    for (ULONG d = 0; d < Map->DieCount; d++) {
+        Map->Die[d].FirstCell = (USHORT)first;
+        next[d] = (USHORT)first;
+        first += Map->Die[d].Cells;
+        Map->DieDirty[d] = 1;
+    }
+    Map->CellCount = first;
+
+    // Core leaders get a cell; SMT siblings share their leader's
+    for (ULONG i = 0; i < count; i++) {
+        const WINMSR_CPU_SNAPSHOT* entry = SnapshotCpu(Page, i);
+        ULONG die = dieOf[i];
+        if (entry->Core >= count || entry->Core == i) {
+            PHEATMAP_CELL cell = &Map->Cell[next[die]];
+            cell->Core = (USHORT)i;
+            cell->Die = (USHORT)die;
+            cell->Temperature = HEATMAP_INVALID;
+            cell->Gradient = 0;
+            cell->Flags = 0;
+            dieOf[i] = next[die]++;         // now the CPU's cell
+        }
+        else {
+            dieOf[i] = dieOf[entry->Core];  // the leader's cell, resolved above
+        }
+        Map->Seen[i] = -1;
+        Map->CpuTemperature[i] = HEATMAP_INVALID;
+        Map->CpuFlags[i] = 0;
+    }
+    Map->CpuCount = count;
+}
+
+// Recomputes the cells and summary of one die
+FORCEINLINE VOID HeatMapUpdateDie(_Inout_ PHEATMAP Map, ULONG DieIndex)
+{
+    PHEATMAP_DIE die = &Map->Die[DieIndex];
+    PHEATMAP_CELL cells = &Map->Cell[die->FirstCell];
+    LONG sum = 0;
+    ULONG valid = 0;
+
+    die->Min = HEATMAP_INVALID;
+    die->Max = HEATMAP_INVALID;
+    die->Mean = HEATMAP_INVALID;
+    die->Flags = 0;
+
+    for (ULONG k = 0; k < die->Cells; k++) {
+        LONG t = cells[k].Temperature;
+        if (t == HEATMAP_INVALID) {
+            continue;
+        }
+        die->Min = (valid == 0 || t < die->Min) ? t : die->Min;
+        die->Max = (valid == 0 || t > die->Max) ? t : die->Max;
+        sum += t;
+        valid++;
+    }
+    if (valid != 0) {
+        die->Mean = sum / (LONG)valid;
+        if (die->Max - die->Min >= Map->SpreadC) {
+            die->Flags |= HEATMAP_DIE_UNEVEN;
+        }
+    }
+
+    for (ULONG k = 0; k < die->Cells; k++) {
+        PHEATMAP_CELL cell = &cells[k];
+        LONG neighbours = 0;
+        LONG n = 0;
+
+        cell->Flags &= HEATMAP_CELL_IDLE;
+        cell->Gradient = 0;
+        if (cell->Temperature == HEATMAP_INVALID) {
+            continue;
+        }
+        if (k > 0 && cells[k - 1].Temperature != HEATMAP_INVALID) {
+            neighbours += cells[k - 1].Temperature;
+            n++;
+        }
+        if (k + 1 < die->Cells && cells[k + 1].Temperature != HEATMAP_INVALID) {
+            neighbours += cells[k + 1].Temperature;
+            n++;
+        }
+        if (n == 0) {
+            continue;
+        }
+        cell->Gradient = cell->Temperature - neighbours / n;
+        if (cell->Gradient >= Map->GradientC) {
+            cell->Flags |= HEATMAP_CELL_HOT;
+        }
+        else if (cell->Gradient <= -Map->GradientC) {
+            cell->Flags |= HEATMAP_CELL_COLD;
+        }
+    }
+}
+
+// Brings the map up to date with the page. Call once per sweep (or as often
+// as wanted); unchanged CPUs cost one load of their sequence. Returns the
+// number of CPUs that changed.
+FORCEINLINE ULONG HeatMapUpdate(_Inout_ PHEATMAP Map, _In_ const WINMSR_SNAPSHOT_PAGE* Page)
+{
+    ULONG changed = 0;
+
+    if (Map->CpuCount == 0) {
+        HeatMapBuildLayout(Map, Page);
+    }
+
+    for (ULONG i = 0; i < Map->CpuCount; i++) {
+        const WINMSR_CPU_SNAPSHOT* entry = SnapshotCpu(Page, i);
+        WINMSR_CPU_SNAPSHOT copy;
+
+        if (ReadAcquire(&entry->Sequence) == Map->Seen[i] || !SnapshotTryRead(entry, &copy)) {
+            continue;       // unchanged, or mid-update: picked up next time
+        }
+        Map->Seen[i] = copy.Sequence;
+        Map->CpuTemperature[i] = (copy.Time != 0 && copy.Temperature >= 0) ? copy.Temperature : HEATMAP_INVALID;
+        Map->CpuFlags[i] = copy.Flags;
+        Map->Time = (copy.Time > Map->Time) ? copy.Time : Map->Time;
+        Map->DieDirty[Map->Cell[Map->CellOf[i]].Die] = 1;
+        changed++;
+    }
+    if (changed == 0) {
+        return 0;
+    }
+
+    // Cell temperature: hottest CPU of the core. Idle only if all of them are.
+    for (ULONG c = 0; c < Map->CellCount; c++) {
+        if (Map->DieDirty[Map->Cell[c].Die]) {
+            Map->Cell[c].Temperature = HEATMAP_INVALID;
+            Map->Cell[c].Flags = HEATMAP_CELL_IDLE;
+        }
+    }
+    for (ULONG i = 0; i < Map->CpuCount; i++) {
+        PHEATMAP_CELL cell = &Map->Cell[Map->CellOf[i]];
+        if (!Map->DieDirty[cell->Die]) {
+            continue;
+        }
+        if (Map->CpuTemperature[i] != HEATMAP_INVALID &&
+            (cell->Temperature == HEATMAP_INVALID || Map->CpuTemperature[i] > cell->Temperature)) {
+            cell->Temperature = Map->CpuTemperature[i];
+        }
+        if (!(Map->CpuFlags[i] & WINMSR_SNAPSHOT_IDLE)) {
+            cell->Flags &= ~HEATMAP_CELL_IDLE;
+        }
+    }
+    for (ULONG d = 0; d < Map->DieCount; d++) {
+        if (Map->DieDirty[d]) {
+            HeatMapUpdateDie(Map, d);
+            Map->DieDirty[d] = 0;
+        }
+    }
+    return changed;
+}
+
+//
+// Compact binary frame for dashboards, little-endian, no padding:
+//   HEATMAP_FRAME_HEADER
+//   HEATMAP_FRAME_DIE[DieCount]
+//   HEATMAP_FRAME_CELL[CellCount], die by die in core order
+// 4 bytes per core; a 128-core, 2-die host is 16 + 2 * 8 + 128 * 4 = 544 bytes.
+//
+
+#define HEATMAP_FRAME_MAGIC         0x4D485057  // 'WPHM'
+#define HEATMAP_FRAME_VERSION       1
+#define HEATMAP_FRAME_NO_READING    0xFF
+
+#pragma pack(push, 1)
+typedef struct _HEATMAP_FRAME_HEADER {
+    ULONG Magic;
+    UCHAR Version;
+    UCHAR Reserved;
+    USHORT DieCount;
+    ULONG64 Time;               // newest sample time in the frame, interrupt time
+} HEATMAP_FRAME_HEADER;
+
+typedef struct _HEATMAP_FRAME_DIE {
+    USHORT Leader;
+    USHORT Cells;
+    UCHAR Min;                  // degrees C, HEATMAP_FRAME_NO_READING if none
+    UCHAR Max;
+    UCHAR Mean;
+    UCHAR Flags;                // HEATMAP_DIE_*
+} HEATMAP_FRAME_DIE;
+
+typedef struct _HEATMAP_FRAME_CELL {
+    USHORT Core;
+    UCHAR Temperature;          // degrees C, HEATMAP_FRAME_NO_READING if none
+    UCHAR GradientFlags;        // low 5 bits: gradient + 16 clamped to 0..31; high 3: HEATMAP_CELL_*
+} HEATMAP_FRAME_CELL;
+#pragma pack(pop)
+
+FORCEINLINE UCHAR HeatMapFrameTemperature(LONG Temperature)
+{
+    if (Temperature == HEATMAP_INVALID) {
+        return HEATMAP_FRAME_NO_READING;
+    }
+    return (UCHAR)((Temperature < 0) ? 0 : (Temperature > 254) ? 254 : Temperature);
+}
+
+FORCEINLINE ULONG HeatMapFrameSize(_In_ const HEATMAP* Map)
+{
+    return sizeof(HEATMAP_FRAME_HEADER) + Map->DieCount * sizeof(HEATMAP_FRAME_DIE) +
+           Map->CellCount * sizeof(HEATMAP_FRAME_CELL);
+}
+
+// Writes the current map as one frame. Returns the bytes written, or 0 if
+// Size is smaller than HeatMapFrameSize().
+FORCEINLINE ULONG HeatMapEncodeFrame(_In_ const HEATMAP* Map, _Out_writes_bytes_(Size) PVOID Buffer, ULONG Size)
+{
+    ULONG needed = HeatMapFrameSize(Map);
+    if (Size < needed) {
+        return 0;
+    }
+
+    HEATMAP_FRAME_HEADER* header = (HEATMAP_FRAME_HEADER*)Buffer;
+    HEATMAP_FRAME_DIE* dies = (HEATMAP_FRAME_DIE*)(header + 1);
+    HEATMAP_FRAME_CELL* cells = (HEATMAP_FRAME_CELL*)(dies + Map->DieCount);
+
+    header->Magic = HEATMAP_FRAME_MAGIC;
+    header->Version = HEATMAP_FRAME_VERSION;
+    header->Reserved = 0;
+    header->DieCount = (USHORT)Map->DieCount;
+    header->Time = Map->Time;
+
+    for (ULONG d = 0; d < Map->DieCount; d++) {
+        dies[d].Leader = Map->Die[d].Leader;
+        dies[d].Cells = Map->Die[d].Cells;
+        dies[d].Min = HeatMapFrameTemperature(Map->Die[d].Min);
+        dies[d].Max = HeatMapFrameTemperature(Map->Die[d].Max);
+        dies[d].Mean = HeatMapFrameTemperature(Map->Die[d].Mean);
+        dies[d].Flags = (UCHAR)Map->Die[d].Flags;
+    }
+
+    for (ULONG c = 0; c < Map->CellCount; c++) {
+        LONG gradient = Map->Cell[c].Gradient + 16;
+        gradient = (gradient < 0) ? 0 : (gradient > 31) ? 31 : gradient;
+        cells[c].Core = Map->Cell[c].Core;
+        cells[c].Temperature = HeatMapFrameTemperature(Map->Cell[c].Temperature);
+        cells[c].GradientFlags = (UCHAR)(gradient | (Map->Cell[c].Flags << 5));
+    }
+    return needed;
+}
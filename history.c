@@ -0,0 +1,90 @@
+#include "history.h"
+
+static PUCHAR HistorySlot(_In_ const HISTORY_RING* Ring, ULONG64 Chunk)
+{
+    return Ring->Chunks + (SIZE_T)(Chunk % Ring->Capacity) * GORILLA_CHUNK_BYTES;
+}
+
+// Buffer holds the chunks, then their stamps. Period is the expected spacing
+// of the stamps, 0 if not known. FALSE if Capacity is too small to ever hand
+// out a chunk.
+BOOLEAN HistoryInit(_Out_ PHISTORY_RING Ring, _Out_writes_bytes_(HISTORY_BYTES(Capacity)) PVOID Buffer,
+                    ULONG Capacity, ULONG64 Period)
+{
+    RtlZeroMemory(Ring, sizeof(*Ring));
+    if (Capacity < HISTORY_MIN_CHUNKS) {
+        return FALSE;
+    }
+
+    Ring->Chunks = (PUCHAR)Buffer;
+    Ring->Stamps = (volatile LONG64*)(Ring->Chunks + (SIZE_T)Capacity * GORILLA_CHUNK_BYTES);
+    Ring->Capacity = Capacity;
+    RtlZeroMemory((PVOID)Ring->Stamps, Capacity * sizeof(LONG64));
+    GorillaEncodeBegin(&Ring->Encoder, Ring->Chunks, Period);
+    return TRUE;
+}
+
+// Owner only. When the open chunk is full it is stamped and counted, and the
+// next one opens in the oldest slot, whose stamp is cleared first. Never waits.
+VOID HistoryAppend(_Inout_ PHISTORY_RING Ring, ULONG64 Stamp, ULONG64 Value)
+{
+    if (GorillaEncode(&Ring->Encoder, Stamp, Value)) {
+        return;
+    }
+
+    ULONG64 sealed = (ULONG64)ReadNoFence64(&Ring->Sealed);
+    WriteRelease64(&Ring->Stamps[sealed % Ring->Capacity], (LONG64)(sealed + 1));
+    WriteRelease64(&Ring->Sealed, (LONG64)(sealed + 1));
+
+    WriteNoFence64(&Ring->Stamps[(sealed + 1) % Ring->Capacity], 0);
+    MemoryBarrier();
+    GorillaEncodeNext(&Ring->Encoder, HistorySlot(Ring, sealed + 1));
+    GorillaEncode(&Ring->Encoder, Stamp, Value);
+}
+
+// Copies up to MaxChunks sealed chunks from chunk number *Cursor on and
+// advances *Cursor past them. Chunks already reused are skipped and counted
+// in *Lost. A cursor of 0 starts at the oldest chunk still held.
+ULONG HistoryRead(_In_ const HISTORY_RING* Ring, _Inout_ PULONG64 Cursor,
+                  _Out_writes_bytes_(MaxChunks * GORILLA_CHUNK_BYTES) PVOID Chunks, ULONG MaxChunks,
+                  _Out_ PULONG64 Lost)
+{
+    ULONG64 cursor = *Cursor;
+    ULONG64 sealed = (ULONG64)ReadAcquire64(&Ring->Sealed);
+    ULONG count = 0;
+
+    *Lost = 0;
+    if (Ring->Chunks == NULL) {
+        return 0;
+    }
+
+    // The open chunk takes one slot, so Capacity - 1 sealed ones are held
+    while (count < MaxChunks && cursor < sealed) {
+        if (sealed - cursor > Ring->Capacity - 1) {
+            *Lost += sealed - (Ring->Capacity - 1) - cursor;
+            cursor = sealed - (Ring->Capacity - 1);
+        }
+
+        volatile LONG64* stamp = &Ring->Stamps[cursor % Ring->Capacity];
+        if ((ULONG64)ReadAcquire64(stamp) == cursor + 1) {
+            RtlCopyMemory((PUCHAR)Chunks + (SIZE_T)count * GORILLA_CHUNK_BYTES, HistorySlot(Ring, cursor),
+                          GORILLA_CHUNK_BYTES);
+            MemoryBarrier();
+            if ((ULONG64)ReadAcquire64(stamp) == cursor + 1) {
+                count++;
+                cursor++;
+                continue;
+            }
+        }
+
+        // Reused while copying: the slot now holds the open chunk
+        sealed = (ULONG64)ReadAcquire64(&Ring->Sealed);
+        ULONG64 oldest = (sealed > Ring->Capacity - 1) ? sealed - (Ring->Capacity - 1) : 0;
+        ULONG64 next = (oldest > cursor + 1) ? oldest : cursor + 1;
+        *Lost += next - cursor;
+        cursor = next;
+    }
+
+    *Cursor = cursor;
+    return count;
+}
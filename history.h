@@ -0,0 +1,41 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "public.h"
+#include "gorilla.h"
+
+//
+// Full-rate history of one CPU: every sample's (interrupt time, raw
+// IA32_THERM_STATUS) compressed into a ring of gorilla.h chunks. The owner
+// appends to the open chunk and seals it when full; readers copy sealed
+// chunks only and, like RingRead, detect on their own when a slot was reused
+// under them. Portable: no kernel calls, no allocation.
+//
+
+C_ASSERT(WINMSR_HISTORY_CHUNK_BYTES == GORILLA_CHUNK_BYTES);
+
+// Buffer HistoryInit needs for Capacity chunks
+#define HISTORY_BYTES(Capacity)     ((SIZE_T)(Capacity) * (GORILLA_CHUNK_BYTES + sizeof(LONG64)))
+#define HISTORY_MIN_CHUNKS          2
+
+typedef struct _HISTORY_RING {
+    PUCHAR Chunks;                  // [Capacity] chunks, NULL if the history is off
+    volatile LONG64* Stamps;        // [Capacity] chunk number + 1 once sealed, 0 while written
+    ULONG Capacity;
+    volatile LONG64 Sealed;         // chunks sealed so far; chunk n is in slot n % Capacity
+    GORILLA_ENCODER Encoder;        // owner-only: fills chunk number Sealed
+} HISTORY_RING, *PHISTORY_RING;
+
+BOOLEAN HistoryInit(_Out_ PHISTORY_RING Ring, _Out_writes_bytes_(HISTORY_BYTES(Capacity)) PVOID Buffer,
+                    ULONG Capacity, ULONG64 Period);
+VOID HistoryAppend(_Inout_ PHISTORY_RING Ring, ULONG64 Stamp, ULONG64 Value);
+ULONG HistoryRead(_In_ const HISTORY_RING* Ring, _Inout_ PULONG64 Cursor,
+                  _Out_writes_bytes_(MaxChunks * GORILLA_CHUNK_BYTES) PVOID Chunks, ULONG MaxChunks,
+                  _Out_ PULONG64 Lost);
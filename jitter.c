@@ -0,0 +1,149 @@
+#include "jitter.h"
+
+#define SWEEP_GEN_SHIFT         (SWEEP_VALUE_BITS + SWEEP_TAG_BITS)
+#define SWEEP_PACK(Gen, Tag, Value) \
+    ((LONG64)((((ULONG64)(Gen) & 0xFF) << SWEEP_GEN_SHIFT) | ((Tag) << SWEEP_VALUE_BITS) | ((Value) & SWEEP_VALUE_MASK)))
+#define SWEEP_GEN(Word)         ((ULONG64)(Word) >> SWEEP_GEN_SHIFT)
+#define SWEEP_TAG(Word)         (((ULONG64)(Word) >> SWEEP_VALUE_BITS) & SWEEP_TAG_MASK)
+#define SWEEP_VALUE(Word)       ((ULONG64)(Word) & SWEEP_VALUE_MASK)
+
+#define SWEEP_COUNT_PACK(Gen, Count)    ((LONG64)((((ULONG64)(Gen) & 0xFFFF) << SWEEP_COUNT_BITS) | (Count)))
+#define SWEEP_COUNT_GEN(Word)           ((ULONG64)(Word) >> SWEEP_COUNT_BITS)
+
+VOID SweepInit(_Out_ PSWEEP_TRACKER Tracker)
+{
+    RtlZeroMemory((PVOID)Tracker, sizeof(*Tracker));
+}
+
+// The new generation goes first: a CPU of the previous session checks it
+// before each CAS, and every word it could still win a CAS on is then
+// rewritten under it. What such a CPU does manage to store carries the old
+// generation and is ignored.
+VOID SweepReset(_Inout_ PSWEEP_TRACKER Tracker, LONG Generation)
+{
+    LONG64 zero = SWEEP_COUNT_PACK(Generation, 0);
+
+    InterlockedExchange(&Tracker->Generation, Generation);
+    for (ULONG s = 0; s < SWEEP_SLOTS; s++) {
+        InterlockedExchange64(&Tracker->Slots[s].Min, 0);
+        InterlockedExchange64(&Tracker->Slots[s].Max, 0);
+        InterlockedExchange64(&Tracker->Slots[s].Count, 0);
+    }
+    InterlockedExchange64(&Tracker->Sweeps, zero);
+    InterlockedExchange64(&Tracker->Incomplete, zero);
+    InterlockedExchange64(&Tracker->SpreadMax, zero);
+    for (ULONG b = 0; b < WINMSR_JITTER_BUCKETS; b++) {
+        InterlockedExchange64(&Tracker->SpreadHistogram[b], zero);
+    }
+}
+
+// TRUE if tag A is a later tick than tag B (modulo the tag width)
+static BOOLEAN SweepTagAfter(ULONG64 A, ULONG64 B)
+{
+    ULONG64 distance = (A - B) & SWEEP_TAG_MASK;
+    return distance != 0 && distance < SWEEP_TAG_MASK / 2;
+}
+
+// A word of this session holding a later tick than Tag
+static BOOLEAN SweepLater(LONG64 Word, ULONG64 Gen, ULONG64 Tag)
+{
+    return Word != 0 && SWEEP_GEN(Word) == Gen && SweepTagAfter(SWEEP_TAG(Word), Tag);
+}
+
+// Folds Value into a Min or Max word. A word still holding an older tick or
+// an older session is taken over; FALSE means the word already belongs to a
+// later tick, or the session is over, and this CPU does not count.
+static BOOLEAN SweepUpdate(PSWEEP_TRACKER Tracker, volatile LONG64* Word, LONG Generation, ULONG64 Tag,
+                           ULONG64 Value, BOOLEAN Larger)
+{
+    ULONG64 gen = (ULONG64)Generation & 0xFF;
+
+    for (;;) {
+        LONG64 old = ReadAcquire64(Word);
+
+        if (ReadAcquire(&Tracker->Generation) != Generation) {
+            return FALSE;
+        }
+        if (old != 0 && SWEEP_GEN(old) == gen && SWEEP_TAG(old) == Tag) {
+            ULONG64 oldValue = SWEEP_VALUE(old);
+            if (Larger ? (Value <= oldValue) : (Value >= oldValue)) {
+                return TRUE;
+            }
+        }
+        else if (SweepLater(old, gen, Tag)) {
+            return FALSE;
+        }
+        if (InterlockedCompareExchange64(Word, SWEEP_PACK(gen, Tag, Value), old) == old) {
+            return TRUE;
+        }
+    }
+}
+
+// Adds to a statistics word, or raises it to Value if Raise; a word of
+// another session is left alone
+static VOID SweepCountAdd(volatile LONG64* Word, LONG Generation, ULONG64 Value, BOOLEAN Raise)
+{
+    ULONG64 gen = (ULONG64)Generation & 0xFFFF;
+
+    for (;;) {
+        LONG64 old = ReadAcquire64(Word);
+        if (SWEEP_COUNT_GEN(old) != gen || (Raise && Value <= SweepCount(old))) {
+            return;
+        }
+        ULONG64 count = Raise ? Value : SweepCount(old) + Value;
+        if (InterlockedCompareExchange64(Word, SWEEP_COUNT_PACK(gen, count & SWEEP_COUNT_MASK), old) == old) {
+            return;
+        }
+    }
+}
+
+// Called by every CPU once per fired tick of session Generation. The CPU
+// that completes the tick (Count reaches Cpus) records its spread; a tick
+// pushed out of its slot before every CPU fired for it is counted as
+// incomplete.
+VOID SweepRecord(_Inout_ PSWEEP_TRACKER Tracker, LONG Generation, ULONG64 Tick, ULONG64 Delay, ULONG Cpus)
+{
+    PSWEEP_SLOT slot = &Tracker->Slots[Tick % SWEEP_SLOTS];
+    ULONG64 gen = (ULONG64)Generation & 0xFF;
+    ULONG64 tag = (Tick + 1) & SWEEP_TAG_MASK;  // + 1: a zero word means "never used"
+    ULONG64 count;
+
+    if (tag == 0) {
+        tag = 1;
+    }
+    if (Delay > SWEEP_VALUE_MASK) {
+        Delay = SWEEP_VALUE_MASK;
+    }
+
+    if (!SweepUpdate(Tracker, &slot->Min, Generation, tag, Delay, FALSE) ||
+        !SweepUpdate(Tracker, &slot->Max, Generation, tag, Delay, TRUE)) {
+        return;
+    }
+
+    for (;;) {
+        LONG64 old = ReadAcquire64(&slot->Count);
+        BOOLEAN same = old != 0 && SWEEP_GEN(old) == gen;
+
+        if (ReadAcquire(&Tracker->Generation) != Generation || SweepLater(old, gen, tag)) {
+            return;
+        }
+        count = (same && SWEEP_TAG(old) == tag) ? SWEEP_VALUE(old) + 1 : 1;
+        if (InterlockedCompareExchange64(&slot->Count, SWEEP_PACK(gen, tag, count), old) == old) {
+            // Only a tick of this session can have been left incomplete
+            if (same && SWEEP_TAG(old) != tag && SWEEP_VALUE(old) < Cpus) {
+                SweepCountAdd(&Tracker->Incomplete, Generation, 1, FALSE);
+            }
+            break;
+        }
+    }
+
+    if (count != Cpus) {
+        return;
+    }
+
+    // Every CPU updated Min and Max before its Count, so both are final here
+    ULONG64 spread = SWEEP_VALUE(ReadAcquire64(&slot->Max)) - SWEEP_VALUE(ReadAcquire64(&slot->Min));
+    SweepCountAdd(&Tracker->Sweeps, Generation, 1, FALSE);
+    SweepCountAdd(&Tracker->SpreadHistogram[JitterBucket(spread)], Generation, 1, FALSE);
+    SweepCountAdd(&Tracker->SpreadMax, Generation, spread, TRUE);
+}
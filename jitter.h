@@ -0,0 +1,74 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+#include <intrin.h>
+#endif
+#include "public.h"
+
+//
+// Timer jitter bookkeeping: log2 histograms of fire delays and the spread of
+// actual fire times across CPUs for each scheduled tick (sweep). Portable:
+// no kernel calls, no allocation, no locks.
+//
+
+// Bucket 0 holds zero delays, bucket b delays in [2^(b-1), 2^b) units;
+// the last bucket collects everything above
+FORCEINLINE ULONG JitterBucket(ULONG64 Delay)
+{
+    ULONG index;
+
+    if (!_BitScanReverse64(&index, Delay)) {
+        return 0;
+    }
+    return (index + 1 < WINMSR_JITTER_BUCKETS) ? index + 1 : WINMSR_JITTER_BUCKETS - 1;
+}
+
+#define SWEEP_SLOTS             16      // ticks in flight at once
+#define SWEEP_VALUE_BITS        40
+#define SWEEP_TAG_BITS          16
+#define SWEEP_VALUE_MASK        ((1ULL << SWEEP_VALUE_BITS) - 1)
+#define SWEEP_TAG_MASK          ((1ULL << SWEEP_TAG_BITS) - 1)
+#define SWEEP_COUNT_BITS        48
+#define SWEEP_COUNT_MASK        ((1ULL << SWEEP_COUNT_BITS) - 1)
+
+// One tick in flight. Each word packs the low bits of the session
+// generation and of the tick (tag) above a 40-bit value, so a slot is
+// claimed and updated with a single CAS and a word left over from an earlier
+// session is never mistaken for one of this session.
+typedef struct DECLSPEC_CACHEALIGN _SWEEP_SLOT {
+    volatile LONG64 Min;        // smallest fire delay of the tick
+    volatile LONG64 Max;        // largest fire delay of the tick
+    volatile LONG64 Count;      // CPUs that have fired for the tick
+} SWEEP_SLOT, *PSWEEP_SLOT;
+
+// The statistics words carry the low 16 bits of the generation above a
+// 48-bit count; read them with SweepCount
+typedef struct _SWEEP_TRACKER {
+    volatile LONG Generation;                       // session the tracker counts for
+    SWEEP_SLOT Slots[SWEEP_SLOTS];
+    DECLSPEC_CACHEALIGN volatile LONG64 Sweeps;     // ticks every CPU fired for
+    volatile LONG64 Incomplete;                     // ticks some CPU skipped
+    volatile LONG64 SpreadMax;
+    volatile LONG64 SpreadHistogram[WINMSR_JITTER_BUCKETS];
+} SWEEP_TRACKER, *PSWEEP_TRACKER;
+
+FORCEINLINE ULONG64 SweepCount(LONG64 Word)
+{
+    return (ULONG64)Word & SWEEP_COUNT_MASK;
+}
+
+// SweepInit before any CPU records; SweepReset when a new session starts
+// while CPUs of the previous one may still be recording. Records carry the
+// generation of the caller's session and are dropped once it is not the
+// tracker's.
+VOID SweepInit(_Out_ PSWEEP_TRACKER Tracker);
+VOID SweepReset(_Inout_ PSWEEP_TRACKER Tracker, LONG Generation);
+VOID SweepRecord(_Inout_ PSWEEP_TRACKER Tracker, LONG Generation, ULONG64 Tick, ULONG64 Delay, ULONG Cpus);
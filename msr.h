@@ -0,0 +1,116 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "thermstatus.h"
+
+// Thermal
+#define IA32_THERM_STATUS           0x19C
+#define MSR_TEMPERATURE_TARGET      0x1A2
+#define IA32_PACKAGE_THERM_STATUS   0x1B1
+#define MSR_CUSTOM_808              0x808
+
+// APIC
+#define IA32_APIC_BASE              0x1B
+#define APIC_BASE_X2APIC_ENABLE     (1ULL << 10)
+
+// Power (RAPL)
+#define MSR_RAPL_POWER_UNIT         0x606
+#define MSR_PKG_ENERGY_STATUS       0x611
+#define MSR_DRAM_ENERGY_STATUS      0x619
+#define MSR_PP0_ENERGY_STATUS       0x639
+#define MSR_AMD_RAPL_POWER_UNIT     0xC0010299
+#define MSR_AMD_CORE_ENERGY_STATUS  0xC001029A
+#define MSR_AMD_PKG_ENERGY_STATUS   0xC001029B
+
+// Residency
+#define IA32_MPERF                  0xE7
+#define IA32_APERF                  0xE8
+#define MSR_PKG_C3_RESIDENCY        0x3F8
+#define MSR_PKG_C6_RESIDENCY        0x3F9
+#define MSR_PKG_C7_RESIDENCY        0x3FA
+#define MSR_CORE_C3_RESIDENCY       0x3FC
+#define MSR_CORE_C6_RESIDENCY       0x3FD
+#define MSR_CORE_C7_RESIDENCY       0x3FE
+#define MSR_PKG_C2_RESIDENCY        0x60D
+#define MSR_MODULE_C6_RESIDENCY     0x664
+
+// Index of each known MSR in per-register tables (MsrInfo, MsrFaults, ...)
+typedef enum _MSR_INDEX {
+    MsrIndexTemperatureTarget = 0,
+    MsrIndexThermStatus,
+    MsrIndexCustom808,
+    MsrIndexPackageThermStatus,
+    MsrIndexRaplPowerUnit,
+    MsrIndexPkgEnergyStatus,
+    MsrIndexDramEnergyStatus,
+    MsrIndexPp0EnergyStatus,
+    MsrIndexAmdRaplPowerUnit,
+    MsrIndexAmdCoreEnergyStatus,
+    MsrIndexAmdPkgEnergyStatus,
+    MsrIndexMperf,
+    MsrIndexAperf,
+    MsrIndexPkgC2Residency,
+    MsrIndexPkgC3Residency,
+    MsrIndexPkgC6Residency,
+    MsrIndexPkgC7Residency,
+    MsrIndexCoreC3Residency,
+    MsrIndexCoreC6Residency,
+    MsrIndexCoreC7Residency,
+    MsrIndexModuleC6Residency,
+    MsrIndexCount
+} MSR_INDEX;
+
+#define MSR_BIT(Index)          (1UL << (Index))
+#define MSR_SUPPORT_ALL         (MSR_BIT(MsrIndexCount) - 1)
+
+// Registers that exist only in a mode firmware or the OS can change between
+// boots (0x808 needs x2APIC): probed on every load, whatever the cache says
+#define MSR_SUPPORT_MODAL       MSR_BIT(MsrIndexCustom808)
+
+// Set of logical processors that see the same value of a register
+typedef enum _MSR_SCOPE {
+    MsrScopeThread = 0,
+    MsrScopeCore,
+    MsrScopeModule,             // cluster of cores sharing an L2 (Atom, hybrid E-cores)
+    MsrScopePackage
+} MSR_SCOPE;
+
+typedef enum _MSR_CLASS {
+    MsrClassThermal = 0,
+    MsrClassPower,
+    MsrClassResidency,
+    MsrClassOther
+} MSR_CLASS;
+
+typedef struct _MSR_INFO {
+    ULONG Address;
+    MSR_SCOPE Scope;
+    MSR_CLASS Class;
+    PCSTR Name;
+} MSR_INFO;
+
+extern const MSR_INFO MsrInfo[MsrIndexCount];
+
+// Measured read cost of one register on one CPU, TSC cycles with the timing
+// overhead taken out. Zero if not measured.
+typedef struct _MSR_COST {
+    ULONG MinCycles;
+    ULONG MeanCycles;
+} MSR_COST, *PMSR_COST;
+
+typedef union {
+    ULONG64 Value;
+    struct {
+        ULONG Reserved1 : 16;
+        ULONG Target : 8;
+        ULONG Reserved2 : 8;
+        ULONG Reserved3 : 32;
+    } Fields;
+} MSR_TEMPERATURE_TARGET_UNION;
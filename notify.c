@@ -0,0 +1,130 @@
+#include "driver.h"
+
+//
+// Inverted call: readers park IOCTL_WINMSR_WAIT_SAMPLES in a manual queue and
+// the driver completes them when a batch fills, its deadline passes, or a
+// thermal status bit changes. Samplers only count; the copying happens in a
+// work item.
+//
+
+static BATCHER Batcher;
+static WDFQUEUE NotifyQueue = NULL;
+static WDFTIMER NotifyTimer = NULL;
+static WDFWORKITEM NotifyWorkItem = NULL;
+static volatile LONG NotifyReady = 0;
+
+EVT_WDF_TIMER EvtNotifyDeadline;
+EVT_WDF_WORKITEM EvtNotifyDeliver;
+
+// Completes every parked request with what its handle has not read yet
+VOID EvtNotifyDeliver(_In_ WDFWORKITEM WorkItem)
+{
+    WDFREQUEST request;
+
+    UNREFERENCED_PARAMETER(WorkItem);
+
+    BatchTake(&Batcher);
+    while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(NotifyQueue, &request))) {
+        WDF_REQUEST_PARAMETERS params;
+        size_t information = 0;
+        NTSTATUS status;
+
+        WDF_REQUEST_PARAMETERS_INIT(&params);
+        WdfRequestGetParameters(request, &params);
+        status = ReadSamples(request, params.Parameters.DeviceIoControl.OutputBufferLength, &information);
+        WdfRequestCompleteWithInformation(request, status, information);
+    }
+}
+
+VOID EvtNotifyDeadline(_In_ WDFTIMER Timer)
+{
+    UNREFERENCED_PARAMETER(Timer);
+    WdfWorkItemEnqueue(NotifyWorkItem);
+}
+
+// Called by every sampler after publishing a sample. Urgent samples (a
+// thermal status bit changed) are delivered without waiting for the batch.
+VOID NotifySample(ULONG64 Now, BOOLEAN Urgent)
+{
+    if (!ReadNoFence(&NotifyReady)) {
+        return;
+    }
+
+    switch (BatchAdd(&Batcher, Now, Urgent)) {
+    case BatchArm:
+        WdfTimerStart(NotifyTimer, WDF_REL_TIMEOUT_IN_US(Config.NotifyLatencyUs));
+        break;
+    case BatchFlush:
+        WdfWorkItemEnqueue(NotifyWorkItem);
+        break;
+    default:
+        break;
+    }
+}
+
+// Parks a wait request. If a full batch is already pending it is delivered
+// right away instead of waiting for the deadline.
+NTSTATUS ParkWaitRequest(_In_ WDFREQUEST Request, size_t OutputBufferLength)
+{
+    NTSTATUS status;
+
+    if (OutputBufferLength < sizeof(WINMSR_READ_HEADER)) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    status = WdfRequestForwardToIoQueue(Request, NotifyQueue);
+    if (NT_SUCCESS(status) && BatchDue(&Batcher, KeQueryInterruptTime())) {
+        WdfWorkItemEnqueue(NotifyWorkItem);
+    }
+    return status;
+}
+
+NTSTATUS CreateNotifyQueue(_In_ WDFDEVICE Device)
+{
+    WDF_IO_QUEUE_CONFIG queueConfig;
+    WDF_TIMER_CONFIG timerConfig;
+    WDF_WORKITEM_CONFIG workConfig;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    NTSTATUS status;
+
+    BatchInit(&Batcher, Config.NotifyBatchSize, 10ULL * Config.NotifyLatencyUs);
+
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+    status = WdfIoQueueCreate(Device, &queueConfig, WDF_NO_OBJECT_ATTRIBUTES, &NotifyQueue);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, EvtNotifyDeadline);
+    status = WdfTimerCreate(&timerConfig, &attributes, &NotifyTimer);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    WDF_WORKITEM_CONFIG_INIT(&workConfig, EvtNotifyDeliver);
+    status = WdfWorkItemCreate(&workConfig, &attributes, &NotifyWorkItem);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    InterlockedExchange(&NotifyReady, 1);
+    return STATUS_SUCCESS;
+}
+
+// Before the control device is deleted; the samplers must already be stopped
+VOID StopNotifyQueue(VOID)
+{
+    InterlockedExchange(&NotifyReady, 0);
+    if (NotifyTimer != NULL) {
+        WdfTimerStop(NotifyTimer, TRUE);
+    }
+    if (NotifyWorkItem != NULL) {
+        WdfWorkItemFlush(NotifyWorkItem);
+    }
+    NotifyQueue = NULL;
+    NotifyTimer = NULL;
+    NotifyWorkItem = NULL;
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+//
+// Interface shared between WinMSRDriver and user-mode consumers.
+// Include <windows.h> and <winioctl.h> (user mode), <ntddk.h> (kernel
+// mode) or compat.h (tests and benchmarks outside Windows) before this header.
+//
+
+#define WINMSR_DEVICE_NAME      L"\\Device\\WinMSR"
+#define WINMSR_SYMBOLIC_NAME    L"\\DosDevices\\WinMSR"
+#define WINMSR_USER_PATH        L"\\\\.\\WinMSR"
+
+#define WINMSR_IOCTL(Function)  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800 + (Function), METHOD_BUFFERED, FILE_READ_ACCESS)
+// Changes driver state: needs a handle opened for writing (administrators)
+#define WINMSR_IOCTL_WRITE(Function) \
+    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800 + (Function), METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+// Output: WINMSR_INTERVAL_SUMMARY[] - the most recent closed interval of each CPU
+#define IOCTL_WINMSR_GET_INTERVALS  WINMSR_IOCTL(0)
+
+// Input: none. Output: WINMSR_READ_HEADER followed by WINMSR_SAMPLE_RECORD[Records].
+// Returns the samples taken since this handle's previous read, across all CPUs.
+// Each handle has its own cursors; a new handle starts at the oldest retained sample.
+#define IOCTL_WINMSR_READ_SAMPLES   WINMSR_IOCTL(1)
+
+// Input: none. Output: WINMSR_SNAPSHOT_MAPPING. Maps the latest-snapshot page
+// read-only into the calling process. One view per handle; it is unmapped when
+// the handle is closed.
+#define IOCTL_WINMSR_MAP_SNAPSHOT   WINMSR_IOCTL(2)
+
+// Input: none. Output: as IOCTL_WINMSR_READ_SAMPLES. Stays pending until a
+// batch of samples is ready, the batch deadline passes or a thermal status bit
+// changes on any CPU (NotifyBatchSize / NotifyLatencyUs registry values).
+#define IOCTL_WINMSR_WAIT_SAMPLES   WINMSR_IOCTL(3)
+
+// Input: WINMSR_SESSION. Starts a new sampling session on every CPU.
+#define IOCTL_WINMSR_SET_SESSION    WINMSR_IOCTL_WRITE(4)
+
+// Output: WINMSR_SESSION_STATUS - current session and its timer accuracy so far
+#define IOCTL_WINMSR_GET_SESSION    WINMSR_IOCTL(5)
+
+// Output: WINMSR_JITTER_HEADER followed by WINMSR_CPU_JITTER[CpuCount]
+#define IOCTL_WINMSR_GET_JITTER     WINMSR_IOCTL(6)
+
+// Output: WINMSR_MSR_COST[] - measured read cost of each sampled register on
+// each CPU. Empty unless the CalibrateMsrCosts registry value is set.
+#define IOCTL_WINMSR_GET_MSR_COSTS  WINMSR_IOCTL(7)
+
+// Input: none. Output: WINMSR_READ_HEADER followed by one frame of the
+// compact encoding in wire.h (WIRE_FRAME_HEADER, CPU table, records). Same
+// per-handle cursors as IOCTL_WINMSR_READ_SAMPLES.
+#define IOCTL_WINMSR_READ_PACKED    WINMSR_IOCTL(8)
+
+// Output: WINMSR_CORE_TYPE_AGGREGATE[WINMSR_CORE_TYPES] - the latest sample of
+// every CPU aggregated per core type, indexed by WINMSR_CORE_TYPE_*
+#define IOCTL_WINMSR_GET_CORE_TYPES WINMSR_IOCTL(9)
+
+// Input: WINMSR_HISTORY_REQUEST. Output: WINMSR_HISTORY_HEADER followed by
+// Chunks chunks of WINMSR_HISTORY_CHUNK_BYTES, the sealed history of one CPU
+// from FirstChunk on, to be decoded with gorilla.h. Needs HistoryKb.
+#define IOCTL_WINMSR_READ_HISTORY   WINMSR_IOCTL(10)
+
+// Status bits 0..11 of IA32_THERM_STATUS (StatusBit .. PowerLimitLog)
+#define WINMSR_THERM_STATUS_BITS    12
+
+// The CPU cleared the sticky log bits after every sample, so the odd entries
+// of StatusBitCounts (StatusLog, PROCHOTLog, ...) count events, not samples
+// that still showed an old event
+#define WINMSR_INTERVAL_LOGS_CLEARED    0x1
+
+// Summary of one CPU over one closed aggregation interval. Times are
+// interrupt time in 100 ns units; interval N covers [N * Length, (N + 1) * Length).
+typedef struct _WINMSR_INTERVAL_SUMMARY {
+    ULONG Cpu;
+    ULONG Samples;              // samples taken in the interval
+    ULONG64 IntervalIndex;
+    ULONG64 FirstSampleTime;
+    ULONG64 LastSampleTime;
+    ULONG ValidSamples;         // samples with a valid temperature
+    LONG MinTemperature;
+    LONG MaxTemperature;
+    ULONG Flags;                // WINMSR_INTERVAL_*
+    LONG64 SumTemperature;      // mean = SumTemperature / ValidSamples
+    ULONG StatusBitCounts[WINMSR_THERM_STATUS_BITS];
+} WINMSR_INTERVAL_SUMMARY, *PWINMSR_INTERVAL_SUMMARY;
+
+// One sample of one CPU
+typedef struct _WINMSR_SAMPLE_RECORD {
+    ULONG64 Time;               // interrupt time, 100 ns units
+    ULONG Cpu;
+    LONG Temperature;           // -1 if the reading was not valid
+    ULONG ThermStatus;          // low half of IA32_THERM_STATUS
+    ULONG FireDelay;            // actual minus intended timer fire time, 100 ns units (saturated)
+} WINMSR_SAMPLE_RECORD, *PWINMSR_SAMPLE_RECORD;
+
+typedef struct _WINMSR_READ_HEADER {
+    ULONG Records;              // records following the header
+    ULONG Reserved;
+    ULONG64 Lost;               // samples overwritten before this handle read them
+    ULONG64 Pending;            // samples still unread after this read (lag)
+} WINMSR_READ_HEADER, *PWINMSR_READ_HEADER;
+
+typedef struct _WINMSR_SNAPSHOT_MAPPING {
+    ULONG64 Address;            // WINMSR_SNAPSHOT_PAGE in the caller's address space
+    ULONG64 Size;
+} WINMSR_SNAPSHOT_MAPPING, *PWINMSR_SNAPSHOT_MAPPING;
+
+// Layout history of the snapshot page; readers should check Version
+//  1: Sequence, Temperature, Dts, ThermStatus, Tsc, Time
+//  2: Flags, CheckTime (idle-respecting sampling)
+//  3: Level, Slope (forecast)
+//  4: ProchotPermille, Core, Package, TjMax (ranking)
+//  5: Die (heat map)
+//  6: page header Reserved became WarmingUp
+#define WINMSR_SNAPSHOT_VERSION     6
+
+// The CPU was idle at CheckTime and is only read every IdleDeferPeriods
+// periods, so as not to wake it; Temperature .. Time are the last known values
+#define WINMSR_SNAPSHOT_IDLE        0x1
+
+// Latest sample of one CPU, one cache line each. Sequence is odd while the
+// CPU's sampler is writing; read with SnapshotRead() from snapshot.h.
+typedef struct DECLSPEC_CACHEALIGN _WINMSR_CPU_SNAPSHOT {
+    volatile LONG Sequence;
+    LONG Temperature;           // -1 if the reading was not valid
+    ULONG Dts;                  // digital readout, degrees below TjMax
+    ULONG ThermStatus;          // low half of IA32_THERM_STATUS
+    ULONG64 Tsc;                // TSC when the sample was taken
+    ULONG64 Time;               // interrupt time, 100 ns units
+    ULONG Flags;                // WINMSR_SNAPSHOT_*
+    ULONG ProchotPermille;      // share of recent readings with PROCHOT asserted or logged, smoothed like Level
+    ULONG64 CheckTime;          // last time the sampler looked at the CPU, >= Time
+    LONG Level;                 // smoothed temperature, milli-degrees C (forecast.h)
+    LONG Slope;                 // its trend, milli-degrees C per second
+    USHORT Core;                // lowest CPU index of the same core (SMT siblings share it)
+    USHORT Package;             // lowest CPU index of the same package
+    USHORT TjMax;               // degrees C
+    USHORT Die;                 // lowest CPU index of the same die
+} WINMSR_CPU_SNAPSHOT, *PWINMSR_CPU_SNAPSHOT;
+
+typedef struct _WINMSR_SNAPSHOT_PAGE {
+    ULONG Version;              // WINMSR_SNAPSHOT_VERSION
+    ULONG CpuCount;
+    ULONG CpuStride;            // sizeof(WINMSR_CPU_SNAPSHOT)
+    volatile LONG WarmingUp;    // CPUs still in their initial sweep; an entry with Time 0 has no sample yet
+    WINMSR_CPU_SNAPSHOT Cpu[1]; // [CpuCount]
+} WINMSR_SNAPSHOT_PAGE, *PWINMSR_SNAPSHOT_PAGE;
+
+// Sampling timer modes
+#define WINMSR_TIMER_COALESCABLE        0   // standard timer; may slip up to ToleranceUs so idle CPUs stay idle
+#define WINMSR_TIMER_HIGH_RESOLUTION    1   // high-resolution timer, for short periods (down to 100 us)
+
+#define WINMSR_MIN_PERIOD_US            100
+#define WINMSR_MAX_PERIOD_US            3600000000UL
+#define WINMSR_MAX_STRIPES              256
+
+typedef struct _WINMSR_SESSION {
+    ULONG TimerMode;            // WINMSR_TIMER_*
+    ULONG PeriodUs;
+    ULONG ToleranceUs;          // coalescable mode: how late a fire may be to avoid waking an idle CPU
+    ULONG Stripes;              // 0 or 1: every CPU on every tick; N: 1/N of the CPUs per PeriodUs / N tick,
+                                // each CPU still sampled once per PeriodUs
+} WINMSR_SESSION, *PWINMSR_SESSION;
+
+// Timer accuracy of the current session, summed over all CPUs
+typedef struct _WINMSR_SESSION_STATUS {
+    WINMSR_SESSION Session;
+    ULONG Generation;           // bumped by every IOCTL_WINMSR_SET_SESSION
+    ULONG Promoted;             // striped sessions: hot CPUs currently sampled on every tick
+    ULONG64 Fires;              // timer fires that took a sample
+    ULONG64 MissedPeriods;      // periods skipped because a fire came more than a period late
+    ULONG64 FireDelaySum;       // sum of actual minus intended fire time, 100 ns units
+    ULONG64 FireDelayMax;
+    ULONG64 SampleCycles;       // TSC cycles spent sampling
+    ULONG WarmingUp;            // CPUs still in their initial sweep after load, 0 once all have sampled
+    ULONG Reserved;
+} WINMSR_SESSION_STATUS, *PWINMSR_SESSION_STATUS;
+
+// Log2 histogram buckets: 0 = no delay, b = [2^(b-1), 2^b) x 100 ns, last = more
+#define WINMSR_JITTER_BUCKETS           24
+
+// Cross-CPU spread of the current session. Ticks are scheduled on a common
+// grid, so a sweep is every CPU's fire for the same tick and its spread is
+// the latest minus the earliest actual fire time.
+typedef struct _WINMSR_JITTER_HEADER {
+    ULONG CpuCount;             // WINMSR_CPU_JITTER entries that follow
+    ULONG Reserved;
+    ULONG64 Sweeps;             // ticks every CPU fired for
+    ULONG64 IncompleteSweeps;   // ticks at least one CPU missed
+    ULONG64 SpreadMax;          // 100 ns units
+    ULONG64 SpreadHistogram[WINMSR_JITTER_BUCKETS];
+} WINMSR_JITTER_HEADER, *PWINMSR_JITTER_HEADER;
+
+// Fire delay (actual minus scheduled) distribution of one CPU in the current session
+typedef struct _WINMSR_CPU_JITTER {
+    ULONG Cpu;
+    ULONG Reserved;
+    ULONG64 Fires;
+    ULONG64 DelayMax;           // 100 ns units
+    ULONG64 DelayHistogram[WINMSR_JITTER_BUCKETS];
+} WINMSR_CPU_JITTER, *PWINMSR_CPU_JITTER;
+
+// Read cost of one register on one CPU, TSC cycles per __readmsr with the
+// timing overhead subtracted
+typedef struct _WINMSR_MSR_COST {
+    ULONG Cpu;
+    ULONG Address;
+    ULONG MinCycles;
+    ULONG MeanCycles;
+    ULONG ReadEvery;            // the register is read on every ReadEvery-th sample
+    ULONG Reserved;
+} WINMSR_MSR_COST, *PWINMSR_MSR_COST;
+
+// Core types of hybrid parts; every CPU of other parts is Uniform
+#define WINMSR_CORE_TYPE_UNIFORM        0
+#define WINMSR_CORE_TYPE_PERFORMANCE    1   // P-core
+#define WINMSR_CORE_TYPE_EFFICIENT      2   // E-core
+#define WINMSR_CORE_TYPES               3
+
+// Latest temperatures of one core type, so P-core and E-core readings are
+// never averaged together. Min and Max are only meaningful if ValidReadings != 0.
+typedef struct _WINMSR_CORE_TYPE_AGGREGATE {
+    ULONG CoreType;             // WINMSR_CORE_TYPE_*
+    ULONG Cpus;
+    ULONG ValidReadings;        // CPUs whose latest sample has a valid temperature
+    ULONG Prochot;              // CPUs whose latest sample shows PROCHOT
+    LONG MinTemperature;
+    LONG MaxTemperature;
+    LONG64 SumTemperature;      // mean = SumTemperature / ValidReadings
+    LONG64 SamplesTaken;        // since the driver was loaded
+    LONG64 SampleCycles;        // cycles per sample = SampleCycles / SamplesTaken
+} WINMSR_CORE_TYPE_AGGREGATE, *PWINMSR_CORE_TYPE_AGGREGATE;
+
+// Full-rate history: every sample's interrupt time and raw IA32_THERM_STATUS,
+// compressed (gorilla.h). The newest samples are in an open chunk that is
+// not returned until it is sealed.
+#define WINMSR_HISTORY_CHUNK_BYTES  4096
+
+typedef struct _WINMSR_HISTORY_REQUEST {
+    ULONG Cpu;
+    ULONG Reserved;
+    ULONG64 FirstChunk;         // chunk number to start at, 0 for the oldest held
+} WINMSR_HISTORY_REQUEST, *PWINMSR_HISTORY_REQUEST;
+
+typedef struct _WINMSR_HISTORY_HEADER {
+    ULONG Chunks;               // chunks following the header
+    ULONG Reserved;
+    ULONG64 NextChunk;          // FirstChunk of the next request
+    ULONG64 Lost;               // chunks from FirstChunk on that were already overwritten
+    ULONG64 Sealed;             // chunks sealed on this CPU so far
+} WINMSR_HISTORY_HEADER, *PWINMSR_HISTORY_HEADER;
+
+// Flight recorder dumps: \SystemRoot\Temp\WinMSR-flight-NN.bin, NN counting
+// from 00; after WINMSR_FLIGHT_MAX_DUMPS dumps the recorder stops until the
+// driver is reloaded, so the first ones are never overwritten. A WINMSR_FLIGHT_HEADER followed
+// by WINMSR_SAMPLE_RECORD[Records], CPU by CPU, oldest first within a CPU.
+#define WINMSR_FLIGHT_MAGIC         0x544C4657  // 'WFLT'
+#define WINMSR_FLIGHT_VERSION       1
+#define WINMSR_FLIGHT_MAX_DUMPS     16
+
+// Trigger reasons
+#define WINMSR_FLIGHT_PROCHOT       0x1
+#define WINMSR_FLIGHT_CRITICAL      0x2
+#define WINMSR_FLIGHT_THRESHOLD     0x4     // FlightTriggerC reached
+
+typedef struct _WINMSR_FLIGHT_HEADER {
+    ULONG Magic;
+    ULONG Version;
+    ULONG Reason;               // WINMSR_FLIGHT_*
+    ULONG TriggerCpu;
+    ULONG64 TriggerTime;        // interrupt time, 100 ns units
+    ULONG64 FreezeTime;         // no record is later than this
+    ULONG CpuCount;
+    ULONG Records;
+} WINMSR_FLIGHT_HEADER, *PWINMSR_FLIGHT_HEADER;
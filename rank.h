@@ -0,0 +1,165 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "public.h"
+#include "snapshot.h"
+
+//
+// Thermal-aware CPU ranking for workload placement, computed from the mapped
+// snapshot page (IOCTL_WINMSR_MAP_SNAPSHOT). Header-only like snapshot.h: one
+// pass over the page plus a counting sort on whole degrees of headroom, no
+// system call, no lock and no allocation. The caller owns a RANK_CONTEXT and
+// may reuse it for every call.
+//
+// The context also keeps the last full ranking with the sequence of every
+// entry it was computed from. Samplers write an entry once per period, so
+// most calls find every sequence unchanged and only copy the ranking out.
+//
+
+#define RANK_MAX_CPUS           2048
+#define RANK_BUCKETS            128     // whole degrees of headroom 0..126; the last holds CPUs without a reading
+#define RANK_PROCHOT_PENALTY    20      // milli-degrees of headroom lost per permille of recent PROCHOT
+
+// Flags of RANKED_CPU, besides WINMSR_SNAPSHOT_*
+#define RANK_NO_READING         0x80000000
+
+// One CPU in rank order. Temperatures are milli-degrees C.
+typedef struct _RANKED_CPU {
+    ULONG Cpu;
+    LONG Headroom;              // TjMax minus the forecast at the horizon, less the PROCHOT penalty
+    LONG Temperature;           // last reading
+    LONG Forecast;              // expected temperature at the horizon
+    LONG SiblingMax;            // hottest last reading among the CPUs of the same core, MINLONG if none
+    LONG PackageMax;            // hottest last reading in the package, MINLONG if none
+    ULONG ProchotPermille;
+    ULONG Flags;                // WINMSR_SNAPSHOT_*, RANK_NO_READING
+} RANKED_CPU, *PRANKED_CPU;
+
+typedef struct _RANK_CONTEXT {
+    RANKED_CPU Scored[RANK_MAX_CPUS];
+    UCHAR Bucket[RANK_MAX_CPUS];
+    LONG CoreMax[RANK_MAX_CPUS];        // by core leader index
+    LONG PackageMax[RANK_MAX_CPUS];     // by package leader index
+    ULONG Start[RANK_BUCKETS];
+    RANKED_CPU Last[RANK_MAX_CPUS];     // full ranking of the last recompute
+    LONG Seen[RANK_MAX_CPUS];           // entry sequences it was computed from
+    ULONG LastCount;                    // CPUs in Last, 0: nothing cached
+    LONG LastHorizonMs;
+} RANK_CONTEXT, *PRANK_CONTEXT;
+
+FORCEINLINE VOID RankInit(_Out_ PRANK_CONTEXT Context)
+{
+    Context->LastCount = 0;
+}
+
+// TRUE if no entry has been written since Last was computed for HorizonMs
+FORCEINLINE BOOLEAN RankCached(_In_ const WINMSR_SNAPSHOT_PAGE* Page, LONG HorizonMs, ULONG Count,
+                               _In_ const RANK_CONTEXT* Context)
+{
+    if (Context->LastCount != Count || Context->LastHorizonMs != HorizonMs) {
+        return FALSE;
+    }
+    for (ULONG i = 0; i < Count; i++) {
+        if (ReadAcquire(&SnapshotCpu(Page, i)->Sequence) != Context->Seen[i]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Fills Ranked with up to Capacity CPUs, most headroom first, judged
+// HorizonMs ahead (0 = now, clamped to FORECAST_MAX_HORIZON_MS). CPUs within
+// the same degree keep index order. Returns the number of entries written.
+// Context must have been through RankInit.
+FORCEINLINE ULONG RankCpus(_In_ const WINMSR_SNAPSHOT_PAGE* Page, LONG HorizonMs, _Inout_ PRANK_CONTEXT Context,
+                           _Out_writes_(Capacity) PRANKED_CPU Ranked, ULONG Capacity)
+{
+    ULONG count = (Page->CpuCount < RANK_MAX_CPUS) ? Page->CpuCount : RANK_MAX_CPUS;
+    ULONG written = (count < Capacity) ? count : Capacity;
+
+    HorizonMs = ForecastClampHorizon(HorizonMs);
+    if (RankCached(Page, HorizonMs, count, Context)) {
+        RtlCopyMemory(Ranked, Context->Last, written * sizeof(RANKED_CPU));
+        return written;
+    }
+    Context->LastCount = 0;
+
+    for (ULONG i = 0; i < count; i++) {
+        Context->CoreMax[i] = MINLONG;
+        Context->PackageMax[i] = MINLONG;
+    }
+    for (ULONG b = 0; b < RANK_BUCKETS; b++) {
+        Context->Start[b] = 0;
+    }
+
+    // Score every CPU and count it into its bucket
+    for (ULONG i = 0; i < count; i++) {
+        WINMSR_CPU_SNAPSHOT copy;
+        PRANKED_CPU scored = &Context->Scored[i];
+        ULONG bucket = RANK_BUCKETS - 1;
+
+        SnapshotRead(SnapshotCpu(Page, i), &copy);
+        Context->Seen[i] = copy.Sequence;
+        scored->Cpu = i;
+        scored->ProchotPermille = copy.ProchotPermille;
+        scored->Flags = copy.Flags;
+
+        if (copy.Time == 0 || copy.Temperature < 0) {
+            scored->Headroom = MINLONG;
+            scored->Temperature = -1;
+            scored->Forecast = -1;
+            scored->Flags |= RANK_NO_READING;
+        }
+        else {
+            scored->Temperature = copy.Temperature * 1000;
+            scored->Forecast = SnapshotForecast(&copy, HorizonMs);
+            scored->Headroom = (LONG)copy.TjMax * 1000 - scored->Forecast - (LONG)copy.ProchotPermille * RANK_PROCHOT_PENALTY;
+
+            LONG degrees = scored->Headroom / 1000;
+            degrees = (degrees < 0) ? 0 : (degrees > RANK_BUCKETS - 2) ? RANK_BUCKETS - 2 : degrees;
+            bucket = RANK_BUCKETS - 2 - (ULONG)degrees;
+
+            ULONG core = (copy.Core < count) ? copy.Core : i;
+            ULONG package = (copy.Package < count) ? copy.Package : i;
+            if (scored->Temperature > Context->CoreMax[core]) {
+                Context->CoreMax[core] = scored->Temperature;
+            }
+            if (scored->Temperature > Context->PackageMax[package]) {
+                Context->PackageMax[package] = scored->Temperature;
+            }
+        }
+        // Keep the topology for the second pass in the fields it will fill
+        scored->SiblingMax = (copy.Core < count) ? copy.Core : i;
+        scored->PackageMax = (copy.Package < count) ? copy.Package : i;
+        Context->Bucket[i] = (UCHAR)bucket;
+        Context->Start[bucket]++;
+    }
+
+    // Bucket counts to start positions
+    ULONG position = 0;
+    for (ULONG b = 0; b < RANK_BUCKETS; b++) {
+        ULONG n = Context->Start[b];
+        Context->Start[b] = position;
+        position += n;
+    }
+
+    // Place each CPU at its rank, resolving the group maxima on the way
+    for (ULONG i = 0; i < count; i++) {
+        ULONG rank = Context->Start[Context->Bucket[i]]++;
+        Context->Last[rank] = Context->Scored[i];
+        Context->Last[rank].SiblingMax = Context->CoreMax[Context->Scored[i].SiblingMax];
+        Context->Last[rank].PackageMax = Context->PackageMax[Context->Scored[i].PackageMax];
+    }
+    Context->LastCount = count;
+    Context->LastHorizonMs = HorizonMs;
+
+    RtlCopyMemory(Ranked, Context->Last, written * sizeof(RANKED_CPU));
+    return written;
+}
@@ -0,0 +1,156 @@
+#include "driver.h"
+#include <ntstrsafe.h>
+
+//
+// Flight recorder: samplers feed their own rings (flight.h) and the one that
+// freezes them queues a work item, which writes the window around the
+// trigger to a file and re-arms, up to WINMSR_FLIGHT_MAX_DUMPS files. Samplers
+// never wait for the file.
+//
+
+static FLIGHT_TRIGGER Flight;
+static WDFWORKITEM FlightWorkItem = NULL;
+static volatile LONG FlightReady = 0;
+static volatile LONG FlightDumps = 0;
+
+EVT_WDF_WORKITEM EvtFlightDump;
+
+// Writes every CPU's frozen ring up to the freeze time, then the header
+static NTSTATUS WriteFlightDump(PUNICODE_STRING Name)
+{
+    OBJECT_ATTRIBUTES attributes;
+    IO_STATUS_BLOCK iosb;
+    WINMSR_FLIGHT_HEADER header;
+    LARGE_INTEGER offset;
+    HANDLE file;
+    NTSTATUS status;
+    ULONG capacity = 0;
+
+    for (ULONG i = 0; i < CoreCount; i++) {
+        capacity = max(capacity, CoreArray[i].Hot->Flight.Capacity);
+    }
+    PWINMSR_SAMPLE_RECORD buffer =
+        (PWINMSR_SAMPLE_RECORD)ExAllocatePool2(POOL_FLAG_PAGED, capacity * sizeof(WINMSR_SAMPLE_RECORD), 'tlFW');
+    if (buffer == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    InitializeObjectAttributes(&attributes, Name, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
+    status = ZwCreateFile(&file, GENERIC_WRITE | SYNCHRONIZE, &attributes, &iosb, NULL, FILE_ATTRIBUTE_NORMAL, 0,
+                          FILE_OVERWRITE_IF, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0);
+    if (!NT_SUCCESS(status)) {
+        ExFreePoolWithTag(buffer, 'tlFW');
+        return status;
+    }
+
+    header.Magic = WINMSR_FLIGHT_MAGIC;
+    header.Version = WINMSR_FLIGHT_VERSION;
+    header.Reason = Flight.Reason;
+    header.TriggerCpu = Flight.Cpu;
+    header.TriggerTime = Flight.TriggerTime;
+    header.FreezeTime = Flight.FreezeTime;
+    header.CpuCount = CoreCount;
+    header.Records = 0;
+
+    offset.QuadPart = sizeof(header);
+    for (ULONG i = 0; i < CoreCount && NT_SUCCESS(status); i++) {
+        ULONG count = FlightCopy(&CoreArray[i].Hot->Flight, Flight.FreezeTime, buffer, capacity);
+        if (count == 0) {
+            continue;
+        }
+        status = ZwWriteFile(file, NULL, NULL, NULL, &iosb, buffer, count * sizeof(WINMSR_SAMPLE_RECORD), &offset, NULL);
+        offset.QuadPart += count * sizeof(WINMSR_SAMPLE_RECORD);
+        header.Records += count;
+    }
+
+    if (NT_SUCCESS(status)) {
+        offset.QuadPart = 0;
+        status = ZwWriteFile(file, NULL, NULL, NULL, &iosb, &header, sizeof(header), &offset, NULL);
+    }
+    ZwClose(file);
+    ExFreePoolWithTag(buffer, 'tlFW');
+    return status;
+}
+
+VOID EvtFlightDump(_In_ WDFWORKITEM WorkItem)
+{
+    WCHAR nameBuffer[64];
+    UNICODE_STRING name;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER(WorkItem);
+
+    LONG n = InterlockedIncrement(&FlightDumps) - 1;
+    RtlInitEmptyUnicodeString(&name, nameBuffer, sizeof(nameBuffer));
+    status = RtlUnicodeStringPrintf(&name, L"\\SystemRoot\\Temp\\WinMSR-flight-%02ld.bin", n);
+    if (NT_SUCCESS(status)) {
+        status = WriteFlightDump(&name);
+    }
+
+    if (NT_SUCCESS(status)) {
+        DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_INFO_LEVEL,
+            "WinMSRDriver: flight recorder triggered on CPU %lu (reason 0x%lX), dumped to %wZ\n",
+            Flight.Cpu, Flight.Reason, &name);
+    }
+    else {
+        DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_ERROR_LEVEL,
+            "WinMSRDriver: flight recorder dump failed: 0x%X\n", status);
+    }
+
+    // Left frozen after the last file: nothing would be kept of later triggers
+    if (n + 1 < WINMSR_FLIGHT_MAX_DUMPS) {
+        FlightRearm(&Flight);
+    }
+    else {
+        DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_WARNING_LEVEL,
+            "WinMSRDriver: flight recorder stopped after %d dumps\n", WINMSR_FLIGHT_MAX_DUMPS);
+    }
+}
+
+// Called by every sampler after publishing a sample
+VOID FlightSample(_Inout_ PCORE_HOT pHot, _In_ const WINMSR_SAMPLE_RECORD* Record)
+{
+    if (!ReadNoFence(&FlightReady) || pHot->Flight.Records == NULL) {
+        return;
+    }
+
+    ULONG reason = FlightReason(&Flight, Record, pHot->ThermLogClearMask != 0);
+    if (FlightRecord(&Flight, &pHot->Flight, Record, reason) == FlightDump) {
+        WdfWorkItemEnqueue(FlightWorkItem);
+    }
+}
+
+NTSTATUS CreateFlightRecorder(_In_ WDFDEVICE Device)
+{
+    WDF_WORKITEM_CONFIG workConfig;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    NTSTATUS status;
+
+    if (Config.FlightRecorderMs == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    FlightInit(&Flight, 10000ULL * Config.FlightPostTriggerMs, (LONG)Config.FlightTriggerC);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+
+    WDF_WORKITEM_CONFIG_INIT(&workConfig, EvtFlightDump);
+    status = WdfWorkItemCreate(&workConfig, &attributes, &FlightWorkItem);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    InterlockedExchange(&FlightReady, 1);
+    return STATUS_SUCCESS;
+}
+
+// Before the control device is deleted; the samplers must already be stopped
+VOID StopFlightRecorder(VOID)
+{
+    InterlockedExchange(&FlightReady, 0);
+    if (FlightWorkItem != NULL) {
+        WdfWorkItemFlush(FlightWorkItem);
+    }
+    FlightWorkItem = NULL;
+}
@@ -0,0 +1,530 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "public.h"
+#include "thermstatus.h"
+
+//
+// Columnar recording file for long thermal histories, read through a mapped
+// view with no parsing. The file is a sequence of RECORDING_BLOCK_SIZE
+// blocks: block 0 is the RECORDING_FILE_HEADER, every other block holds the
+// samples of one CPU as fixed-offset columns (times, status bits, DTS, TjMax,
+// optional power and frequency). Each block links to the previous block of
+// the same CPU and the file header holds the newest block of each CPU, so
+// walking one CPU's history touches that CPU's blocks only, and a query of
+// one column touches only that column's pages.
+//
+// Every block carries a summary (temperature range, any PROCHOT, any
+// critical temperature) that is also copied into an index block: the first
+// block of every run of RECORDING_INDEX_SPAN + 1 blocks lists the summaries
+// of the rest, and its own header summarizes them all. A range query reads
+// the index blocks and opens only the sample blocks that can match.
+//
+// Header-only and portable like wire.h. The writer fills caller-owned block
+// buffers and hands back each completed block; the caller does the file I/O.
+//
+
+#define RECORDING_MAGIC             0x464D5357  // 'WSMF'
+#define RECORDING_BLOCK_MAGIC       0x424D5357  // 'WSMB'
+#define RECORDING_VERSION           2
+#define RECORDING_BLOCK_SIZE        65536       // the allocation granularity, so any block can start a view
+#define RECORDING_MAX_CPUS          4096
+
+// File flags: optional columns
+#define RECORDING_HAS_POWER         0x1         // ULONG milliwatts per sample
+#define RECORDING_HAS_FREQUENCY     0x2         // USHORT MHz per sample
+// ... and the log bits were cleared after every sample (ClearThermLogs), so a
+// log bit in the status column means an event since the previous sample
+#define RECORDING_LOGS_CLEARED      0x4
+
+// DTS column: bits 0..6 DTS, RECORDING_DTS_VALID if the reading was valid
+#define RECORDING_DTS_VALID         0x80
+
+// Cpu of index blocks
+#define RECORDING_INDEX_CPU         MAXULONG
+
+// Summary flags. The log bits count only in RECORDING_LOGS_CLEARED files;
+// otherwise they stay set from the first event on.
+#define RECORDING_SUMMARY_PROCHOT   0x1         // PROCHOT (or its log bit) in any sample
+#define RECORDING_SUMMARY_CRITICAL  0x2         // critical temperature (or its log bit) in any sample
+
+// Range of an empty summary, so it never passes a temperature test
+#define RECORDING_NO_MIN            MAXSHORT
+#define RECORDING_NO_MAX            MINSHORT
+
+typedef struct _RECORDING_FILE_HEADER {
+    ULONG Magic;
+    ULONG Version;
+    ULONG BlockSize;
+    ULONG Flags;                // RECORDING_HAS_*, RECORDING_LOGS_CLEARED
+    ULONG CpuCount;
+    ULONG SamplesPerBlock;      // column length of every block
+    ULONG64 BlockCount;         // sample blocks after this one (blocks 1..BlockCount)
+    ULONG64 CreatedTime;        // interrupt time of the first sample, 100 ns units
+    ULONG64 Reserved[4];
+    ULONG64 LastBlock[RECORDING_MAX_CPUS];  // newest block of each CPU, 0 if none
+} RECORDING_FILE_HEADER, *PRECORDING_FILE_HEADER;
+
+// Start of every sample block. The columns follow at RecordingColumnOffset.
+typedef struct _RECORDING_BLOCK_HEADER {
+    ULONG Magic;
+    ULONG Cpu;
+    ULONG Samples;              // valid entries in each column
+    ULONG Reserved;
+    ULONG64 Index;              // this block, 0 while still being filled
+    ULONG64 PreviousBlock;      // previous block of the same CPU, 0 if none
+    ULONG64 FirstTime;
+    ULONG64 LastTime;
+    SHORT MinTemperature;       // degrees C over valid samples, RECORDING_NO_MIN / _NO_MAX if none
+    SHORT MaxTemperature;
+    ULONG SummaryFlags;         // RECORDING_SUMMARY_*
+    ULONG64 Reserved2;
+} RECORDING_BLOCK_HEADER, *PRECORDING_BLOCK_HEADER;
+
+// Summary of one sample block in its index block
+typedef struct _RECORDING_INDEX_ENTRY {
+    ULONG64 FirstTime;
+    ULONG64 LastTime;
+    USHORT Cpu;
+    SHORT MinTemperature;
+    SHORT MaxTemperature;
+    USHORT SummaryFlags;
+} RECORDING_INDEX_ENTRY, *PRECORDING_INDEX_ENTRY;
+
+C_ASSERT(sizeof(RECORDING_FILE_HEADER) <= RECORDING_BLOCK_SIZE);
+C_ASSERT(sizeof(RECORDING_BLOCK_HEADER) == 64);
+C_ASSERT(sizeof(RECORDING_INDEX_ENTRY) == 24);
+
+// Sample blocks listed by one index block
+#define RECORDING_INDEX_SPAN \
+    ((RECORDING_BLOCK_SIZE - sizeof(RECORDING_BLOCK_HEADER)) / sizeof(RECORDING_INDEX_ENTRY))
+
+typedef enum _RECORDING_COLUMN {
+    RecordingColumnTime = 0,    // ULONG64, interrupt time
+    RecordingColumnPower,       // ULONG, with RECORDING_HAS_POWER
+    RecordingColumnStatus,      // USHORT, IA32_THERM_STATUS bits 0..15
+    RecordingColumnFrequency,   // USHORT, with RECORDING_HAS_FREQUENCY
+    RecordingColumnDts,         // UCHAR, see RECORDING_DTS_VALID
+    RecordingColumnTjMax,       // UCHAR
+    RecordingColumnCount
+} RECORDING_COLUMN;
+
+// One sample as handed to the writer
+typedef struct _RECORDING_SAMPLE {
+    ULONG64 Time;
+    ULONG ThermStatus;          // low half of IA32_THERM_STATUS
+    UCHAR TjMax;
+    ULONG Power;                // milliwatts, ignored without RECORDING_HAS_POWER
+    USHORT Frequency;           // MHz, ignored without RECORDING_HAS_FREQUENCY
+} RECORDING_SAMPLE, *PRECORDING_SAMPLE;
+
+typedef struct _RECORDING_WRITER {
+    PRECORDING_FILE_HEADER Header;  // caller's block, written at offset 0
+    PRECORDING_BLOCK_HEADER Index;  // caller's block, the current index block
+    PUCHAR Blocks;              // caller's CpuCount blocks, one open block per CPU
+    ULONG CpuCount;
+    ULONG Flags;
+    ULONG SamplesPerBlock;
+} RECORDING_WRITER, *PRECORDING_WRITER;
+
+typedef struct _RECORDING_READER {
+    const UCHAR* Base;
+    const RECORDING_FILE_HEADER* Header;
+    ULONG64 Blocks;             // complete blocks within the view
+} RECORDING_READER, *PRECORDING_READER;
+
+// Blocks matching a time range, a CPU and a condition: a temperature above
+// AboveC or any of the summary Flags. Without a condition every sample in
+// range matches.
+#define RECORDING_ANY_CPU           MAXULONG
+#define RECORDING_NO_THRESHOLD      MAXLONG
+
+typedef struct _RECORDING_QUERY {
+    ULONG64 From;               // inclusive time range
+    ULONG64 To;
+    ULONG Cpu;                  // or RECORDING_ANY_CPU
+    LONG AboveC;                // or RECORDING_NO_THRESHOLD
+    ULONG Flags;                // RECORDING_SUMMARY_*
+    ULONG64 Next;               // cursor: next block index to look at
+    ULONG64 BlocksSkipped;      // sample blocks ruled out by the index
+    ULONG64 BlocksOpened;       // sample blocks returned
+} RECORDING_QUERY, *PRECORDING_QUERY;
+
+FORCEINLINE ULONG RecordingColumnWidth(RECORDING_COLUMN Column, ULONG Flags)
+{
+    switch (Column) {
+    case RecordingColumnTime:       return sizeof(ULONG64);
+    case RecordingColumnPower:      return (Flags & RECORDING_HAS_POWER) ? sizeof(ULONG) : 0;
+    case RecordingColumnStatus:     return sizeof(USHORT);
+    case RecordingColumnFrequency:  return (Flags & RECORDING_HAS_FREQUENCY) ? sizeof(USHORT) : 0;
+    case RecordingColumnDts:        return sizeof(UCHAR);
+    case RecordingColumnTjMax:      return sizeof(UCHAR);
+    default:                        return 0;
+    }
+}
+
+FORCEINLINE ULONG RecordingSamplesPerBlock(ULONG Flags)
+{
+    ULONG width = 0;
+    for (ULONG c = 0; c < RecordingColumnCount; c++) {
+        width += RecordingColumnWidth((RECORDING_COLUMN)c, Flags);
+    }
+    return (RECORDING_BLOCK_SIZE - sizeof(RECORDING_BLOCK_HEADER)) / width;
+}
+
+// Byte offset of a column from the start of its block. Columns are in
+// decreasing width order, so each is naturally aligned.
+FORCEINLINE ULONG RecordingColumnOffset(RECORDING_COLUMN Column, ULONG Flags, ULONG SamplesPerBlock)
+{
+    ULONG offset = sizeof(RECORDING_BLOCK_HEADER);
+    for (ULONG c = 0; c < (ULONG)Column; c++) {
+        offset += RecordingColumnWidth((RECORDING_COLUMN)c, Flags) * SamplesPerBlock;
+    }
+    return offset;
+}
+
+FORCEINLINE ULONG64 RecordingBlockOffset(ULONG64 Index)
+{
+    return Index * RECORDING_BLOCK_SIZE;
+}
+
+// Index block listing block Index (Index itself if it is an index block)
+FORCEINLINE ULONG64 RecordingIndexBlockOf(ULONG64 Index)
+{
+    return Index - (Index - 1) % (RECORDING_INDEX_SPAN + 1);
+}
+
+// Summary flags of one status word of a file with the given flags
+FORCEINLINE ULONG RecordingStatusFlags(ULONG ThermStatus, ULONG Flags)
+{
+    ULONG64 active = ThermStatusActive(ThermStatus, (Flags & RECORDING_LOGS_CLEARED) != 0);
+
+    return ((active & THERM_STATUS_PROCHOT) ? RECORDING_SUMMARY_PROCHOT : 0) |
+           ((active & THERM_STATUS_CRITICAL_TEMP) ? RECORDING_SUMMARY_CRITICAL : 0);
+}
+
+FORCEINLINE VOID RecordingBlockReset(_Out_ PRECORDING_BLOCK_HEADER Block, ULONG Cpu)
+{
+    RtlZeroMemory(Block, sizeof(*Block));
+    Block->Magic = RECORDING_BLOCK_MAGIC;
+    Block->Cpu = Cpu;
+    Block->MinTemperature = RECORDING_NO_MIN;
+    Block->MaxTemperature = RECORDING_NO_MAX;
+}
+
+//
+// Writer
+//
+
+// Header, Index (RECORDING_BLOCK_SIZE bytes each) and Blocks (CpuCount *
+// RECORDING_BLOCK_SIZE bytes) are owned by the caller and must stay valid
+// while the writer is used
+FORCEINLINE BOOLEAN RecordingWriterInit(_Out_ PRECORDING_WRITER Writer, _Out_ PRECORDING_FILE_HEADER Header,
+                                        _Out_writes_bytes_(RECORDING_BLOCK_SIZE) PVOID Index,
+                                        _Out_writes_bytes_(CpuCount * RECORDING_BLOCK_SIZE) PVOID Blocks,
+                                        ULONG CpuCount, ULONG Flags)
+{
+    if (CpuCount == 0 || CpuCount > RECORDING_MAX_CPUS) {
+        return FALSE;
+    }
+
+    RtlZeroMemory(Header, RECORDING_BLOCK_SIZE);
+    Header->Magic = RECORDING_MAGIC;
+    Header->Version = RECORDING_VERSION;
+    Header->BlockSize = RECORDING_BLOCK_SIZE;
+    Header->Flags = Flags & (RECORDING_HAS_POWER | RECORDING_HAS_FREQUENCY | RECORDING_LOGS_CLEARED);
+    Header->CpuCount = CpuCount;
+    Header->SamplesPerBlock = RecordingSamplesPerBlock(Header->Flags);
+
+    Writer->Header = Header;
+    Writer->Index = (PRECORDING_BLOCK_HEADER)Index;
+    Writer->Blocks = (PUCHAR)Blocks;
+    Writer->CpuCount = CpuCount;
+    Writer->Flags = Header->Flags;
+    Writer->SamplesPerBlock = Header->SamplesPerBlock;
+
+    RtlZeroMemory(Writer->Index, RECORDING_BLOCK_SIZE);
+    for (ULONG cpu = 0; cpu < CpuCount; cpu++) {
+        RecordingBlockReset((PRECORDING_BLOCK_HEADER)(Writer->Blocks + (SIZE_T)cpu * RECORDING_BLOCK_SIZE), cpu);
+    }
+    return TRUE;
+}
+
+// Gives the open block of Cpu its index, links it into the CPU's chain and
+// lists it in the index block. The caller writes it at
+// RecordingBlockOffset(Index), then Writer->Index at its own offset, then the
+// file header.
+FORCEINLINE PRECORDING_BLOCK_HEADER RecordingSeal(_Inout_ PRECORDING_WRITER Writer, ULONG Cpu)
+{
+    PRECORDING_BLOCK_HEADER block = (PRECORDING_BLOCK_HEADER)(Writer->Blocks + (SIZE_T)Cpu * RECORDING_BLOCK_SIZE);
+    PRECORDING_BLOCK_HEADER index = Writer->Index;
+
+    if (block->Samples == 0 || block->Index != 0) {
+        return NULL;
+    }
+
+    // Every RECORDING_INDEX_SPAN + 1 blocks, the next index is an index block
+    ULONG64 next = Writer->Header->BlockCount + 1;
+    if (RecordingIndexBlockOf(next) == next) {
+        RecordingBlockReset(index, RECORDING_INDEX_CPU);
+        index->Index = next;
+        index->FirstTime = MAXULONG64;
+        next++;
+    }
+    Writer->Header->BlockCount = next;
+
+    block->Index = next;
+    block->PreviousBlock = Writer->Header->LastBlock[Cpu];
+    Writer->Header->LastBlock[Cpu] = block->Index;
+
+    PRECORDING_INDEX_ENTRY entry = (PRECORDING_INDEX_ENTRY)(index + 1) + index->Samples++;
+    entry->FirstTime = block->FirstTime;
+    entry->LastTime = block->LastTime;
+    entry->Cpu = (USHORT)Cpu;
+    entry->MinTemperature = block->MinTemperature;
+    entry->MaxTemperature = block->MaxTemperature;
+    entry->SummaryFlags = (USHORT)block->SummaryFlags;
+
+    index->FirstTime = min(index->FirstTime, block->FirstTime);
+    index->LastTime = max(index->LastTime, block->LastTime);
+    index->MinTemperature = min(index->MinTemperature, block->MinTemperature);
+    index->MaxTemperature = max(index->MaxTemperature, block->MaxTemperature);
+    index->SummaryFlags |= block->SummaryFlags;
+    return block;
+}
+
+// Appends one sample of Cpu. Returns the block it completed, to be written
+// before the next append for that CPU, or NULL.
+FORCEINLINE PRECORDING_BLOCK_HEADER RecordingAppend(_Inout_ PRECORDING_WRITER Writer, ULONG Cpu,
+                                                    _In_ const RECORDING_SAMPLE* Sample)
+{
+    if (Cpu >= Writer->CpuCount) {
+        return NULL;
+    }
+
+    PUCHAR base = Writer->Blocks + (SIZE_T)Cpu * RECORDING_BLOCK_SIZE;
+    PRECORDING_BLOCK_HEADER block = (PRECORDING_BLOCK_HEADER)base;
+    ULONG flags = Writer->Flags;
+    ULONG n = Writer->SamplesPerBlock;
+
+    // The previous block was handed out; start over in the same buffer
+    if (block->Index != 0) {
+        RecordingBlockReset(block, Cpu);
+    }
+
+    ULONG i = block->Samples;
+    if (i == 0) {
+        block->FirstTime = Sample->Time;
+        if (Writer->Header->CreatedTime == 0) {
+            Writer->Header->CreatedTime = Sample->Time;
+        }
+    }
+    block->LastTime = Sample->Time;
+
+    if (Sample->ThermStatus & 0x80000000UL) {
+        SHORT temperature = (SHORT)(Sample->TjMax - ((Sample->ThermStatus >> 16) & 0x7F));
+        block->MinTemperature = min(block->MinTemperature, temperature);
+        block->MaxTemperature = max(block->MaxTemperature, temperature);
+    }
+    block->SummaryFlags |= RecordingStatusFlags(Sample->ThermStatus, flags);
+
+    ((PULONG64)(base + RecordingColumnOffset(RecordingColumnTime, flags, n)))[i] = Sample->Time;
+    ((PUSHORT)(base + RecordingColumnOffset(RecordingColumnStatus, flags, n)))[i] = (USHORT)Sample->ThermStatus;
+    ((PUCHAR)(base + RecordingColumnOffset(RecordingColumnDts, flags, n)))[i] =
+        (UCHAR)(((Sample->ThermStatus >> 16) & 0x7F) | ((Sample->ThermStatus & 0x80000000UL) ? RECORDING_DTS_VALID : 0));
+    ((PUCHAR)(base + RecordingColumnOffset(RecordingColumnTjMax, flags, n)))[i] = Sample->TjMax;
+    if (flags & RECORDING_HAS_POWER) {
+        ((PULONG)(base + RecordingColumnOffset(RecordingColumnPower, flags, n)))[i] = Sample->Power;
+    }
+    if (flags & RECORDING_HAS_FREQUENCY) {
+        ((PUSHORT)(base + RecordingColumnOffset(RecordingColumnFrequency, flags, n)))[i] = Sample->Frequency;
+    }
+
+    block->Samples = i + 1;
+    return (block->Samples == n) ? RecordingSeal(Writer, Cpu) : NULL;
+}
+
+//
+// Reader, over a mapped view of the file
+//
+
+// Validates the file header. Size is the size of the view; blocks the
+// header counts beyond it (a file still being written) are left out.
+FORCEINLINE BOOLEAN RecordingOpen(_Out_ PRECORDING_READER Reader, _In_reads_bytes_(Size) const VOID* Base, ULONG64 Size)
+{
+    const RECORDING_FILE_HEADER* header = (const RECORDING_FILE_HEADER*)Base;
+
+    if (Size < RECORDING_BLOCK_SIZE || header->Magic != RECORDING_MAGIC || header->Version != RECORDING_VERSION ||
+        header->BlockSize != RECORDING_BLOCK_SIZE || header->CpuCount > RECORDING_MAX_CPUS ||
+        header->SamplesPerBlock != RecordingSamplesPerBlock(header->Flags)) {
+        return FALSE;
+    }
+
+    ULONG64 present = Size / RECORDING_BLOCK_SIZE - 1;
+    Reader->Base = (const UCHAR*)Base;
+    Reader->Header = header;
+    Reader->Blocks = (header->BlockCount < present) ? header->BlockCount : present;
+    return TRUE;
+}
+
+// Block Index of Cpu, or NULL if it is outside the view or not that CPU's
+FORCEINLINE const RECORDING_BLOCK_HEADER* RecordingBlock(_In_ const RECORDING_READER* Reader, ULONG64 Index, ULONG Cpu)
+{
+    if (Index == 0 || Index > Reader->Blocks) {
+        return NULL;
+    }
+    const RECORDING_BLOCK_HEADER* block =
+        (const RECORDING_BLOCK_HEADER*)(Reader->Base + RecordingBlockOffset(Index));
+    if (block->Magic != RECORDING_BLOCK_MAGIC || block->Cpu != Cpu || block->Index != Index ||
+        block->Samples > Reader->Header->SamplesPerBlock) {
+        return NULL;
+    }
+    return block;
+}
+
+// Newest block of Cpu, NULL if it has none in the view; walk back with
+// RecordingPreviousBlock
+FORCEINLINE const RECORDING_BLOCK_HEADER* RecordingLastBlock(_In_ const RECORDING_READER* Reader, ULONG Cpu)
+{
+    if (Cpu >= Reader->Header->CpuCount) {
+        return NULL;
+    }
+    return RecordingBlock(Reader, Reader->Header->LastBlock[Cpu], Cpu);
+}
+
+FORCEINLINE const RECORDING_BLOCK_HEADER* RecordingPreviousBlock(_In_ const RECORDING_READER* Reader,
+                                                                 _In_ const RECORDING_BLOCK_HEADER* Block)
+{
+    // Links always point back, which also bounds a walk over a corrupt file
+    if (Block->PreviousBlock >= Block->Index) {
+        return NULL;
+    }
+    return RecordingBlock(Reader, Block->PreviousBlock, Block->Cpu);
+}
+
+// First entry of a column in a block; NULL for an absent optional column
+FORCEINLINE const VOID* RecordingColumn(_In_ const RECORDING_READER* Reader, _In_ const RECORDING_BLOCK_HEADER* Block,
+                                        RECORDING_COLUMN Column)
+{
+    ULONG flags = Reader->Header->Flags;
+    if (RecordingColumnWidth(Column, flags) == 0) {
+        return NULL;
+    }
+    return (const UCHAR*)Block + RecordingColumnOffset(Column, flags, Reader->Header->SamplesPerBlock);
+}
+
+// Temperature from a DTS and a TjMax column entry, degrees C, -1 if the reading was not valid
+FORCEINLINE LONG RecordingTemperature(UCHAR Dts, UCHAR TjMax)
+{
+    return (Dts & RECORDING_DTS_VALID) ? (LONG)TjMax - (LONG)(Dts & 0x7F) : -1;
+}
+
+//
+// Range queries
+//
+
+FORCEINLINE VOID RecordingQueryInit(_Out_ PRECORDING_QUERY Query, ULONG64 From, ULONG64 To, ULONG Cpu,
+                                    LONG AboveC, ULONG Flags)
+{
+    Query->From = From;
+    Query->To = To;
+    Query->Cpu = Cpu;
+    Query->AboveC = AboveC;
+    Query->Flags = Flags;
+    Query->Next = 1;
+    Query->BlocksSkipped = 0;
+    Query->BlocksOpened = 0;
+}
+
+FORCEINLINE BOOLEAN RecordingSummaryMatches(_In_ const RECORDING_QUERY* Query, ULONG64 FirstTime, ULONG64 LastTime,
+                                            LONG MaxTemperature, ULONG Flags)
+{
+    if (LastTime < Query->From || FirstTime > Query->To) {
+        return FALSE;
+    }
+    if (Query->AboveC == RECORDING_NO_THRESHOLD && Query->Flags == 0) {
+        return TRUE;
+    }
+    return (Query->AboveC != RECORDING_NO_THRESHOLD && MaxTemperature > Query->AboveC) || (Flags & Query->Flags) != 0;
+}
+
+// Next sample block that may hold a match, in file order; NULL when done.
+// Only index blocks are read to rule blocks out.
+FORCEINLINE const RECORDING_BLOCK_HEADER* RecordingQueryNext(_In_ const RECORDING_READER* Reader,
+                                                             _Inout_ PRECORDING_QUERY Query)
+{
+    while (Query->Next <= Reader->Blocks) {
+        ULONG64 first = RecordingIndexBlockOf(Query->Next);
+        const RECORDING_BLOCK_HEADER* index = RecordingBlock(Reader, first, RECORDING_INDEX_CPU);
+        if (index == NULL || index->Samples > RECORDING_INDEX_SPAN) {
+            return NULL;
+        }
+
+        // The whole run can be passed over on the index block's own summary
+        if (Query->Next == first) {
+            if (!RecordingSummaryMatches(Query, index->FirstTime, index->LastTime, index->MaxTemperature,
+                                         index->SummaryFlags)) {
+                Query->BlocksSkipped += index->Samples;
+                Query->Next = first + RECORDING_INDEX_SPAN + 1;
+                continue;
+            }
+            Query->Next++;
+        }
+
+        const RECORDING_INDEX_ENTRY* entries = (const RECORDING_INDEX_ENTRY*)(index + 1);
+        ULONG64 listed = first + index->Samples;
+        while (Query->Next <= listed && Query->Next <= Reader->Blocks) {
+            const RECORDING_INDEX_ENTRY* entry = &entries[Query->Next - first - 1];
+            ULONG64 candidate = Query->Next++;
+
+            if ((Query->Cpu != RECORDING_ANY_CPU && entry->Cpu != Query->Cpu) ||
+                !RecordingSummaryMatches(Query, entry->FirstTime, entry->LastTime, entry->MaxTemperature,
+                                         entry->SummaryFlags)) {
+                Query->BlocksSkipped++;
+                continue;
+            }
+            const RECORDING_BLOCK_HEADER* block = RecordingBlock(Reader, candidate, entry->Cpu);
+            if (block != NULL) {
+                Query->BlocksOpened++;
+                return block;
+            }
+        }
+        if (Query->Next <= listed) {
+            return NULL;        // the rest is beyond the view
+        }
+        Query->Next = first + RECORDING_INDEX_SPAN + 1;
+    }
+    return NULL;
+}
+
+// First sample of Block at or after Start that matches the query, MAXULONG if none
+FORCEINLINE ULONG RecordingQuerySample(_In_ const RECORDING_READER* Reader, _In_ const RECORDING_QUERY* Query,
+                                       _In_ const RECORDING_BLOCK_HEADER* Block, ULONG Start)
+{
+    const ULONG64* time = (const ULONG64*)RecordingColumn(Reader, Block, RecordingColumnTime);
+    const USHORT* status = (const USHORT*)RecordingColumn(Reader, Block, RecordingColumnStatus);
+    const UCHAR* dts = (const UCHAR*)RecordingColumn(Reader, Block, RecordingColumnDts);
+    const UCHAR* tjMax = (const UCHAR*)RecordingColumn(Reader, Block, RecordingColumnTjMax);
+    BOOLEAN any = (Query->AboveC == RECORDING_NO_THRESHOLD && Query->Flags == 0);
+
+    for (ULONG i = Start; i < Block->Samples; i++) {
+        if (time[i] < Query->From || time[i] > Query->To) {
+            continue;
+        }
+        if (any || (RecordingStatusFlags(status[i], Reader->Header->Flags) & Query->Flags) != 0) {
+            return i;
+        }
+        if (Query->AboveC != RECORDING_NO_THRESHOLD && (dts[i] & RECORDING_DTS_VALID) &&
+            RecordingTemperature(dts[i], tjMax[i]) > Query->AboveC) {
+            return i;
+        }
+    }
+    return MAXULONG;
+}
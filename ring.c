@@ -0,0 +1,66 @@
+#include "ring.h"
+
+VOID RingInit(_Out_ PSAMPLE_RING Ring)
+{
+    RtlZeroMemory(Ring, sizeof(*Ring));
+}
+
+// Producer only. Clears the slot's stamp, writes the record, then stamps it
+// and advances Head. Never waits.
+VOID RingPublish(_Inout_ PSAMPLE_RING Ring, _In_ const WINMSR_SAMPLE_RECORD* Record)
+{
+    ULONG64 position = (ULONG64)ReadNoFence64(&Ring->Head);
+    PRING_SLOT slot = &Ring->Slots[position & RING_MASK];
+
+    WriteNoFence64(&slot->Stamp, 0);
+    MemoryBarrier();
+    slot->Record = *Record;
+    WriteRelease64(&slot->Stamp, (LONG64)(position + 1));
+    WriteRelease64(&Ring->Head, (LONG64)(position + 1));
+}
+
+ULONG64 RingHead(_In_ const SAMPLE_RING* Ring)
+{
+    return (ULONG64)ReadAcquire64(&Ring->Head);
+}
+
+// Copies up to MaxRecords records from *Cursor on and advances *Cursor past
+// them. Records the producer has already overwritten are skipped and counted
+// in *Lost. A cursor of 0 starts at the oldest record still in the ring.
+ULONG RingRead(_In_ const SAMPLE_RING* Ring, _Inout_ PULONG64 Cursor,
+               _Out_writes_(MaxRecords) PWINMSR_SAMPLE_RECORD Records, ULONG MaxRecords,
+               _Out_ PULONG64 Lost)
+{
+    ULONG64 cursor = *Cursor;
+    ULONG64 head = RingHead(Ring);
+    ULONG count = 0;
+
+    *Lost = 0;
+    while (count < MaxRecords && cursor < head) {
+        if (head - cursor > RING_CAPACITY) {
+            *Lost += head - RING_CAPACITY - cursor;
+            cursor = head - RING_CAPACITY;
+        }
+
+        const RING_SLOT* slot = &Ring->Slots[cursor & RING_MASK];
+        if ((ULONG64)ReadAcquire64(&slot->Stamp) == cursor + 1) {
+            Records[count] = slot->Record;
+            MemoryBarrier();
+            if ((ULONG64)ReadAcquire64(&slot->Stamp) == cursor + 1) {
+                count++;
+                cursor++;
+                continue;
+            }
+        }
+
+        // Lapped while copying: the slot now belongs to a later record
+        head = RingHead(Ring);
+        ULONG64 oldest = head - RING_CAPACITY + 1;
+        ULONG64 next = (oldest > cursor + 1) ? oldest : cursor + 1;
+        *Lost += next - cursor;
+        cursor = next;
+    }
+
+    *Cursor = cursor;
+    return count;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "public.h"
+
+//
+// Single-producer, multi-consumer broadcast ring of sample records. The
+// producer writes each record once and never looks at readers; every reader
+// keeps its own cursor and detects on its own when it has been lapped.
+// Portable: no kernel calls, no allocation.
+//
+
+#define RING_CAPACITY           1024    // records, power of two
+#define RING_MASK               (RING_CAPACITY - 1)
+
+// Stamp is the record's position + 1 once the record is complete, 0 while
+// the producer is rewriting the slot.
+typedef struct _RING_SLOT {
+    volatile LONG64 Stamp;
+    WINMSR_SAMPLE_RECORD Record;
+} RING_SLOT, *PRING_SLOT;
+
+typedef struct _SAMPLE_RING {
+    DECLSPEC_CACHEALIGN volatile LONG64 Head;   // position of the next record to write
+    DECLSPEC_CACHEALIGN RING_SLOT Slots[RING_CAPACITY];
+} SAMPLE_RING, *PSAMPLE_RING;
+
+VOID RingInit(_Out_ PSAMPLE_RING Ring);
+VOID RingPublish(_Inout_ PSAMPLE_RING Ring, _In_ const WINMSR_SAMPLE_RECORD* Record);
+ULONG64 RingHead(_In_ const SAMPLE_RING* Ring);
+ULONG RingRead(_In_ const SAMPLE_RING* Ring, _Inout_ PULONG64 Cursor,
+               _Out_writes_(MaxRecords) PWINMSR_SAMPLE_RECORD Records, ULONG MaxRecords,
+               _Out_ PULONG64 Lost);
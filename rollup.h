@@ -0,0 +1,241 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+
+//
+// Multi-resolution rollups of one CPU's samples: 1 s, 10 s, 1 min and 1 h
+// buckets, maintained as samples arrive. Buckets are aligned to multiples of
+// their length and every length divides the next, so a closed bucket is
+// folded whole into the bucket above it. All sums are integers: a rollup is
+// exactly what recomputing the same buckets from the raw samples gives.
+// Header-only like rank.h; the caller owns one ROLLUP_SERIES per CPU.
+//
+// Throttle time and covered time weigh each sample by the time since the
+// previous sample of the CPU, at most ROLLUP_MAX_COVER, counted in the
+// bucket the sample falls in.
+//
+
+#define ROLLUP_TIERS                4
+#define ROLLUP_MAX_COVER            10000000ULL     // 1 s, 100 ns units
+#define ROLLUP_NO_TEMPERATURE_MIN   MAXLONG
+#define ROLLUP_NO_TEMPERATURE_MAX   MINLONG
+
+// Bucket lengths in 100 ns units, finest first
+#define ROLLUP_LENGTH_1S            10000000ULL
+#define ROLLUP_LENGTH_10S           100000000ULL
+#define ROLLUP_LENGTH_1M            600000000ULL
+#define ROLLUP_LENGTH_1H            36000000000ULL
+
+// Closed buckets kept per tier: 10 min, 1 h, 1 day and 30 days
+#define ROLLUP_KEEP_1S              600
+#define ROLLUP_KEEP_10S             360
+#define ROLLUP_KEEP_1M              1440
+#define ROLLUP_KEEP_1H              720
+
+// One sample as fed to the rollups
+typedef struct _ROLLUP_SAMPLE {
+    ULONG64 Time;               // interrupt time, 100 ns units
+    LONG Temperature;           // degrees C, -1 if the reading was not valid
+    BOOLEAN Throttled;          // e.g. RollupThrottled(ThermStatus)
+    ULONG64 Energy;             // microjoules since the previous sample, 0 if not measured
+} ROLLUP_SAMPLE, *PROLLUP_SAMPLE;
+
+typedef struct _ROLLUP_BUCKET {
+    ULONG64 Index;              // covers [Index * length, (Index + 1) * length)
+    ULONG Samples;              // 0: empty
+    ULONG ValidSamples;
+    LONG MinTemperature;        // over valid samples, ROLLUP_NO_TEMPERATURE_* if none
+    LONG MaxTemperature;
+    LONG64 SumTemperature;      // mean = SumTemperature / ValidSamples
+    ULONG64 CoveredTime;        // throttle fraction = ThrottleTime / CoveredTime
+    ULONG64 ThrottleTime;
+    ULONG64 Energy;             // microjoules
+} ROLLUP_BUCKET, *PROLLUP_BUCKET;
+
+typedef struct _ROLLUP_TIER {
+    ROLLUP_BUCKET Open;
+    ULONG64 Closed;             // buckets closed so far; the newest is at (Closed - 1) % Keep
+    ULONG Keep;
+    PROLLUP_BUCKET Ring;        // points into ROLLUP_SERIES
+} ROLLUP_TIER, *PROLLUP_TIER;
+
+typedef struct _ROLLUP_SERIES {
+    ULONG64 LastTime;           // of the previous sample, 0 before the first
+    ROLLUP_TIER Tier[ROLLUP_TIERS];
+    ROLLUP_BUCKET Ring1s[ROLLUP_KEEP_1S];
+    ROLLUP_BUCKET Ring10s[ROLLUP_KEEP_10S];
+    ROLLUP_BUCKET Ring1m[ROLLUP_KEEP_1M];
+    ROLLUP_BUCKET Ring1h[ROLLUP_KEEP_1H];
+} ROLLUP_SERIES, *PROLLUP_SERIES;
+
+FORCEINLINE ULONG64 RollupLength(ULONG Tier)
+{
+    switch (Tier) {
+    case 0:     return ROLLUP_LENGTH_1S;
+    case 1:     return ROLLUP_LENGTH_10S;
+    case 2:     return ROLLUP_LENGTH_1M;
+    default:    return ROLLUP_LENGTH_1H;
+    }
+}
+
+// PROCHOT or power limitation (IA32_THERM_STATUS bits 2 and 10)
+FORCEINLINE BOOLEAN RollupThrottled(ULONG ThermStatus)
+{
+    return (ThermStatus & 0x404) != 0;
+}
+
+FORCEINLINE VOID RollupBucketReset(_Out_ PROLLUP_BUCKET Bucket, ULONG64 Index)
+{
+    RtlZeroMemory(Bucket, sizeof(*Bucket));
+    Bucket->Index = Index;
+    Bucket->MinTemperature = ROLLUP_NO_TEMPERATURE_MIN;
+    Bucket->MaxTemperature = ROLLUP_NO_TEMPERATURE_MAX;
+}
+
+FORCEINLINE VOID RollupBucketMerge(_Inout_ PROLLUP_BUCKET Into, _In_ const ROLLUP_BUCKET* From)
+{
+    Into->Samples += From->Samples;
+    Into->ValidSamples += From->ValidSamples;
+    Into->MinTemperature = min(Into->MinTemperature, From->MinTemperature);
+    Into->MaxTemperature = max(Into->MaxTemperature, From->MaxTemperature);
+    Into->SumTemperature += From->SumTemperature;
+    Into->CoveredTime += From->CoveredTime;
+    Into->ThrottleTime += From->ThrottleTime;
+    Into->Energy += From->Energy;
+}
+
+FORCEINLINE VOID RollupInit(_Out_ PROLLUP_SERIES Series)
+{
+    Series->LastTime = 0;
+    Series->Tier[0].Ring = Series->Ring1s;
+    Series->Tier[0].Keep = ROLLUP_KEEP_1S;
+    Series->Tier[1].Ring = Series->Ring10s;
+    Series->Tier[1].Keep = ROLLUP_KEEP_10S;
+    Series->Tier[2].Ring = Series->Ring1m;
+    Series->Tier[2].Keep = ROLLUP_KEEP_1M;
+    Series->Tier[3].Ring = Series->Ring1h;
+    Series->Tier[3].Keep = ROLLUP_KEEP_1H;
+    for (ULONG t = 0; t < ROLLUP_TIERS; t++) {
+        RollupBucketReset(&Series->Tier[t].Open, 0);
+        Series->Tier[t].Closed = 0;
+    }
+}
+
+// Closes the open bucket of Tier: stores it and folds it into the tier
+// above, closing that tier's open bucket first if it is a different one
+FORCEINLINE VOID RollupClose(_Inout_ PROLLUP_SERIES Series, ULONG Tier)
+{
+    ROLLUP_BUCKET pending = Series->Tier[Tier].Open;
+    RollupBucketReset(&Series->Tier[Tier].Open, 0);
+
+    for (ULONG t = Tier; ; t++) {
+        PROLLUP_TIER tier = &Series->Tier[t];
+        tier->Ring[tier->Closed % tier->Keep] = pending;
+        tier->Closed++;
+        if (t + 1 == ROLLUP_TIERS) {
+            break;
+        }
+
+        PROLLUP_TIER up = &Series->Tier[t + 1];
+        ULONG64 index = pending.Index * RollupLength(t) / RollupLength(t + 1);
+        if (up->Open.Samples == 0 || up->Open.Index == index) {
+            up->Open.Index = index;
+            RollupBucketMerge(&up->Open, &pending);
+            break;
+        }
+
+        // The bucket above belongs to an earlier period: it closes now
+        ROLLUP_BUCKET next = up->Open;
+        RollupBucketReset(&up->Open, index);
+        RollupBucketMerge(&up->Open, &pending);
+        pending = next;
+    }
+}
+
+// Closes every open bucket that ends at or before Now, so the tiers are
+// current for a CPU that has stopped sampling
+FORCEINLINE VOID RollupAdvance(_Inout_ PROLLUP_SERIES Series, ULONG64 Now)
+{
+    for (ULONG t = 0; t < ROLLUP_TIERS; t++) {
+        PROLLUP_BUCKET open = &Series->Tier[t].Open;
+        if (open->Samples != 0 && (open->Index + 1) * RollupLength(t) <= Now) {
+            RollupClose(Series, t);
+        }
+    }
+}
+
+// Folds in one sample. Samples must come in time order and after the last
+// closed 1 s bucket (RollupAdvance may close one early); anything else is
+// dropped and FALSE returned.
+FORCEINLINE BOOLEAN RollupAdd(_Inout_ PROLLUP_SERIES Series, _In_ const ROLLUP_SAMPLE* Sample)
+{
+    PROLLUP_TIER tier = &Series->Tier[0];
+    PROLLUP_BUCKET open = &tier->Open;
+    ULONG64 index = Sample->Time / ROLLUP_LENGTH_1S;
+
+    if (Sample->Time < Series->LastTime ||
+        (tier->Closed != 0 && index <= tier->Ring[(tier->Closed - 1) % tier->Keep].Index)) {
+        return FALSE;
+    }
+    if (open->Samples != 0 && open->Index != index) {
+        RollupClose(Series, 0);
+    }
+    open->Index = index;
+
+    ULONG64 cover = (Series->LastTime != 0) ? Sample->Time - Series->LastTime : 0;
+    cover = min(cover, ROLLUP_MAX_COVER);
+    Series->LastTime = Sample->Time;
+
+    open->Samples++;
+    if (Sample->Temperature >= 0) {
+        open->ValidSamples++;
+        open->MinTemperature = min(open->MinTemperature, Sample->Temperature);
+        open->MaxTemperature = max(open->MaxTemperature, Sample->Temperature);
+        open->SumTemperature += Sample->Temperature;
+    }
+    open->CoveredTime += cover;
+    if (Sample->Throttled) {
+        open->ThrottleTime += cover;
+    }
+    open->Energy += Sample->Energy;
+    return TRUE;
+}
+
+// Copies the closed buckets of Tier that start in [From, To), oldest first,
+// as far as they are still kept. Returns the number written.
+FORCEINLINE ULONG RollupRead(_In_ const ROLLUP_SERIES* Series, ULONG Tier, ULONG64 From, ULONG64 To,
+                             _Out_writes_(Capacity) PROLLUP_BUCKET Buckets, ULONG Capacity)
+{
+    const ROLLUP_TIER* tier = &Series->Tier[Tier];
+    ULONG64 length = RollupLength(Tier);
+    ULONG64 kept = min(tier->Closed, (ULONG64)tier->Keep);
+    ULONG64 lo = tier->Closed - kept;
+    ULONG64 hi = tier->Closed;
+    ULONG count = 0;
+
+    // Closed buckets are in index order: find the first one starting at From
+    while (lo < hi) {
+        ULONG64 mid = lo + (hi - lo) / 2;
+        if (tier->Ring[mid % tier->Keep].Index * length < From) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    for (ULONG64 n = lo; n < tier->Closed && count < Capacity; n++) {
+        const ROLLUP_BUCKET* bucket = &tier->Ring[n % tier->Keep];
+        if (bucket->Index * length >= To) {
+            break;
+        }
+        Buckets[count++] = *bucket;
+    }
+    return count;
+}
@@ -0,0 +1,78 @@
+#include "driver.h"
+
+// Pagefile-backed section holding the latest-snapshot page. The driver writes
+// through a system-space view; each reader handle gets its own read-only view.
+PWINMSR_SNAPSHOT_PAGE SnapshotPage = NULL;
+static HANDLE SnapshotSection = NULL;
+static PVOID SnapshotSectionObject = NULL;
+
+NTSTATUS CreateSnapshot(ULONG CpuCount)
+{
+    OBJECT_ATTRIBUTES attributes;
+    LARGE_INTEGER size;
+    SIZE_T viewSize = 0;
+    PVOID view = NULL;
+    NTSTATUS status;
+
+    size.QuadPart = ROUND_TO_PAGES(FIELD_OFFSET(WINMSR_SNAPSHOT_PAGE, Cpu) + (SIZE_T)CpuCount * sizeof(WINMSR_CPU_SNAPSHOT));
+
+    InitializeObjectAttributes(&attributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    status = ZwCreateSection(&SnapshotSection, SECTION_ALL_ACCESS, &attributes, &size, PAGE_READWRITE, SEC_COMMIT, NULL);
+    if (!NT_SUCCESS(status)) {
+        SnapshotSection = NULL;
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle(SnapshotSection, SECTION_ALL_ACCESS, NULL, KernelMode, &SnapshotSectionObject, NULL);
+    if (!NT_SUCCESS(status)) {
+        SnapshotSectionObject = NULL;
+        DeleteSnapshot();
+        return status;
+    }
+
+    status = MmMapViewInSystemSpace(SnapshotSectionObject, &view, &viewSize);
+    if (!NT_SUCCESS(status)) {
+        DeleteSnapshot();
+        return status;
+    }
+
+    // Section pages start zeroed: every Sequence is even and every entry empty
+    SnapshotPage = (PWINMSR_SNAPSHOT_PAGE)view;
+    SnapshotPage->Version = WINMSR_SNAPSHOT_VERSION;
+    SnapshotPage->CpuCount = CpuCount;
+    SnapshotPage->CpuStride = sizeof(WINMSR_CPU_SNAPSHOT);
+    SnapshotPage->WarmingUp = (LONG)CpuCount;
+    return STATUS_SUCCESS;
+}
+
+// Only after the sampler threads have stopped
+VOID DeleteSnapshot(VOID)
+{
+    if (SnapshotPage != NULL) {
+        MmUnmapViewInSystemSpace(SnapshotPage);
+        SnapshotPage = NULL;
+    }
+    if (SnapshotSectionObject != NULL) {
+        ObDereferenceObject(SnapshotSectionObject);
+        SnapshotSectionObject = NULL;
+    }
+    if (SnapshotSection != NULL) {
+        ZwClose(SnapshotSection);
+        SnapshotSection = NULL;
+    }
+}
+
+// Maps the page into the current process. Must run in the caller's context.
+// SEC_NO_CHANGE stops the caller from making its view writable later.
+NTSTATUS MapSnapshot(_Out_ PVOID* UserAddress, _Out_ PSIZE_T Size)
+{
+    *UserAddress = NULL;
+    *Size = 0;
+    return ZwMapViewOfSection(SnapshotSection, ZwCurrentProcess(), UserAddress, 0, 0, NULL, Size,
+                              ViewUnmap, SEC_NO_CHANGE, PAGE_READONLY);
+}
+
+VOID UnmapSnapshot(_In_ PVOID UserAddress)
+{
+    ZwUnmapViewOfSection(ZwCurrentProcess(), UserAddress);
+}
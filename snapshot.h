@@ -0,0 +1,95 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "public.h"
+#include "forecast.h"
+
+//
+// Seqlock access to the latest-snapshot page. Header-only so user-mode
+// readers can include it next to public.h: a read is a few loads from the
+// mapped page, no system call and no lock.
+//
+
+// Entry of one CPU; CpuStride keeps older readers working if the entry grows
+FORCEINLINE const WINMSR_CPU_SNAPSHOT* SnapshotCpu(_In_ const WINMSR_SNAPSHOT_PAGE* Page, ULONG Cpu)
+{
+    return (const WINMSR_CPU_SNAPSHOT*)((const UCHAR*)Page->Cpu + (SIZE_T)Cpu * Page->CpuStride);
+}
+
+// Writer side, called only by the CPU's own sampler thread
+FORCEINLINE VOID SnapshotWrite(_Inout_ PWINMSR_CPU_SNAPSHOT Entry, LONG Temperature, ULONG Dts,
+                               ULONG ThermStatus, ULONG64 Tsc, ULONG64 Time, _In_ const FORECAST* Forecast)
+{
+    InterlockedIncrement(&Entry->Sequence);
+    Entry->Temperature = Temperature;
+    Entry->Dts = Dts;
+    Entry->ThermStatus = ThermStatus;
+    Entry->Tsc = Tsc;
+    Entry->Time = Time;
+    Entry->Flags = 0;
+    Entry->CheckTime = Time;
+    Entry->Level = Forecast->Level;
+    Entry->Slope = Forecast->Slope;
+    Entry->ProchotPermille = (ULONG)Forecast->Prochot;
+    InterlockedIncrement(&Entry->Sequence);
+}
+
+// Writer side: the CPU was found idle at Time; the last reading, whether
+// taken just now or earlier, stays in place
+FORCEINLINE VOID SnapshotMarkIdle(_Inout_ PWINMSR_CPU_SNAPSHOT Entry, ULONG64 Time)
+{
+    InterlockedIncrement(&Entry->Sequence);
+    Entry->Flags |= WINMSR_SNAPSHOT_IDLE;
+    Entry->CheckTime = Time;
+    InterlockedIncrement(&Entry->Sequence);
+}
+
+// Takes a consistent copy of one entry. Returns FALSE if the writer was
+// mid-update; the caller may retry or use its previous copy.
+FORCEINLINE BOOLEAN SnapshotTryRead(_In_ const WINMSR_CPU_SNAPSHOT* Entry, _Out_ PWINMSR_CPU_SNAPSHOT Copy)
+{
+    LONG sequence = ReadAcquire(&Entry->Sequence);
+    if (sequence & 1) {
+        return FALSE;
+    }
+
+    Copy->Temperature = Entry->Temperature;
+    Copy->Dts = Entry->Dts;
+    Copy->ThermStatus = Entry->ThermStatus;
+    Copy->Tsc = Entry->Tsc;
+    Copy->Time = Entry->Time;
+    Copy->Flags = Entry->Flags;
+    Copy->CheckTime = Entry->CheckTime;
+    Copy->Level = Entry->Level;
+    Copy->Slope = Entry->Slope;
+    Copy->ProchotPermille = Entry->ProchotPermille;
+    Copy->Core = Entry->Core;
+    Copy->Package = Entry->Package;
+    Copy->TjMax = Entry->TjMax;
+    Copy->Die = Entry->Die;
+    MemoryBarrier();
+
+    Copy->Sequence = sequence;
+    return ReadAcquire(&Entry->Sequence) == sequence;
+}
+
+FORCEINLINE VOID SnapshotRead(_In_ const WINMSR_CPU_SNAPSHOT* Entry, _Out_ PWINMSR_CPU_SNAPSHOT Copy)
+{
+    while (!SnapshotTryRead(Entry, Copy)) {
+        YieldProcessor();
+    }
+}
+
+// Temperature HorizonMs (clamped to 0 .. FORECAST_MAX_HORIZON_MS) ahead of
+// the copy's last reading, milli-degrees C
+FORCEINLINE LONG SnapshotForecast(_In_ const WINMSR_CPU_SNAPSHOT* Copy, LONG HorizonMs)
+{
+    return Copy->Level + Copy->Slope * ForecastClampHorizon(HorizonMs) / 1000;
+}
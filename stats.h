@@ -0,0 +1,38 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "msr.h"
+
+//
+// Self-statistics of one CPU. Only the owning core thread writes its entry,
+// so counters are bumped without interlocked operations; readers sum them
+// without locking. Each entry sits on its own cache line. RingOverruns is the
+// exception: ring readers add the records they lost with InterlockedAdd64.
+// Portable, so bench/falseshare_bench measures this very layout.
+//
+
+typedef struct DECLSPEC_CACHEALIGN _CORE_STATS {
+    volatile LONG64 SamplesTaken;
+    volatile LONG64 MsrFaults[MsrIndexCount];
+    volatile LONG64 RingOverruns;
+    volatile LONG64 LateTimerFires;
+    volatile LONG64 SampleCycles;
+    volatile LONG64 ThreadCreateFailures;
+    volatile LONG64 IdleSkips;  // fires that found the CPU idle and did not read it
+} CORE_STATS, *PCORE_STATS;
+
+C_ASSERT(TYPE_ALIGNMENT(CORE_STATS) == 64 && sizeof(CORE_STATS) % 64 == 0);
+
+// Owner-only bump of a counter other CPUs may read: a plain load and store,
+// no lock prefix
+FORCEINLINE VOID StatAdd(volatile LONG64* Counter, LONG64 Value)
+{
+    WriteNoFence64(Counter, ReadNoFence64(Counter) + Value);
+}
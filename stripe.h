@@ -0,0 +1,72 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+
+//
+// Striped sampling schedule. The session grid is cut into Stripes ticks per
+// period; CPU i belongs to stripe i % Stripes and samples on the ticks of its
+// stripe only, so every CPU is still read once per period while at most
+// ceil(CPUs / Stripes) CPUs fire on any tick. Promoted (hot) CPUs sample on
+// every tick; a shared budget caps how many, which keeps the per-tick bound
+// at ceil(CPUs / Stripes) + budget. Portable: no kernel calls, no allocation.
+//
+
+// A promoted CPU is demoted only this far below the promotion threshold
+#define STRIPE_HYSTERESIS_C     3
+
+FORCEINLINE ULONG StripeOf(ULONG Cpu, ULONG Stripes)
+{
+    return (Stripes > 1) ? Cpu % Stripes : 0;
+}
+
+// First tick at or after Tick that a CPU of Stripe samples when it fires on
+// every Stride-th tick: Stride is Stripes normally, 1 when promoted.
+FORCEINLINE ULONG64 StripeNextTick(ULONG64 Tick, ULONG Stride, ULONG Stripe)
+{
+    if (Stride <= 1) {
+        return Tick;
+    }
+    ULONG64 offset = (Stripe + Stride - Tick % Stride) % Stride;
+    return Tick + offset;
+}
+
+// Whether a CPU should sample on every tick: a thermal state bit is active,
+// or the temperature is within MarginC of TjMax (less the hysteresis once
+// already promoted). Invalid readings never promote.
+FORCEINLINE BOOLEAN StripeWantsPromotion(int Temperature, int TjMax, BOOLEAN Alarm, ULONG MarginC, BOOLEAN Promoted)
+{
+    if (Alarm) {
+        return TRUE;
+    }
+    if (Temperature < 0) {
+        return FALSE;
+    }
+    int threshold = TjMax - (int)MarginC - (Promoted ? STRIPE_HYSTERESIS_C : 0);
+    return Temperature >= threshold;
+}
+
+// Takes one slot of the promotion budget; fails once Max CPUs hold one
+FORCEINLINE BOOLEAN StripePromote(volatile LONG* Promoted, LONG Max)
+{
+    LONG current = *Promoted;
+    while (current < Max) {
+        LONG seen = InterlockedCompareExchange(Promoted, current + 1, current);
+        if (seen == current) {
+            return TRUE;
+        }
+        current = seen;
+    }
+    return FALSE;
+}
+
+FORCEINLINE VOID StripeDemote(volatile LONG* Promoted)
+{
+    InterlockedDecrement(Promoted);
+}
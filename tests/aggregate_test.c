@@ -0,0 +1,158 @@
+#include "test.h"
+#include "aggregate.h"
+
+//
+// Interval aggregation against a brute-force recomputation: random sample
+// streams (gaps of several intervals, samples on boundaries, invalid
+// readings, status words with bits above the counted ones) are fed to
+// IntervalAdd, and every closed interval plus the open one must equal the
+// summary recomputed from the raw samples of its interval.
+//
+
+#define STREAMS         200
+#define MAX_SAMPLES     5000
+
+typedef struct _SAMPLE {
+    ULONG64 Time;
+    LONG Temperature;
+    ULONG64 ThermStatus;
+} SAMPLE;
+
+static SAMPLE Samples[MAX_SAMPLES];
+static WINMSR_INTERVAL_SUMMARY Reported[MAX_SAMPLES + 1];
+
+// Summary of the samples [First, Last) that all fall in one interval
+static WINMSR_INTERVAL_SUMMARY Recompute(ULONG Cpu, ULONG Flags, ULONG64 Length, ULONG First, ULONG Last)
+{
+    WINMSR_INTERVAL_SUMMARY s;
+
+    memset(&s, 0, sizeof(s));
+    s.Cpu = Cpu;
+    s.Flags = Flags;
+    s.IntervalIndex = Samples[First].Time / Length;
+    s.FirstSampleTime = Samples[First].Time;
+    s.LastSampleTime = Samples[Last - 1].Time;
+    s.MinTemperature = MAXLONG;
+    s.MaxTemperature = MINLONG;
+    for (ULONG i = First; i < Last; i++) {
+        s.Samples++;
+        if (Samples[i].Temperature >= 0) {
+            s.ValidSamples++;
+            s.SumTemperature += Samples[i].Temperature;
+            s.MinTemperature = min(s.MinTemperature, Samples[i].Temperature);
+            s.MaxTemperature = max(s.MaxTemperature, Samples[i].Temperature);
+        }
+        for (ULONG bit = 0; bit < WINMSR_THERM_STATUS_BITS; bit++) {
+            if (Samples[i].ThermStatus & (1ULL << bit)) {
+                s.StatusBitCounts[bit]++;
+            }
+        }
+    }
+    return s;
+}
+
+static void CheckSummary(const WINMSR_INTERVAL_SUMMARY* Got, const WINMSR_INTERVAL_SUMMARY* Expected)
+{
+    CHECK(Got->Cpu == Expected->Cpu);
+    CHECK(Got->Samples == Expected->Samples);
+    CHECK(Got->IntervalIndex == Expected->IntervalIndex);
+    CHECK(Got->FirstSampleTime == Expected->FirstSampleTime);
+    CHECK(Got->LastSampleTime == Expected->LastSampleTime);
+    CHECK(Got->ValidSamples == Expected->ValidSamples);
+    CHECK(Got->MinTemperature == Expected->MinTemperature);
+    CHECK(Got->MaxTemperature == Expected->MaxTemperature);
+    CHECK(Got->Flags == Expected->Flags);
+    CHECK(Got->SumTemperature == Expected->SumTemperature);
+    for (ULONG bit = 0; bit < WINMSR_THERM_STATUS_BITS; bit++) {
+        CHECK(Got->StatusBitCounts[bit] == Expected->StatusBitCounts[bit]);
+    }
+}
+
+static void TestStream(ULONG64* Seed, ULONG Stream)
+{
+    INTERVAL_AGGREGATOR aggregator;
+    ULONG64 length = (ULONG64)TestRange(Seed, 1, 10000000);
+    ULONG count = (ULONG)TestRange(Seed, 1, MAX_SAMPLES);
+    ULONG flags = (Stream & 1) ? WINMSR_INTERVAL_LOGS_CLEARED : 0;
+    ULONG64 time = (ULONG64)TestRange(Seed, 0, 3) * length;
+    ULONG reported = 0;
+
+    // Times only go forward; some steps land exactly on a boundary, some
+    // skip whole intervals
+    for (ULONG i = 0; i < count; i++) {
+        switch (TestRange(Seed, 0, 9)) {
+        case 0:
+            time = (time / length + 1) * length;
+            break;
+        case 1:
+            time += (ULONG64)TestRange(Seed, 2, 5) * length;
+            break;
+        default:
+            time += (ULONG64)TestRange(Seed, 0, (LONG64)(length / 4) + 1);
+            break;
+        }
+        Samples[i].Time = time;
+        Samples[i].Temperature = (TestRange(Seed, 0, 7) == 0) ? -1 : (LONG)TestRange(Seed, 0, 110);
+        Samples[i].ThermStatus = TestRandom(Seed) & TestRandom(Seed);
+    }
+
+    IntervalInit(&aggregator, Stream, length);
+    aggregator.Open.Flags = flags;
+    for (ULONG i = 0; i < count; i++) {
+        if (IntervalAdd(&aggregator, Samples[i].Time, Samples[i].Temperature, Samples[i].ThermStatus,
+                        &Reported[reported])) {
+            reported++;
+        }
+    }
+    Reported[reported++] = aggregator.Open;
+
+    // One summary per non-empty interval, in order
+    ULONG first = 0;
+    ULONG n = 0;
+    while (first < count) {
+        ULONG last = first + 1;
+        while (last < count && Samples[last].Time / length == Samples[first].Time / length) {
+            last++;
+        }
+        WINMSR_INTERVAL_SUMMARY expected = Recompute(Stream, flags, length, first, last);
+        CHECK(n < reported);
+        if (n < reported) {
+            CheckSummary(&Reported[n], &expected);
+        }
+        n++;
+        first = last;
+    }
+    CHECK(n == reported);
+}
+
+// An interval whose readings were all invalid keeps the empty min/max
+static void TestAllInvalid(void)
+{
+    INTERVAL_AGGREGATOR aggregator;
+    WINMSR_INTERVAL_SUMMARY closed;
+
+    IntervalInit(&aggregator, 3, 100);
+    CHECK(!IntervalAdd(&aggregator, 10, -1, 0x1, &closed));
+    CHECK(!IntervalAdd(&aggregator, 99, -1, 0x1, &closed));
+    CHECK(IntervalAdd(&aggregator, 100, 50, 0, &closed));
+    CHECK(closed.Samples == 2 && closed.ValidSamples == 0 && closed.SumTemperature == 0);
+    CHECK(closed.MinTemperature == MAXLONG && closed.MaxTemperature == MINLONG);
+    CHECK(closed.StatusBitCounts[0] == 2 && closed.IntervalIndex == 0);
+
+    // A zero length is treated as 1
+    IntervalInit(&aggregator, 0, 0);
+    CHECK(!IntervalAdd(&aggregator, 0, 40, 0, &closed));
+    CHECK(IntervalAdd(&aggregator, 1, 40, 0, &closed));
+    CHECK(closed.IntervalIndex == 0 && closed.Samples == 1);
+}
+
+int main(void)
+{
+    ULONG64 seed = 0x31;
+
+    TestAllInvalid();
+    for (ULONG stream = 0; stream < STREAMS; stream++) {
+        TestStream(&seed, stream);
+    }
+    return TestResult("aggregate_test");
+}
@@ -0,0 +1,282 @@
+#include "test.h"
+#include "batch.h"
+
+//
+// Batch/deadline delivery on a simulated clock. The simulation stands in for
+// notify.c: BatchArm (re)starts a one-shot timer, BatchFlush or the timer
+// queues the delivery, and the delivery calls BatchTake. Every item must be
+// delivered no later than Deadline after it was added, a full batch right
+// away, an urgent item at once. A threaded test races producers against a
+// consumer that takes on deadlines as well as on flushes.
+//
+
+#define MAX_ITEMS       20000
+#define RACE_PRODUCERS  3
+#define RACE_ITEMS      200000
+
+typedef struct _SIM {
+    BATCHER Batcher;
+    ULONG64 Now;
+    ULONG64 TimerDue;               // 0 when the timer is not armed
+    ULONG64 AddTime[MAX_ITEMS];     // of every item, in order
+    ULONG Added;
+    ULONG Delivered;                // items [0, Delivered) have been delivered
+    ULONG Deliveries;               // non-empty ones
+    ULONG DeadlineDeliveries;
+    ULONG LastBatch;                // size of the last non-empty delivery
+    ULONG64 MaxLatency;
+} SIM;
+
+static void SimInit(SIM* Sim, ULONG Size, ULONG64 Deadline)
+{
+    memset(Sim, 0, sizeof(*Sim));
+    BatchInit(&Sim->Batcher, Size, Deadline);
+    Sim->Now = 1000;
+}
+
+// The work item: takes the batch and hands over everything it counted
+static void SimDeliver(SIM* Sim, BOOLEAN Deadline)
+{
+    ULONG count = BatchTake(&Sim->Batcher);
+
+    // Single-threaded, the batch is exactly the items not yet delivered
+    CHECK(count == Sim->Added - Sim->Delivered);
+    if (count == 0) {
+        return;
+    }
+    Sim->MaxLatency = max(Sim->MaxLatency, Sim->Now - Sim->AddTime[Sim->Delivered]);
+    Sim->Delivered += count;
+    Sim->Deliveries++;
+    Sim->DeadlineDeliveries += Deadline;
+    Sim->LastBatch = count;
+}
+
+// Moves the clock to To, firing the timer on the way
+static void SimAdvance(SIM* Sim, ULONG64 To)
+{
+    if (Sim->TimerDue != 0 && Sim->TimerDue <= To) {
+        Sim->Now = Sim->TimerDue;
+        Sim->TimerDue = 0;
+        SimDeliver(Sim, TRUE);
+    }
+    Sim->Now = To;
+}
+
+static BATCH_ACTION SimAdd(SIM* Sim, BOOLEAN Urgent)
+{
+    Sim->AddTime[Sim->Added++] = Sim->Now;
+
+    BATCH_ACTION action = BatchAdd(&Sim->Batcher, Sim->Now, Urgent);
+    switch (action) {
+    case BatchArm:
+        Sim->TimerDue = Sim->Now + Sim->Batcher.Deadline;
+        break;
+    case BatchFlush:
+        SimDeliver(Sim, FALSE);
+        break;
+    default:
+        break;
+    }
+
+    // Nothing pending without a delivery on the way in time
+    if (Sim->Added > Sim->Delivered) {
+        CHECK(Sim->TimerDue != 0 && Sim->TimerDue <= Sim->AddTime[Sim->Delivered] + Sim->Batcher.Deadline);
+    }
+    return action;
+}
+
+// Items closer together than the deadline: every Size-th one flushes
+static void TestSize(void)
+{
+    static SIM sim;
+
+    SimInit(&sim, 8, 1000);
+    for (ULONG i = 0; i < 80; i++) {
+        SimAdvance(&sim, sim.Now + 10);
+        BATCH_ACTION action = SimAdd(&sim, FALSE);
+        CHECK(action == ((i % 8 == 0) ? BatchArm : (i % 8 == 7) ? BatchFlush : BatchNone));
+    }
+    CHECK(sim.Deliveries == 10 && sim.DeadlineDeliveries == 0 && sim.LastBatch == 8);
+    CHECK(sim.Delivered == 80 && sim.MaxLatency == 70);
+
+    // The timer left over from the last batch finds nothing
+    SimAdvance(&sim, sim.Now + 5000);
+    CHECK(sim.Deliveries == 10);
+}
+
+// Items further apart: the deadline delivers whatever has accumulated
+static void TestDeadline(void)
+{
+    static SIM sim;
+
+    SimInit(&sim, 8, 1000);
+    for (ULONG i = 0; i < 40; i++) {
+        SimAdvance(&sim, sim.Now + 300);
+        SimAdd(&sim, FALSE);
+    }
+    SimAdvance(&sim, sim.Now + 1000);
+    CHECK(sim.Delivered == 40 && sim.DeadlineDeliveries == sim.Deliveries && sim.LastBatch == 4);
+    CHECK(sim.MaxLatency == 1000);
+
+    // A poll sees the same deadline
+    SimInit(&sim, 8, 1000);
+    SimAdd(&sim, FALSE);
+    CHECK(!BatchDue(&sim.Batcher, sim.Now + 999));
+    CHECK(BatchDue(&sim.Batcher, sim.Now + 1000));
+}
+
+// An urgent item flushes at once, with everything pending before it
+static void TestUrgent(void)
+{
+    static SIM sim;
+
+    SimInit(&sim, 8, 1000);
+    SimAdd(&sim, FALSE);
+    SimAdvance(&sim, sim.Now + 100);
+    SimAdd(&sim, FALSE);
+    SimAdvance(&sim, sim.Now + 100);
+    CHECK(SimAdd(&sim, TRUE) == BatchFlush);
+    CHECK(sim.Deliveries == 1 && sim.LastBatch == 3 && sim.DeadlineDeliveries == 0);
+
+    // ... also as the first item of a batch, which then arms nothing
+    CHECK(SimAdd(&sim, TRUE) == BatchFlush);
+    CHECK(sim.Deliveries == 2 && sim.LastBatch == 1);
+
+    // A poll sees a full batch before its deadline
+    SimInit(&sim, 2, 1000);
+    BatchAdd(&sim.Batcher, sim.Now, FALSE);
+    CHECK(!BatchDue(&sim.Batcher, sim.Now));
+    BatchAdd(&sim.Batcher, sim.Now, FALSE);
+    CHECK(BatchDue(&sim.Batcher, sim.Now));
+}
+
+// Random spacing, sizes, deadlines and urgent items; SimAdd checks that a
+// delivery is always on the way in time
+static void TestRandomStream(void)
+{
+    static SIM sim;
+    ULONG64 seed = 35;
+
+    for (ULONG run = 0; run < 50; run++) {
+        ULONG64 deadline = (ULONG64)TestRange(&seed, 1, 5000);
+
+        SimInit(&sim, (ULONG)TestRange(&seed, 0, 64), deadline);
+        for (ULONG i = 0; i < MAX_ITEMS; i++) {
+            SimAdvance(&sim, sim.Now + (ULONG64)TestRange(&seed, 0, (LONG64)deadline / 8 + 1) *
+                                           (TestRange(&seed, 0, 31) == 0 ? 16 : 1));
+            SimAdd(&sim, TestRange(&seed, 0, 99) == 0);
+        }
+        SimAdvance(&sim, sim.Now + deadline);
+        CHECK(sim.Delivered == MAX_ITEMS);
+        CHECK(sim.MaxLatency <= deadline);
+    }
+}
+
+typedef struct _RACE {
+    BATCHER Batcher;
+    volatile LONG64 Clock;
+    volatile LONG Kicks;            // flushes not yet seen by the consumer
+    volatile LONG Running;          // producers still adding
+    ULONG64 Taken;
+    ULONG64 Batches;                // non-empty takes
+} RACE;
+
+typedef struct _PRODUCER {
+    RACE* Race;
+    ULONG64 Seed;
+    ULONG64 Arms;
+    ULONG64 Flushes;
+} PRODUCER;
+
+static void Producer(void* Context)
+{
+    PRODUCER* producer = (PRODUCER*)Context;
+    RACE* race = producer->Race;
+
+    for (ULONG i = 0; i < RACE_ITEMS; i++) {
+        ULONG64 now = (ULONG64)InterlockedIncrement64(&race->Clock);
+        switch (BatchAdd(&race->Batcher, now, FALSE)) {
+        case BatchArm:
+            producer->Arms++;
+            break;
+        case BatchFlush:
+            producer->Flushes++;
+            InterlockedIncrement(&race->Kicks);
+            break;
+        default:
+            break;
+        }
+        if (TestRange(&producer->Seed, 0, 63) == 0) {
+            TestYield();
+        }
+    }
+    InterlockedDecrement(&race->Running);
+}
+
+// Takes on a flush, on a deadline, and now and then for no reason, so takes
+// land in the middle of batches that are just filling up
+static void Consumer(void* Context)
+{
+    RACE* race = (RACE*)Context;
+    ULONG64 seed = 7;
+
+    while (ReadAcquire(&race->Running) != 0) {
+        BOOLEAN kicked = InterlockedExchange(&race->Kicks, 0) != 0;
+        BOOLEAN due = BatchDue(&race->Batcher, (ULONG64)ReadAcquire64(&race->Clock));
+        if (kicked || due || TestRange(&seed, 0, 7) == 0) {
+            ULONG count = BatchTake(&race->Batcher);
+            race->Taken += count;
+            race->Batches += (count != 0);
+        }
+        if (TestRange(&seed, 0, 3) == 0) {
+            TestYield();
+        }
+    }
+}
+
+static void TestRace(void)
+{
+    static RACE race;
+    static PRODUCER producers[RACE_PRODUCERS];
+    TEST_THREAD threads[RACE_PRODUCERS];
+    TEST_THREAD consumer;
+    ULONG64 arms = 0;
+    ULONG64 flushes = 0;
+
+    BatchInit(&race.Batcher, 16, 40);
+    race.Running = RACE_PRODUCERS;
+    TestThreadStart(&consumer, Consumer, &race);
+    for (ULONG i = 0; i < RACE_PRODUCERS; i++) {
+        producers[i].Race = &race;
+        producers[i].Seed = i + 1;
+        TestThreadStart(&threads[i], Producer, &producers[i]);
+    }
+    for (ULONG i = 0; i < RACE_PRODUCERS; i++) {
+        TestThreadJoin(threads[i]);
+        arms += producers[i].Arms;
+        flushes += producers[i].Flushes;
+    }
+    TestThreadJoin(consumer);
+
+    ULONG count = BatchTake(&race.Batcher);
+    race.Taken += count;
+    race.Batches += (count != 0);
+
+    printf("  %llu batches, %llu flushes\n", (unsigned long long)race.Batches, (unsigned long long)flushes);
+    CHECK(race.Taken == (ULONG64)RACE_PRODUCERS * RACE_ITEMS);
+
+    // Every batch, however a take cut into it, was started by exactly one
+    // BatchArm, so its deadline timer was armed; none was flushed twice
+    CHECK(arms == race.Batches);
+    CHECK(flushes <= race.Batches);
+}
+
+int main(void)
+{
+    TestSize();
+    TestDeadline();
+    TestUrgent();
+    TestRandomStream();
+    TestRace();
+    return TestResult("batch_test");
+}
@@ -0,0 +1,240 @@
+#include "test.h"
+#include "flight.h"
+#include "thermstatus.h"
+
+//
+// Flight recorder as recorder.c drives it: every CPU feeds its own ring
+// through FlightReason() and FlightRecord(), the one sampler told to dump
+// copies the frozen rings and re-arms. Checks the freeze and hand-off, what
+// FlightCopy() returns from a full ring, and that a condition which stays
+// set fires once, not once per re-arm.
+//
+
+#define CPUS            4
+#define CAPACITY        16
+#define POST_WINDOW     5
+
+static FLIGHT_TRIGGER Trigger;
+static FLIGHT_RING Rings[CPUS];
+static WINMSR_SAMPLE_RECORD Storage[CPUS][CAPACITY];
+
+static void Reset(ULONG64 PostWindow, LONG ThresholdC)
+{
+    FlightInit(&Trigger, PostWindow, ThresholdC);
+    RtlZeroMemory(Storage, sizeof(Storage));
+    for (ULONG i = 0; i < CPUS; i++) {
+        Rings[i].Records = Storage[i];
+        Rings[i].Capacity = CAPACITY;
+        Rings[i].Head = 0;
+        Rings[i].Active = 0;
+    }
+}
+
+// Temperature is derived from the time, so a torn or misplaced record shows
+static WINMSR_SAMPLE_RECORD MakeRecord(ULONG Cpu, ULONG64 Time, ULONG ThermStatus)
+{
+    WINMSR_SAMPLE_RECORD record;
+
+    record.Time = Time;
+    record.Cpu = Cpu;
+    record.Temperature = (LONG)(Time % 50) + 40;
+    record.ThermStatus = ThermStatus;
+    record.FireDelay = (ULONG)Time ^ Cpu;
+    return record;
+}
+
+static BOOLEAN RecordIntact(const WINMSR_SAMPLE_RECORD* Record, ULONG Cpu)
+{
+    return Record->Cpu == Cpu && Record->Temperature == (LONG)(Record->Time % 50) + 40 &&
+           Record->FireDelay == ((ULONG)Record->Time ^ Cpu);
+}
+
+static FLIGHT_ACTION Sample(ULONG Cpu, ULONG64 Time, ULONG ThermStatus)
+{
+    WINMSR_SAMPLE_RECORD record = MakeRecord(Cpu, Time, ThermStatus);
+
+    return FlightRecord(&Trigger, &Rings[Cpu], &record, FlightReason(&Trigger, &record, FALSE));
+}
+
+// A full ring returns its newest Capacity - 1 records, oldest first; one that
+// has not wrapped returns everything; Until cuts off the later ones
+static void TestCopy(void)
+{
+    WINMSR_SAMPLE_RECORD records[CAPACITY];
+    ULONG count;
+
+    Reset(POST_WINDOW, 0);
+    for (ULONG64 t = 1; t <= 3; t++) {
+        Sample(0, t, 0);
+    }
+    count = FlightCopy(&Rings[0], MAXULONG64, records, CAPACITY);
+    CHECK(count == 3);
+    for (ULONG i = 0; i < count; i++) {
+        CHECK(records[i].Time == i + 1 && RecordIntact(&records[i], 0));
+    }
+
+    for (ULONG64 t = 4; t <= 3 * CAPACITY + 5; t++) {
+        Sample(0, t, 0);
+    }
+    count = FlightCopy(&Rings[0], MAXULONG64, records, CAPACITY);
+    CHECK(count == CAPACITY - 1);
+    for (ULONG i = 0; i < count; i++) {
+        CHECK(records[i].Time == 3 * CAPACITY + 5 - (CAPACITY - 1) + 1 + i);
+        CHECK(RecordIntact(&records[i], 0));
+    }
+
+    count = FlightCopy(&Rings[0], 3 * CAPACITY, records, CAPACITY);
+    CHECK(count == CAPACITY - 1 - 5);
+    CHECK(count != 0 && records[count - 1].Time == 3 * CAPACITY);
+
+    count = FlightCopy(&Rings[0], MAXULONG64, records, 4);
+    CHECK(count == 4 && records[0].Time == 3 * CAPACITY + 5 - (CAPACITY - 1) + 1);
+}
+
+// PROCHOT on CPU 2 at time 10: every CPU records through 10 + POST_WINDOW,
+// the first sample after it gets the dump, nothing is recorded while frozen
+// and recording resumes after the re-arm
+static void TestHandOff(void)
+{
+    WINMSR_SAMPLE_RECORD records[CAPACITY];
+    ULONG dumps = 0;
+
+    Reset(POST_WINDOW, 0);
+    for (ULONG64 t = 1; t <= 10 + POST_WINDOW + 3; t++) {
+        for (ULONG cpu = 0; cpu < CPUS; cpu++) {
+            ULONG status = (cpu == 2 && t == 10) ? (ULONG)THERM_STATUS_PROCHOT : 0;
+            LONG64 head = Rings[cpu].Head;
+            if (Sample(cpu, t, status) == FlightDump) {
+                dumps++;
+                CHECK(t == 10 + POST_WINDOW + 1 && cpu == 0);
+            }
+            CHECK(Rings[cpu].Head == ((t <= 10 + POST_WINDOW) ? head + 1 : head));
+        }
+    }
+    CHECK(dumps == 1);
+    CHECK(Trigger.State == FlightDumping);
+    CHECK(Trigger.Reason == WINMSR_FLIGHT_PROCHOT && Trigger.Cpu == 2);
+    CHECK(Trigger.TriggerTime == 10 && Trigger.FreezeTime == 10 + POST_WINDOW);
+
+    for (ULONG cpu = 0; cpu < CPUS; cpu++) {
+        ULONG count = FlightCopy(&Rings[cpu], Trigger.FreezeTime, records, CAPACITY);
+        CHECK(count == CAPACITY - 1 && records[count - 1].Time == Trigger.FreezeTime);
+    }
+
+    FlightRearm(&Trigger);
+    CHECK(Sample(1, 30, 0) == FlightNone && Rings[1].Head == 10 + POST_WINDOW + 1);
+    CHECK(Trigger.State == FlightArmed);
+}
+
+// The temperature above the threshold on CPU 3 and PROCHOT on CPU 1 (set
+// while the first trigger is pending), both held for many dump cycles: one
+// dump. Each time PROCHOT clears and comes back, another one.
+static void TestSustained(void)
+{
+    ULONG dumps = 0;
+    ULONG64 t = 1;
+
+    Reset(POST_WINDOW, 60);
+    for (; t <= 500; t++) {
+        for (ULONG cpu = 0; cpu < CPUS; cpu++) {
+            WINMSR_SAMPLE_RECORD record = MakeRecord(cpu, t, (cpu == 1 && t >= 3) ? (ULONG)THERM_STATUS_PROCHOT : 0);
+            record.Temperature = (cpu == 3) ? 70 : 50;
+            if (FlightRecord(&Trigger, &Rings[cpu], &record, FlightReason(&Trigger, &record, FALSE)) == FlightDump) {
+                dumps++;
+                FlightRearm(&Trigger);
+            }
+        }
+    }
+    CHECK(dumps == 1);
+    CHECK(Trigger.Reason == WINMSR_FLIGHT_THRESHOLD && Trigger.Cpu == 3);
+    CHECK(Rings[1].Active == WINMSR_FLIGHT_PROCHOT);
+
+    for (ULONG64 end = t + 100; t < end; t++) {
+        WINMSR_SAMPLE_RECORD record = MakeRecord(1, t, (t % 50 < 10) ? 0 : (ULONG)THERM_STATUS_PROCHOT);
+        record.Temperature = 50;
+        if (FlightRecord(&Trigger, &Rings[1], &record, FlightReason(&Trigger, &record, FALSE)) == FlightDump) {
+            dumps++;
+            FlightRearm(&Trigger);
+        }
+    }
+    CHECK(dumps == 3);
+    CHECK(Trigger.Reason == WINMSR_FLIGHT_PROCHOT && Trigger.Cpu == 1);
+}
+
+// A trigger while another is pending neither replaces it nor fires later
+static void TestPending(void)
+{
+    ULONG dumps = 0;
+
+    Reset(POST_WINDOW, 0);
+    for (ULONG64 t = 1; t <= 40; t++) {
+        for (ULONG cpu = 0; cpu < CPUS; cpu++) {
+            ULONG status = ((cpu == 0 && t >= 5) || (cpu == 3 && t >= 7)) ? (ULONG)THERM_STATUS_CRITICAL_TEMP : 0;
+            if (Sample(cpu, t, status) == FlightDump) {
+                dumps++;
+                FlightRearm(&Trigger);
+            }
+        }
+    }
+    CHECK(dumps == 1);
+    CHECK(Trigger.Reason == WINMSR_FLIGHT_CRITICAL && Trigger.Cpu == 0 && Trigger.TriggerTime == 5);
+}
+
+#define STRESS_SAMPLES  200000
+
+static volatile LONG StressDumps = 0;
+static volatile LONG StressBad = 0;
+
+// One sampler per CPU with its own clock and now and then a PROCHOT pulse.
+// Whichever is told to dump checks every frozen ring and re-arms, while the
+// others keep sampling.
+static void StressThread(void* Context)
+{
+    ULONG cpu = (ULONG)(ULONG_PTR)Context;
+    ULONG64 seed = 0x9E3779B97F4A7C15ULL * (cpu + 1);
+    static WINMSR_SAMPLE_RECORD records[CPUS][CAPACITY];
+
+    for (ULONG64 t = 1; t <= STRESS_SAMPLES; t++) {
+        ULONG status = (TestRange(&seed, 0, 999) == 0) ? (ULONG)THERM_STATUS_PROCHOT : 0;
+        if (Sample(cpu, t, status) != FlightDump) {
+            continue;
+        }
+
+        InterlockedIncrement(&StressDumps);
+        for (ULONG i = 0; i < CPUS; i++) {
+            ULONG count = FlightCopy(&Rings[i], Trigger.FreezeTime, records[cpu], CAPACITY);
+            for (ULONG r = 0; r < count; r++) {
+                if (!RecordIntact(&records[cpu][r], i) || records[cpu][r].Time > Trigger.FreezeTime ||
+                    (r != 0 && records[cpu][r].Time <= records[cpu][r - 1].Time)) {
+                    InterlockedIncrement(&StressBad);
+                }
+            }
+        }
+        FlightRearm(&Trigger);
+    }
+}
+
+static void TestStress(void)
+{
+    TEST_THREAD threads[CPUS];
+
+    Reset(50, 0);
+    for (ULONG i = 0; i < CPUS; i++) {
+        TestThreadStart(&threads[i], StressThread, (void*)(ULONG_PTR)i);
+    }
+    for (ULONG i = 0; i < CPUS; i++) {
+        TestThreadJoin(threads[i]);
+    }
+    CHECK(StressDumps > 10);
+    CHECK(StressBad == 0);
+}
+
+int main(void)
+{
+    TestCopy();
+    TestHandOff();
+    TestSustained();
+    TestPending();
+    TestStress();
+    return TestResult("flight_test");
+}
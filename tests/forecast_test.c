@@ -0,0 +1,237 @@
+#include "test.h"
+#include "forecast.h"
+#include "snapshot.h"
+
+//
+// The fixed-point Holt filter against the same filter in double precision:
+// a steady ramp, a step, irregular gaps and slopes past the clamp. The
+// fixed-point state may only drift from the reference by rounding, and the
+// ramp must be tracked without lag once settled. Also the extrapolation
+// helpers: horizons out of range act as clamped, and ForecastMsToLimit's
+// edge cases.
+//
+
+#define LEVEL_TAU_MS    1000
+#define SLOPE_TAU_MS    4000
+#define TICKS_PER_MS    10000ULL
+
+typedef struct _REFERENCE {
+    double Level;
+    double Slope;
+    double Prochot;
+    double Time;
+    BOOLEAN Started;
+} REFERENCE;
+
+static double Abs(double Value)
+{
+    return (Value < 0) ? -Value : Value;
+}
+
+static void ReferenceUpdate(REFERENCE* Ref, double MilliC, BOOLEAN Prochot, double Time)
+{
+    double prochot = Prochot ? 1000.0 : 0.0;
+
+    if (Ref->Started && Time <= Ref->Time) {
+        return;
+    }
+    if (!Ref->Started || Time - Ref->Time > (double)FORECAST_MAX_GAP) {
+        Ref->Level = MilliC;
+        Ref->Slope = 0;
+        Ref->Prochot = prochot;
+        Ref->Time = Time;
+        Ref->Started = TRUE;
+        return;
+    }
+
+    double dt = Time - Ref->Time;
+    double alpha = dt / (dt + LEVEL_TAU_MS * (double)TICKS_PER_MS);
+    double beta = dt / (dt + SLOPE_TAU_MS * (double)TICKS_PER_MS);
+    double predicted = Ref->Level + Ref->Slope * dt / FORECAST_TICKS_PER_SECOND;
+    double level = predicted + (MilliC - predicted) * alpha;
+    double slope = Ref->Slope + ((level - Ref->Level) * FORECAST_TICKS_PER_SECOND / dt - Ref->Slope) * beta;
+
+    Ref->Level = level;
+    Ref->Slope = (slope > FORECAST_MAX_SLOPE) ? FORECAST_MAX_SLOPE : (slope < -FORECAST_MAX_SLOPE) ? -FORECAST_MAX_SLOPE : slope;
+    Ref->Prochot += (prochot - Ref->Prochot) * alpha;
+    Ref->Time = Time;
+}
+
+typedef struct _DRIFT {
+    double Level;               // largest |fixed - reference|, m°C
+    double Slope;               // m°C/s
+    double Prochot;             // permille
+} DRIFT;
+
+static void Step(PFORECAST Forecast, REFERENCE* Ref, LONG MilliC, BOOLEAN Prochot, ULONG64 Time, DRIFT* Drift)
+{
+    ForecastUpdate(Forecast, MilliC, Prochot, Time);
+    ReferenceUpdate(Ref, MilliC, Prochot, (double)Time);
+    Drift->Level = max(Drift->Level, Abs(Forecast->Level - Ref->Level));
+    Drift->Slope = max(Drift->Slope, Abs(Forecast->Slope - Ref->Slope));
+    Drift->Prochot = max(Drift->Prochot, Abs(Forecast->Prochot - Ref->Prochot));
+}
+
+static void Start(PFORECAST Forecast, REFERENCE* Ref, DRIFT* Drift)
+{
+    ForecastInit(Forecast, LEVEL_TAU_MS, SLOPE_TAU_MS);
+    RtlZeroMemory(Ref, sizeof(*Ref));
+    RtlZeroMemory(Drift, sizeof(*Drift));
+}
+
+// 2 °C/s for 60 s, a sample every 10 ms: the slope settles on the ramp and
+// the level has no steady-state lag
+static void TestRamp(void)
+{
+    FORECAST forecast;
+    REFERENCE ref;
+    DRIFT drift;
+
+    Start(&forecast, &ref, &drift);
+    for (ULONG64 ms = 0; ms <= 60000; ms += 10) {
+        Step(&forecast, &ref, 40000 + (LONG)(2 * ms), FALSE, TICKS_PER_MS * (ms + 1), &drift);
+    }
+    CHECK(drift.Level <= 10 && drift.Slope <= 10);
+    CHECK(Abs(forecast.Slope - 2000) <= 2);
+    CHECK(Abs(forecast.Level - (40000 + 2 * 60000)) <= 2);
+    CHECK(Abs(ForecastMsToLimit(forecast.Level, forecast.Slope, forecast.Level + 10000) - 5000.0) <= 50);
+}
+
+// 40 °C, then 60 °C from 10 s on: the level closes most of the step within
+// a few level time constants, the slope rises and decays back towards 0
+static void TestStep(void)
+{
+    FORECAST forecast;
+    REFERENCE ref;
+    DRIFT drift;
+    LONG slopePeak = 0;
+
+    Start(&forecast, &ref, &drift);
+    for (ULONG64 ms = 0; ms <= 60000; ms += 10) {
+        Step(&forecast, &ref, (ms < 10000) ? 40000 : 60000, (ms >= 10000 && ms < 12000), TICKS_PER_MS * (ms + 1), &drift);
+        slopePeak = max(slopePeak, forecast.Slope);
+        if (ms == 9990) {
+            CHECK(forecast.Level == 40000 && forecast.Slope == 0 && forecast.Prochot == 0);
+        }
+        if (ms == 15000) {
+            CHECK(forecast.Level > 55000 && forecast.Level < 65000);
+        }
+    }
+    CHECK(drift.Level <= 10 && drift.Slope <= 10 && drift.Prochot <= 1);
+    CHECK(slopePeak > 1000);
+    CHECK(Abs(forecast.Level - 60000) <= 2 && Abs(forecast.Slope) <= 2);
+}
+
+// Spacing from 1 ms to 3 s, as with stripes, idle deferral and promotion,
+// over a noisy wandering temperature; time that does not move is ignored
+static void TestGaps(ULONG64* Seed)
+{
+    FORECAST forecast;
+    REFERENCE ref;
+    DRIFT drift;
+    ULONG64 time = TICKS_PER_MS;
+    LONG milliC = 50000;
+
+    Start(&forecast, &ref, &drift);
+    for (ULONG i = 0; i < 20000; i++) {
+        LONG64 kind = TestRange(Seed, 0, 9);
+        ULONG64 gapMs = (kind < 6) ? (ULONG64)TestRange(Seed, 1, 20) :
+                        (kind < 9) ? (ULONG64)TestRange(Seed, 20, 500) : (ULONG64)TestRange(Seed, 500, 3000);
+        milliC += (LONG)TestRange(Seed, -300, 300);
+        milliC = min(max(milliC, 20000), 100000);
+        time += gapMs * TICKS_PER_MS + (ULONG64)TestRange(Seed, 0, 9999);
+        Step(&forecast, &ref, milliC + (LONG)TestRange(Seed, -500, 500), TestRange(Seed, 0, 19) == 0, time, &drift);
+
+        if (TestRange(Seed, 0, 99) == 0) {
+            FORECAST before = forecast;
+            ForecastUpdate(&forecast, 0, TRUE, time - (ULONG64)TestRange(Seed, 0, 1000));
+            CHECK(memcmp(&before, &forecast, sizeof(before)) == 0);
+        }
+    }
+    CHECK(drift.Level <= 10 && drift.Slope <= 10 && drift.Prochot <= 1);
+
+    // Past FORECAST_MAX_GAP the old state says nothing: start over
+    Step(&forecast, &ref, 70000, FALSE, time + FORECAST_MAX_GAP, &drift);
+    CHECK(forecast.Slope != 0);
+    Step(&forecast, &ref, 30000, TRUE, time + 2 * FORECAST_MAX_GAP + 1, &drift);
+    CHECK(forecast.Level == 30000 && forecast.Slope == 0 && forecast.Prochot == 1000);
+    CHECK(drift.Level <= 10 && drift.Slope <= 10 && drift.Prochot <= 1);
+}
+
+// Ramps at 300 °C/s either way: the slope stays at the clamp, and the
+// reference with the same clamp stays in step. The level lags far behind
+// here, so the Q16 rounding of the weights (up to 0.3% of beta at 10 ms
+// spacing) shows more than on the other series.
+static void TestSlopeClamp(void)
+{
+    FORECAST forecast;
+    REFERENCE ref;
+    DRIFT drift;
+
+    Start(&forecast, &ref, &drift);
+    for (ULONG64 ms = 0; ms <= 20000; ms += 10) {
+        LONG milliC = (ms < 10000) ? 20000 + (LONG)(300 * ms) : 20000 + (LONG)(300 * (20000 - ms));
+        Step(&forecast, &ref, milliC, FALSE, TICKS_PER_MS * (ms + 1), &drift);
+        CHECK(forecast.Slope >= -FORECAST_MAX_SLOPE && forecast.Slope <= FORECAST_MAX_SLOPE);
+        if (ms == 9000) {
+            CHECK(forecast.Slope == FORECAST_MAX_SLOPE);
+        }
+    }
+    CHECK(forecast.Slope == -FORECAST_MAX_SLOPE);
+    CHECK(drift.Level <= 500 && drift.Slope <= 500);
+}
+
+static void TestMsToLimit(void)
+{
+    CHECK(ForecastMsToLimit(80000, 1000, 80000) == 0);
+    CHECK(ForecastMsToLimit(90000, -5000, 80000) == 0);
+    CHECK(ForecastMsToLimit(70000, 0, 80000) == MAXULONG);
+    CHECK(ForecastMsToLimit(70000, -1, 80000) == MAXULONG);
+    CHECK(ForecastMsToLimit(70000, 2000, 80000) == 5000);
+    CHECK(ForecastMsToLimit(70000, 3000, 80000) == 3333);
+    CHECK(ForecastMsToLimit(70000, FORECAST_MAX_SLOPE, 80000) == 100);
+    CHECK(ForecastMsToLimit(MINLONG, 1, MAXLONG) == MAXULONG - 1);
+}
+
+// Out-of-range horizons act as clamped, including ones whose product with a
+// clamped slope would overflow 32 bits
+static void TestHorizonClamp(ULONG64* Seed)
+{
+    static const LONG horizons[] = { MINLONG, -1, 0, 1, 999, 5000, FORECAST_MAX_HORIZON_MS,
+                                     FORECAST_MAX_HORIZON_MS + 1, 30000, MAXLONG };
+    LONG level[64];
+    LONG slope[64];
+    LONG out[64];
+    WINMSR_CPU_SNAPSHOT copy = { 0 };
+
+    for (ULONG i = 0; i < 64; i++) {
+        level[i] = (LONG)TestRange(Seed, 20000, 110000);
+        slope[i] = (i < 2) ? ((i == 0) ? FORECAST_MAX_SLOPE : -FORECAST_MAX_SLOPE) :
+                   (LONG)TestRange(Seed, -FORECAST_MAX_SLOPE, FORECAST_MAX_SLOPE);
+    }
+    for (ULONG h = 0; h < sizeof(horizons) / sizeof(horizons[0]); h++) {
+        LONG64 clamped = min(max(horizons[h], 0), FORECAST_MAX_HORIZON_MS);
+        ForecastAhead(level, slope, 64, horizons[h], out);
+        for (ULONG i = 0; i < 64; i++) {
+            LONG64 expected = level[i] + (LONG64)slope[i] * clamped / 1000;
+            copy.Level = level[i];
+            copy.Slope = slope[i];
+            CHECK(out[i] == expected);
+            CHECK(SnapshotForecast(&copy, horizons[h]) == expected);
+        }
+    }
+    CHECK(ForecastClampHorizon(-5) == 0 && ForecastClampHorizon(21475) == FORECAST_MAX_HORIZON_MS);
+}
+
+int main(void)
+{
+    ULONG64 seed = 0x5EED0041ULL;
+
+    TestRamp();
+    TestStep();
+    TestGaps(&seed);
+    TestSlopeClamp();
+    TestMsToLimit();
+    TestHorizonClamp(&seed);
+    return TestResult("forecast_test");
+}
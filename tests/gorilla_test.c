@@ -0,0 +1,197 @@
+#include "test.h"
+#include "gorilla.h"
+
+//
+// Round trips through chunks of every kind of series: jittered timer fires,
+// spacing changes, repeated and backward stamps, wrap-around, arbitrary
+// 64-bit values, and the worst case per sample against the chunk size. The
+// 1 kHz interrupt-time series must stay well within 12.8 bits per sample, the
+// 10x target against 16 raw bytes. Damaged chunks must end decoding, not
+// overrun.
+//
+
+#define SAMPLES         200000
+#define MAX_CHUNKS      1024
+
+static ULONG64 Stamps[SAMPLES];
+static ULONG64 Values[SAMPLES];
+static ULONG64 Chunks[MAX_CHUNKS][GORILLA_CHUNK_BYTES / sizeof(ULONG64)];
+
+static ULONG Encode(ULONG Count, ULONG64 Period)
+{
+    GORILLA_ENCODER encoder;
+    ULONG chunks = 1;
+
+    GorillaEncodeBegin(&encoder, Chunks[0], Period);
+    for (ULONG i = 0; i < Count; i++) {
+        if (!GorillaEncode(&encoder, Stamps[i], Values[i])) {
+            CHECK(encoder.Chunk->Count != 0 && encoder.Chunk->Bits <= GORILLA_CHUNK_WORDS * 64);
+            if (chunks == MAX_CHUNKS) {
+                CHECK(FALSE);
+                return chunks;
+            }
+            GorillaEncodeNext(&encoder, Chunks[chunks++]);
+            CHECK(GorillaEncode(&encoder, Stamps[i], Values[i]));
+        }
+    }
+    return chunks;
+}
+
+// Decodes every chunk and compares; also each chunk's header against its samples
+static void Verify(ULONG Count, ULONG ChunkCount)
+{
+    ULONG n = 0;
+
+    for (ULONG c = 0; c < ChunkCount; c++) {
+        const GORILLA_CHUNK_HEADER* header = (const GORILLA_CHUNK_HEADER*)Chunks[c];
+        GORILLA_DECODER decoder;
+        ULONG64 stamp;
+        ULONG64 value;
+        ULONG first = n;
+
+        if (!GorillaDecodeBegin(&decoder, Chunks[c], GORILLA_CHUNK_BYTES)) {
+            CHECK(FALSE);
+            return;
+        }
+        while (GorillaDecode(&decoder, &stamp, &value)) {
+            CHECK(n < Count && stamp == Stamps[n] && value == Values[n]);
+            n++;
+        }
+        CHECK(n - first == header->Count && decoder.Position == header->Bits);
+        CHECK(header->FirstStamp == Stamps[first] && header->LastStamp == Stamps[n - 1]);
+    }
+    CHECK(n == Count);
+}
+
+static void RoundTrip(ULONG Count, ULONG64 Period)
+{
+    Verify(Count, Encode(Count, Period));
+}
+
+static ULONG64 StatusWord(LONG Dts, BOOLEAN Log)
+{
+    return 0x88000000ULL | ((ULONG64)Dts << 16) | (Log ? 0x2 : 0);
+}
+
+// 1 kHz interrupt time with +-5 us of uniform jitter, the DTS moving now and
+// then: 9.2 bits per sample when this was written, told the period or not
+static void TestTimer(ULONG64* Seed)
+{
+    LONG dts = 40;
+
+    for (ULONG i = 0; i < SAMPLES; i++) {
+        if (TestRange(Seed, 0, 7) == 0) {
+            dts = (LONG)min(max(dts + TestRange(Seed, -1, 1), 0), 100);
+        }
+        Stamps[i] = 5000000000ULL + 10000ULL * i + (ULONG64)TestRange(Seed, 0, 100);
+        Values[i] = StatusWord(dts, TestRange(Seed, 0, 999) == 0);
+    }
+    for (ULONG64 period = 0; period <= 10000; period += 10000) {
+        ULONG chunks = Encode(SAMPLES, period);
+        Verify(SAMPLES, chunks);
+        CHECK((double)chunks * GORILLA_CHUNK_BYTES * 8 / SAMPLES <= 9.6);
+    }
+}
+
+// Spacing that changes (idle deferral, a new session), single late fires and
+// missed ticks: every change is an escape and costs no more than that
+static void TestSpacingChanges(ULONG64* Seed)
+{
+    ULONG64 grid = 1000;
+    ULONG64 spacing = 10000;
+
+    for (ULONG i = 0; i < SAMPLES; i++) {
+        LONG64 event = TestRange(Seed, 0, 499);
+        if (event == 0) {
+            spacing = (ULONG64)TestRange(Seed, 1, 100) * 10000;
+        }
+        grid += (event == 1) ? 2 * spacing : spacing;
+        Stamps[i] = grid + ((event == 2) ? spacing / 2 : (ULONG64)TestRange(Seed, 0, 50));
+        Values[i] = StatusWord((LONG)(i / 1000) % 100, FALSE);
+    }
+    RoundTrip(SAMPLES, 10000);
+}
+
+// Stamps that repeat, go backwards, jump by almost 2^64 and wrap; values
+// with any bits set
+static void TestOddSeries(ULONG64* Seed)
+{
+    for (ULONG i = 0; i < SAMPLES; i++) {
+        LONG64 kind = TestRange(Seed, 0, 9);
+        ULONG64 previous = (i == 0) ? MAXULONG64 - 5000000 : Stamps[i - 1];
+        Stamps[i] = (kind < 5) ? previous + 7 :
+                    (kind < 6) ? previous :
+                    (kind < 7) ? previous - (ULONG64)TestRange(Seed, 0, 1000000) :
+                    (kind < 8) ? previous + (MAXULONG64 >> (ULONG)TestRange(Seed, 0, 63)) : TestRandom(Seed);
+        Values[i] = (kind < 5) ? (ULONG64)i : TestRandom(Seed) >> (ULONG)TestRange(Seed, 0, 63);
+    }
+    RoundTrip(SAMPLES, 0);
+    RoundTrip(SAMPLES, MAXULONG64);
+}
+
+// Every sample as expensive as it gets: the chunk still never overflows
+static void TestWorstCase(ULONG64* Seed)
+{
+    for (ULONG i = 0; i < SAMPLES / 4; i++) {
+        Stamps[i] = TestRandom(Seed);
+        Values[i] = (i & 1) ? 0xFFFFFFFFFFFFFFFFULL : 1;
+    }
+    ULONG chunks = Encode(SAMPLES / 4, 0);
+    Verify(SAMPLES / 4, chunks);
+    CHECK(chunks > (SAMPLES / 4) / (GORILLA_CHUNK_WORDS * 64 / GORILLA_MAX_SAMPLE_BITS) / 2);
+}
+
+// Random words, or a valid chunk with its bit count cut short: decoding
+// stops within the chunk
+static void TestDamaged(ULONG64* Seed)
+{
+    for (ULONG round = 0; round < 2000; round++) {
+        PGORILLA_CHUNK_HEADER header = (PGORILLA_CHUNK_HEADER)Chunks[0];
+        GORILLA_DECODER decoder;
+        ULONG64 stamp;
+        ULONG64 value;
+        ULONG decoded = 0;
+
+        if (round & 1) {
+            for (ULONG w = 0; w < GORILLA_CHUNK_BYTES / sizeof(ULONG64); w++) {
+                Chunks[0][w] = TestRandom(Seed);
+            }
+            header->Bits = (ULONG)TestRange(Seed, 0, GORILLA_CHUNK_WORDS * 64);
+        }
+        else {
+            for (ULONG i = 0; i < 1000; i++) {
+                Stamps[i] = 10000ULL * i + (ULONG64)TestRange(Seed, 0, 100);
+                Values[i] = TestRandom(Seed);
+            }
+            Encode(1000, 10000);
+            header->Bits = (ULONG)TestRange(Seed, 0, header->Bits);
+        }
+        header->Count = (ULONG)TestRange(Seed, 0, 100000);
+
+        if (!GorillaDecodeBegin(&decoder, Chunks[0], GORILLA_CHUNK_BYTES)) {
+            CHECK(FALSE);
+            return;
+        }
+        while (GorillaDecode(&decoder, &stamp, &value)) {
+            decoded++;
+        }
+        CHECK(decoded <= header->Count && decoder.Position <= header->Bits);
+    }
+
+    ((PGORILLA_CHUNK_HEADER)Chunks[0])->Bits = GORILLA_CHUNK_WORDS * 64 + 1;
+    GORILLA_DECODER decoder;
+    CHECK(!GorillaDecodeBegin(&decoder, Chunks[0], GORILLA_CHUNK_BYTES));
+    CHECK(!GorillaDecodeBegin(&decoder, Chunks[0], GORILLA_CHUNK_BYTES - 1));
+}
+
+int main(void)
+{
+    ULONG64 seed = 0x5EED0048ULL;
+
+    TestTimer(&seed);
+    TestSpacingChanges(&seed);
+    TestOddSeries(&seed);
+    TestWorstCase(&seed);
+    TestDamaged(&seed);
+    return TestResult("gorilla_test");
+}
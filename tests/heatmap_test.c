@@ -0,0 +1,392 @@
+#include "test.h"
+#include "heatmap.h"
+
+//
+// HeatMapUpdate over a snapshot page written the way the samplers write it,
+// against a map recomputed from scratch after every batch of random partial
+// updates: cells per physical core grouped by die, hottest sibling, idle
+// only if every sibling is, neighbour gradients and die summaries. Also the
+// flag thresholds at their exact boundaries, an entry caught mid-write, and
+// HeatMapEncodeFrame decoded back field by field.
+//
+
+#define CPUS            256
+#define GRADIENT_C      5
+#define SPREAD_C        20
+
+static union {
+    WINMSR_SNAPSHOT_PAGE Page;
+    UCHAR Bytes[sizeof(WINMSR_SNAPSHOT_PAGE) + CPUS * sizeof(WINMSR_CPU_SNAPSHOT)];
+} Memory;
+static HEATMAP Map;
+
+// Recomputed map: the same layout as HEATMAP, from the page alone
+static HEATMAP_CELL ExpectedCell[CPUS];
+static HEATMAP_DIE ExpectedDie[CPUS];
+static ULONG ExpectedCells;
+static ULONG ExpectedDies;
+
+static PWINMSR_CPU_SNAPSHOT Entry(ULONG Cpu)
+{
+    return (PWINMSR_CPU_SNAPSHOT)SnapshotCpu(&Memory.Page, Cpu);
+}
+
+static void PageInit(ULONG Cpus)
+{
+    memset(&Memory, 0, sizeof(Memory));
+    Memory.Page.Version = WINMSR_SNAPSHOT_VERSION;
+    Memory.Page.CpuCount = Cpus;
+    Memory.Page.CpuStride = sizeof(WINMSR_CPU_SNAPSHOT);
+}
+
+static void Write(ULONG Cpu, LONG Temperature, ULONG64 Time)
+{
+    FORECAST forecast = { 0 };
+
+    forecast.Level = Temperature * 1000;
+    SnapshotWrite(Entry(Cpu), Temperature, 0, 0, 0, Time, &forecast);
+}
+
+static ULONG LeaderOf(ULONG Cpu, ULONG Cpus)
+{
+    return (Entry(Cpu)->Core < Cpus) ? Entry(Cpu)->Core : Cpu;
+}
+
+static ULONG DieOf(ULONG Cpu, ULONG Cpus)
+{
+    return (Entry(Cpu)->Die < Cpus) ? Entry(Cpu)->Die : Cpu;
+}
+
+static void Recompute(void)
+{
+    ULONG cpus = Memory.Page.CpuCount;
+
+    ExpectedCells = 0;
+    ExpectedDies = 0;
+    for (ULONG d = 0; d < cpus; d++) {
+        if (DieOf(d, cpus) != d) {
+            continue;
+        }
+        PHEATMAP_DIE die = &ExpectedDie[ExpectedDies];
+        LONG sum = 0;
+        ULONG valid = 0;
+
+        die->Leader = (USHORT)d;
+        die->Package = Entry(d)->Package;
+        die->FirstCell = (USHORT)ExpectedCells;
+        die->Cells = 0;
+        die->Min = die->Max = die->Mean = HEATMAP_INVALID;
+        die->Flags = 0;
+
+        for (ULONG c = 0; c < cpus; c++) {
+            if (DieOf(c, cpus) != d || LeaderOf(c, cpus) != c) {
+                continue;
+            }
+            PHEATMAP_CELL cell = &ExpectedCell[ExpectedCells++];
+            BOOLEAN idle = TRUE;
+
+            cell->Core = (USHORT)c;
+            cell->Die = (USHORT)(ExpectedDies);
+            cell->Temperature = HEATMAP_INVALID;
+            for (ULONG s = 0; s < cpus; s++) {
+                const WINMSR_CPU_SNAPSHOT* e = Entry(s);
+                if (LeaderOf(s, cpus) != c) {
+                    continue;
+                }
+                if (e->Time != 0 && e->Temperature >= 0 && e->Temperature > cell->Temperature) {
+                    cell->Temperature = e->Temperature;
+                }
+                idle = idle && (e->Flags & WINMSR_SNAPSHOT_IDLE);
+            }
+            cell->Flags = idle ? HEATMAP_CELL_IDLE : 0;
+            die->Cells++;
+
+            if (cell->Temperature != HEATMAP_INVALID) {
+                die->Min = (valid == 0) ? cell->Temperature : min(die->Min, cell->Temperature);
+                die->Max = (valid == 0) ? cell->Temperature : max(die->Max, cell->Temperature);
+                sum += cell->Temperature;
+                valid++;
+            }
+        }
+        if (valid != 0) {
+            die->Mean = sum / (LONG)valid;
+            die->Flags = (die->Max - die->Min >= SPREAD_C) ? HEATMAP_DIE_UNEVEN : 0;
+        }
+
+        PHEATMAP_CELL cells = &ExpectedCell[die->FirstCell];
+        for (ULONG k = 0; k < die->Cells; k++) {
+            LONG neighbours = 0;
+            LONG n = 0;
+
+            cells[k].Gradient = 0;
+            if (cells[k].Temperature == HEATMAP_INVALID) {
+                continue;
+            }
+            if (k > 0 && cells[k - 1].Temperature != HEATMAP_INVALID) {
+                neighbours += cells[k - 1].Temperature;
+                n++;
+            }
+            if (k + 1 < die->Cells && cells[k + 1].Temperature != HEATMAP_INVALID) {
+                neighbours += cells[k + 1].Temperature;
+                n++;
+            }
+            if (n != 0) {
+                cells[k].Gradient = cells[k].Temperature - neighbours / n;
+                cells[k].Flags |= (cells[k].Gradient >= GRADIENT_C) ? HEATMAP_CELL_HOT :
+                                  (cells[k].Gradient <= -GRADIENT_C) ? HEATMAP_CELL_COLD : 0;
+            }
+        }
+        ExpectedDies++;
+    }
+}
+
+static BOOLEAN MatchesRecompute(void)
+{
+    BOOLEAN same = Map.CellCount == ExpectedCells && Map.DieCount == ExpectedDies;
+
+    for (ULONG c = 0; same && c < ExpectedCells; c++) {
+        same = Map.Cell[c].Core == ExpectedCell[c].Core && Map.Cell[c].Die == ExpectedCell[c].Die &&
+               Map.Cell[c].Temperature == ExpectedCell[c].Temperature &&
+               Map.Cell[c].Gradient == ExpectedCell[c].Gradient && Map.Cell[c].Flags == ExpectedCell[c].Flags;
+    }
+    for (ULONG d = 0; same && d < ExpectedDies; d++) {
+        same = memcmp(&Map.Die[d], &ExpectedDie[d], sizeof(HEATMAP_DIE)) == 0;
+    }
+    return same;
+}
+
+// 2 packages of 2 dies; SMT pairs except on the last die, whose cores are
+// single CPUs. Temperatures close together, so gradients land on both sides
+// of the threshold.
+static void TestRandomUpdates(ULONG64* Seed)
+{
+    ULONG64 time = 1;
+    ULONG64 newest = 1;
+    UCHAR touched[CPUS];
+
+    PageInit(CPUS);
+    for (ULONG i = 0; i < CPUS; i++) {
+        Entry(i)->Core = (USHORT)((i >= 192) ? i : (i & ~1u));
+        Entry(i)->Die = (USHORT)(i / 64 * 64);
+        Entry(i)->Package = (USHORT)(i / 128 * 128);
+        Entry(i)->TjMax = 100;
+        if (TestRange(Seed, 0, 7) != 0) {
+            Write(i, (LONG)TestRange(Seed, 55, 70), time);
+        }
+    }
+
+    HeatMapInit(&Map, GRADIENT_C, SPREAD_C);
+    CHECK(HeatMapUpdate(&Map, &Memory.Page) == CPUS);
+    Recompute();
+    CHECK(Map.CpuCount == CPUS && Map.DieCount == 4 && Map.CellCount == 3 * 32 + 64);
+    CHECK(MatchesRecompute());
+    CHECK(HeatMapUpdate(&Map, &Memory.Page) == 0);
+
+    for (ULONG round = 0; round < 2000; round++) {
+        ULONG updates = (ULONG)TestRange(Seed, 0, 24);
+        ULONG changed = 0;
+
+        memset(touched, 0, sizeof(touched));
+        time++;
+        for (ULONG u = 0; u < updates; u++) {
+            ULONG cpu = (ULONG)TestRange(Seed, 0, CPUS - 1);
+            LONG64 kind = TestRange(Seed, 0, 9);
+
+            if (kind < 3) {
+                SnapshotMarkIdle(Entry(cpu), time);
+            }
+            else if (kind == 3) {
+                Write(cpu, -1, time);
+                newest = time;
+            }
+            else {
+                // Now and then a hot spot well above its neighbours
+                Write(cpu, (LONG)TestRange(Seed, 55, 70) + ((kind == 9) ? 15 : 0), time);
+                newest = time;
+            }
+            changed += !touched[cpu];
+            touched[cpu] = 1;
+        }
+
+        CHECK(HeatMapUpdate(&Map, &Memory.Page) == changed);
+        CHECK(Map.Time == newest);
+        Recompute();
+        CHECK(MatchesRecompute());
+    }
+}
+
+// One die of single-CPU cores with hand-picked temperatures: gradients and
+// spread exactly at and just below the thresholds
+static void TestThresholds(void)
+{
+    static const LONG temperatures[] = { 60, 65, 60, 64, 60, 55, 60, 56, 60 };
+    const ULONG cpus = sizeof(temperatures) / sizeof(temperatures[0]);
+
+    PageInit(cpus);
+    for (ULONG i = 0; i < cpus; i++) {
+        Entry(i)->Core = (USHORT)i;
+        Entry(i)->Die = 0;
+        Write(i, temperatures[i], 10);
+    }
+    HeatMapInit(&Map, GRADIENT_C, SPREAD_C);
+    HeatMapUpdate(&Map, &Memory.Page);
+    Recompute();
+    CHECK(MatchesRecompute());
+
+    CHECK(Map.Cell[1].Gradient == 5 && Map.Cell[1].Flags == HEATMAP_CELL_HOT);
+    CHECK(Map.Cell[3].Gradient == 4 && Map.Cell[3].Flags == 0);
+    CHECK(Map.Cell[5].Gradient == -5 && Map.Cell[5].Flags == HEATMAP_CELL_COLD);
+    CHECK(Map.Cell[7].Gradient == -4 && Map.Cell[7].Flags == 0);
+    CHECK(Map.Cell[0].Gradient == -5 && Map.Cell[0].Flags == HEATMAP_CELL_COLD);   // one neighbour only
+    CHECK(Map.Die[0].Min == 55 && Map.Die[0].Max == 65 && Map.Die[0].Flags == 0);
+
+    // Spread 19, then 20
+    Write(1, 74, 11);
+    HeatMapUpdate(&Map, &Memory.Page);
+    CHECK(Map.Die[0].Max - Map.Die[0].Min == 19 && Map.Die[0].Flags == 0);
+    Write(1, 75, 12);
+    HeatMapUpdate(&Map, &Memory.Page);
+    CHECK(Map.Die[0].Max - Map.Die[0].Min == 20 && Map.Die[0].Flags == HEATMAP_DIE_UNEVEN);
+
+    // A cell with no valid neighbour has no gradient; a die with no reading no summary
+    for (ULONG i = 0; i < cpus; i++) {
+        Write(i, (i == 4) ? 90 : -1, 13);
+    }
+    HeatMapUpdate(&Map, &Memory.Page);
+    CHECK(Map.Cell[4].Temperature == 90 && Map.Cell[4].Gradient == 0 && Map.Cell[4].Flags == 0);
+    CHECK(Map.Die[0].Min == 90 && Map.Die[0].Max == 90 && Map.Die[0].Mean == 90 && Map.Die[0].Flags == 0);
+    Write(4, -1, 14);
+    HeatMapUpdate(&Map, &Memory.Page);
+    CHECK(Map.Die[0].Min == HEATMAP_INVALID && Map.Die[0].Mean == HEATMAP_INVALID && Map.Die[0].Flags == 0);
+}
+
+// SMT pairs: a core is idle only once both siblings are, and an idle core
+// shows the last known temperature
+static void TestIdleCells(void)
+{
+    PageInit(4);
+    for (ULONG i = 0; i < 4; i++) {
+        Entry(i)->Core = (USHORT)(i & ~1u);
+        Entry(i)->Die = 0;
+        Write(i, 60 + (LONG)i, 1);
+    }
+    HeatMapInit(&Map, GRADIENT_C, SPREAD_C);
+    HeatMapUpdate(&Map, &Memory.Page);
+    CHECK(Map.CellCount == 2 && Map.Cell[0].Temperature == 61 && Map.Cell[1].Temperature == 63);
+
+    SnapshotMarkIdle(Entry(0), 2);
+    HeatMapUpdate(&Map, &Memory.Page);
+    CHECK(!(Map.Cell[0].Flags & HEATMAP_CELL_IDLE));
+    SnapshotMarkIdle(Entry(1), 2);
+    HeatMapUpdate(&Map, &Memory.Page);
+    CHECK((Map.Cell[0].Flags & HEATMAP_CELL_IDLE) && Map.Cell[0].Temperature == 61);
+    CHECK(!(Map.Cell[1].Flags & HEATMAP_CELL_IDLE));
+    Write(0, 58, 3);
+    HeatMapUpdate(&Map, &Memory.Page);
+    CHECK(!(Map.Cell[0].Flags & HEATMAP_CELL_IDLE) && Map.Cell[0].Temperature == 61);
+}
+
+// A sequence left odd by a writer mid-update is skipped and counted once
+// the write is done
+static void TestMidWrite(void)
+{
+    PageInit(4);
+    for (ULONG i = 0; i < 4; i++) {
+        Entry(i)->Core = (USHORT)i;
+        Entry(i)->Die = 0;
+        Write(i, 60, 1);
+    }
+    HeatMapInit(&Map, GRADIENT_C, SPREAD_C);
+    HeatMapUpdate(&Map, &Memory.Page);
+
+    InterlockedIncrement(&Entry(2)->Sequence);
+    Entry(2)->Temperature = 80;
+    Entry(2)->Time = 2;
+    CHECK(HeatMapUpdate(&Map, &Memory.Page) == 0);
+    CHECK(Map.Cell[2].Temperature == 60);
+    InterlockedIncrement(&Entry(2)->Sequence);
+    CHECK(HeatMapUpdate(&Map, &Memory.Page) == 1);
+    CHECK(Map.Cell[2].Temperature == 80 && Map.Time == 2);
+}
+
+static ULONG FrameDegrees(LONG Temperature)
+{
+    return (Temperature == HEATMAP_INVALID) ? HEATMAP_FRAME_NO_READING : (ULONG)min(max(Temperature, 0), 254);
+}
+
+// Decodes a frame and compares every field with the map it came from
+static void CheckFrame(const UCHAR* Frame, ULONG Size)
+{
+    const HEATMAP_FRAME_HEADER* header = (const HEATMAP_FRAME_HEADER*)Frame;
+    const HEATMAP_FRAME_DIE* dies = (const HEATMAP_FRAME_DIE*)(Frame + sizeof(HEATMAP_FRAME_HEADER));
+    const HEATMAP_FRAME_CELL* cells = (const HEATMAP_FRAME_CELL*)(dies + header->DieCount);
+    ULONG cellCount = 0;
+
+    CHECK(header->Magic == HEATMAP_FRAME_MAGIC && header->Version == HEATMAP_FRAME_VERSION);
+    CHECK(header->DieCount == Map.DieCount && header->Time == Map.Time);
+    for (ULONG d = 0; d < header->DieCount; d++) {
+        const HEATMAP_DIE* die = &Map.Die[d];
+        CHECK(dies[d].Leader == die->Leader && dies[d].Cells == die->Cells && dies[d].Flags == die->Flags);
+        CHECK(dies[d].Min == FrameDegrees(die->Min));
+        CHECK(dies[d].Max == FrameDegrees(die->Max));
+        CHECK(dies[d].Mean == FrameDegrees(die->Mean));
+        cellCount += dies[d].Cells;
+    }
+    CHECK(Size == sizeof(HEATMAP_FRAME_HEADER) + header->DieCount * sizeof(HEATMAP_FRAME_DIE) +
+                  cellCount * sizeof(HEATMAP_FRAME_CELL));
+    for (ULONG c = 0; c < cellCount && c < Map.CellCount; c++) {
+        const HEATMAP_CELL* cell = &Map.Cell[c];
+        LONG gradient = (LONG)(cells[c].GradientFlags & 0x1F) - 16;
+        CHECK(cells[c].Core == cell->Core);
+        CHECK(cells[c].Temperature == FrameDegrees(cell->Temperature));
+        CHECK(gradient == min(max(cell->Gradient, -16), 15));
+        CHECK((ULONG)(cells[c].GradientFlags >> 5) == cell->Flags);
+    }
+}
+
+static void TestFrame(ULONG64* Seed)
+{
+    static UCHAR frame[sizeof(HEATMAP_FRAME_HEADER) + CPUS * (sizeof(HEATMAP_FRAME_DIE) + sizeof(HEATMAP_FRAME_CELL))];
+    ULONG size;
+
+    CHECK(sizeof(HEATMAP_FRAME_HEADER) == 16 && sizeof(HEATMAP_FRAME_DIE) == 8 && sizeof(HEATMAP_FRAME_CELL) == 4);
+
+    // Readings from below 0 to above 254, gradients beyond the 5-bit range,
+    // no reading at all, and a die with none
+    PageInit(CPUS);
+    for (ULONG i = 0; i < CPUS; i++) {
+        Entry(i)->Core = (USHORT)(i & ~1u);
+        Entry(i)->Die = (USHORT)(i / 64 * 64);
+        LONG64 kind = TestRange(Seed, 0, 9);
+        if (i >= 192 || kind == 0) {
+            continue;
+        }
+        Write(i, (kind == 1) ? (LONG)TestRange(Seed, 240, 300) : (LONG)TestRange(Seed, 0, 120), 5 + i);
+        if (kind == 2) {
+            SnapshotMarkIdle(Entry(i), 5 + i);
+        }
+    }
+    HeatMapInit(&Map, GRADIENT_C, SPREAD_C);
+    HeatMapUpdate(&Map, &Memory.Page);
+    Recompute();
+    CHECK(MatchesRecompute());
+
+    CHECK(HeatMapEncodeFrame(&Map, frame, HeatMapFrameSize(&Map) - 1) == 0);
+    size = HeatMapEncodeFrame(&Map, frame, sizeof(frame));
+    CHECK(size == HeatMapFrameSize(&Map));
+    CHECK(size == 16 + 4 * 8 + 128 * 4);
+    CheckFrame(frame, size);
+    CHECK(Map.Die[3].Min == HEATMAP_INVALID);
+}
+
+int main(void)
+{
+    ULONG64 seed = 0x5EED0043ULL;
+
+    TestRandomUpdates(&seed);
+    TestThresholds();
+    TestIdleCells();
+    TestMidWrite();
+    TestFrame(&seed);
+    return TestResult("heatmap_test");
+}
@@ -0,0 +1,205 @@
+#include "test.h"
+#include "history.h"
+
+//
+// Compressed history as the driver drives it: the sampler appends every
+// sample, IOCTL_WINMSR_READ_HISTORY copies sealed chunks with a cursor.
+// Checks that the open chunk is never handed out, what a lapped cursor
+// skips, and that chunks copied while the sampler runs on decode to exactly
+// the samples appended, in order.
+//
+
+#define CAPACITY        8
+#define PERIOD          10000ULL
+
+static UCHAR Buffer[HISTORY_BYTES(CAPACITY)];
+static HISTORY_RING History;
+static UCHAR Copies[3][CAPACITY][GORILLA_CHUNK_BYTES];
+
+// The value is derived from the stamp, so a sample out of place shows
+static ULONG64 StampOf(ULONG64 Sample)
+{
+    return 1000000ULL + Sample * PERIOD + (Sample * 7919) % 101;
+}
+
+static ULONG64 ValueOf(ULONG64 Stamp)
+{
+    return 0x88000000ULL | (((Stamp / (PERIOD * 13)) % 90) << 16);
+}
+
+// Decodes one chunk; its samples must continue from *Next, or after a gap
+// from a later sample if AllowGap. FALSE if not.
+static BOOLEAN Consume(const UCHAR* Chunk, PULONG64 Next, BOOLEAN AllowGap)
+{
+    GORILLA_DECODER decoder;
+    ULONG64 stamp;
+    ULONG64 value;
+    ULONG64 first = *Next;
+
+    if (!GorillaDecodeBegin(&decoder, Chunk, GORILLA_CHUNK_BYTES)) {
+        return FALSE;
+    }
+    while (GorillaDecode(&decoder, &stamp, &value)) {
+        if (*Next == first && stamp != StampOf(*Next)) {
+            ULONG64 sample = (stamp - 1000000ULL) / PERIOD;
+            if (!AllowGap || sample < *Next) {
+                return FALSE;
+            }
+            *Next = sample;
+        }
+        if (stamp != StampOf(*Next) || value != ValueOf(stamp)) {
+            return FALSE;
+        }
+        (*Next)++;
+    }
+    return decoder.Remaining == 0 && *Next > first;
+}
+
+static ULONG64 Append(ULONG64 From, ULONG64 To)
+{
+    for (ULONG64 i = From; i < To; i++) {
+        ULONG64 stamp = StampOf(i);
+        HistoryAppend(&History, stamp, ValueOf(stamp));
+    }
+    return To;
+}
+
+static void TestSequential(void)
+{
+    ULONG64 cursor = 0;
+    ULONG64 lost;
+    ULONG64 next = 0;
+    ULONG64 samples = 0;
+
+    CHECK(!HistoryInit(&History, Buffer, HISTORY_MIN_CHUNKS - 1, PERIOD));
+    CHECK(HistoryInit(&History, Buffer, CAPACITY, PERIOD));
+
+    // Nothing sealed yet: the open chunk is not handed out
+    samples = Append(samples, 1000);
+    CHECK(HistoryRead(&History, &cursor, Copies[0], CAPACITY, &lost) == 0 && cursor == 0 && lost == 0);
+
+    // Until the first chunk is sealed
+    while (ReadNoFence64(&History.Sealed) == 0) {
+        samples = Append(samples, samples + 1);
+    }
+    CHECK(HistoryRead(&History, &cursor, Copies[0], CAPACITY, &lost) == 1 && cursor == 1 && lost == 0);
+    CHECK(Consume(Copies[0][0], &next, FALSE));
+    CHECK(next == samples - 1);     // the last sample opened the next chunk
+
+    // Read in steps of two while appending: nothing lost, nothing repeated
+    while (ReadNoFence64(&History.Sealed) < 50) {
+        samples = Append(samples, samples + 1000);
+        ULONG count;
+        while ((count = HistoryRead(&History, &cursor, Copies[0], 2, &lost)) != 0) {
+            CHECK(lost == 0);
+            for (ULONG c = 0; c < count; c++) {
+                CHECK(Consume(Copies[0][c], &next, FALSE));
+            }
+        }
+    }
+    CHECK(cursor == (ULONG64)ReadNoFence64(&History.Sealed));
+}
+
+// A cursor left behind gets the newest Capacity - 1 chunks and counts the rest
+static void TestLapped(void)
+{
+    ULONG64 cursor = 0;
+    ULONG64 lost;
+    ULONG64 next = 0;
+
+    HistoryInit(&History, Buffer, CAPACITY, PERIOD);
+    Append(0, 200000);
+    ULONG64 sealed = (ULONG64)ReadNoFence64(&History.Sealed);
+    CHECK(sealed > 3 * CAPACITY);
+
+    // Every slot is stamped with the chunk it holds, the open chunk's with 0,
+    // so a reader that saw an older Sealed cannot take the open chunk
+    for (ULONG64 n = sealed - (CAPACITY - 1); n <= sealed; n++) {
+        CHECK(History.Stamps[n % CAPACITY] == ((n == sealed) ? 0 : (LONG64)(n + 1)));
+    }
+
+    ULONG count = HistoryRead(&History, &cursor, Copies[0], CAPACITY, &lost);
+    CHECK(count == CAPACITY - 1 && lost == sealed - (CAPACITY - 1) && cursor == sealed);
+    for (ULONG c = 0; c < count; c++) {
+        CHECK(Consume(Copies[0][c], &next, c == 0));
+    }
+    CHECK(next == 200000 - History.Encoder.Chunk->Count);
+
+    cursor = sealed + 5;
+    CHECK(HistoryRead(&History, &cursor, Copies[0], CAPACITY, &lost) == 0 && cursor == sealed + 5);
+}
+
+#define STRESS_SAMPLES  4000000
+#define READERS         3
+
+static volatile LONG StressDone = 0;
+static volatile LONG StressBad = 0;
+static volatile LONG StressReads = 0;        // reads that returned chunks
+
+static void WriterThread(void* Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+    // Yields now and then so the readers interleave even on one CPU
+    for (ULONG64 i = 0; i < STRESS_SAMPLES; i += 5000) {
+        Append(i, i + 5000);
+        TestYield();
+    }
+    InterlockedExchange(&StressDone, 1);
+}
+
+// Every copied chunk decodes in order; lost chunks only ever skip forward
+static void ReaderThread(void* Context)
+{
+    ULONG reader = (ULONG)(ULONG_PTR)Context;
+    ULONG64 cursor = 0;
+    ULONG64 next = 0;
+
+    for (;;) {
+        BOOLEAN done = ReadAcquire(&StressDone) != 0;
+        ULONG64 lost;
+        ULONG64 before = cursor;
+        ULONG count = HistoryRead(&History, &cursor, Copies[reader], 1 + reader, &lost);
+
+        if (cursor != before + count + lost) {
+            InterlockedIncrement(&StressBad);
+        }
+        for (ULONG c = 0; c < count; c++) {
+            if (!Consume(Copies[reader][c], &next, lost != 0 || before == 0)) {
+                InterlockedIncrement(&StressBad);
+            }
+        }
+        if (count != 0) {
+            InterlockedIncrement(&StressReads);
+        }
+        if (done && count == 0) {
+            break;
+        }
+        TestYield();
+    }
+}
+
+static void TestStress(void)
+{
+    TEST_THREAD writer;
+    TEST_THREAD readers[READERS];
+
+    HistoryInit(&History, Buffer, CAPACITY, PERIOD);
+    TestThreadStart(&writer, WriterThread, NULL);
+    for (ULONG i = 0; i < READERS; i++) {
+        TestThreadStart(&readers[i], ReaderThread, (void*)(ULONG_PTR)i);
+    }
+    TestThreadJoin(writer);
+    for (ULONG i = 0; i < READERS; i++) {
+        TestThreadJoin(readers[i]);
+    }
+    CHECK(StressBad == 0);
+    CHECK(StressReads > STRESS_SAMPLES / 5000);
+}
+
+int main(void)
+{
+    TestSequential();
+    TestLapped();
+    TestStress();
+    return TestResult("history_test");
+}
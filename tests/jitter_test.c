@@ -0,0 +1,139 @@
+#include "test.h"
+#include "jitter.h"
+
+//
+// Sweep tracking as the samplers in driver.c feed it: every CPU records each
+// tick it fires, in whatever order the CPUs get there. Complete ticks must
+// add their exact spread, skipped ones count as incomplete once their slot is
+// reused, and a session reset must not let a CPU still recording for the
+// previous session disturb the new one.
+//
+
+#define CPUS            8
+
+static SWEEP_TRACKER Tracker;
+
+static ULONG64 HistogramTotal(void)
+{
+    ULONG64 total = 0;
+    for (ULONG b = 0; b < WINMSR_JITTER_BUCKETS; b++) {
+        total += SweepCount(Tracker.SpreadHistogram[b]);
+    }
+    return total;
+}
+
+// Ticks in order, each fired by every CPU (or now and then all but one) in
+// random order with random delays
+static void TestSweeps(ULONG64* Seed)
+{
+    static ULONG64 expected[WINMSR_JITTER_BUCKETS];
+    ULONG64 sweeps = 0;
+    ULONG64 skipped = 0;
+    ULONG64 spreadMax = 0;
+    const ULONG ticks = 5000;
+
+    SweepInit(&Tracker);
+    RtlZeroMemory(expected, sizeof(expected));
+
+    for (ULONG64 tick = 0; tick < ticks; tick++) {
+        ULONG order[CPUS];
+        ULONG64 lo = MAXULONG64;
+        ULONG64 hi = 0;
+        ULONG firing = (TestRange(Seed, 0, 19) == 0) ? CPUS - 1 : CPUS;
+
+        for (ULONG i = 0; i < CPUS; i++) {
+            order[i] = i;
+        }
+        for (ULONG i = CPUS - 1; i > 0; i--) {
+            ULONG j = (ULONG)TestRange(Seed, 0, i);
+            ULONG t = order[i];
+            order[i] = order[j];
+            order[j] = t;
+        }
+        for (ULONG i = 0; i < firing; i++) {
+            ULONG64 delay = (ULONG64)TestRange(Seed, 0, (TestRange(Seed, 0, 9) == 0) ? 100000 : 500);
+            lo = min(lo, delay);
+            hi = max(hi, delay);
+            SweepRecord(&Tracker, 0, tick, delay, CPUS);
+        }
+
+        if (firing == CPUS) {
+            sweeps++;
+            expected[JitterBucket(hi - lo)]++;
+            spreadMax = max(spreadMax, hi - lo);
+        }
+        else if (tick + SWEEP_SLOTS < ticks) {
+            skipped++;      // found when the slot is reused
+        }
+    }
+
+    CHECK(SweepCount(Tracker.Sweeps) == sweeps);
+    CHECK(SweepCount(Tracker.Incomplete) == skipped);
+    CHECK(SweepCount(Tracker.SpreadMax) == spreadMax);
+    for (ULONG b = 0; b < WINMSR_JITTER_BUCKETS; b++) {
+        CHECK(SweepCount(Tracker.SpreadHistogram[b]) == expected[b]);
+    }
+}
+
+// A CPU late for the previous session: its generation check passed before
+// the reset and its CAS lands after it. Both a tick behind and a tick ahead
+// of the new session's ticks must leave every new sweep complete.
+static void TestStaleWrite(ULONG64 StaleTick)
+{
+    SweepInit(&Tracker);
+
+    // Session 1: a tick half recorded when the session changes
+    for (ULONG i = 0; i < CPUS / 2; i++) {
+        SweepRecord(&Tracker, 1, StaleTick, 10 * i, CPUS);
+    }
+    SweepReset(&Tracker, 2);
+    CHECK(Tracker.Sweeps == Tracker.Incomplete && SweepCount(Tracker.Sweeps) == 0);
+
+    // The interleaving: the late CPU saw generation 1 before the reset
+    Tracker.Generation = 1;
+    SweepRecord(&Tracker, 1, StaleTick, 7, CPUS);
+    Tracker.Generation = 2;
+
+    // ... and once it sees the reset, it records nothing more
+    SweepRecord(&Tracker, 1, StaleTick, 7, CPUS);
+
+    // Session 2 starts its ticks over
+    for (ULONG64 tick = 0; tick < 4 * SWEEP_SLOTS; tick++) {
+        for (ULONG i = 0; i < CPUS; i++) {
+            SweepRecord(&Tracker, 2, tick, 100 + i, CPUS);
+        }
+    }
+    CHECK(SweepCount(Tracker.Sweeps) == 4 * SWEEP_SLOTS);
+    CHECK(SweepCount(Tracker.Incomplete) == 0);
+    CHECK(SweepCount(Tracker.SpreadMax) == CPUS - 1);
+    CHECK(HistogramTotal() == 4 * SWEEP_SLOTS);
+}
+
+// Generations wrap in the packed words without mixing sessions up
+static void TestGenerationWrap(void)
+{
+    SweepInit(&Tracker);
+    for (LONG gen = 1; gen < 70000; gen += 997) {
+        SweepReset(&Tracker, gen);
+        for (ULONG i = 0; i < CPUS - 1; i++) {
+            SweepRecord(&Tracker, gen, 3, i, CPUS);
+        }
+        CHECK(SweepCount(Tracker.Sweeps) == 0 && SweepCount(Tracker.Incomplete) == 0);
+        SweepRecord(&Tracker, gen, 3, 0, CPUS);
+        SweepRecord(&Tracker, gen, 3 + SWEEP_SLOTS, 0, CPUS);
+        CHECK(SweepCount(Tracker.Sweeps) == 1 && SweepCount(Tracker.Incomplete) == 0);
+    }
+}
+
+int main(void)
+{
+    ULONG64 seed = 37;
+
+    for (ULONG run = 0; run < 4; run++) {
+        TestSweeps(&seed);
+    }
+    TestStaleWrite(5);                      // behind the new session's ticks
+    TestStaleWrite(20 * SWEEP_SLOTS + 5);   // ahead of them, same slot
+    TestGenerationWrap();
+    return TestResult("jitter_test");
+}
@@ -0,0 +1,166 @@
+#include "test.h"
+#include "rank.h"
+
+//
+// RankCpus over a snapshot page written the way the samplers write it,
+// against a brute-force ranking: most headroom first by whole degrees, index
+// order within a degree, and the hottest sibling and package readings. The
+// cached ranking must match a fresh one after any entries were rewritten,
+// and horizons outside 0 .. FORECAST_MAX_HORIZON_MS rank as if clamped.
+//
+
+#define CPUS            256
+
+static union {
+    WINMSR_SNAPSHOT_PAGE Page;
+    UCHAR Bytes[sizeof(WINMSR_SNAPSHOT_PAGE) + CPUS * sizeof(WINMSR_CPU_SNAPSHOT)];
+} Memory;
+static RANK_CONTEXT Cached;
+static RANK_CONTEXT Fresh;
+static RANKED_CPU Ranked[CPUS];
+static RANKED_CPU Expected[CPUS];
+
+static PWINMSR_CPU_SNAPSHOT Entry(ULONG Cpu)
+{
+    return (PWINMSR_CPU_SNAPSHOT)SnapshotCpu(&Memory.Page, Cpu);
+}
+
+// A new reading, an idle mark or (rarely) no reading at all
+static void Update(ULONG Cpu, ULONG64 Time, ULONG64* Seed)
+{
+    FORECAST forecast = { 0 };
+
+    if (TestRange(Seed, 0, 3) == 0) {
+        SnapshotMarkIdle(Entry(Cpu), Time);
+        return;
+    }
+    LONG temperature = (TestRange(Seed, 0, 19) == 0) ? -1 : (LONG)TestRange(Seed, 30, 105);
+    forecast.Level = temperature * 1000 + (LONG)TestRange(Seed, -900, 900);
+    forecast.Slope = (LONG)TestRange(Seed, -FORECAST_MAX_SLOPE, FORECAST_MAX_SLOPE) / 10;
+    forecast.Prochot = (LONG)TestRange(Seed, 0, 1000) * (TestRange(Seed, 0, 3) == 0);
+    SnapshotWrite(Entry(Cpu), temperature, 0, 0, 0, Time, &forecast);
+}
+
+static void PageInit(ULONG64* Seed)
+{
+    memset(&Memory, 0, sizeof(Memory));
+    Memory.Page.Version = WINMSR_SNAPSHOT_VERSION;
+    Memory.Page.CpuCount = CPUS;
+    Memory.Page.CpuStride = sizeof(WINMSR_CPU_SNAPSHOT);
+    for (ULONG i = 0; i < CPUS; i++) {
+        Entry(i)->Core = (USHORT)(i & ~1u);         // SMT pairs
+        Entry(i)->Package = (USHORT)(i / 64 * 64);
+        Entry(i)->TjMax = 100;
+        if (TestRange(Seed, 0, 15) != 0) {
+            Update(i, 1, Seed);
+        }
+    }
+}
+
+// Stable selection by bucket over every CPU, maxima by scanning
+static void BruteRank(LONG HorizonMs)
+{
+    ULONG n = 0;
+    HorizonMs = min(max(HorizonMs, 0), FORECAST_MAX_HORIZON_MS);
+
+    for (ULONG bucket = 0; bucket < RANK_BUCKETS; bucket++) {
+        for (ULONG i = 0; i < CPUS; i++) {
+            const WINMSR_CPU_SNAPSHOT* e = Entry(i);
+            RANKED_CPU r = { 0 };
+            ULONG b = RANK_BUCKETS - 1;
+
+            r.Cpu = i;
+            r.ProchotPermille = e->ProchotPermille;
+            r.Flags = e->Flags;
+            if (e->Time == 0 || e->Temperature < 0) {
+                r.Headroom = MINLONG;
+                r.Temperature = r.Forecast = -1;
+                r.Flags |= RANK_NO_READING;
+            }
+            else {
+                r.Temperature = e->Temperature * 1000;
+                r.Forecast = e->Level + e->Slope * HorizonMs / 1000;
+                r.Headroom = e->TjMax * 1000 - r.Forecast - (LONG)e->ProchotPermille * RANK_PROCHOT_PENALTY;
+                b = RANK_BUCKETS - 2 - (ULONG)min(max(r.Headroom / 1000, 0), RANK_BUCKETS - 2);
+            }
+            if (b != bucket) {
+                continue;
+            }
+            r.SiblingMax = r.PackageMax = MINLONG;
+            for (ULONG j = 0; j < CPUS; j++) {
+                const WINMSR_CPU_SNAPSHOT* o = Entry(j);
+                if (o->Time == 0 || o->Temperature < 0) {
+                    continue;
+                }
+                if (o->Core == e->Core) {
+                    r.SiblingMax = max(r.SiblingMax, o->Temperature * 1000);
+                }
+                if (o->Package == e->Package) {
+                    r.PackageMax = max(r.PackageMax, o->Temperature * 1000);
+                }
+            }
+            Expected[n++] = r;
+        }
+    }
+    CHECK(n == CPUS);
+}
+
+static BOOLEAN Same(const RANKED_CPU* A, const RANKED_CPU* B, ULONG Count)
+{
+    return memcmp(A, B, Count * sizeof(RANKED_CPU)) == 0;
+}
+
+static void TestRanking(ULONG64* Seed)
+{
+    PageInit(Seed);
+    RankInit(&Cached);
+
+    for (ULONG round = 0; round < 200; round++) {
+        static const LONG horizons[] = { 0, 1000, 5000, FORECAST_MAX_HORIZON_MS };
+        LONG horizon = horizons[TestRange(Seed, 0, 3)];
+        ULONG capacity = (TestRange(Seed, 0, 3) == 0) ? (ULONG)TestRange(Seed, 1, CPUS) : CPUS;
+
+        // Between calls, nothing changes or a few samplers write
+        ULONG writes = (TestRange(Seed, 0, 1) == 0) ? 0 : (ULONG)TestRange(Seed, 1, 4);
+        for (ULONG w = 0; w < writes; w++) {
+            Update((ULONG)TestRange(Seed, 0, CPUS - 1), 2 + round, Seed);
+        }
+
+        BruteRank(horizon);
+        CHECK(RankCpus(&Memory.Page, horizon, &Cached, Ranked, capacity) == capacity);
+        CHECK(Same(Ranked, Expected, capacity));
+        RankInit(&Fresh);
+        CHECK(RankCpus(&Memory.Page, horizon, &Fresh, Ranked, CPUS) == CPUS);
+        CHECK(Same(Ranked, Expected, CPUS));
+    }
+}
+
+// Horizons beyond the forecast's range rank as the nearest valid one
+static void TestHorizonClamp(ULONG64* Seed)
+{
+    static RANKED_CPU clamped[CPUS];
+
+    PageInit(Seed);
+    RankInit(&Fresh);
+    RankCpus(&Memory.Page, FORECAST_MAX_HORIZON_MS, &Fresh, clamped, CPUS);
+    RankInit(&Fresh);
+    RankCpus(&Memory.Page, MAXLONG, &Fresh, Ranked, CPUS);
+    CHECK(Same(Ranked, clamped, CPUS));
+
+    RankInit(&Fresh);
+    RankCpus(&Memory.Page, 0, &Fresh, clamped, CPUS);
+    RankInit(&Fresh);
+    RankCpus(&Memory.Page, -5000, &Fresh, Ranked, CPUS);
+    CHECK(Same(Ranked, clamped, CPUS));
+}
+
+int main(void)
+{
+    ULONG64 seed = 42;
+
+    for (ULONG run = 0; run < 4; run++) {
+        TestRanking(&seed);
+    }
+    TestHorizonClamp(&seed);
+    return TestResult("rank_test");
+}
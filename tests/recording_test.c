@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include "test.h"
+#include "recording.h"
+
+//
+// Recording files written to memory and queried through the sparse index,
+// against a brute-force scan of every appended sample: random CPUs, readings
+// and status words, random time ranges, CPUs, thresholds and flags. A status
+// word whose sticky log bits stay set after one throttle must not make every
+// later block match, unless the file says the logs were cleared per sample.
+//
+
+#define MAX_BLOCKS      64
+#define MAX_SAMPLES     100000
+#define CPUS            4
+
+typedef struct _MEMORY_FILE {
+    UCHAR* Data;                // MAX_BLOCKS + 1 blocks
+    ULONG64 Size;
+} MEMORY_FILE;
+
+typedef struct _APPENDED {
+    ULONG Cpu;
+    RECORDING_SAMPLE Sample;
+} APPENDED;
+
+static MEMORY_FILE File;
+static APPENDED Appended[MAX_SAMPLES];
+static ULONG AppendedCount;
+
+static UCHAR* HeaderBuffer;
+static UCHAR* IndexBuffer;
+static UCHAR* BlockBuffers;
+
+static void FileWrite(ULONG64 Offset, const void* Data)
+{
+    CHECK(Offset + RECORDING_BLOCK_SIZE <= (ULONG64)(MAX_BLOCKS + 1) * RECORDING_BLOCK_SIZE);
+    if (Offset + RECORDING_BLOCK_SIZE > (ULONG64)(MAX_BLOCKS + 1) * RECORDING_BLOCK_SIZE) {
+        return;
+    }
+    memcpy(File.Data + Offset, Data, RECORDING_BLOCK_SIZE);
+    File.Size = max(File.Size, Offset + RECORDING_BLOCK_SIZE);
+}
+
+// The write order the writer asks for: the block, its index block, the header
+static void WriteBlock(PRECORDING_WRITER Writer, const RECORDING_BLOCK_HEADER* Block)
+{
+    FileWrite(RecordingBlockOffset(Block->Index), Block);
+    FileWrite(RecordingBlockOffset(Writer->Index->Index), Writer->Index);
+    FileWrite(0, Writer->Header);
+}
+
+static void Begin(PRECORDING_WRITER Writer, ULONG Flags)
+{
+    memset(File.Data, 0, (SIZE_T)(MAX_BLOCKS + 1) * RECORDING_BLOCK_SIZE);
+    File.Size = 0;
+    AppendedCount = 0;
+    CHECK(RecordingWriterInit(Writer, (PRECORDING_FILE_HEADER)HeaderBuffer, IndexBuffer, BlockBuffers, CPUS, Flags));
+}
+
+static void Append(PRECORDING_WRITER Writer, ULONG Cpu, const RECORDING_SAMPLE* Sample)
+{
+    Appended[AppendedCount].Cpu = Cpu;
+    Appended[AppendedCount].Sample = *Sample;
+    AppendedCount++;
+
+    const RECORDING_BLOCK_HEADER* block = RecordingAppend(Writer, Cpu, Sample);
+    if (block != NULL) {
+        WriteBlock(Writer, block);
+    }
+}
+
+static void End(PRECORDING_WRITER Writer, PRECORDING_READER Reader)
+{
+    for (ULONG cpu = 0; cpu < CPUS; cpu++) {
+        const RECORDING_BLOCK_HEADER* block = RecordingSeal(Writer, cpu);
+        if (block != NULL) {
+            WriteBlock(Writer, block);
+        }
+    }
+    CHECK(RecordingOpen(Reader, File.Data, File.Size));
+}
+
+static BOOLEAN BruteMatches(const RECORDING_QUERY* Query, ULONG FileFlags, const APPENDED* Entry)
+{
+    const RECORDING_SAMPLE* sample = &Entry->Sample;
+
+    if (sample->Time < Query->From || sample->Time > Query->To) {
+        return FALSE;
+    }
+    if (Query->Cpu != RECORDING_ANY_CPU && Entry->Cpu != Query->Cpu) {
+        return FALSE;
+    }
+    if (Query->AboveC == RECORDING_NO_THRESHOLD && Query->Flags == 0) {
+        return TRUE;
+    }
+
+    // From the raw status word, not the columns
+    MSR_THERM_STATUS_UNION status = { sample->ThermStatus };
+    BOOLEAN cleared = (FileFlags & RECORDING_LOGS_CLEARED) != 0;
+    ULONG flags = ((status.Fields.PROCHOT || (cleared && status.Fields.PROCHOTLog)) ? RECORDING_SUMMARY_PROCHOT : 0) |
+                  ((status.Fields.CriticalTemp || (cleared && status.Fields.CriticalTempLog)) ? RECORDING_SUMMARY_CRITICAL : 0);
+    if (flags & Query->Flags) {
+        return TRUE;
+    }
+    return Query->AboveC != RECORDING_NO_THRESHOLD && status.Fields.ReadingValid &&
+           (LONG)sample->TjMax - (LONG)status.Fields.DTS > Query->AboveC;
+}
+
+// Runs a query through the index and returns how many samples matched;
+// *Hash folds in which ones
+static ULONG Query(const RECORDING_READER* Reader, PRECORDING_QUERY Query, ULONG64* Hash)
+{
+    const RECORDING_BLOCK_HEADER* block;
+    ULONG matches = 0;
+
+    *Hash = 0;
+    while ((block = RecordingQueryNext(Reader, Query)) != NULL) {
+        const ULONG64* time = (const ULONG64*)RecordingColumn(Reader, block, RecordingColumnTime);
+        for (ULONG i = RecordingQuerySample(Reader, Query, block, 0); i != MAXULONG;
+             i = RecordingQuerySample(Reader, Query, block, i + 1)) {
+            matches++;
+            *Hash += (time[i] * 0x9E3779B97F4A7C15ULL) ^ block->Cpu;
+        }
+    }
+    return matches;
+}
+
+static ULONG Brute(const RECORDING_QUERY* Query, ULONG FileFlags, ULONG64* Hash)
+{
+    ULONG matches = 0;
+
+    *Hash = 0;
+    for (ULONG i = 0; i < AppendedCount; i++) {
+        if (BruteMatches(Query, FileFlags, &Appended[i])) {
+            matches++;
+            *Hash += (Appended[i].Sample.Time * 0x9E3779B97F4A7C15ULL) ^ Appended[i].Cpu;
+        }
+    }
+    return matches;
+}
+
+static ULONG StatusWord(LONG Dts, BOOLEAN Valid, ULONG Bits)
+{
+    return (Valid ? 0x80000000UL : 0) | ((ULONG)Dts << 16) | Bits;
+}
+
+// One throttle early on: PROCHOT and its log bit set in the first sample,
+// then only the log bit for the rest of the recording, as happens when
+// nobody clears it
+static void TestStickyLog(ULONG FileFlags)
+{
+    RECORDING_WRITER writer;
+    RECORDING_READER reader;
+    RECORDING_QUERY query;
+    RECORDING_SAMPLE sample = { 0 };
+    ULONG64 hash;
+    ULONG perBlock = RecordingSamplesPerBlock(FileFlags);
+    ULONG count = 3 * perBlock + 10;
+
+    Begin(&writer, FileFlags);
+    sample.TjMax = 100;
+    for (ULONG i = 0; i < count; i++) {
+        sample.Time = 1000 + i;
+        sample.ThermStatus = StatusWord(40, TRUE, (i == 0) ? 0xC : 0x8);
+        Append(&writer, 0, &sample);
+        sample.ThermStatus = StatusWord(40, TRUE, 0);
+        Append(&writer, 1, &sample);
+    }
+    End(&writer, &reader);
+
+    RecordingQueryInit(&query, 0, MAXULONG64, RECORDING_ANY_CPU, RECORDING_NO_THRESHOLD, RECORDING_SUMMARY_PROCHOT);
+    ULONG matches = Query(&reader, &query, &hash);
+    if (FileFlags & RECORDING_LOGS_CLEARED) {
+        // Cleared per sample, every log bit is a fresh event
+        CHECK(matches == count);
+        CHECK(query.BlocksOpened == 4);
+    }
+    else {
+        CHECK(matches == 1);
+        CHECK(query.BlocksOpened == 1);
+        CHECK(query.BlocksSkipped == 7);
+    }
+
+    // Nothing critical happened either way
+    RecordingQueryInit(&query, 0, MAXULONG64, RECORDING_ANY_CPU, RECORDING_NO_THRESHOLD, RECORDING_SUMMARY_CRITICAL);
+    CHECK(Query(&reader, &query, &hash) == 0 && query.BlocksOpened == 0);
+
+    CHECK(RecordingStatusFlags(0x8, 0) == 0);
+    CHECK(RecordingStatusFlags(0x20, 0) == 0);
+    CHECK(RecordingStatusFlags(0x8, RECORDING_LOGS_CLEARED) == RECORDING_SUMMARY_PROCHOT);
+    CHECK(RecordingStatusFlags(0x20, RECORDING_LOGS_CLEARED) == RECORDING_SUMMARY_CRITICAL);
+    CHECK(RecordingStatusFlags(0x14, 0) == (RECORDING_SUMMARY_PROCHOT | RECORDING_SUMMARY_CRITICAL));
+}
+
+// Random recordings, random queries, index against brute force
+static void TestRandomQueries(ULONG64* Seed, ULONG FileFlags)
+{
+    RECORDING_WRITER writer;
+    RECORDING_READER reader;
+    ULONG64 times[CPUS] = { 0 };
+    ULONG count = (ULONG)TestRange(Seed, 1, MAX_SAMPLES);
+    ULONG hotCpu = (ULONG)TestRange(Seed, 0, CPUS - 1);
+
+    Begin(&writer, FileFlags);
+    for (ULONG i = 0; i < count; i++) {
+        RECORDING_SAMPLE sample = { 0 };
+        ULONG cpu = (ULONG)TestRange(Seed, 0, CPUS - 1);
+        ULONG bits = 0;
+
+        // Rare events, mostly on one CPU, with log bits left set for a
+        // while as they would be without clearing
+        if (TestRange(Seed, 0, (cpu == hotCpu) ? 200 : 20000) == 0) {
+            bits |= (TestRange(Seed, 0, 1) ? 0xC : 0x30);
+        }
+        if (TestRange(Seed, 0, 3) == 0) {
+            bits |= 0x8;
+        }
+        if (TestRange(Seed, 0, 99) == 0) {
+            bits |= 0x20;
+        }
+        times[cpu] += (ULONG64)TestRange(Seed, 1, 100000);
+        sample.Time = times[cpu];
+        sample.TjMax = (UCHAR)TestRange(Seed, 90, 105);
+        LONG dts = (TestRange(Seed, 0, 500) == 0) ? (LONG)TestRange(Seed, 0, 5) : (LONG)TestRange(Seed, 20, 70);
+        sample.ThermStatus = StatusWord(dts, TestRange(Seed, 0, 15) != 0, bits);
+        sample.Power = (ULONG)TestRange(Seed, 0, 200000);
+        sample.Frequency = (USHORT)TestRange(Seed, 400, 6000);
+        Append(&writer, cpu, &sample);
+    }
+    End(&writer, &reader);
+
+    ULONG64 last = 0;
+    for (ULONG cpu = 0; cpu < CPUS; cpu++) {
+        last = max(last, times[cpu]);
+    }
+
+    for (ULONG q = 0; q < 200; q++) {
+        RECORDING_QUERY query;
+        ULONG64 from = (ULONG64)TestRange(Seed, 0, (LONG64)last);
+        ULONG64 to = (TestRange(Seed, 0, 3) == 0) ? MAXULONG64 : from + (ULONG64)TestRange(Seed, 0, (LONG64)last / 4);
+        ULONG cpu = TestRange(Seed, 0, 1) ? RECORDING_ANY_CPU : (ULONG)TestRange(Seed, 0, CPUS - 1);
+        LONG above = TestRange(Seed, 0, 2) ? (LONG)TestRange(Seed, 40, 104) : RECORDING_NO_THRESHOLD;
+        ULONG flags = (ULONG)TestRange(Seed, 0, 3);
+        ULONG64 indexHash;
+        ULONG64 bruteHash;
+
+        RecordingQueryInit(&query, from, to, cpu, above, flags);
+        ULONG found = Query(&reader, &query, &indexHash);
+        ULONG expected = Brute(&query, FileFlags, &bruteHash);
+        CHECK(found == expected);
+        CHECK(indexHash == bruteHash);
+        CHECK(query.BlocksOpened + query.BlocksSkipped <= reader.Blocks);
+    }
+}
+
+int main(void)
+{
+    ULONG64 seed = 46;
+
+    File.Data = (UCHAR*)malloc((SIZE_T)(MAX_BLOCKS + 1) * RECORDING_BLOCK_SIZE);
+    HeaderBuffer = (UCHAR*)malloc(RECORDING_BLOCK_SIZE);
+    IndexBuffer = (UCHAR*)malloc(RECORDING_BLOCK_SIZE);
+    BlockBuffers = (UCHAR*)malloc((SIZE_T)CPUS * RECORDING_BLOCK_SIZE);
+    if (File.Data == NULL || HeaderBuffer == NULL || IndexBuffer == NULL || BlockBuffers == NULL) {
+        return 2;
+    }
+
+    TestStickyLog(0);
+    TestStickyLog(RECORDING_LOGS_CLEARED);
+    for (ULONG run = 0; run < 8; run++) {
+        static const ULONG flags[] = {
+            0, RECORDING_LOGS_CLEARED, RECORDING_HAS_POWER | RECORDING_HAS_FREQUENCY,
+            RECORDING_HAS_POWER | RECORDING_LOGS_CLEARED
+        };
+        TestRandomQueries(&seed, flags[run % 4]);
+    }
+    return TestResult("recording_test");
+}
@@ -0,0 +1,222 @@
+#include "test.h"
+#include "ring.h"
+
+//
+// SAMPLE_RING: one producer, several readers with their own cursors. Every
+// record carries fields derived from its position, so a torn copy shows up
+// as an inconsistent record; every read must account for each position it
+// moves past as either returned or lost.
+//
+
+#define STRESS_RECORDS      2000000ULL
+#define STRESS_READERS      4
+
+static WINMSR_SAMPLE_RECORD MakeRecord(ULONG64 Position)
+{
+    WINMSR_SAMPLE_RECORD record;
+
+    record.Time = Position + 1;
+    record.Cpu = (ULONG)(Position * 2654435761ULL);
+    record.Temperature = (LONG)(Position % 100);
+    record.ThermStatus = ~(ULONG)Position;
+    record.FireDelay = (ULONG)(Position >> 3) ^ 0x5A5A5A5A;
+    return record;
+}
+
+static BOOLEAN RecordIntact(const WINMSR_SAMPLE_RECORD* Record)
+{
+    WINMSR_SAMPLE_RECORD expected = MakeRecord(Record->Time - 1);
+
+    return Record->Time != 0 && memcmp(Record, &expected, sizeof(expected)) == 0;
+}
+
+// A read moves the cursor past every position it returned or lost, returns
+// intact records in position order and nothing outside [before, after)
+static void CheckRead(ULONG64 Before, ULONG64 After, const WINMSR_SAMPLE_RECORD* Records, ULONG Count,
+                      ULONG64 Lost, ULONG64* Torn, ULONG64* Misordered)
+{
+    ULONG64 previous = Before;
+
+    CHECK(After - Before == Count + Lost);
+    for (ULONG i = 0; i < Count; i++) {
+        ULONG64 position = Records[i].Time - 1;
+        if (!RecordIntact(&Records[i])) {
+            (*Torn)++;
+            continue;
+        }
+        if (position < previous || position >= After) {
+            (*Misordered)++;
+        }
+        previous = position + 1;
+    }
+}
+
+static void TestSingleThreaded(void)
+{
+    static SAMPLE_RING ring;
+    static WINMSR_SAMPLE_RECORD records[RING_CAPACITY];
+    ULONG64 cursor = 0;
+    ULONG64 lost;
+    ULONG64 torn = 0;
+    ULONG64 misordered = 0;
+
+    RingInit(&ring);
+    CHECK(RingRead(&ring, &cursor, records, RING_CAPACITY, &lost) == 0);
+    CHECK(cursor == 0 && lost == 0);
+
+    // Partial reads in order, no loss
+    for (ULONG64 p = 0; p < 100; p++) {
+        WINMSR_SAMPLE_RECORD record = MakeRecord(p);
+        RingPublish(&ring, &record);
+    }
+    CHECK(RingRead(&ring, &cursor, records, 60, &lost) == 60);
+    CHECK(cursor == 60 && lost == 0 && records[0].Time == 1 && records[59].Time == 60);
+    CHECK(RingRead(&ring, &cursor, records, RING_CAPACITY, &lost) == 40);
+    CHECK(cursor == 100 && lost == 0 && records[39].Time == 100);
+
+    // Lapped reader: skips to the oldest retained record and reports the gap
+    for (ULONG64 p = 100; p < 3000; p++) {
+        WINMSR_SAMPLE_RECORD record = MakeRecord(p);
+        RingPublish(&ring, &record);
+    }
+    ULONG64 before = cursor;
+    ULONG count = RingRead(&ring, &cursor, records, RING_CAPACITY, &lost);
+    CHECK(count == RING_CAPACITY);
+    CHECK(lost == 3000 - RING_CAPACITY - 100);
+    CHECK(records[0].Time == 3000 - RING_CAPACITY + 1);
+    CHECK(cursor == 3000);
+    CheckRead(before, cursor, records, count, lost, &torn, &misordered);
+    CHECK(torn == 0 && misordered == 0);
+
+    // A new handle starts at the oldest retained record
+    ULONG64 fresh = 0;
+    count = RingRead(&ring, &fresh, records, RING_CAPACITY, &lost);
+    CHECK(count == RING_CAPACITY && lost == 3000 - RING_CAPACITY && fresh == 3000);
+}
+
+// The producer caught between clearing a slot's stamp and restamping it: the
+// slot's record is half old, half new and must be skipped as lost, as must
+// a slot that is restamped before Head moves
+static void TestRewrite(void)
+{
+    static SAMPLE_RING ring;
+    static WINMSR_SAMPLE_RECORD records[RING_CAPACITY];
+    ULONG64 torn = 0;
+    ULONG64 misordered = 0;
+    ULONG64 lost;
+
+    RingInit(&ring);
+    for (ULONG64 p = 0; p < 2000; p++) {
+        WINMSR_SAMPLE_RECORD record = MakeRecord(p);
+        RingPublish(&ring, &record);
+    }
+
+    ULONG64 oldest = 2000 - RING_CAPACITY;
+    PRING_SLOT slot = &ring.Slots[oldest & RING_MASK];
+    WINMSR_SAMPLE_RECORD next = MakeRecord(2000);
+    slot->Stamp = 0;
+    slot->Record.Time = next.Time;
+    slot->Record.Cpu = next.Cpu;
+
+    ULONG64 cursor = oldest;
+    ULONG count = RingRead(&ring, &cursor, records, RING_CAPACITY, &lost);
+    CHECK(count == RING_CAPACITY - 1 && lost == 1 && cursor == 2000);
+    CHECK(records[0].Time == oldest + 2);
+    CheckRead(oldest, cursor, records, count, lost, &torn, &misordered);
+    CHECK(torn == 0 && misordered == 0);
+
+    slot->Record = next;
+    slot->Stamp = 2001;
+    cursor = oldest;
+    count = RingRead(&ring, &cursor, records, RING_CAPACITY, &lost);
+    CHECK(count == RING_CAPACITY - 1 && lost == 1 && cursor == 2000);
+    CheckRead(oldest, cursor, records, count, lost, &torn, &misordered);
+    CHECK(torn == 0 && misordered == 0);
+}
+
+typedef struct _READER {
+    PSAMPLE_RING Ring;
+    volatile LONG* Done;
+    ULONG64 Seed;
+    ULONG64 Received;
+    ULONG64 Lost;
+    ULONG64 Torn;
+    ULONG64 Misordered;
+    ULONG64 Cursor;
+    WINMSR_SAMPLE_RECORD Records[RING_CAPACITY];
+} READER;
+
+static void ReaderThread(void* Context)
+{
+    READER* reader = (READER*)Context;
+    PWINMSR_SAMPLE_RECORD records = reader->Records;
+
+    for (;;) {
+        BOOLEAN done = ReadAcquire(reader->Done) != 0;
+        ULONG max = (ULONG)TestRange(&reader->Seed, 1, RING_CAPACITY);
+        ULONG64 before = reader->Cursor;
+        ULONG64 lost;
+        ULONG count = RingRead(reader->Ring, &reader->Cursor, records, max, &lost);
+
+        CheckRead(before, reader->Cursor, records, count, lost, &reader->Torn, &reader->Misordered);
+        reader->Received += count;
+        reader->Lost += lost;
+
+        if (done && reader->Cursor == RingHead(reader->Ring)) {
+            break;
+        }
+        // Some readers fall behind on purpose
+        if (TestRange(&reader->Seed, 0, 15) == 0) {
+            TestYield();
+        }
+    }
+}
+
+static void TestStress(void)
+{
+    static SAMPLE_RING ring;
+    static READER readers[STRESS_READERS];
+    TEST_THREAD threads[STRESS_READERS];
+    volatile LONG done = 0;
+    ULONG64 totalLost = 0;
+
+    RingInit(&ring);
+    for (ULONG i = 0; i < STRESS_READERS; i++) {
+        readers[i].Ring = &ring;
+        readers[i].Done = &done;
+        readers[i].Seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        TestThreadStart(&threads[i], ReaderThread, &readers[i]);
+    }
+
+    ULONG64 seed = 42;
+    for (ULONG64 p = 0; p < STRESS_RECORDS; p++) {
+        WINMSR_SAMPLE_RECORD record = MakeRecord(p);
+        RingPublish(&ring, &record);
+        if (TestRange(&seed, 0, 4095) == 0) {
+            TestYield();
+        }
+    }
+    WriteRelease(&done, 1);
+
+    for (ULONG i = 0; i < STRESS_READERS; i++) {
+        TestThreadJoin(threads[i]);
+        READER* reader = &readers[i];
+        printf("  reader %u: %llu received, %llu lost\n", (unsigned)i,
+               (unsigned long long)reader->Received, (unsigned long long)reader->Lost);
+        CHECK(reader->Torn == 0);
+        CHECK(reader->Misordered == 0);
+        CHECK(reader->Cursor == STRESS_RECORDS);
+        CHECK(reader->Received + reader->Lost == STRESS_RECORDS);
+        totalLost += reader->Lost;
+    }
+    // The producer never waits, so somebody must have been lapped
+    CHECK(totalLost > 0);
+}
+
+int main(void)
+{
+    TestSingleThreaded();
+    TestRewrite();
+    TestStress();
+    return TestResult("ring_test");
+}
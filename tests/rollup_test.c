@@ -0,0 +1,261 @@
+#include "test.h"
+#include "rollup.h"
+
+//
+// Rollup tiers against a brute-force recomputation from the raw samples.
+// Streams mix dense stretches, gaps of several 1 h buckets and samples that
+// arrive out of order (which must be dropped), and call RollupAdvance at
+// random moments as for a CPU that stopped sampling. After each advance every
+// tier must have closed exactly the buckets that end by then, each equal to
+// the bucket recomputed from the samples, and RollupRead must return the
+// kept ones (the rings wrap) for any range.
+//
+
+#define MAX_SAMPLES     40000
+#define MAX_BUCKETS     MAX_SAMPLES
+
+typedef struct _KEPT_SAMPLE {
+    ROLLUP_SAMPLE Sample;
+    ULONG64 Cover;
+} KEPT_SAMPLE;
+
+static ROLLUP_SERIES Series;
+static KEPT_SAMPLE Accepted[MAX_SAMPLES];
+static ULONG AcceptedCount;
+static ULONG64 BruteLastTime;
+static ULONG64 BruteClosedIndex;        // last 1 s bucket closed by an advance, plus one
+static ROLLUP_BUCKET Expected[MAX_BUCKETS];
+static ROLLUP_BUCKET Read[ROLLUP_KEEP_1M];
+
+static ULONG Keep(ULONG Tier)
+{
+    static const ULONG keep[ROLLUP_TIERS] = { ROLLUP_KEEP_1S, ROLLUP_KEEP_10S, ROLLUP_KEEP_1M, ROLLUP_KEEP_1H };
+    return keep[Tier];
+}
+
+// Every non-empty bucket of Tier over the accepted samples, in order
+static ULONG Recompute(ULONG Tier)
+{
+    ULONG64 length = RollupLength(Tier);
+    ULONG count = 0;
+
+    for (ULONG i = 0; i < AcceptedCount; i++) {
+        const ROLLUP_SAMPLE* sample = &Accepted[i].Sample;
+        ULONG64 index = sample->Time / length;
+        if (count == 0 || Expected[count - 1].Index != index) {
+            RollupBucketReset(&Expected[count++], index);
+        }
+
+        PROLLUP_BUCKET bucket = &Expected[count - 1];
+        bucket->Samples++;
+        if (sample->Temperature >= 0) {
+            bucket->ValidSamples++;
+            bucket->MinTemperature = min(bucket->MinTemperature, sample->Temperature);
+            bucket->MaxTemperature = max(bucket->MaxTemperature, sample->Temperature);
+            bucket->SumTemperature += sample->Temperature;
+        }
+        bucket->CoveredTime += Accepted[i].Cover;
+        bucket->ThrottleTime += sample->Throttled ? Accepted[i].Cover : 0;
+        bucket->Energy += sample->Energy;
+    }
+    return count;
+}
+
+static BOOLEAN SameBucket(const ROLLUP_BUCKET* A, const ROLLUP_BUCKET* B)
+{
+    return A->Index == B->Index && A->Samples == B->Samples && A->ValidSamples == B->ValidSamples &&
+           A->MinTemperature == B->MinTemperature && A->MaxTemperature == B->MaxTemperature &&
+           A->SumTemperature == B->SumTemperature && A->CoveredTime == B->CoveredTime &&
+           A->ThrottleTime == B->ThrottleTime && A->Energy == B->Energy;
+}
+
+static void Add(const ROLLUP_SAMPLE* Sample)
+{
+    BOOLEAN accepted = RollupAdd(&Series, Sample);
+
+    CHECK(accepted == (Sample->Time >= BruteLastTime && Sample->Time / ROLLUP_LENGTH_1S >= BruteClosedIndex));
+    if (!accepted || AcceptedCount == MAX_SAMPLES) {
+        return;
+    }
+    ULONG64 cover = (BruteLastTime != 0) ? Sample->Time - BruteLastTime : 0;
+    Accepted[AcceptedCount].Sample = *Sample;
+    Accepted[AcceptedCount].Cover = min(cover, ROLLUP_MAX_COVER);
+    AcceptedCount++;
+    BruteLastTime = Sample->Time;
+}
+
+// After RollupAdvance(Now), Now at or after the last sample: every bucket
+// that ends by Now is closed and equals its recomputation; RollupRead
+// returns the kept ones for the whole range and for random ranges
+static void Check(ULONG64 Now, ULONG64* Seed)
+{
+    if (AcceptedCount != 0 && (BruteLastTime / ROLLUP_LENGTH_1S + 1) * ROLLUP_LENGTH_1S <= Now) {
+        BruteClosedIndex = BruteLastTime / ROLLUP_LENGTH_1S + 1;
+    }
+    for (ULONG t = 0; t < ROLLUP_TIERS; t++) {
+        const ROLLUP_TIER* tier = &Series.Tier[t];
+        ULONG64 length = RollupLength(t);
+        ULONG n = Recompute(t);
+        ULONG closed = n;
+
+        if (n != 0 && (Expected[n - 1].Index + 1) * length > Now) {
+            closed--;
+            CHECK(tier->Open.Samples == 0 || tier->Open.Index == Expected[n - 1].Index);
+        }
+        else {
+            CHECK(tier->Open.Samples == 0);
+        }
+        CHECK(tier->Closed == closed);
+
+        ULONG kept = min(closed, Keep(t));
+        ULONG count = RollupRead(&Series, t, 0, MAXULONG64, Read, Keep(t));
+        CHECK(count == kept);
+        for (ULONG i = 0; i < count && i < kept; i++) {
+            CHECK(SameBucket(&Read[i], &Expected[closed - kept + i]));
+        }
+
+        // A random range and capacity
+        if (kept == 0) {
+            continue;
+        }
+        ULONG64 first = Expected[closed - kept].Index * length;
+        ULONG64 last = Expected[closed - 1].Index * length;
+        ULONG64 from = first - min(first, length) + (ULONG64)TestRange(Seed, 0, (LONG64)(last - first + 2 * length));
+        ULONG64 to = from + (ULONG64)TestRange(Seed, 0, (LONG64)(last - first + length));
+        ULONG capacity = (ULONG)TestRange(Seed, 1, Keep(t));
+        ULONG expected = 0;
+        ULONG start = closed;
+        for (ULONG i = closed - kept; i < closed; i++) {
+            ULONG64 begin = Expected[i].Index * length;
+            if (begin >= from && begin < to) {
+                start = min(start, i);
+                expected++;
+            }
+        }
+        expected = min(expected, capacity);
+        count = RollupRead(&Series, t, from, to, Read, capacity);
+        CHECK(count == expected);
+        for (ULONG i = 0; i < count && i < expected; i++) {
+            CHECK(SameBucket(&Read[i], &Expected[start + i]));
+        }
+    }
+}
+
+static void TestStream(ULONG64* Seed)
+{
+    ULONG64 time = (ULONG64)TestRange(Seed, 1, (LONG64)ROLLUP_LENGTH_1H);
+    ULONG count = (ULONG)TestRange(Seed, 1000, MAX_SAMPLES);
+    ULONG mode = 0;
+
+    RollupInit(&Series);
+    AcceptedCount = 0;
+    BruteLastTime = 0;
+    BruteClosedIndex = 0;
+
+    for (ULONG i = 0; i < count; i++) {
+        ROLLUP_SAMPLE sample;
+
+        if (TestRange(Seed, 0, 499) == 0) {
+            mode = (ULONG)TestRange(Seed, 0, 3);
+        }
+        switch (mode) {
+        case 0:     // dense, several per 1 s bucket
+            time += (ULONG64)TestRange(Seed, 0, (LONG64)ROLLUP_LENGTH_1S / 4);
+            break;
+        case 1:     // sparse, longer than ROLLUP_MAX_COVER apart
+            time += (ULONG64)TestRange(Seed, 0, 3 * (LONG64)ROLLUP_LENGTH_10S);
+            break;
+        case 2:     // on bucket boundaries
+            time = (time / ROLLUP_LENGTH_1S + (ULONG64)TestRange(Seed, 1, 90)) * ROLLUP_LENGTH_1S;
+            break;
+        default:    // gaps of whole hours
+            time += (ULONG64)TestRange(Seed, 1, 5) * ROLLUP_LENGTH_1H + (ULONG64)TestRange(Seed, 0, 99);
+            break;
+        }
+
+        sample.Time = time;
+        sample.Temperature = (TestRange(Seed, 0, 9) == 0) ? -1 : (LONG)TestRange(Seed, 20, 105);
+        sample.Throttled = TestRange(Seed, 0, 7) == 0;
+        sample.Energy = (ULONG64)TestRange(Seed, 0, 50000000);
+
+        // Now and then a sample from the past, which must be dropped
+        if (BruteLastTime > 1 && TestRange(Seed, 0, 49) == 0) {
+            ROLLUP_SAMPLE stale = sample;
+            stale.Time = (ULONG64)TestRange(Seed, 1, (LONG64)BruteLastTime - 1);
+            Add(&stale);
+        }
+        Add(&sample);
+
+        // The CPU stalls for a while; the tiers are advanced without it
+        if (TestRange(Seed, 0, 999) == 0) {
+            ULONG64 now = time + (ULONG64)TestRange(Seed, 0, 3 * (LONG64)ROLLUP_LENGTH_1H);
+            RollupAdvance(&Series, now);
+            Check(now, Seed);
+
+            // Samples it missed arrive late, in buckets already closed
+            if (TestRange(Seed, 0, 1) == 0) {
+                ROLLUP_SAMPLE late = sample;
+                ULONG64 end = (time / ROLLUP_LENGTH_1S + 1) * ROLLUP_LENGTH_1S;
+                if (TestRange(Seed, 0, 1) == 0) {
+                    late.Time = end - 1 - (ULONG64)TestRange(Seed, 0, (LONG64)(end - 1 - time));
+                }
+                else {
+                    late.Time = now - (ULONG64)TestRange(Seed, 0, (LONG64)min(now - time, ROLLUP_LENGTH_1S));
+                }
+                Add(&late);
+            }
+            time = max(now, BruteLastTime);
+        }
+    }
+
+    // Everything closes eventually
+    RollupAdvance(&Series, MAXULONG64 / 2);
+    Check(MAXULONG64 / 2, Seed);
+    for (ULONG t = 0; t < ROLLUP_TIERS; t++) {
+        CHECK(Series.Tier[t].Closed == Recompute(t));
+    }
+}
+
+// A bucket that spans the whole sample history still reads as one bucket,
+// and an advance before the end of the open bucket closes nothing
+static void TestEdges(void)
+{
+    ROLLUP_SAMPLE sample = { 0 };
+    ROLLUP_BUCKET bucket = { 0 };
+
+    RollupInit(&Series);
+    sample.Time = 5 * ROLLUP_LENGTH_1S + 1;
+    sample.Temperature = 50;
+    CHECK(RollupAdd(&Series, &sample));
+    RollupAdvance(&Series, 6 * ROLLUP_LENGTH_1S - 1);
+    CHECK(Series.Tier[0].Closed == 0 && Series.Tier[0].Open.Samples == 1);
+    RollupAdvance(&Series, 6 * ROLLUP_LENGTH_1S);
+    CHECK(Series.Tier[0].Closed == 1 && Series.Tier[0].Open.Samples == 0);
+    CHECK(Series.Tier[1].Closed == 0 && Series.Tier[1].Open.Samples == 1);
+
+    // Its bucket was closed by the advance: a late sample for it is dropped
+    CHECK(!RollupAdd(&Series, &sample));
+    sample.Time = 6 * ROLLUP_LENGTH_1S;
+    CHECK(RollupAdd(&Series, &sample));
+
+    // Same time as the previous sample is in order; earlier is not
+    CHECK(RollupAdd(&Series, &sample));
+    sample.Time--;
+    CHECK(!RollupAdd(&Series, &sample));
+
+    RollupAdvance(&Series, ROLLUP_LENGTH_1H);
+    CHECK(RollupRead(&Series, 3, 0, MAXULONG64, &bucket, 1) == 1);
+    CHECK(bucket.Index == 0 && bucket.Samples == 3 && bucket.SumTemperature == 150);
+    CHECK(RollupRead(&Series, 3, 1, MAXULONG64, &bucket, 1) == 0);
+}
+
+int main(void)
+{
+    ULONG64 seed = 47;
+
+    TestEdges();
+    for (ULONG stream = 0; stream < 12; stream++) {
+        TestStream(&seed);
+    }
+    return TestResult("rollup_test");
+}
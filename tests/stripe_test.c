@@ -0,0 +1,224 @@
+#include "test.h"
+#include "stripe.h"
+
+//
+// The striped schedule, iterated tick by tick the way the samplers in
+// driver.c follow it: each CPU fires on its stripe's ticks, moves onto every
+// tick while hot and the promotion budget lasts, and re-arms onto the next
+// tick of its new stride. For several CPU counts and stripe counts, every
+// CPU must fire at least once per period (exactly once while on its stripe)
+// and no tick may fire more than ceil(CPUs / Stripes) + budget CPUs.
+//
+
+#define MAX_CPUS        257
+#define TICKS           20000
+#define TJMAX           100
+#define MARGIN_C        5
+
+typedef struct _SIM_CPU {
+    ULONG64 Next;               // next tick it fires on
+    ULONG64 Last;               // last tick it fired on
+    ULONG Stride;
+    BOOLEAN Promoted;
+    BOOLEAN Steady;             // Next is one full stripe stride after Last
+    BOOLEAN Fired;
+    int Temperature;
+} SIM_CPU;
+
+static void TestSchedule(ULONG Cpus, ULONG Stripes, LONG MaxPromoted, ULONG64* Seed)
+{
+    static SIM_CPU cpus[MAX_CPUS];
+    volatile LONG promotedCount = 0;
+    ULONG bound = (Cpus + Stripes - 1) / Stripes + (ULONG)MaxPromoted;
+    ULONG64 promotions = 0;
+
+    for (ULONG i = 0; i < Cpus; i++) {
+        cpus[i].Stride = Stripes;
+        cpus[i].Next = StripeNextTick(0, Stripes, StripeOf(i, Stripes));
+        cpus[i].Promoted = FALSE;
+        cpus[i].Steady = FALSE;
+        cpus[i].Fired = FALSE;
+        // A few CPUs run hot, most stay well below the margin
+        cpus[i].Temperature = (TestRange(Seed, 0, 7) == 0) ? TJMAX - MARGIN_C : TJMAX - 40;
+    }
+
+    for (ULONG64 tick = 0; tick < TICKS; tick++) {
+        ULONG fires = 0;
+
+        for (ULONG i = 0; i < Cpus; i++) {
+            SIM_CPU* cpu = &cpus[i];
+            if (cpu->Next != tick) {
+                CHECK(cpu->Next > tick);
+                continue;
+            }
+            fires++;
+
+            // At least once per period; exactly once while on the stripe
+            if (cpu->Fired) {
+                ULONG64 gap = tick - cpu->Last;
+                CHECK(gap >= 1 && gap <= Stripes);
+                if (cpu->Steady) {
+                    CHECK(gap == Stripes);
+                }
+            }
+            else {
+                CHECK(tick < Stripes);
+            }
+            cpu->Fired = TRUE;
+            cpu->Last = tick;
+
+            // Temperatures wander around the threshold; now and then an alarm
+            cpu->Temperature += (int)TestRange(Seed, -2, 2);
+            cpu->Temperature = min(max(cpu->Temperature, TJMAX - 45), TJMAX);
+            BOOLEAN alarm = TestRange(Seed, 0, 999) == 0;
+            BOOLEAN invalid = TestRange(Seed, 0, 99) == 0;
+
+            ULONG newStride = cpu->Stride;
+            if (Stripes > 1) {
+                BOOLEAN hot = StripeWantsPromotion(invalid ? -1 : cpu->Temperature, TJMAX, alarm, MARGIN_C,
+                                                   cpu->Promoted);
+                if (hot && !cpu->Promoted && StripePromote(&promotedCount, MaxPromoted)) {
+                    cpu->Promoted = TRUE;
+                    promotions++;
+                }
+                else if (!hot && cpu->Promoted) {
+                    StripeDemote(&promotedCount);
+                    cpu->Promoted = FALSE;
+                }
+                newStride = cpu->Promoted ? 1 : Stripes;
+            }
+            CHECK(promotedCount >= 0 && promotedCount <= MaxPromoted);
+
+            // Re-arm as ArmCoreTimer does: the first tick of the new stride
+            // after this one
+            if (newStride != cpu->Stride) {
+                cpu->Stride = newStride;
+                cpu->Next = StripeNextTick(tick + 1, newStride, StripeOf(i, Stripes));
+                cpu->Steady = FALSE;
+            }
+            else {
+                cpu->Next = tick + cpu->Stride;
+                cpu->Steady = cpu->Stride == Stripes;
+            }
+        }
+
+        CHECK(fires <= bound);
+    }
+
+    for (ULONG i = 0; i < Cpus; i++) {
+        CHECK(cpus[i].Fired);
+    }
+    // The hot CPUs did get promoted wherever there are stripes to leave
+    CHECK(Stripes == 1 || promotions > 0);
+}
+
+// The threshold moves down by the hysteresis once promoted, so a reading
+// that wobbles around it does not flap between strides
+static void TestHysteresis(void)
+{
+    int threshold = TJMAX - MARGIN_C;
+
+    CHECK(StripeWantsPromotion(threshold, TJMAX, FALSE, MARGIN_C, FALSE));
+    CHECK(!StripeWantsPromotion(threshold - 1, TJMAX, FALSE, MARGIN_C, FALSE));
+    for (int t = threshold - STRIPE_HYSTERESIS_C; t <= threshold; t++) {
+        CHECK(StripeWantsPromotion(t, TJMAX, FALSE, MARGIN_C, TRUE));
+    }
+    CHECK(!StripeWantsPromotion(threshold - STRIPE_HYSTERESIS_C - 1, TJMAX, FALSE, MARGIN_C, TRUE));
+
+    // Alarms promote regardless; invalid readings never do
+    CHECK(StripeWantsPromotion(0, TJMAX, TRUE, MARGIN_C, FALSE));
+    CHECK(!StripeWantsPromotion(-1, TJMAX, FALSE, 0, FALSE));
+    CHECK(!StripeWantsPromotion(-1, TJMAX, FALSE, 0, TRUE));
+
+    // A reading oscillating by one degree around the threshold promotes once
+    BOOLEAN promoted = FALSE;
+    ULONG changes = 0;
+    for (ULONG i = 0; i < 100; i++) {
+        int t = threshold - (int)(i & 1);
+        BOOLEAN hot = StripeWantsPromotion(t, TJMAX, FALSE, MARGIN_C, promoted);
+        changes += (hot != promoted);
+        promoted = hot;
+    }
+    CHECK(promoted && changes == 1);
+}
+
+// Stripe arithmetic: every stripe's ticks are one stride apart, and a
+// stride of 1 fires on every tick
+static void TestNextTick(void)
+{
+    for (ULONG stride = 1; stride <= 16; stride++) {
+        for (ULONG stripe = 0; stripe < stride; stripe++) {
+            for (ULONG64 tick = 0; tick < 3 * stride; tick++) {
+                ULONG64 next = StripeNextTick(tick, stride, stripe);
+                CHECK(next >= tick && next < tick + stride);
+                CHECK(next % stride == stripe);
+            }
+        }
+    }
+    CHECK(StripeOf(5, 1) == 0 && StripeOf(5, 0) == 0 && StripeOf(5, 3) == 2);
+}
+
+typedef struct _RACER {
+    volatile LONG* Count;
+    LONG Max;
+    ULONG64 Seed;
+    LONG Seen;                  // largest count observed while holding a slot
+} RACER;
+
+static void Racer(void* Context)
+{
+    RACER* racer = (RACER*)Context;
+
+    for (ULONG i = 0; i < 200000; i++) {
+        if (StripePromote(racer->Count, racer->Max)) {
+            racer->Seen = max(racer->Seen, ReadAcquire(racer->Count));
+            if (TestRange(&racer->Seed, 0, 15) == 0) {
+                TestYield();
+            }
+            StripeDemote(racer->Count);
+        }
+    }
+}
+
+// The budget holds while samplers on several CPUs promote at once
+static void TestBudgetRace(void)
+{
+    static RACER racers[4];
+    TEST_THREAD threads[4];
+    volatile LONG count = 0;
+    LONG seen = 0;
+
+    for (ULONG i = 0; i < 4; i++) {
+        racers[i].Count = &count;
+        racers[i].Max = 2;
+        racers[i].Seed = i + 1;
+        TestThreadStart(&threads[i], Racer, &racers[i]);
+    }
+    for (ULONG i = 0; i < 4; i++) {
+        TestThreadJoin(threads[i]);
+        CHECK(racers[i].Seen <= 2);
+        seen = max(seen, racers[i].Seen);
+    }
+    CHECK(seen == 2 && count == 0);
+}
+
+int main(void)
+{
+    static const ULONG cpuCounts[] = { 1, 2, 7, 16, 64, 257 };
+    static const ULONG stripeCounts[] = { 1, 2, 3, 4, 8, 16 };
+    ULONG64 seed = 39;
+
+    TestHysteresis();
+    TestNextTick();
+    for (ULONG c = 0; c < sizeof(cpuCounts) / sizeof(cpuCounts[0]); c++) {
+        for (ULONG s = 0; s < sizeof(stripeCounts) / sizeof(stripeCounts[0]); s++) {
+            ULONG cpus = cpuCounts[c];
+            ULONG stripes = stripeCounts[s];
+            // The driver's default budget, and a tight one
+            TestSchedule(cpus, stripes, (LONG)max(cpus / stripes, 1), &seed);
+            TestSchedule(cpus, stripes, 1, &seed);
+        }
+    }
+    TestBudgetRace();
+    return TestResult("stripe_test");
+}
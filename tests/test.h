@@ -0,0 +1,127 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// Minimal support for the user-mode tests: checks that count failures
+// instead of stopping, a deterministic random source and threads.
+//
+
+static int TestFailures = 0;
+
+#define CHECK(Condition)                                                    \
+    do {                                                                    \
+        if (!(Condition)) {                                                 \
+            if (TestFailures++ < 20) {                                      \
+                printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #Condition); \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+// Prints the outcome; the return value is the process exit code
+static inline int TestResult(const char* Name)
+{
+    if (TestFailures != 0) {
+        printf("%s: %d checks failed\n", Name, TestFailures);
+        return 1;
+    }
+    printf("%s: passed\n", Name);
+    return 0;
+}
+
+// xorshift64*, so every run sees the same streams
+static inline ULONG64 TestRandom(ULONG64* State)
+{
+    ULONG64 x = *State;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *State = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in [Low, High]
+static inline LONG64 TestRange(ULONG64* State, LONG64 Low, LONG64 High)
+{
+    return Low + (LONG64)(TestRandom(State) % (ULONG64)(High - Low + 1));
+}
+
+typedef void (*TEST_THREAD_ROUTINE)(void* Context);
+
+#ifdef _WIN32
+typedef HANDLE TEST_THREAD;
+
+typedef struct _TEST_THREAD_START {
+    TEST_THREAD_ROUTINE Routine;
+    void* Context;
+} TEST_THREAD_START;
+
+static inline DWORD WINAPI TestThreadTrampoline(LPVOID Parameter)
+{
+    TEST_THREAD_START start = *(TEST_THREAD_START*)Parameter;
+    free(Parameter);
+    start.Routine(start.Context);
+    return 0;
+}
+
+static inline void TestThreadStart(TEST_THREAD* Thread, TEST_THREAD_ROUTINE Routine, void* Context)
+{
+    TEST_THREAD_START* start = (TEST_THREAD_START*)malloc(sizeof(*start));
+    start->Routine = Routine;
+    start->Context = Context;
+    *Thread = CreateThread(NULL, 0, TestThreadTrampoline, start, 0, NULL);
+}
+
+static inline void TestThreadJoin(TEST_THREAD Thread)
+{
+    WaitForSingleObject(Thread, INFINITE);
+    CloseHandle(Thread);
+}
+
+static inline void TestYield(void)
+{
+    SwitchToThread();
+}
+#else
+typedef pthread_t TEST_THREAD;
+
+typedef struct _TEST_THREAD_START {
+    TEST_THREAD_ROUTINE Routine;
+    void* Context;
+} TEST_THREAD_START;
+
+static inline void* TestThreadTrampoline(void* Parameter)
+{
+    TEST_THREAD_START start = *(TEST_THREAD_START*)Parameter;
+    free(Parameter);
+    start.Routine(start.Context);
+    return NULL;
+}
+
+static inline void TestThreadStart(TEST_THREAD* Thread, TEST_THREAD_ROUTINE Routine, void* Context)
+{
+    TEST_THREAD_START* start = (TEST_THREAD_START*)malloc(sizeof(*start));
+    start->Routine = Routine;
+    start->Context = Context;
+    pthread_create(Thread, NULL, TestThreadTrampoline, start);
+}
+
+static inline void TestThreadJoin(TEST_THREAD Thread)
+{
+    pthread_join(Thread, NULL);
+}
+
+static inline void TestYield(void)
+{
+    sched_yield();
+}
+#endif
@@ -0,0 +1,143 @@
+#include "test.h"
+#include "thermstatus.h"
+
+//
+// ThermLogClearValue against a simulated IA32_THERM_STATUS. The fake
+// register keeps the state bits and the sticky log bits as hardware does:
+// an event sets its log bit, a write of 0 to a log bit clears it, a write of
+// 1 leaves it alone, and writing 1 to any bit outside the writable log bits
+// faults. Random events land before the read and between the read and the
+// write of each sample, as on a real CPU.
+//
+
+#define SAMPLES     200000
+
+typedef struct _FAKE_THERM_STATUS {
+    ULONG64 Value;
+    ULONG64 Writable;           // log bits this CPU implements
+    ULONG64 Faults;             // writes that would #GP
+    ULONG64 Unseen;             // log bits set by events no read has observed yet
+} FAKE_THERM_STATUS;
+
+// Event on the state bit under Log: the state follows, the log bit latches
+static void FakeEvent(FAKE_THERM_STATUS* Msr, ULONG64 Log, BOOLEAN Asserted)
+{
+    ULONG64 state = Log >> 1;
+
+    Msr->Value = Asserted ? (Msr->Value | state) : (Msr->Value & ~state);
+    Msr->Value |= Log;
+    Msr->Unseen |= Log;
+}
+
+static ULONG BitCount(ULONG64 Value)
+{
+    ULONG n = 0;
+
+    for (; Value != 0; Value &= Value - 1) {
+        n++;
+    }
+    return n;
+}
+
+static ULONG64 FakeRead(FAKE_THERM_STATUS* Msr)
+{
+    Msr->Unseen &= ~Msr->Value;
+    return Msr->Value;
+}
+
+static void FakeWrite(FAKE_THERM_STATUS* Msr, ULONG64 Value)
+{
+    if (Value & ~Msr->Writable) {
+        Msr->Faults++;
+        return;
+    }
+    Msr->Value &= ~(Msr->Writable & ~Value);
+}
+
+// Runs the sampler's read / clear sequence with random events and returns
+// how many events were lost, i.e. cleared before any read saw them
+static ULONG64 Run(ULONG64 Writable, ULONG64 (*ClearValue)(ULONG64, ULONG64), ULONG64* Faults, ULONG64* Counted)
+{
+    static const ULONG64 logs[] = { 0x2, 0x8, 0x20, 0x80, 0x200, 0x800 };
+    FAKE_THERM_STATUS msr = { 0x88000000ULL, Writable, 0, 0 };     // valid reading, some DTS
+    ULONG64 seed = Writable;
+    ULONG64 lost = 0;
+
+    *Counted = 0;
+    for (ULONG s = 0; s < SAMPLES; s++) {
+        if (TestRange(&seed, 0, 3) == 0) {
+            ULONG64 log = logs[TestRange(&seed, 0, 5)] & Writable;
+            if (log != 0) {
+                FakeEvent(&msr, log, (BOOLEAN)TestRange(&seed, 0, 1));
+            }
+        }
+
+        ULONG64 observed = FakeRead(&msr);
+        *Counted += BitCount(observed & Writable);
+
+        // An event between the read and the write, on a log bit that was clear
+        ULONG64 between = 0;
+        if (TestRange(&seed, 0, 3) == 0) {
+            between = logs[TestRange(&seed, 0, 5)] & Writable & ~observed;
+            if (between != 0) {
+                FakeEvent(&msr, between, (BOOLEAN)TestRange(&seed, 0, 1));
+            }
+        }
+
+        if (observed & Writable) {
+            FakeWrite(&msr, ClearValue(observed, Writable));
+        }
+        if (between != 0 && !(msr.Value & between)) {
+            lost++;
+        }
+        // Nothing an earlier read saw may be reported again
+        CHECK((msr.Value & Writable & ~msr.Unseen) == 0 || ClearValue != ThermLogClearValue);
+    }
+    *Faults = msr.Faults;
+    return lost;
+}
+
+// What a sampler that just zeroes the log bits it knows about would write
+static ULONG64 ClearAll(ULONG64 Observed, ULONG64 Writable)
+{
+    UNREFERENCED_PARAMETER(Observed);
+    UNREFERENCED_PARAMETER(Writable);
+    return 0;
+}
+
+// ... and one that writes back what it read with the log bits cleared
+static ULONG64 WriteBack(ULONG64 Observed, ULONG64 Writable)
+{
+    return Observed & ~Writable;
+}
+
+int main(void)
+{
+    ULONG64 faults;
+    ULONG64 counted;
+
+    // Field layout: DTS is bits 16..22, Resolution 27..30, ReadingValid 31
+    MSR_THERM_STATUS_UNION status = { 0x80000000ULL | (0x5ULL << 27) | (0x7FULL << 16) | 0x800000ULL | 0x8 };
+    CHECK(status.Fields.ReadingValid == 1 && status.Fields.DTS == 0x7F && status.Fields.Resolution == 5);
+    CHECK(status.Fields.PROCHOTLog == 1 && status.Fields.PROCHOT == 0 && status.Fields.Reserved2 == 1);
+    status.Value = 0x88000000ULL;
+    CHECK(status.Fields.ReadingValid == 1 && status.Fields.Resolution == 1 && status.Fields.DTS == 0);
+
+    // Examples from the header comment
+    CHECK(ThermLogClearValue(0x0A, THERM_STATUS_LOG_MASK) == (THERM_STATUS_LOG_MASK & ~0x0AULL));
+    CHECK(ThermLogClearValue(0x88000000ULL | 0x5, THERM_STATUS_LOG_MASK) == THERM_STATUS_LOG_MASK);
+    CHECK((ThermLogClearValue(MAXULONG64, THERM_STATUS_LOG_MASK | THERM_STATUS_POWER_LIMIT_LOG)) == 0);
+
+    // Without PLN, PowerLimitLog is reserved and must never be written as 1
+    CHECK(Run(THERM_STATUS_LOG_MASK, ThermLogClearValue, &faults, &counted) == 0);
+    CHECK(faults == 0 && counted > 0);
+    CHECK(Run(THERM_STATUS_LOG_MASK | THERM_STATUS_POWER_LIMIT_LOG, ThermLogClearValue, &faults, &counted) == 0);
+    CHECK(faults == 0 && counted > 0);
+
+    // The simulation tells the rule apart from the obvious alternatives
+    CHECK(Run(THERM_STATUS_LOG_MASK, ClearAll, &faults, &counted) > 0);
+    Run(THERM_STATUS_LOG_MASK, WriteBack, &faults, &counted);
+    CHECK(faults > 0);
+
+    return TestResult("thermstatus_test");
+}
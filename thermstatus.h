@@ -0,0 +1,74 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+
+//
+// Bit layout of IA32_THERM_STATUS and the rule for clearing its sticky log
+// bits. Portable, so user-mode code and the tests share it with the driver.
+//
+
+typedef union {
+    ULONG64 Value;
+    struct {
+        ULONG StatusBit : 1;
+        ULONG StatusLog : 1;
+        ULONG PROCHOT : 1;
+        ULONG PROCHOTLog : 1;
+        ULONG CriticalTemp : 1;
+        ULONG CriticalTempLog : 1;
+        ULONG Threshold1 : 1;
+        ULONG Threshold1Log : 1;
+        ULONG Threshold2 : 1;
+        ULONG Threshold2Log : 1;
+        ULONG PowerLimit : 1;
+        ULONG PowerLimitLog : 1;
+        ULONG Reserved1 : 4;
+        ULONG DTS : 7;
+        ULONG Reserved2 : 4;
+        ULONG Resolution : 4;
+        ULONG ReadingValid : 1;
+        ULONG Reserved3 : 32;
+    } Fields;
+} MSR_THERM_STATUS_UNION;
+
+C_ASSERT(sizeof(MSR_THERM_STATUS_UNION) == sizeof(ULONG64));
+
+// Current-state bits of IA32_THERM_STATUS: StatusBit, PROCHOT, CriticalTemp,
+// Threshold1, Threshold2, PowerLimit
+#define THERM_STATUS_STATE_MASK         0x555ULL
+#define THERM_STATUS_PROCHOT            0x4ULL
+#define THERM_STATUS_CRITICAL_TEMP      0x10ULL
+
+// Sticky log bits of IA32_THERM_STATUS: StatusLog, PROCHOTLog, CriticalTempLog,
+// Threshold1Log, Threshold2Log. Writing 0 clears a bit, writing 1 leaves it alone.
+#define THERM_STATUS_LOG_MASK           0x2AAULL
+#define THERM_STATUS_POWER_LIMIT_LOG    0x800ULL    // only with CPUID.06H:EAX[4] (PLN)
+
+// Value to write to IA32_THERM_STATUS after reading Observed: clears the log
+// bits that were seen and writes 1 to the others, so an event that lands
+// between the read and the write stays logged for the next sample. All
+// non-log bits are read-only or reserved and are written as 0.
+FORCEINLINE ULONG64 ThermLogClearValue(ULONG64 Observed, ULONG64 Writable)
+{
+    return Writable & ~Observed;
+}
+
+// State bits that were active at the read or, when the log bits are cleared
+// after every read, at any time since the previous one. Without clearing, a
+// log bit only says "since boot or the last clear" and is ignored.
+FORCEINLINE ULONG64 ThermStatusActive(ULONG64 Value, BOOLEAN LogsCleared)
+{
+    ULONG64 active = Value & THERM_STATUS_STATE_MASK;
+
+    if (LogsCleared) {
+        active |= (Value & (THERM_STATUS_LOG_MASK | THERM_STATUS_POWER_LIMIT_LOG)) >> 1;
+    }
+    return active;
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include "compat.h"
+#endif
+#include "public.h"
+
+//
+// Compact encoding of sample records for streaming to local tools
+// (IOCTL_WINMSR_READ_PACKED, or a collector relaying frames over a pipe).
+// A frame is a fixed header, an optional per-CPU table and a run of records:
+//
+//   varint   Cpu
+//   varint   zigzag(Time - previous record's Time), the first against BaseTime
+//   byte     DTS in bits 0..6; bit 7 set if an extension follows
+//   varint   extension: status bits 0..11 << 1 | 1 if the reading was invalid
+//
+// A quiet CPU sampled every 100 ms costs 5 bytes instead of 24. FireDelay is
+// not carried. Temperature is rebuilt from the table when the frame has one.
+// Portable and header-only; the decoder checks every length, so frames from
+// another process can be decoded as they come.
+//
+
+#define WIRE_FRAME_MAGIC        0x57534D57  // 'WMSW'
+#define WIRE_FRAME_VERSION      1
+
+// Frame flags
+#define WIRE_FRAME_CPU_TABLE    0x1     // TableCpus WIRE_CPU_INFO entries follow the header
+
+// Largest encoding of one record: 5 + 10 + 1 + 2 bytes
+#define WIRE_MAX_RECORD_BYTES   18
+
+#define WIRE_STATUS_MASK        ((1UL << WINMSR_THERM_STATUS_BITS) - 1)
+#define WIRE_DTS_SHIFT          16
+#define WIRE_DTS_MASK           0x7F
+#define WIRE_RESOLUTION_SHIFT   27
+#define WIRE_READING_VALID      0x80000000UL
+
+#pragma pack(push, 1)
+typedef struct _WIRE_FRAME_HEADER {
+    ULONG Magic;
+    UCHAR Version;
+    UCHAR Flags;                // WIRE_FRAME_*
+    USHORT TableCpus;           // entries in the CPU table, 0 without WIRE_FRAME_CPU_TABLE
+    ULONG Records;
+    ULONG PayloadBytes;         // table and records following the header
+    ULONG64 BaseTime;           // interrupt time, 100 ns units
+} WIRE_FRAME_HEADER, *PWIRE_FRAME_HEADER;
+
+// Table entry for one CPU, indexed by CPU; TjMax 0 if unknown
+typedef struct _WIRE_CPU_INFO {
+    UCHAR TjMax;
+    UCHAR DtsResolution;
+} WIRE_CPU_INFO, *PWIRE_CPU_INFO;
+#pragma pack(pop)
+
+typedef struct _WIRE_ENCODER {
+    PUCHAR Start;
+    PUCHAR Next;
+    PUCHAR End;
+    ULONG64 Previous;
+    ULONG Records;
+} WIRE_ENCODER, *PWIRE_ENCODER;
+
+typedef struct _WIRE_DECODER {
+    const UCHAR* Next;
+    const UCHAR* End;
+    const WIRE_CPU_INFO* Table;
+    ULONG TableCpus;
+    ULONG Remaining;            // records not decoded yet
+    ULONG64 Previous;
+} WIRE_DECODER, *PWIRE_DECODER;
+
+FORCEINLINE PUCHAR WirePutVarint(PUCHAR Out, ULONG64 Value)
+{
+    while (Value >= 0x80) {
+        *Out++ = (UCHAR)(Value | 0x80);
+        Value >>= 7;
+    }
+    *Out++ = (UCHAR)Value;
+    return Out;
+}
+
+// Reads one varint of at most 10 bytes; NULL if it runs past End
+FORCEINLINE const UCHAR* WireGetVarint(const UCHAR* In, const UCHAR* End, ULONG64* Value)
+{
+    ULONG64 value = 0;
+    for (ULONG shift = 0; shift < 70 && In < End; shift += 7) {
+        UCHAR b = *In++;
+        value |= (ULONG64)(b & 0x7F) << shift;
+        if (b < 0x80) {
+            *Value = value;
+            return In;
+        }
+    }
+    return NULL;
+}
+
+// Starts a frame at Buffer with room for a CPU table of TableCpus entries
+// (0 for none), zeroed for the caller to fill through WireEncodeTable. Fails
+// if Buffer cannot hold the header and the table.
+FORCEINLINE BOOLEAN WireEncodeBegin(_Out_ PWIRE_ENCODER Encoder, _Out_writes_bytes_(Size) PVOID Buffer, ULONG Size,
+                                    ULONG64 BaseTime, ULONG TableCpus)
+{
+    PWIRE_FRAME_HEADER header = (PWIRE_FRAME_HEADER)Buffer;
+
+    if (TableCpus > MAXUSHORT || Size < sizeof(*header) + TableCpus * sizeof(WIRE_CPU_INFO)) {
+        return FALSE;
+    }
+
+    header->Magic = WIRE_FRAME_MAGIC;
+    header->Version = WIRE_FRAME_VERSION;
+    header->Flags = (TableCpus != 0) ? WIRE_FRAME_CPU_TABLE : 0;
+    header->TableCpus = (USHORT)TableCpus;
+    header->Records = 0;
+    header->PayloadBytes = 0;
+    header->BaseTime = BaseTime;
+
+    PWIRE_CPU_INFO table = (PWIRE_CPU_INFO)(header + 1);
+    for (ULONG i = 0; i < TableCpus; i++) {
+        table[i].TjMax = 0;
+        table[i].DtsResolution = 0;
+    }
+
+    Encoder->Start = (PUCHAR)Buffer;
+    Encoder->Next = (PUCHAR)(table + TableCpus);
+    Encoder->End = (PUCHAR)Buffer + Size;
+    Encoder->Previous = BaseTime;
+    Encoder->Records = 0;
+    return TRUE;
+}
+
+FORCEINLINE PWIRE_CPU_INFO WireEncodeTable(_In_ const WIRE_ENCODER* Encoder)
+{
+    return (PWIRE_CPU_INFO)((PWIRE_FRAME_HEADER)Encoder->Start + 1);
+}
+
+// Appends one record; fails without writing once fewer than
+// WIRE_MAX_RECORD_BYTES remain
+FORCEINLINE BOOLEAN WireEncodeRecord(_Inout_ PWIRE_ENCODER Encoder, _In_ const WINMSR_SAMPLE_RECORD* Record)
+{
+    PUCHAR out = Encoder->Next;
+
+    if ((ULONG_PTR)(Encoder->End - out) < WIRE_MAX_RECORD_BYTES) {
+        return FALSE;
+    }
+
+    if (Record->Cpu < 0x80) {
+        *out++ = (UCHAR)Record->Cpu;
+    }
+    else {
+        out = WirePutVarint(out, Record->Cpu);
+    }
+
+    LONG64 delta = (LONG64)(Record->Time - Encoder->Previous);
+    out = WirePutVarint(out, ((ULONG64)delta << 1) ^ (ULONG64)(delta >> 63));
+    Encoder->Previous = Record->Time;
+
+    ULONG status = Record->ThermStatus;
+    ULONG extension = ((status & WIRE_STATUS_MASK) << 1) | ((status & WIRE_READING_VALID) ? 0 : 1);
+    UCHAR dts = (UCHAR)((status >> WIRE_DTS_SHIFT) & WIRE_DTS_MASK);
+    if (extension == 0) {
+        *out++ = dts;
+    }
+    else {
+        *out++ = dts | 0x80;
+        out = WirePutVarint(out, extension);
+    }
+
+    Encoder->Next = out;
+    Encoder->Records++;
+    return TRUE;
+}
+
+// Closes the frame and returns its size in bytes
+FORCEINLINE ULONG WireEncodeEnd(_Inout_ PWIRE_ENCODER Encoder)
+{
+    PWIRE_FRAME_HEADER header = (PWIRE_FRAME_HEADER)Encoder->Start;
+
+    header->Records = Encoder->Records;
+    header->PayloadBytes = (ULONG)(Encoder->Next - (Encoder->Start + sizeof(*header)));
+    return (ULONG)(Encoder->Next - Encoder->Start);
+}
+
+// Validates the frame at Buffer; Size may extend past it. Returns the frame
+// size in bytes (so the next frame starts there), 0 if the frame is malformed
+// or not complete yet.
+FORCEINLINE ULONG WireDecodeBegin(_Out_ PWIRE_DECODER Decoder, _In_reads_bytes_(Size) const VOID* Buffer, ULONG Size)
+{
+    const WIRE_FRAME_HEADER* header = (const WIRE_FRAME_HEADER*)Buffer;
+
+    if (Size < sizeof(*header) || header->Magic != WIRE_FRAME_MAGIC || header->Version != WIRE_FRAME_VERSION) {
+        return 0;
+    }
+    if (header->PayloadBytes > Size - sizeof(*header)) {
+        return 0;
+    }
+
+    ULONG tableCpus = (header->Flags & WIRE_FRAME_CPU_TABLE) ? header->TableCpus : 0;
+    if (tableCpus * sizeof(WIRE_CPU_INFO) > header->PayloadBytes) {
+        return 0;
+    }
+
+    Decoder->Table = (const WIRE_CPU_INFO*)(header + 1);
+    Decoder->TableCpus = tableCpus;
+    Decoder->Next = (const UCHAR*)(Decoder->Table + tableCpus);
+    Decoder->End = (const UCHAR*)(header + 1) + header->PayloadBytes;
+    Decoder->Remaining = header->Records;
+    Decoder->Previous = header->BaseTime;
+    return (ULONG)sizeof(*header) + header->PayloadBytes;
+}
+
+// Decodes the next record. FALSE at the end of the frame or if the frame is
+// truncated. ThermStatus carries the status bits, DTS, the table's resolution
+// and the valid bit; Temperature is -1 without a table entry.
+FORCEINLINE BOOLEAN WireDecodeRecord(_Inout_ PWIRE_DECODER Decoder, _Out_ PWINMSR_SAMPLE_RECORD Record)
+{
+    const UCHAR* in = Decoder->Next;
+    const UCHAR* end = Decoder->End;
+    ULONG64 cpu;
+    ULONG64 delta;
+    ULONG64 extension = 0;
+
+    if (Decoder->Remaining == 0) {
+        return FALSE;
+    }
+    in = WireGetVarint(in, end, &cpu);
+    if (in == NULL || cpu > MAXULONG) {
+        return FALSE;
+    }
+    in = WireGetVarint(in, end, &delta);
+    if (in == NULL || in >= end) {
+        return FALSE;
+    }
+    UCHAR thermal = *in++;
+    if (thermal & 0x80) {
+        in = WireGetVarint(in, end, &extension);
+        if (in == NULL) {
+            return FALSE;
+        }
+    }
+
+    Decoder->Previous += (ULONG64)((LONG64)(delta >> 1) ^ -(LONG64)(delta & 1));
+    Decoder->Next = in;
+    Decoder->Remaining--;
+
+    ULONG dts = thermal & WIRE_DTS_MASK;
+    BOOLEAN valid = (extension & 1) == 0;
+    ULONG status = ((ULONG)(extension >> 1) & WIRE_STATUS_MASK) | (dts << WIRE_DTS_SHIFT);
+
+    Record->Time = Decoder->Previous;
+    Record->Cpu = (ULONG)cpu;
+    Record->Temperature = -1;
+    Record->FireDelay = 0;
+    if (valid) {
+        status |= WIRE_READING_VALID;
+    }
+    if (cpu < Decoder->TableCpus && Decoder->Table[cpu].TjMax != 0) {
+        const WIRE_CPU_INFO* info = &Decoder->Table[cpu];
+        status |= (ULONG)(info->DtsResolution & 0xF) << WIRE_RESOLUTION_SHIFT;
+        if (valid) {
+            Record->Temperature = (LONG)info->TjMax - (LONG)(dts * info->DtsResolution);
+        }
+    }
+    Record->ThermStatus = status;
+    return TRUE;
+}